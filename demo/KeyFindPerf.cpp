@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "protorecord.h"
+#include "DemoMessages.pb.h"
+
+using namespace protorecord;
+using namespace protorecord::demo;
+
+const std::string RECORDS_DIR("key_find_perf_recordings");
+
+// number of records to search, and items in each of them
+const unsigned int NUM_RECORDS = 1000;
+const unsigned int ITEMS_PER_RECORD = 10000;
+
+// every record has its own range of sensor ids. the rare key shows up in
+// only a few records.
+const unsigned int SENSORS_PER_RECORD = 100;
+const int64_t RARE_KEY = 99999999;
+const unsigned int RARE_KEY_EVERY = 300;
+
+std::vector<std::string>
+make_records()
+{
+	mkdir(RECORDS_DIR.c_str(),0777);
+
+	WriterOptions options;
+	options.key_field = "sensor_id";
+	std::vector<std::string> paths;
+	WideMessage msg;
+	for (unsigned int r=0; r<NUM_RECORDS; r++)
+	{
+		paths.push_back(RECORDS_DIR + "/record" + std::to_string(r));
+		Writer writer(paths.back(),options);
+		for (unsigned int i=0; i<ITEMS_PER_RECORD; i++)
+		{
+			msg.set_timestamp(i * 1000ull);
+			msg.set_sensor_id(r * SENSORS_PER_RECORD + i % SENSORS_PER_RECORD);
+			if (r % RARE_KEY_EVERY == 0 && i == ITEMS_PER_RECORD / 2)
+			{
+				msg.set_sensor_id(RARE_KEY);
+			}
+			writer.write(msg);
+		}
+		writer.close();
+	}
+	return paths;
+}
+
+// "which records hold the key", checking only the records' Bloom filters
+// before looking the key up in the few that might
+double
+filters(
+	const std::vector<std::string> &paths,
+	size_t &num_found)
+{
+	// only a few bytes of each record are read, so skip the read-ahead
+	ReaderOptions options;
+	options.access_pattern = AccessPattern::RANDOM;
+	std::vector<uint64_t> items;
+	num_found = 0;
+	auto start = get_mono_time();
+	for (const auto &path : paths)
+	{
+		Reader reader(path,options);
+		if (reader.might_contain(RARE_KEY) && reader.lookup(RARE_KEY,items) && ! items.empty())
+		{
+			num_found++;
+		}
+	}
+	return (get_mono_time() - start).count() / 1.0e6;
+}
+
+// the same query, looking the key up in every record's key index
+double
+key_index(
+	const std::vector<std::string> &paths,
+	size_t &num_found)
+{
+	// only a few bytes of each record are read, so skip the read-ahead
+	ReaderOptions options;
+	options.access_pattern = AccessPattern::RANDOM;
+	std::vector<uint64_t> items;
+	num_found = 0;
+	auto start = get_mono_time();
+	for (const auto &path : paths)
+	{
+		Reader reader(path,options);
+		if (reader.lookup(RARE_KEY,items) && ! items.empty())
+		{
+			num_found++;
+		}
+	}
+	return (get_mono_time() - start).count() / 1.0e6;
+}
+
+// the same query, scanning every item with a Projection
+double
+scan(
+	const std::vector<std::string> &paths,
+	size_t &num_found)
+{
+	Projection projection(WideMessage::descriptor(),{8},{Predicate(8,CompareOp::EQ,RARE_KEY)});
+	ScanOptions options;
+	options.reader_options.use_mmap = true;
+	ProjectionResult result;
+	auto start = get_mono_time();
+	if ( ! projection.scan(paths,result,options))
+	{
+		std::cerr << "scan failed. reason: " << projection.reason() << std::endl;
+	}
+	double elapsed = (get_mono_time() - start).count() / 1.0e6;
+
+	std::vector<bool> found(paths.size(),false);
+	for (const auto &item : result.items)
+	{
+		found[item.record] = true;
+	}
+	num_found = std::count(found.begin(),found.end(),true);
+	return elapsed;
+}
+
+int main()
+{
+	std::cout << "creating " << NUM_RECORDS << " records with " << ITEMS_PER_RECORD << " items each..." << std::endl;
+	const std::vector<std::string> paths = make_records();
+
+	size_t found = 0;
+	double filtered = filters(paths,found);
+	std::cout << "key filters: " << filtered << "s, found in " << found << " records" << std::endl;
+
+	double indexed = key_index(paths,found);
+	std::cout << "key index only: " << indexed << "s, found in " << found << " records" << std::endl;
+
+	double scanned = scan(paths,found);
+	std::cout << "projection scan: " << scanned << "s, found in " << found << " records (" << scanned / filtered << "x slower)" << std::endl;
+
+	return 0;
+}
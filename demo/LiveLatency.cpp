@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "protorecord.h"
+#include "DemoMessages.pb.h"
+
+using namespace protorecord;
+using namespace protorecord::demo;
+
+const std::string RECORD_PATH("live_latency_recording");
+const std::string CHANNEL("protorecord_live_latency");
+
+// items sent per mode, unless given on the command line
+const size_t DEFAULT_ITEMS = 20000;
+
+// pause between items, so that every hand-off is measured on its own
+// instead of items queueing up behind each other
+const std::chrono::microseconds SEND_INTERVAL(50);
+
+int64_t
+now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// runs in the reader process. takes 'num_items' items off the channel and
+// prints how long each one took from write() to take_next().
+void
+receive(
+	const std::string &name,
+	int ready_fd,
+	size_t num_items)
+{
+	LiveReader live(CHANNEL);
+	if ( ! live.is_open())
+	{
+		std::cerr << "failed to open live channel. reason: " << live.reason() << std::endl;
+		return;
+	}
+	// tell the writer to start sending
+	char ready = 1;
+	if (write(ready_fd,&ready,1) != 1)
+	{
+		return;
+	}
+
+	BasicMessage msg;
+	std::vector<double> latencies_us;
+	latencies_us.reserve(num_items);
+	while (latencies_us.size() < num_items && live.follow(std::chrono::seconds(5)))
+	{
+		while (live.take_next(msg))
+		{
+			int64_t sent_ns = std::stoll(msg.mystring());
+			latencies_us.push_back((now_ns() - sent_ns) / 1000.0);
+		}
+	}
+	if (latencies_us.empty())
+	{
+		std::cerr << name << ": no items received" << std::endl;
+		return;
+	}
+
+	std::sort(latencies_us.begin(),latencies_us.end());
+	std::cout << name << ": ";
+	std::cout << latencies_us.size() << " items, ";
+	std::cout << live.dropped() << " dropped, ";
+	std::cout << "p50 " << latencies_us[latencies_us.size() / 2] << "us, ";
+	std::cout << "p99 " << latencies_us[latencies_us.size() * 99 / 100] << "us, ";
+	std::cout << "p999 " << latencies_us[latencies_us.size() * 999 / 1000] << "us, ";
+	std::cout << "max " << latencies_us.back() << "us";
+	std::cout << std::endl;
+}
+
+// records 'num_items' while a LiveReader in another process measures the
+// hand-off latency through the live channel
+void
+measure_latency(
+	const std::string &name,
+	WriterOptions options,
+	size_t num_items)
+{
+	options.live_channel = CHANNEL;
+	Writer writer(RECORD_PATH,options);
+	std::string why = writer.reason();
+	if ( ! why.empty())
+	{
+		std::cerr << "failed to open writer. reason: " << why << std::endl;
+		return;
+	}
+
+	int ready_pipe[2];
+	if (pipe(ready_pipe) != 0)
+	{
+		return;
+	}
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		close(ready_pipe[0]);
+		receive(name,ready_pipe[1],num_items);
+		_exit(0);
+	}
+	close(ready_pipe[1]);
+	char ready = 0;
+	bool reader_ready = read(ready_pipe[0],&ready,1) == 1;
+	close(ready_pipe[0]);
+
+	BasicMessage msg;
+	for (size_t i=0; reader_ready && i<num_items; i++)
+	{
+		msg.set_mystring(std::to_string(now_ns()));
+		msg.set_myint(i);
+		writer.write(msg);
+		std::this_thread::sleep_for(SEND_INTERVAL);
+	}
+	writer.close();
+	waitpid(pid,nullptr,0);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_items = DEFAULT_ITEMS;
+	if (argc > 1)
+	{
+		num_items = std::stoul(argv[1]);
+	}
+	std::cout << "sending " << num_items << " items per mode" << std::endl;
+
+	WriterOptions sync_options;
+	measure_latency("sync",sync_options,num_items);
+
+	WriterOptions mmap_options;
+	mmap_options.use_mmap = true;
+	measure_latency("mmap",mmap_options,num_items);
+
+	WriterOptions async_options;
+	async_options.async = true;
+	measure_latency("async",async_options,num_items);
+
+	return 0;
+}
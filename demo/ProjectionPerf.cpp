@@ -0,0 +1,131 @@
+#include <iostream>
+#include <string>
+#include "protorecord.h"
+#include "DemoMessages.pb.h"
+
+using namespace protorecord;
+using namespace protorecord::demo;
+
+const std::string RECORD_PATH("projection_perf_recording");
+
+// number of items in the benchmark record
+const unsigned int N = 500000;
+
+void
+make_record()
+{
+	Writer writer(RECORD_PATH);
+
+	WideMessage msg;
+	msg.set_temperature(21.5);
+	msg.set_pressure(1013.25f);
+	msg.set_label("sensor");
+	msg.set_sensor_id(1234);
+	msg.set_offset(-42);
+	msg.set_status(WideMessage::OK);
+	msg.set_description("a fairly long description of where the sensor is mounted");
+	msg.set_location("building 7, floor 3");
+	msg.set_extra13(13); msg.set_extra14(14); msg.set_extra15(15); msg.set_extra16(16);
+	msg.set_extra17(17); msg.set_extra18(18); msg.set_extra19(19); msg.set_extra20(20);
+	msg.set_extra21(2.1); msg.set_extra22(2.2); msg.set_extra23(2.3); msg.set_extra24(2.4);
+	msg.set_extra25("extra25"); msg.set_extra26("extra26");
+	msg.set_extra27("extra27"); msg.set_extra28("extra28");
+	msg.set_extra29(29); msg.set_extra30(30); msg.set_extra31(31); msg.set_extra32(32);
+	msg.mutable_nested()->set_mystring("nested");
+	msg.mutable_nested()->set_myint(33);
+	for (unsigned int s=0; s<16; s++)
+	{
+		msg.add_samples(s);
+	}
+
+	for (unsigned int i=0; i<N; i++)
+	{
+		msg.set_timestamp(i * 1000ull);
+		msg.set_value(i % 2000);
+		msg.set_delta(-(int)i);
+		msg.set_valid(i % 3 != 0);
+		writer.write(msg);
+	}
+	writer.close();
+}
+
+// "select timestamp where value > 1000" by parsing every message
+double
+full_parse(
+	uint64_t &num_matches)
+{
+	ReaderOptions options;
+	options.use_mmap = true;
+	Reader reader(RECORD_PATH,options);
+	WideMessage msg;
+	uint64_t sum = 0;
+	num_matches = 0;
+
+	auto start = get_mono_time();
+	while (reader.take_next(msg))
+	{
+		if (msg.value() > 1000)
+		{
+			sum += msg.timestamp();
+			num_matches++;
+		}
+	}
+	auto elapsed = get_mono_time() - start;
+
+	std::cout << "(checksum " << sum << ") ";
+	return reader.size() / (elapsed.count() / 1.0e6);
+}
+
+// the same query, walking the wire format with a Projection
+double
+projection(
+	size_t num_threads,
+	uint64_t &num_matches)
+{
+	// the record was written by Writer::write(), so the rest of an item can
+	// be skipped once its fields were found
+	ProjectionOptions projection_options;
+	projection_options.assume_canonical = true;
+	Projection projection(WideMessage::descriptor(),{1},{Predicate(2,CompareOp::GT,1000)},projection_options);
+	ScanOptions options;
+	options.num_threads = num_threads;
+	options.reader_options.use_mmap = true;
+	ProjectionResult result;
+
+	auto start = get_mono_time();
+	if ( ! projection.scan({RECORD_PATH},result,options))
+	{
+		std::cerr << "projection failed. reason: " << projection.reason() << std::endl;
+	}
+	auto elapsed = get_mono_time() - start;
+
+	uint64_t sum = 0;
+	for (uint64_t timestamp : result.columns[0].uint_values)
+	{
+		sum += timestamp;
+	}
+	num_matches = result.items.size();
+	std::cout << "(checksum " << sum << ") ";
+	return N / (elapsed.count() / 1.0e6);
+}
+
+int main()
+{
+	std::cout << "creating benchmark record with " << N << " items..." << std::endl;
+	make_record();
+
+	uint64_t matches = 0;
+	std::cout << "full parse: ";
+	double full = full_parse(matches);
+	std::cout << full << " items/s, " << matches << " matches" << std::endl;
+
+	std::cout << "projection: ";
+	double projected = projection(1,matches);
+	std::cout << projected << " items/s, " << matches << " matches (" << projected / full << "x)" << std::endl;
+
+	std::cout << "projection, all threads: ";
+	double parallel = projection(0,matches);
+	std::cout << parallel << " items/s, " << matches << " matches (" << parallel / full << "x)" << std::endl;
+
+	return 0;
+}
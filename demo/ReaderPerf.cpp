@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "protorecord.h"
+#include "DemoMessages.pb.h"
+
+using namespace protorecord;
+using namespace protorecord::demo;
+
+const std::string RECORD_PATH("reader_perf_recording");
+
+// number of items in the benchmark record
+const unsigned int N = 2000000;
+
+// number of random get() calls made by the random access benchmark
+const unsigned int NUM_RANDOM_GETS = 200000;
+
+// number of items parsed per take_batch() call
+const size_t BATCH_SIZE = 1024;
+
+// I/O syscall counters for this process, as reported by /proc/self/io
+struct SyscallCount
+{
+	uint64_t reads = 0;
+	uint64_t writes = 0;
+};
+
+SyscallCount
+get_syscall_count()
+{
+	SyscallCount count;
+	std::ifstream proc_io("/proc/self/io");
+	std::string key;
+	uint64_t value;
+	while (proc_io >> key >> value)
+	{
+		if (key == "syscr:")
+		{
+			count.reads = value;
+		}
+		else if (key == "syscw:")
+		{
+			count.writes = value;
+		}
+	}
+	return count;
+}
+
+void
+make_record()
+{
+	Writer writer(RECORD_PATH);
+
+	LargeMessage lmsg;
+	for (unsigned int i=0; i<4; i++)
+	{
+		lmsg.add_mystrings("helloworld" + std::to_string(i));
+		lmsg.add_myints(rand());
+		lmsg.add_mybools(rand()%2);
+	}
+
+	for (unsigned int i=0; i<N; i++)
+	{
+		lmsg.set_myints(0,i);
+		writer.write(lmsg);
+	}
+	writer.close();
+}
+
+// reads the whole record and prints the achieved throughput
+void
+read_record(
+	const std::string &name,
+	const ReaderOptions &options)
+{
+	Reader reader(RECORD_PATH,options);
+	LargeMessage lmsg;
+
+	SyscallCount start_count = get_syscall_count();
+	auto start = get_mono_time();
+	size_t items = 0;
+	while (reader.take_next(lmsg))
+	{
+		items++;
+	}
+	auto elapsed = get_mono_time() - start;
+	SyscallCount end_count = get_syscall_count();
+
+	std::cout << name << ": ";
+	std::cout << items / (elapsed.count() / 1.0e6) << " items/s, ";
+	std::cout << (double)(end_count.reads - start_count.reads) / items << " read syscalls per item";
+	std::cout << std::endl;
+}
+
+// reads the whole record into a fresh message per item, then into arena
+// allocated messages a batch at a time, and prints the throughput of both
+void
+read_into_arena(
+	const std::string &name,
+	const ReaderOptions &options)
+{
+	{
+		Reader reader(RECORD_PATH,options);
+		auto start = get_mono_time();
+		size_t items = 0;
+		while (reader.has_next())
+		{
+			LargeMessage lmsg;
+			reader.take_next(lmsg);
+			items++;
+		}
+		auto elapsed = get_mono_time() - start;
+		std::cout << name << " take_next() into new messages: ";
+		std::cout << items / (elapsed.count() / 1.0e6) << " items/s" << std::endl;
+	}
+
+	{
+		Reader reader(RECORD_PATH,options);
+		google::protobuf::Arena arena;
+		std::vector<LargeMessage*> batch;
+		auto start = get_mono_time();
+		size_t items = 0;
+		while (reader.take_batch(BATCH_SIZE,arena,batch))
+		{
+			items += batch.size();
+		}
+		auto elapsed = get_mono_time() - start;
+		std::cout << name << " take_batch(" << BATCH_SIZE << ") into an arena: ";
+		std::cout << items / (elapsed.count() / 1.0e6) << " items/s" << std::endl;
+	}
+}
+
+// reads items in random order and prints the latency distribution
+void
+random_access(
+	const std::string &name,
+	const ReaderOptions &options)
+{
+	Reader reader(RECORD_PATH,options);
+	LargeMessage lmsg;
+
+	std::mt19937_64 rng(1234);
+	std::uniform_int_distribution<uint64_t> pick(0,reader.size() - 1);
+
+	std::vector<double> latencies_us;
+	latencies_us.reserve(NUM_RANDOM_GETS);
+	for (unsigned int i=0; i<NUM_RANDOM_GETS; i++)
+	{
+		uint64_t idx = pick(rng);
+		auto start = std::chrono::steady_clock::now();
+		reader.get(idx,lmsg);
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		latencies_us.push_back(std::chrono::duration<double,std::micro>(elapsed).count());
+	}
+
+	std::sort(latencies_us.begin(),latencies_us.end());
+	double total_us = 0.0;
+	for (const auto latency : latencies_us)
+	{
+		total_us += latency;
+	}
+
+	std::cout << name << " random get(): ";
+	std::cout << "mean " << total_us / latencies_us.size() << "us, ";
+	std::cout << "p50 " << latencies_us[latencies_us.size() / 2] << "us, ";
+	std::cout << "p99 " << latencies_us[latencies_us.size() * 99 / 100] << "us";
+	std::cout << std::endl;
+}
+
+int main()
+{
+	make_record();
+
+	ReaderOptions stream_options;
+	stream_options.storage_backend = StorageBackend::POSIX;
+	read_record("posix",stream_options);
+
+	if (storage_backend_available(StorageBackend::IO_URING))
+	{
+		ReaderOptions uring_options;
+		uring_options.storage_backend = StorageBackend::IO_URING;
+		read_record("io_uring",uring_options);
+	}
+
+	ReaderOptions mmap_options;
+	mmap_options.use_mmap = true;
+	mmap_options.access_pattern = AccessPattern::SEQUENTIAL;
+	read_record("mmap",mmap_options);
+
+	// reads happen on a background thread, the consumer only parses
+	ReaderOptions prefetch_options = stream_options;
+	prefetch_options.prefetch_items = 4096;
+	read_record("posix prefetch",prefetch_options);
+
+	read_into_arena("posix",stream_options);
+	read_into_arena("mmap",mmap_options);
+
+	mmap_options.access_pattern = AccessPattern::RANDOM;
+	stream_options.access_pattern = AccessPattern::RANDOM;
+	random_access("posix",stream_options);
+	random_access("mmap",mmap_options);
+
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "protorecord.h"
+#include "DemoMessages.pb.h"
+
+using namespace protorecord;
+using namespace protorecord::demo;
+
+const std::string RECORD_PATH("scan_scaling_recording");
+
+// number of items in the benchmark record
+const unsigned int N = 4000000;
+
+void
+make_record()
+{
+	Writer writer(RECORD_PATH);
+
+	LargeMessage lmsg;
+	for (unsigned int i=0; i<4; i++)
+	{
+		lmsg.add_mystrings("helloworld" + std::to_string(i));
+		lmsg.add_myints(rand());
+		lmsg.add_mybools(rand()%2);
+	}
+
+	for (unsigned int i=0; i<N; i++)
+	{
+		lmsg.set_myints(0,i);
+		writer.write(lmsg);
+	}
+	writer.close();
+}
+
+// scans the record with 'num_threads' workers and returns the achieved
+// throughput in items/sec
+double
+run_scan(
+	size_t num_threads,
+	const ScanOptions &base_options)
+{
+	ScanOptions options = base_options;
+	options.num_threads = num_threads;
+	ParallelScan scan({RECORD_PATH},options);
+
+	std::atomic<uint64_t> sum(0);
+	auto start = get_mono_time();
+	scan.scan<LargeMessage>([&sum](const ScanItem &, const LargeMessage &lmsg){
+		sum.fetch_add(lmsg.myints(0),std::memory_order_relaxed);
+		return true;
+	});
+	auto elapsed = get_mono_time() - start;
+
+	return scan.size() / (elapsed.count() / 1.0e6);
+}
+
+int main(int argc, char *argv[])
+{
+	make_record();
+
+	ScanOptions posix_options;
+	posix_options.reader_options.storage_backend = StorageBackend::POSIX;
+	ScanOptions mmap_options;
+	mmap_options.reader_options.use_mmap = true;
+	ScanOptions ordered_options = mmap_options;
+	ordered_options.ordered = true;
+
+	std::cout << "threads, posix (items/s), mmap (items/s), mmap ordered (items/s)" << std::endl;
+	// the largest thread count to try, one per hardware thread by default
+	size_t max_threads = std::max(std::thread::hardware_concurrency(),1u);
+	if (argc > 1)
+	{
+		max_threads = std::stoul(argv[1]);
+	}
+
+	for (size_t num_threads=1; num_threads<=max_threads; num_threads*=2)
+	{
+		std::cout << num_threads << ", ";
+		std::cout << run_scan(num_threads,posix_options) << ", ";
+		std::cout << run_scan(num_threads,mmap_options) << ", ";
+		std::cout << run_scan(num_threads,ordered_options) << std::endl;
+	}
+
+	return 0;
+}
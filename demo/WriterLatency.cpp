@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "protorecord.h"
+#include "DemoMessages.pb.h"
+
+using namespace protorecord;
+using namespace protorecord::demo;
+
+const std::string RECORD_PATH("writer_latency_recording");
+
+// size of each recorded item's payload
+const size_t PAYLOAD_SIZE = 1024;
+
+// megabytes recorded per mode, unless given on the command line
+const size_t DEFAULT_MEGABYTES = 1024;
+
+// records 'num_items' as fast as possible and prints the write() latency
+// distribution
+void
+measure_latency(
+	const std::string &name,
+	const WriterOptions &options,
+	size_t num_items)
+{
+	Writer writer(RECORD_PATH,options);
+
+	BasicMessage msg;
+	msg.set_mystring(std::string(PAYLOAD_SIZE,'p'));
+
+	std::vector<double> latencies_us;
+	latencies_us.reserve(num_items);
+	auto start = get_mono_time();
+	for (size_t i=0; i<num_items; i++)
+	{
+		msg.set_myint(i);
+		auto write_start = std::chrono::steady_clock::now();
+		writer.write(msg);
+		auto elapsed = std::chrono::steady_clock::now() - write_start;
+		latencies_us.push_back(std::chrono::duration<double,std::micro>(elapsed).count());
+	}
+	writer.close();
+	auto total = get_mono_time() - start;
+
+	std::sort(latencies_us.begin(),latencies_us.end());
+	std::cout << name << ": ";
+	std::cout << num_items * PAYLOAD_SIZE / (total.count() / 1.0e6) / (1024 * 1024) << " MiB/s, ";
+	std::cout << "p50 " << latencies_us[latencies_us.size() / 2] << "us, ";
+	std::cout << "p99 " << latencies_us[latencies_us.size() * 99 / 100] << "us, ";
+	std::cout << "p999 " << latencies_us[latencies_us.size() * 999 / 1000] << "us, ";
+	std::cout << "max " << latencies_us.back() << "us";
+	std::cout << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t megabytes = DEFAULT_MEGABYTES;
+	if (argc > 1)
+	{
+		megabytes = std::stoul(argv[1]);
+	}
+	const size_t num_items = megabytes * 1024 * 1024 / PAYLOAD_SIZE;
+	std::cout << "recording " << megabytes << "MiB per mode" << std::endl;
+
+	WriterOptions buffered_options;
+	measure_latency("buffered",buffered_options,num_items);
+
+	WriterOptions direct_options;
+	direct_options.direct_io = true;
+	measure_latency("direct",direct_options,num_items);
+
+	WriterOptions mmap_options;
+	mmap_options.use_mmap = true;
+	measure_latency("mmap",mmap_options,num_items);
+
+	return 0;
+}
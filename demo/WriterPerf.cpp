@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 #include "tqdm.h"
 #include "protorecord.h"
 #include "DemoMessages.pb.h"
@@ -6,6 +10,46 @@
 using namespace protorecord;
 using namespace protorecord::demo;
 
+// I/O syscall counters for this process, as reported by /proc/self/io
+struct SyscallCount
+{
+	uint64_t reads = 0;
+	uint64_t writes = 0;
+};
+
+SyscallCount
+get_syscall_count()
+{
+	SyscallCount count;
+	std::ifstream proc_io("/proc/self/io");
+	std::string key;
+	uint64_t value;
+	while (proc_io >> key >> value)
+	{
+		if (key == "syscr:")
+		{
+			count.reads = value;
+		}
+		else if (key == "syscw:")
+		{
+			count.writes = value;
+		}
+	}
+	return count;
+}
+
+void
+print_syscalls_per_message(
+	const SyscallCount &start,
+	const SyscallCount &end,
+	unsigned int num_messages)
+{
+	std::cout << "write syscalls per message: ";
+	std::cout << (double)(end.writes - start.writes) / num_messages << std::endl;
+	std::cout << "read syscalls per message: ";
+	std::cout << (double)(end.reads - start.reads) / num_messages << std::endl;
+}
+
 int main()
 {
 	const unsigned int N = 1000000;
@@ -18,14 +62,56 @@ int main()
 	bmsg.set_mystring("helloworld");
 
 	bar.reset();
+	SyscallCount start = get_syscall_count();
 	for (unsigned int i=0; i<N; i++)
 	{
 		bar.progress(i, N);
 		bmsg.set_myint(rand());
 		writer.write(bmsg);
 	}
-	bar.finish();
 	writer.close();
+	SyscallCount end = get_syscall_count();
+	bar.finish();
+	print_syscalls_per_message(start,end,N);
+
+	// --------------------------------------------
+
+	std::cout << "BasicMessage index buffer test" << std::endl;
+
+	// index entries are buffered, so that they don't cost a write() each.
+	// the smallest buffer writes them out (and checkpoints the record)
+	// every few items instead. POSIX I/O is used, as io_uring's writes
+	// don't show up in /proc/self/io.
+	const size_t INDEX_BUFFER_SIZES[] = {WriterOptions().index_buffer_size, 0};
+	for (const auto index_buffer_size : INDEX_BUFFER_SIZES)
+	{
+		WriterOptions options;
+		options.storage_backend = StorageBackend::POSIX;
+		options.index_buffer_size = index_buffer_size;
+		writer.open("index_buffer_recording",options);
+
+		start = get_syscall_count();
+		auto start_time = get_mono_time();
+		for (unsigned int i=0; i<N; i++)
+		{
+			bmsg.set_myint(rand());
+			writer.write(bmsg);
+		}
+		writer.close();
+		auto elapsed = get_mono_time() - start_time;
+		end = get_syscall_count();
+
+		if (index_buffer_size > 0)
+		{
+			std::cout << "index buffer size " << index_buffer_size << ": ";
+		}
+		else
+		{
+			std::cout << "smallest index buffer: ";
+		}
+		std::cout << N / (elapsed.count() / 1.0e6) << " items/s" << std::endl;
+		print_syscalls_per_message(start,end,N);
+	}
 
 	// --------------------------------------------
 
@@ -48,13 +134,43 @@ int main()
 	lmsg.add_mybools(rand()%2);
 
 	bar.reset();
+	start = get_syscall_count();
 	for (unsigned int i=0; i<N; i++)
 	{
 		bar.progress(i, N);
 		writer.write(lmsg);
 	}
-	bar.finish();
 	writer.close();
+	end = get_syscall_count();
+	bar.finish();
+	print_syscalls_per_message(start,end,N);
+
+	// --------------------------------------------
+
+	std::cout << "LargeMessage write_batch() test" << std::endl;
+
+	const unsigned int BATCH_SIZES[] = {1, 16, 256};
+	for (const auto batch_size : BATCH_SIZES)
+	{
+		std::vector<LargeMessage> batch(batch_size,lmsg);
+		writer.open("batch_recording");
+
+		start = get_syscall_count();
+		auto start_time = get_mono_time();
+		for (unsigned int i=0; i<N; i+=batch_size)
+		{
+			// the last batch is trimmed, so that every run writes N items
+			unsigned int num_items = std::min(batch_size,N - i);
+			writer.write_batch(batch.begin(),batch.begin() + num_items);
+		}
+		writer.close();
+		auto elapsed = get_mono_time() - start_time;
+		end = get_syscall_count();
+
+		std::cout << "batch size " << batch_size << ": ";
+		std::cout << N / (elapsed.count() / 1.0e6) << " items/s" << std::endl;
+		print_syscalls_per_message(start,end,N);
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "protorecord.h"
+#include "DemoMessages.pb.h"
+
+using namespace protorecord;
+using namespace protorecord::demo;
+
+// total number of items written for every producer count
+const unsigned int N = 1000000;
+
+LargeMessage
+make_message(
+	unsigned int seed)
+{
+	LargeMessage lmsg;
+	for (unsigned int i=0; i<4; i++)
+	{
+		lmsg.add_mystrings("helloworld" + std::to_string(seed + i));
+		lmsg.add_myints(seed * i);
+		lmsg.add_mybools((seed + i) % 2);
+	}
+	return lmsg;
+}
+
+// runs 'num_producers' threads that each write N/num_producers items
+// with 'write_fn' and returns the achieved throughput in items/sec
+template<class WRITE_FN>
+double
+run_producers(
+	unsigned int num_producers,
+	WRITE_FN write_fn)
+{
+	const unsigned int items_per_producer = N / num_producers;
+
+	auto start = get_mono_time();
+	std::vector<std::thread> producers;
+	for (unsigned int p=0; p<num_producers; p++)
+	{
+		producers.emplace_back([&write_fn,p,items_per_producer](){
+			LargeMessage lmsg = make_message(p);
+			for (unsigned int i=0; i<items_per_producer; i++)
+			{
+				lmsg.set_myints(0,i);
+				write_fn(lmsg);
+			}
+		});
+	}
+	for (auto &producer : producers)
+	{
+		producer.join();
+	}
+	auto elapsed = get_mono_time() - start;
+
+	return (items_per_producer * num_producers) / (elapsed.count() / 1.0e6);
+}
+
+int main()
+{
+	const unsigned int PRODUCER_COUNTS[] = {1, 2, 4, 8, 16};
+
+	std::cout << "producers, global mutex (items/s), async multi-producer (items/s)" << std::endl;
+	for (const auto num_producers : PRODUCER_COUNTS)
+	{
+		// baseline: a synchronous Writer shared behind a global mutex
+		double mutex_rate = 0.0;
+		{
+			Writer writer("scaling_mutex_recording");
+			std::mutex writer_mutex;
+			mutex_rate = run_producers(num_producers,[&](const LargeMessage &lmsg){
+				std::lock_guard<std::mutex> lock(writer_mutex);
+				writer.write(lmsg);
+			});
+			writer.close();
+		}
+
+		// async Writer that every producer writes to directly
+		double async_rate = 0.0;
+		{
+			WriterOptions options;
+			options.async = true;
+			Writer writer("scaling_async_recording",options);
+			async_rate = run_producers(num_producers,[&](const LargeMessage &lmsg){
+				writer.write(lmsg);
+			});
+			writer.close();
+		}
+
+		std::cout << num_producers << ", " << mutex_rate << ", " << async_rate << std::endl;
+	}
+
+	return 0;
+}
@@ -2,5 +2,10 @@
 
 #include "protorecord/Writer.h"
 #include "protorecord/Reader.h"
+#include "protorecord/LiveReader.h"
+#include "protorecord/ParallelScan.h"
+#include "protorecord/Projection.h"
+#include "protorecord/ColumnExport.h"
+#include "protorecord/KeyIndex.h"
 #include "protorecord/Utils.h"
 #include "protorecord/Constants.h"
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "protorecord/Compression.h"
+
+namespace protorecord
+{
+	/**
+	 * A small pool of worker threads that compresses data blocks in the
+	 * background. Blocks are handed out again in the same order they were
+	 * submitted, so the caller can append them to the record one after
+	 * another while later blocks are still being compressed.
+	 *
+	 * submit() and pop_finished() must be called from a single thread.
+	 */
+	class BlockCompressor
+	{
+	public:
+		struct Block
+		{
+			// the packed item data
+			std::vector<char> raw;
+
+			// number of valid bytes in 'raw'
+			size_t raw_size = 0;
+
+			// the compressed block, only valid once the block is finished
+			std::vector<char> compressed;
+
+			// number of valid bytes in 'compressed'
+			size_t compressed_size = 0;
+
+			// the codec the block ended up being stored with. blocks that
+			// don't get any smaller are stored raw with Codec::NONE.
+			Codec codec = Codec::NONE;
+
+			// number of items packed into the block
+			uint64_t num_items = 0;
+
+			// set by the worker once the block has been compressed
+			bool finished = false;
+
+			/**
+			 * @return
+			 * The bytes that should be stored in the data file
+			 */
+			const char *
+			stored_data() const
+			{
+				return codec == Codec::NONE ? raw.data() : compressed.data();
+			}
+
+			/**
+			 * @return
+			 * The number of bytes that should be stored in the data file
+			 */
+			size_t
+			stored_size() const
+			{
+				return codec == Codec::NONE ? raw_size : compressed_size;
+			}
+		};
+
+		/**
+		 * Constructor
+		 *
+		 * @param[in] codec
+		 * The codec to compress blocks with
+		 *
+		 * @param[in] num_threads
+		 * Number of worker threads. If 0, blocks are compressed on the
+		 * calling thread inside submit().
+		 *
+		 * @param[in] max_in_flight
+		 * The number of submitted blocks that haven't been popped yet,
+		 * after which full() starts returning true.
+		 */
+		BlockCompressor(
+			Codec codec,
+			size_t num_threads,
+			size_t max_in_flight);
+
+		/**
+		 * Destructor. Stops the workers; unfinished blocks are discarded.
+		 */
+		~BlockCompressor();
+
+		/**
+		 * @return
+		 * An empty block to pack items into. Blocks handed back with
+		 * recycle() are reused so their buffers don't need to be
+		 * reallocated.
+		 */
+		std::unique_ptr<Block>
+		get_block();
+
+		/**
+		 * Queues a block up to be compressed
+		 *
+		 * @param[in] block
+		 * The block to compress
+		 */
+		void
+		submit(
+			std::unique_ptr<Block> block);
+
+		/**
+		 * Takes the oldest submitted block if it has been compressed
+		 *
+		 * @param[in] wait
+		 * If true, wait for the oldest block to finish compressing
+		 *
+		 * @return
+		 * The oldest block, or nullptr if there are no blocks in flight or
+		 * the oldest one isn't finished yet and 'wait' is false.
+		 */
+		std::unique_ptr<Block>
+		pop_finished(
+			bool wait);
+
+		/**
+		 * Hands a popped block back so that it can be reused by get_block()
+		 */
+		void
+		recycle(
+			std::unique_ptr<Block> block);
+
+		/**
+		 * @return
+		 * True if max_in_flight blocks are waiting to be popped
+		 */
+		bool
+		full();
+
+	protected:
+		/**
+		 * Compresses a block's raw data in place
+		 */
+		void
+		compress(
+			Block &block);
+
+	private:
+		/**
+		 * Main loop of a worker thread
+		 */
+		void
+		worker_main();
+
+	private:
+		// the codec blocks are compressed with
+		const Codec codec_;
+
+		// see constructor
+		const size_t max_in_flight_;
+
+		// blocks that were submitted but not popped yet, oldest first
+		std::deque<std::unique_ptr<Block>> in_flight_;
+
+		// blocks the workers haven't started compressing yet
+		std::deque<Block *> pending_;
+
+		// blocks that can be reused by get_block()
+		std::vector<std::unique_ptr<Block>> free_blocks_;
+
+		// set to true when the workers should exit
+		bool stopping_;
+
+		// guards everything above
+		std::mutex mutex_;
+
+		// signaled when a block is added to pending_
+		std::condition_variable pending_cv_;
+
+		// signaled when a block is finished
+		std::condition_variable finished_cv_;
+
+		// the worker threads
+		std::vector<std::thread> workers_;
+
+	};
+
+}// protorecord
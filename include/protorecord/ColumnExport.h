@@ -0,0 +1,152 @@
+#pragma once
+
+#include <google/protobuf/descriptor.h>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "protorecord/ParallelScan.h"
+#include "protorecord/Projection.h"
+#include "protorecord/Reader.h"
+
+namespace protorecord
+{
+	/**
+	 * Describes one of the files a ColumnExport wrote
+	 */
+	struct ExportedColumn
+	{
+		// the field's path, or "_item", "_record" or "_timestamp_us"
+		std::string name;
+
+		// the file's name within the output directory
+		std::string file;
+
+		// the type of the array's elements as a numpy dtype string, e.g.
+		// "<i8", "<u8", "<f8" or "|b1"
+		std::string dtype;
+
+		// the size of one element in bytes
+		size_t element_size = 0;
+	};
+
+	/**
+	 * Exports numeric fields of records into flat binary arrays, one file
+	 * per field, that can be memory mapped or loaded without any parsing:
+	 *
+	 * ColumnExport column_export(nullptr,{"timestamp","position.x"});
+	 * column_export.run({"recording"},"recording_columns");
+	 *
+	 * and then in python:
+	 *
+	 * x = numpy.fromfile("recording_columns/position.x.bin", dtype="<f8")
+	 *
+	 * Signed integer and enum fields are exported as int64, unsigned ones
+	 * as uint64, float and double fields as double, and bool fields as one
+	 * byte each. Fields that aren't set are exported as their default.
+	 * Alongside the fields, every item's index in its record is written to
+	 * "_item.bin", the index of its record to "_record.bin" if several
+	 * records are exported, and its timestamp to "_timestamp_us.bin" if the
+	 * records have timestamps. "manifest.json" lists the files.
+	 *
+	 * Fields are extracted with a Projection, on the workers of a
+	 * ParallelScan. Every chunk's arrays are appended to the files as soon
+	 * as the chunks before it are written.
+	 */
+	class ColumnExport
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] descriptor
+		 * The descriptor of the recorded messages, or nullptr to use the
+		 * schema stored in the first exported record
+		 *
+		 * @param[in] fields
+		 * The numeric fields to export, by number or by path
+		 *
+		 * @param[in] predicates
+		 * Only items that meet these are exported
+		 */
+		ColumnExport(
+			const google::protobuf::Descriptor *descriptor,
+			const std::vector<FieldPath> &fields,
+			const std::vector<Predicate> &predicates = {});
+
+		/**
+		 * Exports the fields of one or more records
+		 *
+		 * @param[in] record_paths
+		 * The records to export. Their items are exported as if the records
+		 * were concatenated in this order.
+		 *
+		 * @param[in] output_dir
+		 * The directory to write the files to. It's created if it doesn't
+		 * exist, and files of the same names are overwritten.
+		 *
+		 * @param[in] options
+		 * How to split up the scan. 'ordered' is ignored, as the files are
+		 * always written in record order.
+		 *
+		 * @return
+		 * True on success, false otherwise. reason() explains why.
+		 */
+		bool
+		run(
+			const std::vector<std::string> &record_paths,
+			const std::string &output_dir,
+			const ScanOptions &options = ScanOptions());
+
+		/**
+		 * @return
+		 * The files the last successful run() wrote
+		 */
+		const std::vector<ExportedColumn> &
+		columns() const;
+
+		/**
+		 * @return
+		 * The number of items the last successful run() exported
+		 */
+		uint64_t
+		size() const;
+
+		/**
+		 * @return
+		 * A string explaining why the last run() failed. Like
+		 * Reader::reason(), the reason is "popped" by calling this.
+		 */
+		std::string
+		reason();
+
+	protected:
+		/**
+		 * Writes "manifest.json" to the output directory
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		write_manifest(
+			const std::string &output_dir);
+
+	private:
+		// see the constructor
+		const google::protobuf::Descriptor *descriptor_;
+		std::vector<FieldPath> fields_;
+		std::vector<Predicate> predicates_;
+
+		// the files written by the last run()
+		std::vector<ExportedColumn> columns_;
+
+		// the number of items exported by the last run()
+		uint64_t num_items_;
+
+		// set to a human readable string explaining the last failure
+		std::string fail_reason_;
+
+	};
+
+}// protorecord
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace protorecord
+{
+	/**
+	 * Codecs that can be used to compress a record's data blocks. The
+	 * values are stored in the record, so they must never change.
+	 */
+	enum class Codec : uint32_t
+	{
+		NONE = 0,
+		LZ4 = 1,
+		ZSTD = 2,
+		ZLIB = 3
+	};
+
+	/**
+	 * @param[in] codec
+	 * The codec to check for
+	 *
+	 * @return
+	 * True if the library was built with support for the codec
+	 */
+	bool
+	codec_available(
+		Codec codec);
+
+	/**
+	 * @return
+	 * Human readable name of the codec (ie. "lz4")
+	 */
+	std::string
+	codec_name(
+		Codec codec);
+
+	/**
+	 * Compresses a block of data
+	 *
+	 * @param[in] codec
+	 * The codec to compress with
+	 *
+	 * @param[in] src
+	 * The data to compress
+	 *
+	 * @param[in] src_size
+	 * Number of bytes in 'src'
+	 *
+	 * @param[out] dst
+	 * Buffer to store the compressed data in. It's grown if it's too small
+	 * to hold the worst case compressed size.
+	 *
+	 * @param[out] dst_size
+	 * Number of bytes of compressed data stored in 'dst'
+	 *
+	 * @return
+	 * True on success, false otherwise
+	 */
+	bool
+	compress_block(
+		Codec codec,
+		const char *src,
+		size_t src_size,
+		std::vector<char> &dst,
+		size_t &dst_size);
+
+	/**
+	 * Decompresses a block of data
+	 *
+	 * @param[in] codec
+	 * The codec the block was compressed with
+	 *
+	 * @param[in] src
+	 * The compressed data
+	 *
+	 * @param[in] src_size
+	 * Number of bytes in 'src'
+	 *
+	 * @param[out] dst
+	 * Where to store the decompressed data
+	 *
+	 * @param[in] raw_size
+	 * The block's size before it was compressed. 'dst' must be at least
+	 * this large.
+	 *
+	 * @return
+	 * True if exactly 'raw_size' bytes were decompressed, false otherwise
+	 */
+	bool
+	decompress_block(
+		Codec codec,
+		const char *src,
+		size_t src_size,
+		char *dst,
+		size_t raw_size);
+
+}// protorecord
@@ -28,6 +28,28 @@
 
 #define ITEM_BLOCK_STRIDE (PROTORECORD_INDEX_ITEM_SIZE_TIMESTAMP + 1)
 
+// index format where items are length prefixed IndexItem messages that
+// are padded out to ITEM_BLOCK_STRIDE. used by protorecord 0.2.x
+#define PROTORECORD_INDEX_FORMAT_V1 1
+
+// index format where items are packed little-endian fixed-width entries
+#define PROTORECORD_INDEX_FORMAT_V2 2
+
+// in a v2 index the summary block is given room to grow, and the items
+// start on a 64 byte boundary
+#define ITEM_BLOCK_OFFSET_V2 128
+
+#define SUMMARY_BLOCK_SIZE_V2 (ITEM_BLOCK_OFFSET_V2 - SUMMARY_BLOCK_OFFSET)
+
+// size in bytes of a v2 index entry (offset, size, file)
+#define INDEX_V2_ENTRY_SIZE 16
+
+// size in bytes of a v2 index entry with a trailing timestamp
+#define INDEX_V2_ENTRY_SIZE_TIMESTAMP 24
+
+// size in bytes of an entry in a compressed record's block table
+#define BLOCK_ENTRY_SIZE 24
+
 namespace protorecord
 {
 	namespace Flags
@@ -46,5 +68,26 @@ namespace protorecord
 
 		// indicating the record contains timestamped items
 		const uint32_t HAS_TIMESTAMPS = 0x8;
+
+		// set if an async Writer had to drop items because its queue
+		// was full. the record is missing those items.
+		const uint32_t HAS_DROPPED_ITEMS = 0x10;
+
+		// set if the items are packed into compressed blocks. index entries
+		// then refer to a block in the record's block table, and an offset
+		// within the decompressed block.
+		const uint32_t HAS_COMPRESSED_BLOCKS = 0x20;
+
+		// set once the Writer has stored the message type's schema in the
+		// record. see Reader::message_descriptor().
+		const uint32_t HAS_SCHEMA = 0x40;
+
+		// set if the record has a key index, which the Writer stores when it
+		// is closed. see Reader::lookup().
+		const uint32_t HAS_KEY_INDEX = 0x80;
+
+		// set if the record has Bloom filters over its keys, which the
+		// Writer stores along with the key index. see Reader::might_contain().
+		const uint32_t HAS_KEY_FILTERS = 0x100;
 	}
 }
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "protorecord/Constants.h"
+
+namespace protorecord
+{
+	/**
+	 * Location and metadata of a single item in the record. This is the
+	 * in-memory form of an index entry, no matter which index format the
+	 * record was stored with.
+	 */
+	struct IndexEntry
+	{
+		// item's byte offset within its data file
+		uint64_t offset = 0;
+
+		// item's size in bytes
+		uint32_t size = 0;
+
+		// the data file (segment) number that the item is located in. if
+		// the record has the HAS_COMPRESSED_BLOCKS flag, this is the number
+		// of the block the item is packed into, and 'offset' is relative
+		// to the start of the decompressed block.
+		uint32_t file = 0;
+
+		// timestamp in microseconds relative to the beginning of the
+		// recording. only valid if the record has the HAS_TIMESTAMPS flag.
+		uint64_t timestamp = 0;
+	};
+
+	/**
+	 * @param[in] has_timestamps
+	 * True if the record contains timestamped items
+	 *
+	 * @return
+	 * The size in bytes of a single v2 index entry
+	 */
+	inline
+	size_t
+	index_entry_stride_v2(
+		bool has_timestamps)
+	{
+		return has_timestamps ? INDEX_V2_ENTRY_SIZE_TIMESTAMP : INDEX_V2_ENTRY_SIZE;
+	}
+
+	/**
+	 * Stores 'value' to 'out' in little-endian byte order
+	 */
+	template<class UINT_T>
+	inline
+	void
+	store_le(
+		char *out,
+		UINT_T value)
+	{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		for (size_t i=0; i<sizeof(UINT_T); i++)
+		{
+			out[i] = (char)(value >> (8 * i));
+		}
+#else
+		memcpy(out,&value,sizeof(UINT_T));
+#endif
+	}
+
+	/**
+	 * @return
+	 * The little-endian value stored at 'in'
+	 */
+	template<class UINT_T>
+	inline
+	UINT_T
+	load_le(
+		const char *in)
+	{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		UINT_T value = 0;
+		for (size_t i=0; i<sizeof(UINT_T); i++)
+		{
+			value |= (UINT_T)(uint8_t)in[i] << (8 * i);
+		}
+		return value;
+#else
+		UINT_T value;
+		memcpy(&value,in,sizeof(UINT_T));
+		return value;
+#endif
+	}
+
+	/**
+	 * Encodes an entry into the v2 index format. Entries are packed
+	 * little-endian fields laid out as
+	 *
+	 *   offset (u64) | size (u32) | file (u32) | timestamp (u64, optional)
+	 *
+	 * @param[in] entry
+	 * The entry to encode
+	 *
+	 * @param[in] has_timestamps
+	 * True if the timestamp field should be stored
+	 *
+	 * @param[out] out
+	 * Where to store the entry. Must be index_entry_stride_v2() bytes long.
+	 */
+	inline
+	void
+	encode_index_entry_v2(
+		const IndexEntry &entry,
+		bool has_timestamps,
+		char *out)
+	{
+		store_le<uint64_t>(out + 0,entry.offset);
+		store_le<uint32_t>(out + 8,entry.size);
+		store_le<uint32_t>(out + 12,entry.file);
+		if (has_timestamps)
+		{
+			store_le<uint64_t>(out + 16,entry.timestamp);
+		}
+	}
+
+	/**
+	 * Decodes an entry stored in the v2 index format
+	 *
+	 * @param[in] in
+	 * The encoded entry
+	 *
+	 * @param[in] has_timestamps
+	 * True if the entry contains a timestamp field
+	 *
+	 * @param[out] entry
+	 * The decoded entry
+	 */
+	inline
+	void
+	decode_index_entry_v2(
+		const char *in,
+		bool has_timestamps,
+		IndexEntry &entry)
+	{
+		entry.offset = load_le<uint64_t>(in + 0);
+		entry.size = load_le<uint32_t>(in + 8);
+		entry.file = load_le<uint32_t>(in + 12);
+		entry.timestamp = has_timestamps ? load_le<uint64_t>(in + 16) : 0;
+	}
+
+	/**
+	 * Location of a single data block in a compressed record. Blocks are
+	 * numbered by their position in the record's block table.
+	 */
+	struct BlockEntry
+	{
+		// block's byte offset within its data file
+		uint64_t offset = 0;
+
+		// number of bytes the block occupies in the data file
+		uint32_t stored_size = 0;
+
+		// size of the block once it's decompressed
+		uint32_t raw_size = 0;
+
+		// the data file (segment) number that the block is located in
+		uint32_t file = 0;
+
+		// the protorecord::Codec value the block was compressed with
+		uint32_t codec = 0;
+	};
+
+	/**
+	 * Encodes a block table entry. Entries are BLOCK_ENTRY_SIZE bytes of
+	 * packed little-endian fields laid out as
+	 *
+	 *   offset (u64) | stored_size (u32) | raw_size (u32) | file (u32) | codec (u32)
+	 *
+	 * @param[in] entry
+	 * The entry to encode
+	 *
+	 * @param[out] out
+	 * Where to store the entry. Must be BLOCK_ENTRY_SIZE bytes long.
+	 */
+	inline
+	void
+	encode_block_entry(
+		const BlockEntry &entry,
+		char *out)
+	{
+		store_le<uint64_t>(out + 0,entry.offset);
+		store_le<uint32_t>(out + 8,entry.stored_size);
+		store_le<uint32_t>(out + 12,entry.raw_size);
+		store_le<uint32_t>(out + 16,entry.file);
+		store_le<uint32_t>(out + 20,entry.codec);
+	}
+
+	/**
+	 * Decodes a block table entry
+	 *
+	 * @param[in] in
+	 * The encoded entry
+	 *
+	 * @param[out] entry
+	 * The decoded entry
+	 */
+	inline
+	void
+	decode_block_entry(
+		const char *in,
+		BlockEntry &entry)
+	{
+		entry.offset = load_le<uint64_t>(in + 0);
+		entry.stored_size = load_le<uint32_t>(in + 8);
+		entry.raw_size = load_le<uint32_t>(in + 12);
+		entry.file = load_le<uint32_t>(in + 16);
+		entry.codec = load_le<uint32_t>(in + 20);
+	}
+
+}// protorecord
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace protorecord
+{
+	/**
+	 * Describes what a producer should do when it tries to queue an item
+	 * into an ItemQueue that is already full.
+	 */
+	enum class FullQueuePolicy
+	{
+		// wait for the consumer to free up a slot
+		BLOCK,
+
+		// discard the item that is being queued
+		DROP_NEWEST,
+
+		// discard the oldest item that is still waiting in the queue
+		DROP_OLDEST
+	};
+
+	/**
+	 * A bounded lock-free queue that is used to hand serialized items from
+	 * the threads calling Writer::write() off to the Writer's I/O thread.
+	 *
+	 * The queue is a ring of preallocated slots. Each slot carries a
+	 * sequence number that tells the producers and the consumer who owns
+	 * it, so nobody ever takes a lock on the fast path. Any number of
+	 * producers may reserve slots concurrently, but there must only be a
+	 * single consumer. Items are serialized directly into a slot's buffer,
+	 * which gives every producer its own scratch space. The buffer is
+	 * reused once the consumer has released the slot.
+	 */
+	class ItemQueue
+	{
+	public:
+		struct Slot
+		{
+			// the serialized item data
+			std::vector<char> data;
+
+			// number of valid bytes in 'data'
+			uint32_t size;
+
+			// the item's timestamp relative to the start of the recording
+			std::chrono::microseconds timestamp;
+
+			// false if the producer failed to fill in the slot. the consumer
+			// should release these slots without writing them.
+			bool valid;
+
+			// the queue position that this slot was reserved for
+			uint64_t pos;
+
+			// sequence number used to pass ownership between the producer
+			// and the consumer
+			std::atomic<uint64_t> seq;
+		};
+
+		/**
+		 * Constructor
+		 *
+		 * @param[in] capacity
+		 * The number of items the queue can hold. This is rounded up to the
+		 * next power of two.
+		 *
+		 * @param[in] slot_reserve
+		 * The number of bytes to preallocate in each slot's data buffer.
+		 */
+		ItemQueue(
+			size_t capacity,
+			size_t slot_reserve);
+
+		/**
+		 * Reserves the next slot in the queue for the producer to fill in.
+		 * The slot must be handed back with commit(). This method is safe to
+		 * call from multiple threads at once.
+		 *
+		 * @param[in] policy
+		 * What to do if the queue is full
+		 *
+		 * @param[out] dropped_oldest
+		 * Set to true if the oldest queued item had to be discarded in
+		 * order to make room for the new one.
+		 *
+		 * @return
+		 * The reserved slot, or nullptr if the queue was full and the
+		 * new item should be dropped.
+		 */
+		Slot *
+		reserve(
+			FullQueuePolicy policy,
+			bool &dropped_oldest);
+
+		/**
+		 * Publishes a slot that was previously returned by reserve() to
+		 * the consumer.
+		 */
+		void
+		commit(
+			Slot *slot);
+
+		/**
+		 * @return
+		 * The oldest committed slot in the queue, or nullptr if the queue
+		 * is empty. The slot must be handed back with release().
+		 */
+		Slot *
+		try_pop();
+
+		/**
+		 * Returns a slot that was obtained from try_pop() back to the
+		 * producer so that it can be reused.
+		 */
+		void
+		release(
+			Slot *slot);
+
+		/**
+		 * Blocks the consumer until there is at least one item available,
+		 * the timeout expires, or the queue is closed.
+		 *
+		 * @param[in] timeout
+		 * Maximum amount of time to wait for an item
+		 *
+		 * @return
+		 * False once the queue has been closed and there are no more items
+		 * left to pop, true otherwise.
+		 */
+		bool
+		wait(
+			std::chrono::microseconds timeout);
+
+		/**
+		 * Marks the queue as closed and wakes up the consumer. Items that
+		 * were committed before this call can still be popped.
+		 */
+		void
+		close();
+
+		/**
+		 * @return
+		 * The number of items the queue can hold
+		 */
+		size_t
+		capacity();
+
+	protected:
+		/**
+		 * @return
+		 * True if the slot at the consumer's position holds a committed item
+		 */
+		bool
+		has_items();
+
+	private:
+		// number of slots minus one, used to map positions to slots
+		const uint64_t mask_;
+
+		// the queue's ring of slots
+		std::vector<Slot> slots_;
+
+		// the position the next producer will reserve
+		alignas(64) std::atomic<uint64_t> enqueue_pos_;
+
+		// the position the consumer will pop next. producers also advance
+		// this when they discard the oldest item.
+		alignas(64) std::atomic<uint64_t> dequeue_pos_;
+
+		// set while the consumer is (about to be) sleeping in wait()
+		alignas(64) std::atomic<bool> consumer_waiting_;
+
+		// set to true once close() is called
+		bool closed_;
+
+		// used to put the consumer to sleep while the queue is empty
+		std::mutex mutex_;
+		std::condition_variable cv_;
+
+	};
+
+}// protorecord
@@ -0,0 +1,412 @@
+#pragma once
+
+#include <functional>
+#include <google/protobuf/descriptor.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "protorecord/MappedFile.h"
+
+namespace protorecord
+{
+	class Projection;
+	struct ProjectionResult;
+
+	/**
+	 * Extracts the key of an item from its serialized data, for items that
+	 * are indexed by something other than a single field
+	 *
+	 * @param[in] item_data
+	 * The serialized item
+	 *
+	 * @param[out] key
+	 * The item's key
+	 *
+	 * @return
+	 * True if the item has a key, false if it shouldn't be indexed
+	 */
+	using KeyExtractor = std::function<bool(std::string_view item_data, std::string &key)>;
+
+	/**
+	 * How the keys of a key index are to be interpreted
+	 */
+	enum class KeyType : uint32_t
+	{
+		// signed integer and enum fields
+		INT64 = 1,
+
+		// unsigned integer and bool fields
+		UINT64 = 2,
+
+		// string and bytes fields, and keys made by a KeyExtractor
+		BYTES = 3
+	};
+
+	/**
+	 * The start of a record's "keys" file. All integers are little-endian.
+	 * The header is followed by
+	 *   uint64_t key_offsets[num_keys + 1]      offset of each key in the key bytes
+	 *   uint64_t posting_offsets[num_keys + 1]  index of each key's first posting
+	 *   uint64_t postings[num_postings]         item numbers, ascending per key
+	 *   char key_bytes[key_bytes]               the keys, in ascending order
+	 * Integer keys are stored as 8 big endian bytes with the sign bit of
+	 * signed keys flipped, so that all keys sort with memcmp().
+	 */
+	struct KeyIndexHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t key_type;
+		uint64_t num_keys;
+		uint64_t num_postings;
+		uint64_t key_bytes;
+	};
+
+	/**
+	 * The start of a record's "filters" file. All integers are
+	 * little-endian. The header is followed by
+	 *   uint64_t block_offsets[num_filters + 2]  index of each filter's first block
+	 *   uint64_t blocks[num_blocks][8]           the filters' 512 bit blocks
+	 * Filter 'f' holds the keys of items [f * items_per_filter, (f + 1) *
+	 * items_per_filter), and the last filter holds every key of the record.
+	 * Each key sets 'num_probes' bits within one block.
+	 */
+	struct KeyFilterHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t key_type;
+		uint32_t num_filters;
+		uint32_t num_probes;
+		uint64_t items_per_filter;
+		uint64_t num_items;
+		uint64_t num_blocks;
+	};
+
+	/**
+	 * @return
+	 * 'key' encoded so that it sorts with memcmp()
+	 */
+	std::string
+	encode_key(
+		int64_t key);
+
+	/**
+	 * @return
+	 * 'key' encoded so that it sorts with memcmp()
+	 */
+	std::string
+	encode_key(
+		uint64_t key);
+
+	/**
+	 * Collects the keys of a Writer's items, and stores them as a sorted
+	 * key -> items index and as Bloom filters when the record is closed.
+	 * Thread safe, so that an async Writer's producers can resolve the key
+	 * field while its I/O thread adds items.
+	 */
+	class KeyIndexBuilder
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] key_field
+		 * The name or path of the field to index. Ignored if 'extractor' is
+		 * set.
+		 *
+		 * @param[in] extractor
+		 * Extracts the items' keys instead of 'key_field'
+		 */
+		KeyIndexBuilder(
+			const std::string &key_field,
+			const KeyExtractor &extractor);
+
+		/**
+		 * Destructor
+		 */
+		~KeyIndexBuilder();
+
+		/**
+		 * Resolves the key field in the recorded message type. Keys can
+		 * only be extracted from fields once this was called.
+		 *
+		 * @param[in] descriptor
+		 * The recorded message type
+		 *
+		 * @return
+		 * True if the key field can be indexed, false otherwise
+		 */
+		bool
+		set_descriptor(
+			const google::protobuf::Descriptor *descriptor);
+
+		/**
+		 * Extracts an item's key and adds it to the index
+		 *
+		 * @param[in] item_data
+		 * The serialized item
+		 *
+		 * @param[in] item_data_size
+		 * The size of the item in bytes
+		 *
+		 * @param[in] item_num
+		 * The index of the item in the record
+		 */
+		void
+		add(
+			const char *item_data,
+			uint32_t item_data_size,
+			uint64_t item_num);
+
+		/**
+		 * Sorts the keys and stores the index
+		 *
+		 * @param[in] filepath
+		 * The file to store the index in
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		store_index(
+			const std::string &filepath);
+
+		/**
+		 * Stores blocked Bloom filters over the keys, one per range of
+		 * consecutive items
+		 *
+		 * @param[in] filepath
+		 * The file to store the filters in
+		 *
+		 * @param[in] bits_per_key
+		 * The size of the filters. 10 bits give about 1% false positives.
+		 *
+		 * @param[in] items_per_filter
+		 * The number of consecutive items each filter covers
+		 *
+		 * @param[in] num_items
+		 * The number of items in the record
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		store_filters(
+			const std::string &filepath,
+			size_t bits_per_key,
+			uint64_t items_per_filter,
+			uint64_t num_items);
+
+		/**
+		 * @return
+		 * A string explaining why the key field can't be indexed, or the
+		 * index couldn't be stored. The reason is "popped" by calling this.
+		 */
+		std::string
+		reason();
+
+	protected:
+		/**
+		 * Sorts the keys by key and item, if they aren't sorted yet
+		 *
+		 * @return
+		 * False if the keys can't be stored, as the key field was never
+		 * resolved
+		 */
+		bool
+		sort_keys();
+
+	private:
+		// see the constructor
+		std::string key_field_;
+		KeyExtractor extractor_;
+
+		// how the keys are interpreted
+		KeyType key_type_;
+
+		// extracts key_field_. nullptr until set_descriptor() succeeded.
+		std::unique_ptr<Projection> projection_;
+
+		// reused to extract every item's key with projection_
+		std::unique_ptr<ProjectionResult> key_result_;
+
+		// (encoded key, item number) of integer keys
+		std::vector<std::pair<uint64_t,uint64_t>> int_keys_;
+
+		// (key, item number) of BYTES keys
+		std::vector<std::pair<std::string,uint64_t>> byte_keys_;
+
+		// set once sort_keys() sorted the keys
+		bool sorted_;
+
+		// reused by extractor_
+		std::string extracted_key_;
+
+		// set to a human readable string explaining the last failure
+		std::string fail_reason_;
+
+		// guards the members above, as set_descriptor() is called by
+		// producers while add() runs on the Writer's I/O thread
+		std::mutex mutex_;
+
+	};
+
+	/**
+	 * A record's key index, memory mapped for lookups
+	 */
+	class KeyIndex
+	{
+	public:
+		/**
+		 * Constructor
+		 */
+		KeyIndex();
+
+		/**
+		 * Maps a key index file
+		 *
+		 * @param[in] filepath
+		 * The record's "keys" file
+		 *
+		 * @return
+		 * True on success, false if the file is missing or malformed
+		 */
+		bool
+		open(
+			const std::string &filepath);
+
+		/**
+		 * @return
+		 * How the index's keys are to be interpreted
+		 */
+		KeyType
+		key_type() const;
+
+		/**
+		 * Finds the items of a key with a binary search over the keys, in
+		 * O(log n + k)
+		 *
+		 * @param[in] key
+		 * The key, encoded like the index stores it
+		 *
+		 * @param[out] items
+		 * The numbers of the items with the key, in ascending order
+		 */
+		void
+		lookup(
+			std::string_view key,
+			std::vector<uint64_t> &items) const;
+
+	protected:
+		/**
+		 * @return
+		 * The 'k'th key
+		 */
+		std::string_view
+		key_at(
+			uint64_t k) const;
+
+	private:
+		// the mapped file
+		MappedFile map_;
+
+		// the file's header
+		KeyIndexHeader header_;
+
+		// the arrays following the header, within map_
+		const char *key_offsets_;
+		const char *posting_offsets_;
+		const char *postings_;
+		const char *key_bytes_;
+
+	};
+
+	/**
+	 * A record's Bloom filters over its keys, memory mapped. They tell
+	 * which ranges of items might hold a key, and rule out the others
+	 * without touching the key index or the items.
+	 */
+	class KeyFilter
+	{
+	public:
+		/**
+		 * Constructor
+		 */
+		KeyFilter();
+
+		/**
+		 * Maps a key filter file
+		 *
+		 * @param[in] filepath
+		 * The record's "filters" file
+		 *
+		 * @return
+		 * True on success, false if the file is missing or malformed
+		 */
+		bool
+		open(
+			const std::string &filepath);
+
+		/**
+		 * @return
+		 * How the filtered keys are to be interpreted
+		 */
+		KeyType
+		key_type() const;
+
+		/**
+		 * @param[in] key
+		 * The key, encoded like the key index stores it
+		 *
+		 * @return
+		 * False if no item has the key, true if some might
+		 */
+		bool
+		might_contain(
+			std::string_view key) const;
+
+		/**
+		 * Finds the ranges of items that might hold a key
+		 *
+		 * @param[in] key
+		 * The key, encoded like the key index stores it
+		 *
+		 * @param[out] ranges
+		 * The [first,last) item ranges whose filters let the key pass, in
+		 * ascending order
+		 */
+		void
+		key_ranges(
+			std::string_view key,
+			std::vector<std::pair<uint64_t,uint64_t>> &ranges) const;
+
+	protected:
+		/**
+		 * @return
+		 * True if filter 'f' lets a key of 'hash' pass
+		 */
+		bool
+		filter_passes(
+			uint64_t f,
+			uint64_t hash) const;
+
+	private:
+		// the mapped file
+		MappedFile map_;
+
+		// the file's header
+		KeyFilterHeader header_;
+
+		// the arrays following the header, within map_
+		const char *block_offsets_;
+		const char *blocks_;
+
+	};
+
+}// protorecord
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace protorecord
+{
+	struct LiveChannelHeader;
+
+	/**
+	 * A ring buffer in POSIX shared memory that a Writer publishes every
+	 * item it records into, so that readers in other threads or processes
+	 * see the item without waiting for it to reach the record files.
+	 *
+	 * There is one writer and any number of readers. The writer never
+	 * waits for readers; once it has gone all the way around the ring it
+	 * overwrites the oldest items. Every reader keeps its own position and
+	 * checks after copying an item out that the writer hadn't started
+	 * overwriting it (a seqlock on the ring's write position). A reader
+	 * that was lapped skips ahead to the newest item.
+	 */
+	class LiveChannel
+	{
+	public:
+		/**
+		 * Constructor
+		 */
+		LiveChannel();
+
+		/**
+		 * Destructor. Closes the channel.
+		 */
+		~LiveChannel();
+
+		LiveChannel(const LiveChannel &) = delete;
+		LiveChannel &operator=(const LiveChannel &) = delete;
+
+		/**
+		 * Creates the channel's shared memory for writing. A stale channel
+		 * of the same name is replaced.
+		 *
+		 * @param[in] name
+		 * The name of the channel. A leading '/' is added if it's missing.
+		 *
+		 * @param[in] capacity
+		 * The size of the ring in bytes. It's rounded up to a power of two.
+		 *
+		 * @return
+		 * True on success, false otherwise. reason() explains why.
+		 */
+		bool
+		create(
+			const std::string &name,
+			size_t capacity);
+
+		/**
+		 * Opens an existing channel for reading
+		 *
+		 * @param[in] name
+		 * The name the channel was created with
+		 *
+		 * @return
+		 * True on success, false otherwise. reason() explains why.
+		 */
+		bool
+		open(
+			const std::string &name);
+
+		/**
+		 * Unmaps the channel. If the channel was created by this object,
+		 * readers are told the writer is gone and the name is removed, so
+		 * that no new readers can open it.
+		 */
+		void
+		close();
+
+		/**
+		 * @return
+		 * True if the channel is created or opened
+		 */
+		bool
+		is_open() const;
+
+		/**
+		 * Copies an item into the ring. Items that don't fit in the ring at
+		 * all are skipped, which readers see as dropped items.
+		 *
+		 * @param[in] item_data
+		 * The serialized item
+		 *
+		 * @param[in] item_data_size
+		 * The size of the item in bytes
+		 *
+		 * @param[in] item_num
+		 * The index of the item in the record
+		 */
+		void
+		publish(
+			const char *item_data,
+			uint32_t item_data_size,
+			uint64_t item_num);
+
+		/**
+		 * Copies the item at 'read_pos' out of the ring
+		 *
+		 * @param[in,out] read_pos
+		 * The reader's position in the ring. It's moved past the item, or
+		 * to the newest item if the reader was lapped.
+		 *
+		 * @param[out] item_data
+		 * The item is copied into here. It's only grown if it's too small.
+		 *
+		 * @param[out] item_data_size
+		 * The size of the item in bytes
+		 *
+		 * @param[out] item_num
+		 * The index of the item in the record
+		 *
+		 * @return
+		 * True if an item was copied, false if there's no new item yet
+		 */
+		bool
+		read(
+			uint64_t &read_pos,
+			std::vector<char> &item_data,
+			uint32_t &item_data_size,
+			uint64_t &item_num) const;
+
+		/**
+		 * @return
+		 * The position in the ring after the newest item. Readers start
+		 * here to only see items published after they opened the channel.
+		 */
+		uint64_t
+		write_pos() const;
+
+		/**
+		 * @return
+		 * True once the writer has closed the channel
+		 */
+		bool
+		writer_closed() const;
+
+		/**
+		 * @return
+		 * A string explaining why create() or open() failed. Like
+		 * Reader::reason(), the reason is "popped" by calling this.
+		 */
+		std::string
+		reason();
+
+	protected:
+		/**
+		 * Maps the channel's shared memory object
+		 *
+		 * @param[in] fd
+		 * The shared memory object
+		 *
+		 * @param[in] map_size
+		 * The number of bytes to map
+		 *
+		 * @param[in] writable
+		 * True to map the object for writing
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		map(
+			int fd,
+			size_t map_size,
+			bool writable);
+
+	private:
+		// the name of the shared memory object
+		std::string name_;
+
+		// set to true if this object created the channel
+		bool is_writer_;
+
+		// the start of the mapping
+		LiveChannelHeader *header_;
+
+		// the ring's bytes, following the header in the mapping
+		char *ring_;
+
+		// the size of the ring in bytes, a power of two
+		uint64_t capacity_;
+
+		// the size of the mapping in bytes
+		size_t map_size_;
+
+		// the writer's position in the ring. only used by the writer.
+		uint64_t write_pos_;
+
+		// set to a human readable string explaining the last failure
+		std::string fail_reason_;
+
+	};
+
+}// protorecord
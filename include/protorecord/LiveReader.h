@@ -0,0 +1,180 @@
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "protorecord/LiveChannel.h"
+
+namespace protorecord
+{
+	/**
+	 * Reads the items a Writer publishes to its live channel (see
+	 * WriterOptions::live_channel) as they are written, from any thread
+	 * or process on the same machine. Only items published after the
+	 * LiveReader was opened are seen.
+	 *
+	 * The writer never waits for a LiveReader. A LiveReader that falls a
+	 * whole ring behind skips ahead to the newest item; dropped() counts
+	 * the items it missed. Use a Reader on the record to see every item.
+	 *
+	 * LiveReader live("camera");
+	 * while (running)
+	 * {
+	 *    if (live.follow(std::chrono::seconds(1)))
+	 *    {
+	 *       while (live.take_next(msg)) { ... }
+	 *    }
+	 * }
+	 */
+	class LiveReader
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] channel
+		 * The name of the Writer's live channel
+		 *
+		 * @param[in] max_item_size
+		 * Number of bytes preallocated for copying items out of the
+		 * channel. It's grown the first time a larger item is read.
+		 */
+		LiveReader(
+			const std::string &channel,
+			size_t max_item_size = 64000);
+
+		/**
+		 * @return
+		 * True if the channel was opened successfully
+		 */
+		bool
+		is_open() const;
+
+		/**
+		 * @return
+		 * True if the writer has published an item that hasn't been taken
+		 * yet. Never blocks.
+		 */
+		bool
+		has_next();
+
+		/**
+		 * Parses the next published item, and moves past it. Never blocks.
+		 *
+		 * @param[out] pb
+		 * The google::protobuf message to read into
+		 *
+		 * @return
+		 * True if an item was read, false if there is no new item yet or it
+		 * couldn't be parsed
+		 */
+		template<class PROTOBUF_T>
+		bool
+		take_next(
+			PROTOBUF_T &pb);
+
+		/**
+		 * Waits until the writer publishes a new item. The channel is
+		 * polled in a tight loop for a few microseconds, so that hand-offs
+		 * are quick, and then with short sleeps.
+		 *
+		 * @param[in] timeout
+		 * The longest time to wait for
+		 *
+		 * @return
+		 * True if there's a next item to take, false if the timeout passed
+		 * first or the writer closed the channel
+		 */
+		bool
+		follow(
+			std::chrono::microseconds timeout);
+
+		/**
+		 * @return
+		 * The record index of the item last taken with take_next()
+		 */
+		uint64_t
+		item_num();
+
+		/**
+		 * @return
+		 * The number of items this LiveReader missed because the writer
+		 * lapped it, or because they didn't fit in the channel
+		 */
+		uint64_t
+		dropped();
+
+		/**
+		 * @return
+		 * True once the writer has closed the channel. Items published
+		 * before that can still be taken.
+		 */
+		bool
+		writer_closed();
+
+		/**
+		 * @return
+		 * A string explaining the failure reason for a previously called
+		 * method in this class. Like Reader::reason(), the reason is
+		 * "popped" by calling this.
+		 */
+		std::string
+		reason();
+
+	private:
+		// the channel the items are read from
+		LiveChannel channel_;
+
+		// this reader's position in the channel's ring
+		uint64_t read_pos_;
+
+		// the next item, copied out of the ring by has_next()
+		std::vector<char> item_data_;
+
+		// the size of the item in item_data_
+		uint32_t item_data_size_;
+
+		// set to true while item_data_ holds an item that wasn't taken yet
+		bool pending_;
+
+		// record index of the item in item_data_
+		uint64_t pending_item_num_;
+
+		// record index of the last item copied out of the ring. UINT64_MAX
+		// before the first.
+		uint64_t last_item_num_;
+
+		// see item_num()
+		uint64_t taken_item_num_;
+
+		// see dropped()
+		uint64_t dropped_;
+
+		// set to a human readable string explaining the last failure
+		std::string fail_reason_;
+
+	};
+
+	template<class PROTOBUF_T>
+	bool
+	LiveReader::take_next(
+		PROTOBUF_T &pb)
+	{
+		if ( ! has_next())
+		{
+			return false;
+		}
+
+		pending_ = false;
+		taken_item_num_ = pending_item_num_;
+		bool okay = pb.ParseFromArray((const void*)item_data_.data(),item_data_size_);
+		if ( ! okay)
+		{
+			fail_reason_ = "failed to parse item " + std::to_string(pending_item_num_) + " from live channel";
+		}
+		return okay;
+	}
+
+}// protorecord
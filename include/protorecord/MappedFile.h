@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+namespace protorecord
+{
+	/**
+	 * Tells the kernel how a memory mapped record is going to be read, so
+	 * that it can tune its read-ahead accordingly.
+	 */
+	enum class AccessPattern
+	{
+		// no particular pattern
+		NORMAL,
+
+		// items are read front to back. pages are read ahead aggressively
+		// and can be dropped soon after they were read.
+		SEQUENTIAL,
+
+		// items are read in no particular order. read-ahead is disabled.
+		RANDOM
+	};
+
+	/**
+	 * A read-only memory mapping of an entire file
+	 */
+	class MappedFile
+	{
+	public:
+		/**
+		 * Constructor
+		 */
+		MappedFile();
+
+		/**
+		 * Destructor. Unmaps the file.
+		 */
+		~MappedFile();
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		/**
+		 * Maps a file into memory
+		 *
+		 * @param[in] filepath
+		 * The file to map
+		 *
+		 * @return
+		 * True if the file was mapped, false otherwise
+		 */
+		bool
+		open(
+			const std::string &filepath);
+
+		/**
+		 * Unmaps the file, if one is mapped
+		 */
+		void
+		close();
+
+		/**
+		 * Passes an access pattern hint on to the kernel with madvise()
+		 *
+		 * @param[in] pattern
+		 * How the mapping is going to be read
+		 *
+		 * @return
+		 * True if the hint was accepted, false otherwise
+		 */
+		bool
+		advise(
+			AccessPattern pattern);
+
+		/**
+		 * @return
+		 * True if a file is mapped
+		 */
+		bool
+		is_open() const;
+
+		/**
+		 * @return
+		 * Pointer to the start of the mapping. nullptr if the file is empty
+		 * or nothing is mapped.
+		 */
+		const char *
+		data() const;
+
+		/**
+		 * @return
+		 * The size of the mapped file in bytes
+		 */
+		size_t
+		size() const;
+
+	private:
+		// start of the mapping
+		char *addr_;
+
+		// size of the mapping in bytes
+		size_t size_;
+
+		// set to true once a file has been mapped
+		bool is_open_;
+
+	};
+
+}// protorecord
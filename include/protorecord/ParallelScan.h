@@ -0,0 +1,400 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <google/protobuf/arena.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "protorecord/Reader.h"
+
+namespace protorecord
+{
+	/**
+	 * Settings that control how a ParallelScan splits up and reads its
+	 * records
+	 */
+	struct ScanOptions
+	{
+		// number of worker threads. 0 uses one per hardware thread.
+		size_t num_threads = 0;
+
+		// number of consecutive items each worker parses at a time
+		uint64_t chunk_size = 4096;
+
+		// set to true to call the callback one item at a time, in record
+		// order. workers still parse their chunks in parallel, but hold on
+		// to them until every chunk before theirs has been handed out.
+		bool ordered = false;
+
+		// how the workers open the records. every worker has its own file
+		// handles or mappings.
+		ReaderOptions reader_options;
+	};
+
+	/**
+	 * Identifies an item handed out by a ParallelScan
+	 */
+	struct ScanItem
+	{
+		// index of the item's record in the list of scanned records
+		size_t record = 0;
+
+		// index of the item within its record
+		uint64_t item = 0;
+
+		// index of the item's chunk in ParallelScan::chunks(). every chunk
+		// is handled by one worker at a time.
+		size_t chunk = 0;
+
+		// the item's timestamp in microseconds relative to the beginning of
+		// its recording. only valid if the record has timestamps.
+		uint64_t timestamp = 0;
+	};
+
+	/**
+	 * A range of consecutive items in one of the scanned records
+	 */
+	struct ScanChunk
+	{
+		// index of the chunk's record in the list of scanned records
+		size_t record = 0;
+
+		// index of the first item in the chunk
+		uint64_t first = 0;
+
+		// index one past the last item in the chunk
+		uint64_t last = 0;
+	};
+
+	/**
+	 * Reads one or more records on a pool of worker threads. The records'
+	 * items are split into chunks, which the workers parse independently
+	 * and pass on to a callback.
+	 *
+	 * ParallelScan scan({"recording"});
+	 * scan.scan<LargeMessage>([](const ScanItem &item, const LargeMessage &msg){
+	 *    ...
+	 *    return true;
+	 * });
+	 */
+	class ParallelScan
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] record_paths
+		 * The records to scan. Their items are handed out as if the
+		 * records were concatenated in this order.
+		 *
+		 * @param[in] options
+		 * Settings that control how the records are split up and read
+		 */
+		ParallelScan(
+			const std::vector<std::string> &record_paths,
+			const ScanOptions &options = ScanOptions());
+
+		/**
+		 * Parses every item of the records and calls 'callback' with it.
+		 * Unless ScanOptions::ordered is set, the callback is called from
+		 * all of the workers at once; items within a chunk are always
+		 * handed out in order.
+		 *
+		 * @param[in] callback
+		 * Called as bool(const ScanItem &, const PROTOBUF_T &). The message
+		 * is only valid during the call. Returning false stops the scan.
+		 *
+		 * @return
+		 * True if every item was handed to the callback, false if the scan
+		 * failed or the callback stopped it. reason() is empty in the
+		 * latter case.
+		 */
+		template<class PROTOBUF_T, class CALLBACK_T>
+		bool
+		scan(
+			CALLBACK_T callback);
+
+		/**
+		 * Same as scan(), but hands out the items' serialized data instead
+		 * of parsing them
+		 *
+		 * @param[in] callback
+		 * Called as bool(const ScanItem &, std::string_view). The data is
+		 * only valid during the call. Returning false stops the scan.
+		 *
+		 * @return
+		 * Same as scan()
+		 */
+		template<class CALLBACK_T>
+		bool
+		scan_raw(
+			CALLBACK_T callback);
+
+		/**
+		 * @return
+		 * The total number of items in the scanned records
+		 */
+		uint64_t
+		size();
+
+		/**
+		 * @return
+		 * The chunks the records were split into, in record order
+		 */
+		const std::vector<ScanChunk> &
+		chunks();
+
+		/**
+		 * @return
+		 * A string explaining why the constructor or the last scan failed.
+		 * Like Reader::reason(), the reason is "popped" by calling this.
+		 */
+		std::string
+		reason();
+
+	protected:
+		/**
+		 * Opens every record to find its size, and splits the records up
+		 * into chunks
+		 *
+		 * @return
+		 * True if every record could be opened, false otherwise
+		 */
+		bool
+		plan_chunks();
+
+		/**
+		 * Runs the workers until every chunk has been scanned or the scan
+		 * is stopped
+		 *
+		 * @param[in] scan_chunk
+		 * Called by the workers for every chunk, with the worker's number,
+		 * the worker's Reader for the chunk's record and the chunk's index
+		 * in chunks(). Returning false stops the scan.
+		 *
+		 * @return
+		 * True if every chunk was scanned successfully, false otherwise
+		 */
+		bool
+		run(
+			const std::function<bool(size_t, Reader &, size_t)> &scan_chunk);
+
+		/**
+		 * @return
+		 * The number of worker threads run() is going to start
+		 */
+		size_t
+		num_workers();
+
+		/**
+		 * Blocks until every chunk before 'chunk_num' has been handed out.
+		 * Only used in ordered mode.
+		 *
+		 * @param[in] chunk_num
+		 * The chunk that wants to be handed out next
+		 *
+		 * @return
+		 * True once it's the chunk's turn, false if the scan was stopped
+		 */
+		bool
+		wait_for_turn(
+			size_t chunk_num);
+
+		/**
+		 * Lets the chunk after 'chunk_num' be handed out
+		 */
+		void
+		end_turn(
+			size_t chunk_num);
+
+		/**
+		 * Stops the scan. The first reason given is kept for reason().
+		 *
+		 * @param[in] why
+		 * Why the scan stopped, or an empty string if the callback asked
+		 * for it
+		 */
+		void
+		stop(
+			const std::string &why);
+
+	private:
+		// the records being scanned
+		std::vector<std::string> record_paths_;
+
+		// see ScanOptions
+		ScanOptions options_;
+
+		// set to true if every record was opened successfully
+		bool initialized_;
+
+		// the records' items split into chunks, in record order
+		std::vector<ScanChunk> chunks_;
+
+		// total number of items in the records
+		uint64_t total_items_;
+
+		// the next chunk a worker will pick up
+		std::atomic<size_t> next_chunk_;
+
+		// set to true once the scan should stop
+		std::atomic<bool> stopping_;
+
+		// the next chunk to be handed out in ordered mode
+		size_t next_turn_;
+
+		// guards next_turn_ and fail_reason_
+		std::mutex mutex_;
+
+		// signaled every time a turn ends, or the scan is stopped
+		std::condition_variable turn_cv_;
+
+		// set to a human readable string explaining the last failure
+		std::string fail_reason_;
+
+	};
+
+	template<class PROTOBUF_T, class CALLBACK_T>
+	bool
+	ParallelScan::scan(
+		CALLBACK_T callback)
+	{
+		// every worker parses into its own arena, which is reset per chunk
+		struct WorkerState
+		{
+			google::protobuf::Arena arena;
+			std::vector<PROTOBUF_T*> batch;
+		};
+		std::vector<std::unique_ptr<WorkerState>> workers(num_workers());
+		for (auto &worker : workers)
+		{
+			worker.reset(new WorkerState());
+		}
+
+		return run([&](size_t worker_num, Reader &reader, size_t chunk_num){
+			const ScanChunk &chunk = chunks_[chunk_num];
+			WorkerState &worker = *workers[worker_num];
+			bool okay = reader.seek(chunk.first);
+			okay = okay && reader.take_batch(chunk.last - chunk.first,worker.arena,worker.batch);
+			okay = okay && worker.batch.size() == chunk.last - chunk.first;
+			if ( ! okay)
+			{
+				stop("failed to read items " + std::to_string(chunk.first) + " to " +
+					std::to_string(chunk.last) + " of record " + std::to_string(chunk.record) +
+					". reason: " + reader.reason());
+				return false;
+			}
+
+			if (options_.ordered && ! wait_for_turn(chunk_num))
+			{
+				return false;
+			}
+
+			ScanItem item;
+			item.record = chunk.record;
+			item.item = chunk.first;
+			item.chunk = chunk_num;
+			for (size_t i=0; i<worker.batch.size(); i++)
+			{
+				item.timestamp = reader.batch_entries_[i].timestamp;
+				if ( ! callback(item,*worker.batch[i]))
+				{
+					okay = false;
+					break;
+				}
+				item.item++;
+			}
+
+			// stop before ending the turn, so that the next chunk in line
+			// isn't handed out once the callback asked to stop
+			if ( ! okay)
+			{
+				stop("");
+			}
+			if (options_.ordered)
+			{
+				end_turn(chunk_num);
+			}
+			return okay;
+		});
+	}
+
+	template<class CALLBACK_T>
+	bool
+	ParallelScan::scan_raw(
+		CALLBACK_T callback)
+	{
+		std::vector<std::vector<IndexEntry>> worker_entries(num_workers());
+
+		return run([&](size_t worker_num, Reader &reader, size_t chunk_num){
+			const ScanChunk &chunk = chunks_[chunk_num];
+			std::vector<IndexEntry> &entries = worker_entries[worker_num];
+			const char *batch_data = nullptr;
+			bool okay = reader.get_index_items(chunk.first,chunk.last - chunk.first,entries);
+			okay = okay && reader.read_batch_data(entries,batch_data);
+			if ( ! okay)
+			{
+				stop("failed to read items " + std::to_string(chunk.first) + " to " +
+					std::to_string(chunk.last) + " of record " + std::to_string(chunk.record) +
+					". reason: " + reader.reason());
+				return false;
+			}
+
+			// unlike parsed batches, the data isn't kept around, so ordered
+			// scans wait for their turn before reading
+			if (options_.ordered && ! wait_for_turn(chunk_num))
+			{
+				return false;
+			}
+
+			ScanItem item;
+			item.record = chunk.record;
+			item.item = chunk.first;
+			item.chunk = chunk_num;
+			bool stopped = false;
+			for (const IndexEntry &entry : entries)
+			{
+				// items that aren't stored back to back are read one by one
+				const char *item_data = nullptr;
+				if (batch_data != nullptr)
+				{
+					item_data = batch_data + (entry.offset - entries.front().offset);
+				}
+				else if ( ! reader.read_item(entry,item_data))
+				{
+					okay = false;
+					break;
+				}
+
+				item.timestamp = entry.timestamp;
+				if ( ! callback(item,std::string_view(item_data,entry.size)))
+				{
+					stopped = true;
+					break;
+				}
+				item.item++;
+			}
+
+			if ( ! okay)
+			{
+				stop("failed to read item " + std::to_string(item.item) + " of record " +
+					std::to_string(chunk.record) + ". reason: " + reader.reason());
+			}
+			else if (stopped)
+			{
+				stop("");
+			}
+			if (options_.ordered)
+			{
+				end_turn(chunk_num);
+			}
+			return okay && ! stopped;
+		});
+	}
+
+}// protorecord
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "protorecord/Storage.h"
+
+namespace protorecord
+{
+	/**
+	 * An OutputFile that collects appends in a user-space buffer and writes
+	 * them out with write(). Appends that don't fit in the buffer are sent
+	 * together with the buffered data in a single writev().
+	 */
+	class PosixOutputFile : public OutputFile
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] buffer_size
+		 * Number of bytes to buffer before writing to the file
+		 */
+		PosixOutputFile(
+			size_t buffer_size);
+
+		~PosixOutputFile() override;
+
+		bool
+		open(
+			const std::string &filepath) override;
+
+		bool
+		append(
+			const void *data,
+			size_t size) override;
+
+		bool
+		flush() override;
+
+		/**
+		 * Hands out the free end of the buffer, writing the buffer out first
+		 * if there isn't enough room left in it
+		 */
+		char *
+		reserve(
+			size_t size) override;
+
+		void
+		commit(
+			size_t size) override;
+
+		void
+		close() override;
+
+	private:
+		// the opened file. -1 if no file is open.
+		int fd_;
+
+		// appended data that hasn't been written yet
+		std::vector<char> buffer_;
+
+		// number of bytes used in buffer_
+		size_t buffer_used_;
+
+		// set to true once a write fails
+		bool failed_;
+
+	};
+
+	/**
+	 * An OutputFile that writes with O_DIRECT, bypassing the page cache.
+	 * Appends fill one of two aligned buffers while the other one is being
+	 * written by a background thread. The file is preallocated in extents
+	 * so that the filesystem doesn't have to allocate blocks mid-write.
+	 */
+	class DirectOutputFile : public OutputFile
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] buffer_size
+		 * Size of each of the two buffers. Rounded up to DIRECT_IO_ALIGNMENT.
+		 *
+		 * @param[in] preallocate_extent
+		 * Number of bytes to preallocate every time the file runs out of
+		 * allocated space. 0 disables preallocation.
+		 */
+		DirectOutputFile(
+			size_t buffer_size,
+			uint64_t preallocate_extent);
+
+		~DirectOutputFile() override;
+
+		/**
+		 * Opens the file with O_DIRECT. Filesystems that don't support
+		 * O_DIRECT (like tmpfs) get the same aligned writes without it.
+		 */
+		bool
+		open(
+			const std::string &filepath) override;
+
+		bool
+		append(
+			const void *data,
+			size_t size) override;
+
+		/**
+		 * Waits for the background write, then writes the partially filled
+		 * buffer. O_DIRECT writes must be whole blocks, so the unaligned
+		 * tail is padded and gets written again once more data follows it.
+		 */
+		bool
+		flush() override;
+
+		/**
+		 * Flushes, and truncates the padding off the end of the file
+		 */
+		void
+		close() override;
+
+	private:
+		/**
+		 * Hands the full buffer to the background thread, and starts filling
+		 * the other one
+		 */
+		bool
+		submit_full_buffer();
+
+		/**
+		 * Waits until the background thread is done writing
+		 */
+		bool
+		wait_idle();
+
+		/**
+		 * Preallocates extents until the file has room for 'end' bytes
+		 */
+		void
+		preallocate(
+			uint64_t end);
+
+		/**
+		 * Main loop of the background thread
+		 */
+		void
+		write_thread_main();
+
+		// the opened file. -1 if no file is open.
+		int fd_;
+
+		size_t buffer_size_;
+
+		uint64_t preallocate_extent_;
+
+		// the two aligned buffers
+		char *buffers_[2];
+
+		// index of the buffer that appends go to
+		unsigned int fill_;
+
+		// number of bytes used in the fill buffer
+		size_t fill_used_;
+
+		// file offset of the fill buffer's first byte. always aligned.
+		uint64_t fill_offset_;
+
+		// number of bytes the file has been preallocated up to
+		uint64_t allocated_;
+
+		// set once a write fails, either here or in the background thread
+		std::atomic<bool> failed_;
+
+		// protects the write request below
+		std::mutex mutex_;
+		std::condition_variable cv_;
+
+		// the write the background thread should do
+		bool write_pending_;
+		const char *write_data_;
+		size_t write_size_;
+		uint64_t write_offset_;
+
+		bool stop_;
+
+		std::thread write_thread_;
+
+	};
+
+	/**
+	 * An OutputFile that writes straight into a shared memory mapping of the
+	 * file. The file is grown an extent at a time with fallocate() (or
+	 * ftruncate() where that's unsupported), and a window of it is mapped.
+	 * reserve() hands out memory inside the window, so data can be
+	 * serialized in place without any copies or write syscalls.
+	 */
+	class MappedOutputFile : public OutputFile
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] extent
+		 * Number of bytes the file grows by, and the size of the mapped
+		 * window
+		 */
+		MappedOutputFile(
+			uint64_t extent);
+
+		~MappedOutputFile() override;
+
+		bool
+		open(
+			const std::string &filepath) override;
+
+		bool
+		append(
+			const void *data,
+			size_t size) override;
+
+		/**
+		 * The data is in the page cache as soon as it's written into the
+		 * mapping, so there's nothing to wait for
+		 */
+		bool
+		flush() override;
+
+		char *
+		reserve(
+			size_t size) override;
+
+		void
+		commit(
+			size_t size) override;
+
+		/**
+		 * Unmaps the window, and truncates the file to the data's length
+		 */
+		void
+		close() override;
+
+	private:
+		/**
+		 * Maps a new window that covers the next 'size' bytes
+		 */
+		bool
+		remap(
+			size_t size);
+
+		/**
+		 * Unmaps the current window
+		 */
+		void
+		unmap();
+
+		// the opened file. -1 if no file is open.
+		int fd_;
+
+		uint64_t extent_;
+
+		// the mapped window of the file
+		char *window_;
+
+		// file offset of the first byte in window_. always page aligned.
+		uint64_t window_offset_;
+
+		// length of window_ in bytes
+		size_t window_size_;
+
+		// number of bytes of data in the file
+		uint64_t size_;
+
+		// number of bytes the file has been grown to
+		uint64_t file_size_;
+
+		// set once growing or mapping the file fails
+		bool failed_;
+
+	};
+
+	/**
+	 * An InputFile that reads with pread(). For NORMAL and SEQUENTIAL
+	 * access, a window of the file is read at a time so that neighboring
+	 * reads are served from memory.
+	 */
+	class PosixInputFile : public InputFile
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] window_size
+		 * Number of bytes to read from the file at a time. 0 reads exactly
+		 * what's requested.
+		 */
+		PosixInputFile(
+			size_t window_size);
+
+		~PosixInputFile() override;
+
+		bool
+		open(
+			const std::string &filepath) override;
+
+		bool
+		read(
+			uint64_t offset,
+			size_t size,
+			char *dst) override;
+
+		void
+		invalidate() override;
+
+		void
+		close() override;
+
+	private:
+		// the opened file. -1 if no file is open.
+		int fd_;
+
+		// the most recently read window of the file
+		std::vector<char> window_;
+
+		// file offset of the first byte in window_
+		uint64_t window_offset_;
+
+		// number of valid bytes in window_
+		size_t window_used_;
+
+	};
+
+}// protorecord
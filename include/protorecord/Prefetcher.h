@@ -0,0 +1,216 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "protorecord/Index.h"
+
+namespace protorecord
+{
+	class Reader;
+	struct ReaderOptions;
+
+	/**
+	 * Reads a record's items ahead of a Reader on a background thread. The
+	 * thread reads the index entries and data of consecutive items into
+	 * chunks, and queues the chunks up until either a maximum number of
+	 * items or of bytes is buffered. The Reader then only has to parse the
+	 * items out of memory.
+	 *
+	 * The background thread reads through a Reader of its own, so it never
+	 * touches the consuming Reader's files. Only one thread may consume.
+	 */
+	class Prefetcher
+	{
+	public:
+		/**
+		 * Constructor. The background thread isn't started until the
+		 * first item is asked for.
+		 *
+		 * @param[in] filepath
+		 * The record to read ahead in
+		 *
+		 * @param[in] options
+		 * How to open the record, and how far to read ahead of the consumer.
+		 * See ReaderOptions::prefetch_items and prefetch_bytes.
+		 */
+		Prefetcher(
+			const std::string &filepath,
+			const ReaderOptions &options);
+
+		/**
+		 * Destructor. Stops the background thread.
+		 */
+		~Prefetcher();
+
+		/**
+		 * Returns an item that was read ahead. If 'item_idx' isn't the item
+		 * after the last one popped, reading ahead restarts at 'item_idx'.
+		 * Blocks until the item has been read.
+		 *
+		 * @param[in] item_idx
+		 * The index of the item to return
+		 *
+		 * @param[out] entry
+		 * Set to point at the item's index entry
+		 *
+		 * @param[out] item_data
+		 * Set to point at the item's data
+		 *
+		 * @return
+		 * True on success. False if the item is past the end of the record
+		 * or couldn't be read ahead, in which case the caller should read it
+		 * itself. The pointers are valid until the item is popped.
+		 */
+		bool
+		peek(
+			uint64_t item_idx,
+			const IndexEntry *&entry,
+			const char *&item_data);
+
+		/**
+		 * Moves past an item returned by peek()
+		 *
+		 * @param[in] item_idx
+		 * The item to move past. Nothing happens if it isn't the item
+		 * peek() would return next.
+		 */
+		void
+		pop(
+			uint64_t item_idx);
+
+		/**
+		 * Drops everything read ahead so far and refreshes the record, to
+		 * pick up items that were added to it. See Reader::refresh().
+		 */
+		void
+		refresh();
+
+	protected:
+		struct Chunk
+		{
+			// index of the first item in the chunk
+			uint64_t first = 0;
+
+			// number of items in the chunk
+			size_t count = 0;
+
+			// the items' index entries
+			std::vector<IndexEntry> entries;
+
+			// byte offset of each item's data within 'data'
+			std::vector<size_t> offsets;
+
+			// the items' data
+			std::vector<char> data;
+
+			// number of valid bytes in 'data'
+			size_t data_size = 0;
+
+			// false if the chunk's items couldn't be read
+			bool okay = true;
+		};
+
+		/**
+		 * Stops the background thread if it's running, and starts it again
+		 * so that it reads ahead from 'item_idx'
+		 */
+		void
+		restart(
+			uint64_t item_idx);
+
+		/**
+		 * Stops the background thread and drops the chunks it has queued
+		 */
+		void
+		stop();
+
+		/**
+		 * Reads the next chunk's items
+		 *
+		 * @param[in,out] chunk
+		 * The chunk to fill. 'first' and 'count' must be set.
+		 */
+		void
+		fill_chunk(
+			Chunk &chunk);
+
+		/**
+		 * Hands the chunk the consumer is done with back to the background
+		 * thread
+		 */
+		void
+		release_current();
+
+	private:
+		/**
+		 * Main loop of the background thread
+		 */
+		void
+		prefetch_main();
+
+	private:
+		// the Reader the background thread reads the record with
+		std::unique_ptr<Reader> reader_;
+
+		// number of items in the record
+		uint64_t total_items_;
+
+		// see ReaderOptions::prefetch_items
+		size_t max_items_;
+
+		// see ReaderOptions::prefetch_bytes
+		size_t max_bytes_;
+
+		// number of items read into a chunk at a time
+		size_t chunk_items_;
+
+		// the chunk the consumer is reading items from
+		std::unique_ptr<Chunk> current_;
+
+		// index of the next item the consumer will peek at
+		uint64_t consume_pos_;
+
+		// set once the background thread has been started
+		bool started_;
+
+		// index of the next item the background thread will read
+		uint64_t fetch_pos_;
+
+		// chunks that were read ahead, oldest first
+		std::deque<std::unique_ptr<Chunk>> ready_;
+
+		// chunks that can be reused
+		std::vector<std::unique_ptr<Chunk>> free_chunks_;
+
+		// number of items and bytes in ready_ and current_
+		size_t queued_items_;
+		size_t queued_bytes_;
+
+		// set once the background thread has read its last chunk
+		bool done_;
+
+		// set to true when the background thread should exit
+		bool stopping_;
+
+		// guards everything from fetch_pos_ on
+		std::mutex mutex_;
+
+		// signaled when a chunk is queued, or the thread is done
+		std::condition_variable ready_cv_;
+
+		// signaled when the consumer releases a chunk, or on stop()
+		std::condition_variable space_cv_;
+
+		// the background thread
+		std::thread thread_;
+
+	};
+
+}// protorecord
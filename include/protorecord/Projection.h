@@ -0,0 +1,492 @@
+#pragma once
+
+#include <google/protobuf/descriptor.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "protorecord/ParallelScan.h"
+
+namespace protorecord
+{
+	/**
+	 * Names a field to project, either by the number of a top level field,
+	 * or by its path. Paths are the names of the fields along the way,
+	 * separated by dots, e.g. "position.x" for field 'x' of the message in
+	 * field 'position'.
+	 */
+	struct FieldPath
+	{
+		FieldPath(uint32_t number)
+		 : number(number)
+		 , path()
+		{}
+
+		FieldPath(const std::string &path)
+		 : number(0)
+		 , path(path)
+		{}
+
+		FieldPath(const char *path)
+		 : FieldPath(std::string(path))
+		{}
+
+		// the field's number. only used if 'path' is empty.
+		uint32_t number;
+
+		// the field's path
+		std::string path;
+	};
+
+	/**
+	 * How a Predicate compares a field's value
+	 */
+	enum class CompareOp
+	{
+		EQ,// ==
+		NE,// !=
+		LT,// <
+		LE,// <=
+		GT,// >
+		GE// >=
+	};
+
+	/**
+	 * A condition on a scalar field that a Projection filters items with,
+	 * e.g. Predicate(2,CompareOp::GT,1000) for "field 2 > 1000". Numeric
+	 * fields are compared with numbers and string fields with strings.
+	 * Fields that aren't set compare with their default value.
+	 */
+	struct Predicate
+	{
+		// kinds of values a Predicate can compare with
+		enum class ValueKind
+		{
+			INT,
+			UINT,
+			DOUBLE,
+			STRING
+		};
+
+		Predicate() = default;
+
+		template<class T, typename std::enable_if<std::is_arithmetic<T>::value,int>::type = 0>
+		Predicate(uint32_t field, CompareOp op, T value)
+		 : field(field)
+		 , op(op)
+		{
+			if (std::is_floating_point<T>::value)
+			{
+				kind = ValueKind::DOUBLE;
+				double_value = value;
+			}
+			else if (std::is_signed<T>::value)
+			{
+				kind = ValueKind::INT;
+				int_value = value;
+			}
+			else
+			{
+				kind = ValueKind::UINT;
+				uint_value = value;
+			}
+		}
+
+		Predicate(uint32_t field, CompareOp op, const std::string &value)
+		 : field(field)
+		 , op(op)
+		 , kind(ValueKind::STRING)
+		 , string_value(value)
+		{}
+
+		Predicate(uint32_t field, CompareOp op, const char *value)
+		 : Predicate(field,op,std::string(value))
+		{}
+
+		// number of the field to compare
+		uint32_t field = 0;
+
+		// how to compare the field with the value
+		CompareOp op = CompareOp::EQ;
+
+		// which of the values below is set
+		ValueKind kind = ValueKind::INT;
+
+		int64_t int_value = 0;
+		uint64_t uint_value = 0;
+		double double_value = 0.0;
+		std::string string_value;
+	};
+
+	/**
+	 * How the values of a projected field are stored
+	 */
+	enum class ColumnType
+	{
+		// int32, int64, sint*, sfixed* and enum fields
+		INT64,
+
+		// uint32, uint64 and fixed* fields
+		UINT64,
+
+		// float and double fields
+		DOUBLE,
+
+		// bool fields, stored in uint_values as 0 or 1
+		BOOL,
+
+		// string and bytes fields
+		STRING
+	};
+
+	/**
+	 * The values of one projected field, one per matching item. Only the
+	 * vector that belongs to the column's type is filled.
+	 */
+	struct Column
+	{
+		// the field's number. for nested fields, the number within the
+		// nested message.
+		uint32_t field = 0;
+
+		// the field's name, or its path for nested fields
+		std::string name;
+
+		// which of the value vectors is filled
+		ColumnType type = ColumnType::INT64;
+
+		std::vector<int64_t> int_values;
+		std::vector<uint64_t> uint_values;
+		std::vector<double> double_values;
+		std::vector<std::string> string_values;
+
+		// false where the item didn't have the field set, in which case
+		// the field's default value is stored
+		std::vector<bool> present;
+
+		size_t size() const { return present.size(); }
+	};
+
+	/**
+	 * The items that matched a Projection, and their projected fields
+	 */
+	struct ProjectionResult
+	{
+		// the matching items, in record order
+		std::vector<ScanItem> items;
+
+		// one column per projected field, in the order they were asked for
+		std::vector<Column> columns;
+	};
+
+	/**
+	 * Settings that control how a Projection walks the wire format
+	 */
+	struct ProjectionOptions
+	{
+		// set to true if the items were serialized by protobuf in one go,
+		// which writes every singular field at most once. the rest of a
+		// message is then skipped once every needed field has been seen.
+		// items that were concatenated or merged on the wire may read the
+		// first value of a field instead of the last one, and nested
+		// messages aren't merged.
+		bool assume_canonical = false;
+	};
+
+	/**
+	 * Reads a few scalar fields out of serialized messages without parsing
+	 * them. The wire format is walked directly, and fields that aren't
+	 * needed are skipped. Items that don't match the predicates are
+	 * dropped before anything is copied out of them.
+	 *
+	 * Projection projection(WideMessage::descriptor(),{1,4},{Predicate(2,CompareOp::GT,1000)});
+	 * ProjectionResult result;
+	 * projection.scan({"recording"},result);
+	 *
+	 * Fields can also be given by their path, which reaches into nested
+	 * messages. Nested messages that aren't set read as all defaults.
+	 *
+	 * Projection projection(WideMessage::descriptor(),{"timestamp","nested.myInt"});
+	 *
+	 * Only singular scalar, string and bytes fields can be projected, and
+	 * only top level ones filtered on. Like protobuf's parser, the last
+	 * value of a field that's set several times wins, and nested messages
+	 * that appear several times are merged.
+	 */
+	class Projection
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] descriptor
+		 * The descriptor of the recorded messages, e.g. MyMessage::descriptor()
+		 *
+		 * @param[in] fields
+		 * The fields to extract, by number or by path
+		 *
+		 * @param[in] predicates
+		 * Conditions every returned item has to meet. The fields they test
+		 * don't need to be projected.
+		 *
+		 * @param[in] options
+		 * How the wire format is walked
+		 */
+		Projection(
+			const google::protobuf::Descriptor *descriptor,
+			const std::vector<FieldPath> &fields,
+			const std::vector<Predicate> &predicates = {},
+			const ProjectionOptions &options = ProjectionOptions());
+
+		/**
+		 * @return
+		 * True if the fields and predicates are supported. If not,
+		 * reason() explains why.
+		 */
+		bool
+		is_valid() const;
+
+		/**
+		 * Scans records and collects the projected fields of every item
+		 * that matches the predicates
+		 *
+		 * @param[in] record_paths
+		 * The records to scan
+		 *
+		 * @param[out] result
+		 * The matching items and their fields, in record order
+		 *
+		 * @param[in] options
+		 * How to split up the scan. num_threads > 1 extracts fields in
+		 * parallel; 'ordered' is ignored, as the results are always merged
+		 * in record order.
+		 *
+		 * @return
+		 * True on success, false if a record couldn't be read or an item
+		 * is malformed
+		 */
+		bool
+		scan(
+			const std::vector<std::string> &record_paths,
+			ProjectionResult &result,
+			const ScanOptions &options = ScanOptions());
+
+		/**
+		 * Extracts the projected fields of a single serialized item, if it
+		 * matches the predicates. Thread safe.
+		 *
+		 * @param[in] item_data
+		 * The serialized message
+		 *
+		 * @param[in] item
+		 * Identifies the item in 'result'
+		 *
+		 * @param[in,out] result
+		 * The item and its fields are appended to this if it matches. It
+		 * has to have been set up with make_result().
+		 *
+		 * @return
+		 * True on success, false if the item is malformed
+		 */
+		bool
+		apply(
+			std::string_view item_data,
+			const ScanItem &item,
+			ProjectionResult &result) const;
+
+		/**
+		 * @return
+		 * An empty result with a column for every projected field
+		 */
+		ProjectionResult
+		make_result() const;
+
+		/**
+		 * @return
+		 * A string explaining why the Projection is invalid or the last
+		 * scan failed. Like Reader::reason(), the reason is "popped" by
+		 * calling this.
+		 */
+		std::string
+		reason();
+
+	protected:
+		// a field's value within one item
+		struct FieldValue
+		{
+			bool present = false;
+			int64_t int_value = 0;
+			uint64_t uint_value = 0;
+			double double_value = 0.0;
+			std::string_view string_value;
+		};
+
+		// a field the Projection needs, either to extract or to test
+		struct FieldSpec
+		{
+			const google::protobuf::FieldDescriptor *descriptor = nullptr;
+
+			// the field's type, and the wire type it's encoded with. kept
+			// here so that decoding doesn't go through the descriptor.
+			google::protobuf::FieldDescriptor::Type field_type = google::protobuf::FieldDescriptor::TYPE_INT64;
+			uint32_t wire_type = 0;
+
+			// the name of the field's column
+			std::string name;
+
+			// how the field's values are stored
+			ColumnType type = ColumnType::INT64;
+
+			// the value of the field when an item doesn't have it set
+			FieldValue default_value;
+		};
+
+		// a message the Projection walks, either the recorded message or
+		// one nested in it
+		struct MessageNode
+		{
+			const google::protobuf::Descriptor *descriptor = nullptr;
+
+			// index into specs_ by field number, or -1 for fields that
+			// aren't needed
+			std::vector<int> spec_by_field;
+
+			// index into nodes_ by field number for the nested messages
+			// that need walking, or -1
+			std::vector<int> node_by_field;
+		};
+
+		/**
+		 * @return
+		 * Index of a field of nodes_[node] in specs_, or -1 if it isn't
+		 * needed
+		 */
+		int
+		find_field(
+			size_t node,
+			uint32_t field) const;
+
+		/**
+		 * Adds a field of nodes_[node] to specs_
+		 *
+		 * @param[in] node
+		 * The message the field belongs to
+		 *
+		 * @param[in] field
+		 * The field's number
+		 *
+		 * @param[in] name
+		 * The name of the field's column
+		 *
+		 * @return
+		 * Index of the field in specs_, or -1 if the message has no such
+		 * field or it isn't supported
+		 */
+		int
+		add_field(
+			size_t node,
+			uint32_t field,
+			const std::string &name);
+
+		/**
+		 * Adds a projected field to specs_, along with the nested messages
+		 * leading up to it
+		 *
+		 * @return
+		 * Index of the field in specs_, or -1 if there's no such field, it
+		 * isn't supported or it was already added
+		 */
+		int
+		add_path(
+			const FieldPath &field);
+
+		/**
+		 * Walks an item's wire format, and decodes the needed fields
+		 *
+		 * @param[in] item_data
+		 * The serialized message
+		 *
+		 * @param[out] values
+		 * The decoded value of each of specs_
+		 *
+		 * @return
+		 * True on success, false if the item is malformed
+		 */
+		bool
+		decode(
+			std::string_view item_data,
+			std::vector<FieldValue> &values) const;
+
+		/**
+		 * Walks the wire format of one message, recursing into the nested
+		 * messages that have needed fields
+		 *
+		 * @param[in] node
+		 * The message's entry in nodes_
+		 *
+		 * @param[in] pos
+		 * The start of the serialized message
+		 *
+		 * @param[in] end
+		 * The end of the serialized message
+		 *
+		 * @param[out] values
+		 * The decoded value of each of specs_
+		 *
+		 * @param[in,out] remaining
+		 * The number of needed fields that haven't been seen yet. With
+		 * ProjectionOptions::assume_canonical, the walk stops once it's 0.
+		 *
+		 * @return
+		 * True on success, false if the message is malformed
+		 */
+		bool
+		decode_message(
+			size_t node,
+			const uint8_t *pos,
+			const uint8_t *end,
+			std::vector<FieldValue> &values,
+			size_t &remaining) const;
+
+		/**
+		 * @return
+		 * True if 'value' of the field in specs_[spec] meets 'predicate'
+		 */
+		bool
+		matches(
+			const Predicate &predicate,
+			size_t spec,
+			const FieldValue &value) const;
+
+	private:
+		// the descriptor of the messages
+		const google::protobuf::Descriptor *descriptor_;
+
+		// the fields the Projection needs. projected ones come first, in
+		// the same order as the result's columns.
+		std::vector<FieldSpec> specs_;
+
+		// the messages that are walked. the recorded message is first.
+		std::vector<MessageNode> nodes_;
+
+		// number of fields that are projected
+		size_t num_columns_;
+
+		// the predicates, and the index of the field each one tests
+		std::vector<Predicate> predicates_;
+		std::vector<size_t> predicate_specs_;
+
+		// see the constructor
+		ProjectionOptions options_;
+
+		// set to false if the fields or predicates aren't supported
+		bool valid_;
+
+		// set to a human readable string explaining the last failure
+		std::string fail_reason_;
+
+	};
+
+}// protorecord
@@ -1,16 +1,300 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <google/protobuf/arena.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/dynamic_message.h>
+#include <iterator>
 #include <string>
+#include <string_view>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "Protorecord.pb.h"
 #include "protorecord/Constants.h"
+#include "protorecord/Index.h"
+#include "protorecord/KeyIndex.h"
+#include "protorecord/MappedFile.h"
+#include "protorecord/Prefetcher.h"
+#include "protorecord/Storage.h"
 
 namespace protorecord
 {
+	/**
+	 * Settings that control how a Reader accesses its record
+	 */
+	struct ReaderOptions
+	{
+		// set to true to memory map the record's files instead of reading
+		// them with streams. items are then parsed straight out of the
+		// mapping, which saves a copy and a couple of syscalls per item.
+		bool use_mmap = false;
+
+		// how the record is going to be read. in mmap mode it's passed on to
+		// madvise(), otherwise it decides whether files are read ahead.
+		AccessPattern access_pattern = AccessPattern::SEQUENTIAL;
+
+		// how the record's files are read when use_mmap isn't set. AUTO uses
+		// io_uring when the kernel supports it, and falls back to POSIX I/O
+		// otherwise. RANDOM access_pattern always reads with POSIX I/O.
+		StorageBackend storage_backend = StorageBackend::AUTO;
+
+		// number of bytes preallocated for reading items into. reading an
+		// item larger than this grows the buffer, which allocates.
+		size_t max_item_size = 64000;
+
+		// number of items to read ahead of get_next() and take_next() on a
+		// background thread. 0 disables reading ahead.
+		size_t prefetch_items = 0;
+
+		// stop reading ahead once this many bytes of items are buffered
+		size_t prefetch_bytes = 16 * 1024 * 1024;
+	};
+
+	/**
+	 * A half-open range [first,last) of item indices. It can be iterated
+	 * over to visit every item index in the range.
+	 */
+	struct ItemRange
+	{
+		class iterator
+		{
+		public:
+			explicit iterator(uint64_t idx) : idx_(idx) {}
+
+			uint64_t operator*() const { return idx_; }
+			iterator &operator++() { idx_++; return *this; }
+			bool operator==(const iterator &other) const { return idx_ == other.idx_; }
+			bool operator!=(const iterator &other) const { return idx_ != other.idx_; }
+
+		private:
+			uint64_t idx_;
+		};
+
+		// index of the first item in the range
+		uint64_t first = 0;
+
+		// index one past the last item in the range
+		uint64_t last = 0;
+
+		iterator begin() const { return iterator(first); }
+		iterator end() const { return iterator(last); }
+		uint64_t size() const { return last - first; }
+		bool empty() const { return first == last; }
+	};
+
+	class Reader;
+
+	/**
+	 * A lightweight handle to one of a Reader's items. Nothing is read
+	 * until it's asked for: size() and timestamp() only read the item's
+	 * index entry, which is then cached in the handle, and the item's data
+	 * is only read by raw() and parse().
+	 *
+	 * Handles of the same Reader can be used from several threads at
+	 * once, e.g. by parallel algorithms. Index entries and data are read
+	 * one thread at a time, but parse() parses outside of the Reader's
+	 * lock. Don't call any other Reader methods meanwhile.
+	 */
+	class ItemHandle
+	{
+	public:
+		/**
+		 * Constructor. The handle doesn't refer to any item.
+		 */
+		ItemHandle();
+
+		/**
+		 * Constructor
+		 *
+		 * @param[in] reader
+		 * The Reader of the item's record
+		 *
+		 * @param[in] item_idx
+		 * The index of the item
+		 */
+		ItemHandle(
+			Reader *reader,
+			uint64_t item_idx);
+
+		/**
+		 * @return
+		 * The index of the item in its record
+		 */
+		uint64_t
+		index() const;
+
+		/**
+		 * @return
+		 * The size of the item's serialized data in bytes, or 0 if its
+		 * index entry couldn't be read
+		 */
+		uint32_t
+		size() const;
+
+		/**
+		 * @return
+		 * The item's timestamp in microseconds relative to the beginning of
+		 * the recording. 0 if the record has no timestamps.
+		 */
+		uint64_t
+		timestamp() const;
+
+		/**
+		 * @return
+		 * The item's serialized data, or an empty view if it couldn't be
+		 * read. In mmap mode (for uncompressed records) it points into the
+		 * mapping. Otherwise it's copied into a per-thread buffer, and is
+		 * only valid until this thread's next raw() or parse() call.
+		 */
+		std::string_view
+		raw() const;
+
+		/**
+		 * Parses the item
+		 *
+		 * @param[out] pb
+		 * The google::protobuf message to read into
+		 *
+		 * @return
+		 * True if the item was read and parsed successfully
+		 */
+		template<class PROTOBUF_T>
+		bool
+		parse(
+			PROTOBUF_T &pb) const;
+
+	protected:
+		/**
+		 * Reads the item's index entry, unless it's cached already
+		 *
+		 * @return
+		 * True if entry_ holds the item's entry
+		 */
+		bool
+		load_entry() const;
+
+	private:
+		// the Reader of the item's record
+		Reader *reader_;
+
+		// the index of the item
+		uint64_t item_idx_;
+
+		// the item's index entry, once it was read
+		mutable IndexEntry entry_;
+
+		// set to true once entry_ was read
+		mutable bool has_entry_;
+
+	};
+
+	/**
+	 * A random access iterator over a Reader's items. Dereferencing it
+	 * gives an ItemHandle by value, so iterating never reads anything by
+	 * itself, and handles stay valid after the iterator moves on.
+	 *
+	 * As there's no ItemHandle to refer to, C++20 sees it as an input
+	 * iterator that models std::random_access_iterator. Like
+	 * std::vector<bool>::iterator, C++17 builds tag it random access.
+	 */
+	class ItemIterator
+	{
+	public:
+		// operator->() returns one of these, as there's no ItemHandle to
+		// point at
+		class arrow_proxy
+		{
+		public:
+			explicit arrow_proxy(const ItemHandle &handle) : handle_(handle) {}
+			const ItemHandle *operator->() const { return &handle_; }
+
+		private:
+			ItemHandle handle_;
+		};
+
+#if __cplusplus > 201703L
+		using iterator_concept = std::random_access_iterator_tag;
+		using iterator_category = std::input_iterator_tag;
+#else
+		using iterator_category = std::random_access_iterator_tag;
+#endif
+		using value_type = ItemHandle;
+		using difference_type = std::ptrdiff_t;
+		using pointer = arrow_proxy;
+		using reference = ItemHandle;
+
+		ItemIterator() : reader_(nullptr), item_idx_(0) {}
+		ItemIterator(Reader *reader, uint64_t item_idx) : reader_(reader), item_idx_(item_idx) {}
+
+		reference operator*() const { return ItemHandle(reader_,item_idx_); }
+		pointer operator->() const { return arrow_proxy(**this); }
+		reference operator[](difference_type n) const { return ItemHandle(reader_,item_idx_ + n); }
+
+		ItemIterator &operator++() { item_idx_++; return *this; }
+		ItemIterator &operator--() { item_idx_--; return *this; }
+		ItemIterator operator++(int) { ItemIterator prev(*this); item_idx_++; return prev; }
+		ItemIterator operator--(int) { ItemIterator prev(*this); item_idx_--; return prev; }
+		ItemIterator &operator+=(difference_type n) { item_idx_ += n; return *this; }
+		ItemIterator &operator-=(difference_type n) { item_idx_ -= n; return *this; }
+		ItemIterator operator+(difference_type n) const { return ItemIterator(reader_,item_idx_ + n); }
+		ItemIterator operator-(difference_type n) const { return ItemIterator(reader_,item_idx_ - n); }
+		friend ItemIterator operator+(difference_type n, const ItemIterator &it) { return it + n; }
+		difference_type operator-(const ItemIterator &other) const { return (difference_type)(item_idx_ - other.item_idx_); }
+
+		bool operator==(const ItemIterator &other) const { return item_idx_ == other.item_idx_; }
+		bool operator!=(const ItemIterator &other) const { return item_idx_ != other.item_idx_; }
+		bool operator<(const ItemIterator &other) const { return item_idx_ < other.item_idx_; }
+		bool operator>(const ItemIterator &other) const { return item_idx_ > other.item_idx_; }
+		bool operator<=(const ItemIterator &other) const { return item_idx_ <= other.item_idx_; }
+		bool operator>=(const ItemIterator &other) const { return item_idx_ >= other.item_idx_; }
+
+	private:
+		// the Reader of the items
+		Reader *reader_;
+
+		// the index of the item the iterator is at
+		uint64_t item_idx_;
+	};
+
+	/**
+	 * A range of a Reader's items that works with range-based for loops
+	 * and the standard algorithms
+	 *
+	 * for (const auto &item : reader.items())
+	 * {
+	 *    if (item.size() > 1024 && item.parse(msg)) { ... }
+	 * }
+	 */
+	struct ItemView
+	{
+		// iterator at the first item
+		ItemIterator first;
+
+		// iterator one past the last item
+		ItemIterator last;
+
+		ItemIterator begin() const { return first; }
+		ItemIterator end() const { return last; }
+		ItemHandle operator[](size_t n) const { return first[n]; }
+		size_t size() const { return last - first; }
+		bool empty() const { return first == last; }
+	};
+
 	class Reader
 	{
+		// reads ahead through a Reader of its own
+		friend class Prefetcher;
+
+		// reads chunks of raw items, and the index entries of parsed batches
+		friend class ParallelScan;
+
+		// reads index entries and data on behalf of iterators
+		friend class ItemHandle;
+
 	public:
 		/**
 		 * Constructor
@@ -21,6 +305,19 @@ namespace protorecord
 		Reader(
 			const std::string &filepath);
 
+		/**
+		 * Constructor
+		 *
+		 * @param[in] filepath
+		 * The absolute or relative filepath to the record.
+		 *
+		 * @param[in] options
+		 * Settings that control how the record is accessed
+		 */
+		Reader(
+			const std::string &filepath,
+			const ReaderOptions &options);
+
 		/**
 		 * Destructor
 		 */
@@ -64,6 +361,98 @@ namespace protorecord
 		take_next(
 			PROTOBUF_T &pb);
 
+		/**
+		 * Reads up to 'n' of the next items into messages allocated on an
+		 * arena, and increments past them. The index entries of the whole
+		 * batch are read at once, and so is the items' data if they are
+		 * stored next to each other in one data file.
+		 *
+		 * @param[in] n
+		 * The maximum number of items to read. Fewer are read once the end
+		 * of the record is reached.
+		 *
+		 * @param[in] arena
+		 * The arena that owns the parsed messages. It's Reset() before the
+		 * batch is read, which frees the messages of the previous batch, so
+		 * reusing one arena lets every batch reuse the same memory.
+		 *
+		 * @param[out] batch
+		 * The parsed messages, in record order. They are owned by 'arena'.
+		 *
+		 * @return
+		 * True if every item in the batch was read successfully, false if
+		 * there were no items left to read or an item couldn't be read. On
+		 * failure 'batch' holds the items read before the failing one.
+		 */
+		template<class PROTOBUF_T>
+		bool
+		take_batch(
+			size_t n,
+			google::protobuf::Arena &arena,
+			std::vector<PROTOBUF_T*> &batch);
+
+		/**
+		 * Reads any item from the record without changing the position of
+		 * the next item
+		 *
+		 * @param[in] item_idx
+		 * The index of the item to read
+		 *
+		 * @param[out] pb
+		 * The google::protobuf message to read into
+		 *
+		 * @return
+		 * True if message was successfully read, false otherwise
+		 */
+		template<class PROTOBUF_T>
+		bool
+		get(
+			uint64_t item_idx,
+			PROTOBUF_T &pb);
+
+		/**
+		 * Moves the Reader so that the next item read by get_next() and
+		 * take_next() is 'item_idx'. Index entries have a fixed size, so
+		 * this takes constant time no matter how far the jump is.
+		 *
+		 * @param[in] item_idx
+		 * The index of the item to read next. Seeking to size() is allowed
+		 * and leaves the Reader at the end of the record.
+		 *
+		 * @return
+		 * True on success, false if 'item_idx' is past the end of the record
+		 */
+		bool
+		seek(
+			uint64_t item_idx);
+
+		/**
+		 * @return
+		 * The index of the item that will be read next
+		 */
+		uint64_t
+		tell();
+
+		/**
+		 * Returns an item's serialized data without parsing it. When the
+		 * record is memory mapped (and uncompressed) the data is not copied.
+		 *
+		 * @param[in] item_idx
+		 * The index of the item to return
+		 *
+		 * @param[out] item_data
+		 * The item's data. It points into the mapping, which stays valid
+		 * until the Reader is destroyed. Without a mapping, or if the record
+		 * is compressed, it's only valid until the next item is read.
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		get_raw(
+			uint64_t item_idx,
+			std::string_view &item_data);
+
 		/**
 		 * Reads the next item's timestamp
 		 *
@@ -78,6 +467,117 @@ namespace protorecord
 		get_next_timestamp(
 			uint64_t &item_timestamp);
 
+		/**
+		 * Moves the Reader to the first item that was recorded at or after
+		 * a point in time. The index is binary searched, so only O(log n)
+		 * index entries are read.
+		 *
+		 * @param[in] timestamp_us
+		 * Time in microseconds relative to the beginning of the recording
+		 *
+		 * @return
+		 * True on success. If every item is older than 'timestamp_us', the
+		 * Reader is left at the end of the record. False is returned if the
+		 * record has no timestamps.
+		 */
+		bool
+		seek_to_time(
+			uint64_t timestamp_us);
+
+		/**
+		 * Finds the items that were recorded within a window of time
+		 *
+		 * @param[in] begin_us
+		 * Start of the window in microseconds relative to the beginning of
+		 * the recording (inclusive)
+		 *
+		 * @param[in] end_us
+		 * End of the window in microseconds relative to the beginning of
+		 * the recording (exclusive)
+		 *
+		 * @return
+		 * The indices of the items in the window. The range is empty if the
+		 * record has no timestamps, in which case reason() explains why.
+		 */
+		ItemRange
+		range(
+			uint64_t begin_us,
+			uint64_t end_us);
+
+		/**
+		 * @return
+		 * A view of all of the record's items. Iterating over it doesn't
+		 * move the Reader, or read anything until an item is accessed.
+		 */
+		ItemView
+		items();
+
+		/**
+		 * @param[in] range
+		 * The item indices to view, e.g. from range(). Indices past the end
+		 * of the record are left out.
+		 *
+		 * @return
+		 * A view of the items in 'range'
+		 */
+		ItemView
+		items(
+			const ItemRange &range);
+
+		/**
+		 * @return
+		 * Iterator at the record's first item. Same as items().begin().
+		 */
+		ItemIterator
+		begin();
+
+		/**
+		 * @return
+		 * Iterator one past the record's last item
+		 */
+		ItemIterator
+		end();
+
+		/**
+		 * Reads the record's summary again, to pick up the items a Writer
+		 * has stored since the Reader was opened. Writers publish their
+		 * progress at every checkpoint; see WriterOptions::checkpoint_interval.
+		 *
+		 * In mmap mode the record is mapped again if it grew, which makes
+		 * the data returned by earlier get_raw() calls invalid.
+		 *
+		 * @return
+		 * True on success, false if the summary couldn't be read or the
+		 * record has fewer items than before (it was overwritten)
+		 */
+		bool
+		refresh();
+
+		/**
+		 * Waits until there's a next item to read, which is how records that
+		 * are still being written are tailed. The record's index file is
+		 * watched with inotify, or polled every millisecond if that isn't
+		 * available.
+		 *
+		 * while (running)
+		 * {
+		 *    if (reader.follow(std::chrono::seconds(1)))
+		 *    {
+		 *       while (reader.take_next(msg)) { ... }
+		 *    }
+		 * }
+		 *
+		 * @param[in] timeout
+		 * The longest time to wait for
+		 *
+		 * @return
+		 * True if there's a next item to read, false if the timeout passed
+		 * first or the record couldn't be refreshed
+		 */
+		bool
+		follow(
+			std::chrono::microseconds timeout);
+
 		/**
 		 * @return
 		 * The number of items that can be read from the record
@@ -106,6 +606,30 @@ namespace protorecord
 		bool
 		has_timestamps();
 
+		/**
+		 * @return
+		 * True if the record's HAS_DROPPED_ITEMS flag is set, meaning the
+		 * Writer had to discard items that were sent to it.
+		 */
+		bool
+		has_dropped_items();
+
+		/**
+		 * @return
+		 * The number of items the Writer had to drop. Records made with a
+		 * v1 index don't store this count, so 0 is returned for them even
+		 * if has_dropped_items() is true.
+		 */
+		size_t
+		dropped();
+
+		/**
+		 * @return
+		 * True if the record's items are stored in compressed blocks
+		 */
+		bool
+		has_compressed_blocks();
+
 		/**
 		 * @param[out] start_time_us
 		 * The records start time in microseconds
@@ -127,6 +651,163 @@ namespace protorecord
 		protorecord::Version
 		get_version();
 
+		/**
+		 * @return
+		 * The full name of the recorded message type, e.g.
+		 * "mypackage.MyMessage", or an empty string if the Writer didn't
+		 * store the record's schema
+		 */
+		std::string
+		message_type();
+
+		/**
+		 * Builds the recorded message type out of the schema stored in the
+		 * record, so that the record can be read without the type's
+		 * generated code. The descriptor is owned by the Reader.
+		 *
+		 * @return
+		 * The recorded message type, or nullptr if the record has no
+		 * schema or it's invalid
+		 */
+		const google::protobuf::Descriptor *
+		message_descriptor();
+
+		/**
+		 * Creates an empty message of the recorded type, which items can be
+		 * read into with get_next(), take_next(), get() etc. like any other
+		 * message. The message must not outlive the Reader.
+		 *
+		 * @return
+		 * A new DynamicMessage, or nullptr if the record has no schema
+		 */
+		std::unique_ptr<google::protobuf::Message>
+		new_message();
+
+		/**
+		 * @return
+		 * True if the Writer stored a key index in the record (see
+		 * WriterOptions::key_field), false otherwise
+		 */
+		bool
+		has_key_index();
+
+		/**
+		 * Finds every item with an integer key in the record's key index.
+		 * The keys are binary searched, so this takes O(log n + k) for n
+		 * distinct keys and k matching items.
+		 *
+		 * @param[in] key
+		 * The key to look up. Negative keys never match unsigned ones.
+		 *
+		 * @param[out] items
+		 * The indices of the items with the key in ascending order, e.g.
+		 * for get(). Empty if no item has the key.
+		 *
+		 * @return
+		 * True on success, false if the record has no key index, or its keys
+		 * aren't integers
+		 */
+		bool
+		lookup(
+			int64_t key,
+			std::vector<uint64_t> &items);
+
+		/**
+		 * Finds every item with a string or bytes key in the record's key
+		 * index, including keys made by a WriterOptions::key_extractor
+		 *
+		 * @param[in] key
+		 * The key to look up
+		 *
+		 * @param[out] items
+		 * The indices of the items with the key in ascending order. Empty if
+		 * no item has the key.
+		 *
+		 * @return
+		 * True on success, false if the record has no key index, or its keys
+		 * are integers
+		 */
+		bool
+		lookup(
+			const std::string &key,
+			std::vector<uint64_t> &items);
+
+		/**
+		 * @return
+		 * True if the Writer stored Bloom filters over the record's keys
+		 * (see WriterOptions::key_filter_bits), false otherwise
+		 */
+		bool
+		has_key_filters();
+
+		/**
+		 * Checks the record's Bloom filters for an integer key, without
+		 * touching the key index or any items. Cheap enough to rule out
+		 * thousands of records in well under a second.
+		 *
+		 * @param[in] key
+		 * The key to check for
+		 *
+		 * @return
+		 * False if no item in the record has the key. True if some item
+		 * might, or the record has no key filters to tell.
+		 */
+		bool
+		might_contain(
+			int64_t key);
+
+		/**
+		 * Checks the record's Bloom filters for a string or bytes key
+		 *
+		 * @param[in] key
+		 * The key to check for
+		 *
+		 * @return
+		 * False if no item in the record has the key. True if some item
+		 * might, or the record has no key filters to tell.
+		 */
+		bool
+		might_contain(
+			const std::string &key);
+
+		/**
+		 * Finds the ranges of items that might hold an integer key, by
+		 * checking the Bloom filter of each range (see
+		 * WriterOptions::key_filter_items)
+		 *
+		 * @param[in] key
+		 * The key to check for
+		 *
+		 * @param[out] ranges
+		 * The ranges of items that might hold the key, in ascending order.
+		 * Empty if none do.
+		 *
+		 * @return
+		 * True on success, false if the record has no key filters
+		 */
+		bool
+		key_ranges(
+			int64_t key,
+			std::vector<ItemRange> &ranges);
+
+		/**
+		 * Finds the ranges of items that might hold a string or bytes key
+		 *
+		 * @param[in] key
+		 * The key to check for
+		 *
+		 * @param[out] ranges
+		 * The ranges of items that might hold the key, in ascending order.
+		 * Empty if none do.
+		 *
+		 * @return
+		 * True on success, false if the record has no key filters
+		 */
+		bool
+		key_ranges(
+			const std::string &key,
+			std::vector<ItemRange> &ranges);
+
 		/**
 		 * @return
 		 * A string explaining the failure reason for a previously called
@@ -154,6 +835,37 @@ namespace protorecord
 		init_record(
 			const std::string &filepath);
 
+		/**
+		 * Reads the IndexSummary from the index file
+		 *
+		 * @param[out] summary
+		 * The parsed summary
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		read_summary(
+			protorecord::IndexSummary &summary);
+
+		/**
+		 * Starts watching the index file for modifications with inotify,
+		 * unless it's being watched already. Falls back to polling if
+		 * inotify isn't available.
+		 */
+		void
+		watch_index();
+
+		/**
+		 * Blocks until the index file is modified, or a timeout passes
+		 *
+		 * @param[in] timeout
+		 * The longest time to wait for
+		 */
+		void
+		wait_for_change(
+			std::chrono::microseconds timeout);
+
 		/**
 		 * Closes all opened file descriptors. This method is automatically
 		 * called by class's destructor.
@@ -164,21 +876,21 @@ namespace protorecord
 		/**
 		 * @return
 		 * True if record's version number is compatible with this version of
-		 * Reader class.
+		 * Reader class. Records from protorecord 0.2.0 onward are supported.
 		 */
 		bool
 		is_compatible(
 			const Version &record_version);
 
 		/**
-		 * Parse the next index item from the index_file_ and places the
-		 * result in the classes index_item_ member
+		 * Reads an item's entry from the index_file_. Both v1 and v2 index
+		 * formats are supported.
 		 *
 		 * @param[in] item_idx
 		 * The index item to read from the index_file
 		 *
 		 * @param[out] item_out
-		 * The parsed IndexItem
+		 * The parsed entry
 		 *
 		 * @return
 		 * True if index_item was parsed successfully, false otherwise
@@ -186,7 +898,283 @@ namespace protorecord
 		bool
 		get_index_item(
 			uint64_t item_idx,
-			protorecord::IndexItem &item_out);
+			IndexEntry &item_out);
+
+		/**
+		 * Reads the index entries of consecutive items with as few reads
+		 * as possible. v2 entries are read in one go.
+		 *
+		 * @param[in] first_idx
+		 * The index of the first item
+		 *
+		 * @param[in] count
+		 * The number of items
+		 *
+		 * @param[out] entries
+		 * The parsed entries
+		 *
+		 * @return
+		 * True if every entry was parsed successfully, false otherwise
+		 */
+		bool
+		get_index_items(
+			uint64_t first_idx,
+			size_t count,
+			std::vector<IndexEntry> &entries);
+
+		/**
+		 * Reads the data of a batch of items in one go, if they are all in
+		 * the same uncompressed data file and stored in order.
+		 *
+		 * @param[in] entries
+		 * The items' index entries
+		 *
+		 * @param[out] batch_data
+		 * Set to point at the first item's data, or to nullptr if the items
+		 * need to be read one at a time. Only valid until the next read.
+		 *
+		 * @return
+		 * True on success, false if the read failed
+		 */
+		bool
+		read_batch_data(
+			const std::vector<IndexEntry> &entries,
+			const char *&batch_data);
+
+		/**
+		 * Binary searches the index for the first item with a timestamp at
+		 * or after 'timestamp_us'. Relies on the Writer storing timestamps
+		 * that never decrease.
+		 *
+		 * @param[in] timestamp_us
+		 * The timestamp to search for
+		 *
+		 * @param[out] item_idx
+		 * The found item's index, or size() if there isn't one
+		 *
+		 * @return
+		 * True on success, false if the record has no timestamps or the
+		 * index couldn't be read
+		 */
+		bool
+		find_time(
+			uint64_t timestamp_us,
+			uint64_t &item_idx);
+
+		/**
+		 * Returns one of the record's data files, opening it first if this
+		 * is the first time it's needed.
+		 *
+		 * @param[in] file_num
+		 * The data file (segment) number
+		 *
+		 * @return
+		 * The opened data file, or nullptr if it couldn't be opened
+		 */
+		InputFile *
+		get_data_file(
+			uint32_t file_num);
+
+		/**
+		 * Returns the memory mapping of one of the record's data files,
+		 * mapping it first if this is the first time it's needed.
+		 *
+		 * @param[in] file_num
+		 * The data file (segment) number
+		 *
+		 * @return
+		 * The mapped data file, or nullptr if it couldn't be mapped
+		 */
+		MappedFile *
+		get_mapped_data_file(
+			uint32_t file_num);
+
+		/**
+		 * Reads a range of bytes from one of the record's data files. In
+		 * mmap mode no data is copied.
+		 *
+		 * @param[in] file_num
+		 * The data file (segment) number
+		 *
+		 * @param[in] offset
+		 * Byte offset of the range within the data file
+		 *
+		 * @param[in] size
+		 * Number of bytes to read
+		 *
+		 * @param[out] data
+		 * Set to point at the bytes. Only valid until the next read.
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		read_data(
+			uint32_t file_num,
+			uint64_t offset,
+			size_t size,
+			const char *&data);
+
+		/**
+		 * Reads a range of bytes from a file that's either memory mapped or
+		 * opened as a stream
+		 *
+		 * @param[in] file
+		 * The opened file. Only used if 'map' is nullptr.
+		 *
+		 * @param[in] map
+		 * The file's mapping, or nullptr if the file isn't mapped
+		 *
+		 * @param[in] offset
+		 * Byte offset of the range within the file
+		 *
+		 * @param[in] size
+		 * Number of bytes to read
+		 *
+		 * @param[out] data
+		 * Set to point at the bytes. Only valid until the next read.
+		 *
+		 * @return
+		 * True on success, false if the range goes past the end of the file
+		 */
+		bool
+		read_bytes(
+			InputFile *file,
+			const MappedFile *map,
+			uint64_t offset,
+			size_t size,
+			const char *&data);
+
+		/**
+		 * Reads an item's serialized data from the record
+		 *
+		 * @param[in] entry
+		 * The item's index entry
+		 *
+		 * @param[out] item_data
+		 * Set to point at the item's data. The pointer is only valid until
+		 * the next item is read.
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		read_item(
+			const IndexEntry &entry,
+			const char *&item_data);
+
+		/**
+		 * Decompresses a block into block_cache_, unless it's already there
+		 *
+		 * @param[in] block_num
+		 * The block's number in the record's block table
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		load_block(
+			uint32_t block_num);
+
+		/**
+		 * Reads an item's index entry for an ItemHandle. Thread safe with
+		 * respect to other handles.
+		 *
+		 * @param[in] item_idx
+		 * The index of the item
+		 *
+		 * @param[out] entry
+		 * The item's entry
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		handle_entry(
+			uint64_t item_idx,
+			IndexEntry &entry);
+
+		/**
+		 * Reads an item's data for an ItemHandle. Thread safe with respect
+		 * to other handles.
+		 *
+		 * @param[in] entry
+		 * The item's index entry
+		 *
+		 * @param[out] item_data
+		 * The item's data. See ItemHandle::raw() for how long it's valid.
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		handle_data(
+			const IndexEntry &entry,
+			std::string_view &item_data);
+
+		/**
+		 * Reads the record's schema file and builds the message type out
+		 * of it. Only done once.
+		 *
+		 * @return
+		 * True if the message type was built, false otherwise
+		 */
+		bool
+		load_schema();
+
+		/**
+		 * Maps the record's key index, if it isn't mapped yet
+		 *
+		 * @return
+		 * True if the key index is mapped, false otherwise
+		 */
+		bool
+		load_key_index();
+
+		/**
+		 * Maps the record's key filters, if they aren't mapped yet
+		 *
+		 * @return
+		 * True if the key filters are mapped, false otherwise
+		 */
+		bool
+		load_key_filter();
+
+		/**
+		 * Encodes an integer key like an index of 'key_type' stores it
+		 *
+		 * @param[in] key_type
+		 * How the index's keys are interpreted
+		 *
+		 * @param[in] key
+		 * The key to encode
+		 *
+		 * @param[out] encoded
+		 * The encoded key
+		 *
+		 * @return
+		 * True if the key was encoded, false if no key of the index can
+		 * ever match it
+		 */
+		bool
+		encode_int_key(
+			KeyType key_type,
+			int64_t key,
+			std::string &encoded);
+
+		/**
+		 * Appends the ranges of items whose key filters let a key pass
+		 *
+		 * @param[in] key
+		 * The key, encoded like the key filters store it
+		 *
+		 * @param[in,out] ranges
+		 * The ranges are appended to this
+		 */
+		void
+		add_key_ranges(
+			std::string_view key,
+			std::vector<ItemRange> &ranges);
 
 		/**
 		 * @param[in] flag
@@ -209,18 +1197,105 @@ namespace protorecord
 		// the parsed IndexSummary
 		protorecord::IndexSummary index_summary_;
 
+		// layout of the record's index file. see PROTORECORD_INDEX_FORMAT_*
+		uint32_t index_format_;
+
+		// byte offset of the first item in the index file
+		uint64_t item_block_offset_;
+
+		// number of bytes between items in the index file
+		uint64_t item_block_stride_;
+
 		// the current parsed index item
-		protorecord::IndexItem index_item_;
+		IndexEntry index_item_;
+
+		// scratch message used to parse v1 index items
+		protorecord::IndexItem v1_index_item_;
+
+		// see ReaderOptions::use_mmap
+		bool use_mmap_;
+
+		// see ReaderOptions::access_pattern
+		AccessPattern access_pattern_;
+
+		// see ReaderOptions::storage_backend
+		StorageBackend storage_backend_;
 
 		// the opened index file
-		std::ifstream index_file_;
+		std::unique_ptr<InputFile> index_file_;
 
-		// the opened data file
-		std::ifstream data_file_;
+		// the memory mapped index file. only used in mmap mode.
+		MappedFile index_map_;
+
+		// the record's filepath
+		std::string record_path_;
+
+		// the record's data files, indexed by file number. they are only
+		// opened once an item in them is read.
+		std::vector<std::unique_ptr<InputFile>> data_files_;
+
+		// the record's memory mapped data files. only used in mmap mode.
+		std::vector<std::unique_ptr<MappedFile>> mapped_data_files_;
+
+		// the block table of a compressed record
+		std::unique_ptr<InputFile> blocks_file_;
+
+		// the memory mapped block table. only used in mmap mode.
+		MappedFile blocks_map_;
+
+		// set to true if the record's items are packed into compressed blocks
+		bool compressed_;
+
+		// the block table entry of the block in block_cache_
+		BlockEntry block_entry_;
+
+		// number of the block that's in block_cache_, or -1 if none is
+		int64_t cached_block_num_;
+
+		// the most recently decompressed block. consecutive items usually
+		// share a block, so it only needs to be decompressed once.
+		std::vector<char> block_cache_;
 
 		// buffer used to deserialize data from files
 		std::vector<char> buffer_;
 
+		// index entries of the batch being read by take_batch()
+		std::vector<IndexEntry> batch_entries_;
+
+		// reads items ahead of get_next(). only set if prefetching is enabled.
+		std::unique_ptr<Prefetcher> prefetcher_;
+
+		// inotify instance watching the index file for follow(). -1 until
+		// follow() is first called, or if inotify isn't available.
+		int inotify_fd_;
+
+		// set to true if follow() has to poll instead of using inotify
+		bool follow_polling_;
+
+		// serializes the reads of ItemHandles used from several threads
+		std::mutex handle_mutex_;
+
+		// the record's stored schema. read on demand by load_schema().
+		protorecord::Schema schema_;
+
+		// set to true once load_schema() was called
+		bool schema_loaded_;
+
+		// the types built from schema_, and the factory of their
+		// DynamicMessages. nullptr if the record has no schema.
+		std::unique_ptr<google::protobuf::DescriptorPool> schema_pool_;
+		std::unique_ptr<google::protobuf::DynamicMessageFactory> schema_factory_;
+
+		// the recorded message type within schema_pool_, and its prototype
+		const google::protobuf::Descriptor *schema_descriptor_;
+		const google::protobuf::Message *schema_prototype_;
+
+		// the record's key index. mapped on demand by load_key_index().
+		std::unique_ptr<KeyIndex> key_index_;
+
+		// the record's key filters. mapped on demand by load_key_filter().
+		std::unique_ptr<KeyFilter> key_filter_;
+
 		// the next item index the class will read from
 		uint64_t next_item_num_;
 
@@ -241,30 +1316,102 @@ namespace protorecord
 		fail_reason_ = "";
 
 		okay = okay && has_next();
-		okay = okay && get_index_item(next_item_num_,index_item_);
 
+		// items that were read ahead only need to be parsed
+		const IndexEntry *entry = nullptr;
+		const char *item_data = nullptr;
+		if (okay && prefetcher_ && prefetcher_->peek(next_item_num_,entry,item_data))
+		{
+			if ( ! pb.ParseFromArray((const void*)item_data,entry->size))
+			{
+				fail_reason_ = "protobuf parse failed";
+				okay = false;
+			}
+		}
+		else
+		{
+			okay = okay && get(next_item_num_,pb);
+		}
+
+		if ( ! okay)
+		{
+			failbit_ = true;
+		}
+
+		return okay;
+	}
+
+	template<class PROTOBUF_T>
+	bool
+	Reader::get(
+		uint64_t item_idx,
+		PROTOBUF_T &pb)
+	{
+		bool okay = initialized_;
+		fail_reason_ = "";
+
+		okay = okay && get_index_item(item_idx,index_item_);
+
+		const char *item_data = nullptr;
+		okay = okay && read_item(index_item_,item_data);
+
+		if (okay && ! pb.ParseFromArray((const void*)item_data,index_item_.size))
+		{
+			fail_reason_ = "protobuf parse failed";
+			okay = false;
+		}
+
+		return okay;
+	}
+
+	template<class PROTOBUF_T>
+	bool
+	Reader::take_batch(
+		size_t n,
+		google::protobuf::Arena &arena,
+		std::vector<PROTOBUF_T*> &batch)
+	{
+		bool okay = initialized_;
+		fail_reason_ = "";
+		batch.clear();
+		arena.Reset();
+
+		okay = okay && has_next();
+		size_t count = 0;
 		if (okay)
 		{
-			// TODO could probably optimize this out
-			data_file_.seekg(index_item_.offset());
+			count = std::min<uint64_t>(n,this->size() - next_item_num_);
+		}
 
-			if (buffer_.size() < index_item_.size())
+		const char *batch_data = nullptr;
+		okay = okay && get_index_items(next_item_num_,count,batch_entries_);
+		okay = okay && read_batch_data(batch_entries_,batch_data);
+
+		for (size_t i=0; okay && i<count; i++)
+		{
+			const IndexEntry &entry = batch_entries_[i];
+			const char *item_data = nullptr;
+			if (batch_data != nullptr)
 			{
-				buffer_.resize(index_item_.size() * 2);
+				item_data = batch_data + (entry.offset - batch_entries_[0].offset);
+			}
+			else
+			{
+				okay = read_item(entry,item_data);
 			}
 
-			data_file_.read(buffer_.data(),index_item_.size());
-			if (data_file_.eof())
+			PROTOBUF_T *pb = google::protobuf::Arena::CreateMessage<PROTOBUF_T>(&arena);
+			if (okay && ! pb->ParseFromArray((const void*)item_data,entry.size))
 			{
-				fail_reason_ = "reached end of data file";
+				fail_reason_ = "protobuf parse failed";
 				okay = false;
 			}
-		}
 
-		if (okay && ! pb.ParseFromArray((void*)buffer_.data(),index_item_.size()))
-		{
-			fail_reason_ = "protobuf parse failed";
-			okay = false;
+			if (okay)
+			{
+				batch.push_back(pb);
+				next_item_num_++;
+			}
 		}
 
 		if ( ! okay)
@@ -283,9 +1430,24 @@ namespace protorecord
 		bool okay = get_next(pb);
 		if (okay)
 		{
+			if (prefetcher_)
+			{
+				prefetcher_->pop(next_item_num_);
+			}
 			next_item_num_++;
 		}
 		return okay;
 	}
 
+	template<class PROTOBUF_T>
+	bool
+	ItemHandle::parse(
+		PROTOBUF_T &pb) const
+	{
+		// only reading is serialized, parsing happens in parallel
+		std::string_view item_data;
+		bool okay = load_entry() && reader_->handle_data(entry_,item_data);
+		return okay && pb.ParseFromArray((const void*)item_data.data(),item_data.size());
+	}
+
 }// protorecord
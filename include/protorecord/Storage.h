@@ -0,0 +1,259 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "protorecord/MappedFile.h"
+
+namespace protorecord
+{
+	/**
+	 * The I/O interfaces that Writers and Readers can access record files
+	 * through
+	 */
+	enum class StorageBackend
+	{
+		// use IO_URING if the running kernel supports it, otherwise POSIX
+		AUTO,
+
+		// buffered blocking I/O with write()/pread()
+		POSIX,
+
+		// asynchronous I/O with Linux's io_uring
+		IO_URING
+	};
+
+	/**
+	 * A file that is written front to back
+	 */
+	class OutputFile
+	{
+	public:
+		virtual
+		~OutputFile() = default;
+
+		/**
+		 * Creates (or truncates) a file for writing
+		 *
+		 * @param[in] filepath
+		 * The file to open
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		virtual
+		bool
+		open(
+			const std::string &filepath) = 0;
+
+		/**
+		 * Appends data to the end of the file. The data may be buffered, or
+		 * still in flight when this returns.
+		 *
+		 * @param[in] data
+		 * The data to append
+		 *
+		 * @param[in] size
+		 * Number of bytes to append
+		 *
+		 * @return
+		 * True on success. False if this or any previous write failed.
+		 */
+		virtual
+		bool
+		append(
+			const void *data,
+			size_t size) = 0;
+
+		/**
+		 * Waits until everything that was appended so far is in the file
+		 *
+		 * @return
+		 * True on success. False if any write failed.
+		 */
+		virtual
+		bool
+		flush() = 0;
+
+		/**
+		 * Hands out memory for the next bytes of the file, so that they can
+		 * be written in place instead of being copied in by append(). Must
+		 * be followed by a commit().
+		 *
+		 * @param[in] size
+		 * Number of bytes to reserve
+		 *
+		 * @return
+		 * Where to write the bytes, or nullptr if the file can't hand out
+		 * memory for them. Use append() in that case.
+		 */
+		virtual
+		char *
+		reserve(
+			size_t /*size*/)
+		{
+			return nullptr;
+		}
+
+		/**
+		 * Appends the bytes that were written to the memory from reserve()
+		 *
+		 * @param[in] size
+		 * Number of bytes to append. At most what was reserved.
+		 */
+		virtual
+		void
+		commit(
+			size_t /*size*/)
+		{
+		}
+
+		/**
+		 * Flushes and closes the file
+		 */
+		virtual
+		void
+		close() = 0;
+	};
+
+	/**
+	 * A file that is read at arbitrary offsets
+	 */
+	class InputFile
+	{
+	public:
+		virtual
+		~InputFile() = default;
+
+		/**
+		 * Opens a file for reading
+		 *
+		 * @param[in] filepath
+		 * The file to open
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		virtual
+		bool
+		open(
+			const std::string &filepath) = 0;
+
+		/**
+		 * Reads a range of bytes from the file
+		 *
+		 * @param[in] offset
+		 * Byte offset of the range within the file
+		 *
+		 * @param[in] size
+		 * Number of bytes to read
+		 *
+		 * @param[out] dst
+		 * Where to store the bytes. Must be at least 'size' bytes long.
+		 *
+		 * @return
+		 * True on success, false if the range goes past the end of the file
+		 * or the read failed
+		 */
+		virtual
+		bool
+		read(
+			uint64_t offset,
+			size_t size,
+			char *dst) = 0;
+
+		/**
+		 * Forgets anything read from the file so far, so that the next
+		 * reads see its current contents. Needed when another process is
+		 * still writing to the file.
+		 */
+		virtual
+		void
+		invalidate()
+		{
+		}
+
+		/**
+		 * Closes the file
+		 */
+		virtual
+		void
+		close() = 0;
+	};
+
+	/**
+	 * @param[in] backend
+	 * The backend to check for
+	 *
+	 * @return
+	 * True if the backend can be used on this system. The io_uring backend
+	 * is probed at runtime, since it can be disabled in the kernel.
+	 */
+	bool
+	storage_backend_available(
+		StorageBackend backend);
+
+	/**
+	 * How an OutputFile gets its data into the file
+	 */
+	enum class WriteMode
+	{
+		// through the page cache with the chosen StorageBackend
+		BUFFERED,
+
+		// around the page cache with O_DIRECT
+		DIRECT,
+
+		// straight into a shared memory mapping of the file
+		MAPPED
+	};
+
+	// O_DIRECT needs buffers, offsets and sizes aligned to the device's
+	// logical block size. 4KiB covers every common device.
+	const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+	/**
+	 * Creates an OutputFile that uses the requested backend
+	 *
+	 * @param[in] backend
+	 * The backend to use. Falls back to POSIX if it's unavailable.
+	 *
+	 * @param[in] mode
+	 * How the file is written. 'backend' only applies to BUFFERED mode.
+	 *
+	 * @param[in] preallocate_extent
+	 * Number of bytes to preallocate at a time for DIRECT and MAPPED files.
+	 * 0 disables preallocation of DIRECT files, and picks a default for
+	 * MAPPED ones, which always need to grow the file ahead of the data.
+	 *
+	 * @return
+	 * The unopened file
+	 */
+	std::unique_ptr<OutputFile>
+	make_output_file(
+		StorageBackend backend,
+		WriteMode mode = WriteMode::BUFFERED,
+		uint64_t preallocate_extent = 0);
+
+	/**
+	 * Creates an InputFile that uses the requested backend
+	 *
+	 * @param[in] backend
+	 * The backend to use. Falls back to POSIX if it's unavailable.
+	 *
+	 * @param[in] pattern
+	 * How the file is going to be read. Read-ahead is only done for
+	 * NORMAL and SEQUENTIAL access. RANDOM access always uses POSIX, even
+	 * if IO_URING is requested, as UringInputFile only speeds up read-ahead.
+	 *
+	 * @return
+	 * The unopened file
+	 */
+	std::unique_ptr<InputFile>
+	make_input_file(
+		StorageBackend backend,
+		AccessPattern pattern);
+
+}// protorecord
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "protorecord/Storage.h"
+
+namespace protorecord
+{
+	/**
+	 * A minimal io_uring instance that is driven with the raw system calls
+	 */
+	class IoUring
+	{
+	public:
+		// constructors/destructors
+		IoUring();
+
+		~IoUring();
+
+		IoUring(
+			const IoUring &) = delete;
+
+		IoUring &
+		operator=(
+			const IoUring &) = delete;
+
+		// public methods
+
+		/**
+		 * Creates the ring and maps its queues into memory
+		 *
+		 * @param[in] entries
+		 * Number of submission queue entries
+		 *
+		 * @return
+		 * True on success, false if io_uring is unavailable
+		 */
+		bool
+		init(
+			unsigned int entries);
+
+		/**
+		 * Unmaps the queues and closes the ring
+		 */
+		void
+		destroy();
+
+		/**
+		 * @return
+		 * True if init() succeeded
+		 */
+		bool
+		is_ready() const;
+
+		/**
+		 * Registers buffers for use with the *_FIXED operations
+		 *
+		 * @param[in] iovecs
+		 * The buffers to register
+		 *
+		 * @param[in] count
+		 * Number of buffers
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		register_buffers(
+			const struct iovec *iovecs,
+			unsigned int count);
+
+		/**
+		 * Asks the kernel which operations it supports. Rings can be
+		 * created since Linux 5.1, but IORING_OP_READ and IORING_OP_WRITE
+		 * only exist since 5.6.
+		 *
+		 * @param[in] opcode
+		 * The IORING_OP_* to check for
+		 *
+		 * @return
+		 * True if the kernel supports the operation, false if it doesn't or
+		 * can't be asked
+		 */
+		bool
+		supports_op(
+			unsigned int opcode);
+
+		/**
+		 * @return
+		 * A zeroed submission queue entry, or nullptr if the submission
+		 * queue is full
+		 */
+		struct io_uring_sqe *
+		get_sqe();
+
+		/**
+		 * Submits the queued entries to the kernel
+		 *
+		 * @param[in] wait_nr
+		 * Number of completions to wait for
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		submit(
+			unsigned int wait_nr = 0);
+
+		/**
+		 * Waits for the next completion
+		 *
+		 * @return
+		 * The completion queue entry, or nullptr on error. Must be released
+		 * with cqe_seen().
+		 */
+		struct io_uring_cqe *
+		wait_cqe();
+
+		/**
+		 * Releases the completion returned by wait_cqe()
+		 */
+		void
+		cqe_seen();
+
+		/**
+		 * Probes whether io_uring can be used on this system
+		 *
+		 * @return
+		 * True if a ring can be created, and the kernel supports every
+		 * operation the io_uring files submit
+		 */
+		static
+		bool
+		supported();
+
+	private:
+		int ring_fd_;
+
+		void *sq_ptr_;
+		size_t sq_ring_size_;
+		void *cq_ptr_;
+		size_t cq_ring_size_;
+		struct io_uring_sqe *sqes_;
+		size_t sqes_size_;
+
+		unsigned int *sq_head_;
+		unsigned int *sq_tail_;
+		unsigned int *sq_mask_;
+		unsigned int *sq_array_;
+		unsigned int sq_entries_;
+
+		unsigned int *cq_head_;
+		unsigned int *cq_tail_;
+		unsigned int *cq_mask_;
+		struct io_uring_cqe *cqes_;
+
+		// tail of the entries handed out by get_sqe()
+		unsigned int sqe_tail_;
+
+		// tail of the entries handed to the kernel
+		unsigned int sqe_submitted_;
+
+	};
+
+	/**
+	 * An OutputFile that writes asynchronously with io_uring. Appends are
+	 * copied into a set of registered buffers; each full buffer is submitted
+	 * as a fixed-buffer write, and is recycled once its write completes.
+	 */
+	class UringOutputFile : public OutputFile
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] buffer_size
+		 * Size of each write buffer
+		 *
+		 * @param[in] num_buffers
+		 * Number of buffers, which also limits the writes in flight
+		 */
+		UringOutputFile(
+			size_t buffer_size,
+			unsigned int num_buffers);
+
+		~UringOutputFile() override;
+
+		bool
+		open(
+			const std::string &filepath) override;
+
+		bool
+		append(
+			const void *data,
+			size_t size) override;
+
+		bool
+		flush() override;
+
+		/**
+		 * Hands out the free end of the current buffer, submitting it first
+		 * if there isn't enough room left in it
+		 */
+		char *
+		reserve(
+			size_t size) override;
+
+		void
+		commit(
+			size_t size) override;
+
+		void
+		close() override;
+
+	private:
+		struct Buffer
+		{
+			std::vector<char> data;
+
+			// number of bytes used in data
+			size_t used = 0;
+
+			// file offset the buffer is written to
+			uint64_t offset = 0;
+
+			// true while a write of the buffer is in flight
+			bool in_flight = false;
+		};
+
+		/**
+		 * Submits the current buffer, and makes the next buffer current
+		 */
+		bool
+		submit_current();
+
+		/**
+		 * Waits for one write to complete, and recycles its buffer
+		 */
+		bool
+		reap_one();
+
+		IoUring ring_;
+
+		// the opened file. -1 if no file is open.
+		int fd_;
+
+		std::vector<Buffer> buffers_;
+
+		// true if buffers_ were registered with the ring
+		bool registered_;
+
+		// index of the buffer that appends go to
+		size_t current_;
+
+		// file offset of the next submitted write
+		uint64_t file_offset_;
+
+		// number of writes in flight
+		unsigned int in_flight_;
+
+		// set to true once a write fails
+		bool failed_;
+
+	};
+
+	/**
+	 * An InputFile that reads with io_uring. The file is read in chunks, and
+	 * for NORMAL/SEQUENTIAL access the following chunks are kept in flight
+	 * while the current one is consumed. A chunk's buffer is reused for
+	 * read-ahead once its read completes and the reader has moved past it.
+	 */
+	class UringInputFile : public InputFile
+	{
+	public:
+		/**
+		 * Constructor
+		 *
+		 * @param[in] chunk_size
+		 * Number of bytes per read
+		 *
+		 * @param[in] num_chunks
+		 * Number of chunk buffers, which also limits the reads in flight
+		 */
+		UringInputFile(
+			size_t chunk_size,
+			unsigned int num_chunks);
+
+		~UringInputFile() override;
+
+		bool
+		open(
+			const std::string &filepath) override;
+
+		bool
+		read(
+			uint64_t offset,
+			size_t size,
+			char *dst) override;
+
+		void
+		invalidate() override;
+
+		void
+		close() override;
+
+	private:
+		enum class ChunkState
+		{
+			EMPTY,
+			IN_FLIGHT,
+			READY
+		};
+
+		struct Chunk
+		{
+			std::vector<char> data;
+
+			// which chunk of the file is held
+			uint64_t number = 0;
+
+			// number of valid bytes in data
+			size_t used = 0;
+
+			ChunkState state = ChunkState::EMPTY;
+		};
+
+		/**
+		 * Makes sure the chunk and the ones after it are read or being read
+		 *
+		 * @param[in] number
+		 * The chunk that's needed next
+		 */
+		bool
+		read_ahead(
+			uint64_t number);
+
+		/**
+		 * Waits for one read to complete
+		 */
+		bool
+		reap_one();
+
+		/**
+		 * @return
+		 * The ready chunk, or nullptr on failure
+		 */
+		Chunk *
+		get_chunk(
+			uint64_t number);
+
+		/**
+		 * Updates file_size_ with the file's current size
+		 */
+		bool
+		update_file_size();
+
+		IoUring ring_;
+
+		// the opened file. -1 if no file is open.
+		int fd_;
+
+		// size of the file when it was last checked
+		uint64_t file_size_;
+
+		size_t chunk_size_;
+
+		std::vector<Chunk> chunks_;
+
+		// the chunk the last read was served from
+		Chunk *current_;
+
+		// number of reads in flight
+		unsigned int in_flight_;
+
+	};
+
+}// protorecord
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <iomanip>
 #include <sstream>
 
 #include "Protorecord.pb.h"
@@ -72,6 +73,32 @@ namespace protorecord
 		return v;
 	}
 
+	/**
+	 * @param[in] record_path
+	 * The record's directory
+	 *
+	 * @param[in] file_num
+	 * The data file (segment) number
+	 *
+	 * @return
+	 * Path to one of the record's data files. The first file is named
+	 * "data", and the ones after it are "data.0001", "data.0002", ...
+	 */
+	inline
+	std::string
+	data_file_path(
+		const std::string &record_path,
+		uint32_t file_num)
+	{
+		std::stringstream ss;
+		ss << record_path << "/data";
+		if (file_num > 0)
+		{
+			ss << "." << std::setw(4) << std::setfill('0') << file_num;
+		}
+		return ss.str();
+	}
+
 	/**
 	 * @return
 	 * the system clock time in microseconds
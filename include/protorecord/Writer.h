@@ -1,16 +1,165 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <google/protobuf/descriptor.h>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <fstream>
+#include <thread>
 #include <vector>
 
+#include "protorecord/BlockCompressor.h"
+#include "protorecord/Compression.h"
 #include "protorecord/Constants.h"
+#include "protorecord/Index.h"
+#include "protorecord/ItemQueue.h"
+#include "protorecord/KeyIndex.h"
+#include "protorecord/LiveChannel.h"
+#include "protorecord/Storage.h"
 #include "protorecord/Utils.h"
 
 namespace protorecord
 {
+	/**
+	 * Settings that control how a Writer stores its record
+	 */
+	struct WriterOptions
+	{
+		// set to true if you want to store a UTC timestamp for each
+		// recorded sample. storing timestamps will increase the size
+		// of the index file.
+		bool enable_timestamping = false;
+
+		// set to true to move all file I/O onto a background thread.
+		// write() will only serialize the item into a queue and return.
+		// an async Writer can be written to from multiple threads.
+		bool async = false;
+
+		// the number of items the async queue can hold
+		size_t async_queue_depth = 4096;
+
+		// number of bytes preallocated for each item in the async queue.
+		// slots grow on demand if an item doesn't fit.
+		size_t async_slot_size = 256;
+
+		// number of bytes preallocated for serializing items that can't be
+		// serialized straight into the data file. write() grows the buffer,
+		// which allocates, the first time it sees an item larger than this.
+		size_t max_item_size = 64000;
+
+		// what write() should do when the async queue is full
+		FullQueuePolicy full_queue_policy = FullQueuePolicy::BLOCK;
+
+		// number of bytes of index entries to buffer in memory before
+		// appending them to the index file. every time the buffer is
+		// written out the record is checkpointed, meaning the summary on
+		// disk is updated to cover all items written so far.
+		size_t index_buffer_size = 1024 * 1024;
+
+		// start a new data file once the current one would grow past this
+		// many bytes. 0 means there is no size limit.
+		uint64_t segment_max_bytes = 0;
+
+		// start a new data file once the current one has been open for
+		// this long. 0 means there is no time limit.
+		std::chrono::microseconds segment_max_duration = std::chrono::microseconds(0);
+
+		// checkpoint the record once this much time has passed since the
+		// last checkpoint, so that Readers tailing the record with
+		// Reader::follow() see new items quickly. in async mode this is
+		// also done while the Writer is idle; otherwise it's done by the
+		// next write. 0 only checkpoints when the index buffer is full.
+		std::chrono::microseconds checkpoint_interval = std::chrono::microseconds(0);
+
+		// codec used to compress the item data. Codec::NONE stores items
+		// uncompressed. codec_available() tells which codecs this build of
+		// the library supports.
+		Codec compression = Codec::NONE;
+
+		// items are packed into blocks of about this many bytes, and each
+		// block is compressed on its own
+		size_t compression_block_size = 256 * 1024;
+
+		// number of threads that compress blocks in the background. 0 means
+		// blocks are compressed by the thread that writes the record.
+		size_t compression_threads = 2;
+
+		// how the data files are written. AUTO uses io_uring when the
+		// kernel supports it, and falls back to POSIX I/O otherwise.
+		StorageBackend storage_backend = StorageBackend::AUTO;
+
+		// set to true to write the data files with O_DIRECT, so that long
+		// recordings don't fill up the page cache and trigger writeback
+		// stalls. storage_backend is ignored in this mode.
+		bool direct_io = false;
+
+		// set to true to grow the data and index files in large extents
+		// and memory map them. items are then serialized straight into the
+		// mapping, skipping the copies and write syscalls. can't be combined
+		// with direct_io.
+		bool use_mmap = false;
+
+		// in direct_io and use_mmap modes, data files are preallocated this
+		// many bytes at a time. 0 disables preallocation for direct_io.
+		uint64_t preallocate_extent = 64 * 1024 * 1024;
+
+		// name of a shared memory channel to publish every item into as it
+		// is written, for LiveReaders in other threads or processes. an
+		// empty name disables the channel.
+		std::string live_channel = "";
+
+		// size of the live channel's ring buffer in bytes. LiveReaders that
+		// fall this far behind skip ahead and miss items.
+		size_t live_channel_size = 16 * 1024 * 1024;
+
+		// name or path of a scalar field to build a key index on, e.g.
+		// "sensor_id" or "header.source". the index maps every value of the
+		// field to the items that have it, and is stored when the record is
+		// closed. see Reader::lookup(). an empty name disables the index.
+		std::string key_field = "";
+
+		// extracts the items' keys instead of key_field, for keys that
+		// aren't a single field. called once per item by the thread that
+		// writes the record.
+		KeyExtractor key_extractor;
+
+		// bits per key of the Bloom filters stored along with the key index.
+		// they let Readers rule out records, or ranges of items, that can't
+		// hold a key by touching only a few cache lines. 10 bits give about
+		// 1% false positives. 0 stores no filters.
+		size_t key_filter_bits = 10;
+
+		// number of consecutive items each Bloom filter covers
+		uint64_t key_filter_items = 64 * 1024;
+	};
+
+	/**
+	 * An externally serialized item that's passed to Writer::write_batch()
+	 */
+	struct ItemSpan
+	{
+		// pointer to the serialized item
+		const void *data;
+
+		// size of the item in bytes
+		uint32_t size;
+	};
+
+	/**
+	 * How the items in a batch are timestamped
+	 */
+	enum class BatchTimestamp
+	{
+		// every item in the batch gets the time the batch was written
+		PER_BATCH,
+
+		// every item gets its own timestamp as it's serialized
+		PER_ITEM
+	};
+
 	class Writer
 	{
 	public:
@@ -43,6 +192,19 @@ namespace protorecord
 			const std::string &filepath,
 			bool enable_timestamping);
 
+		/**
+		 * Constructor
+		 *
+		 * @param[in] filepath
+		 * The absolute or relative filepath to store the record.
+		 *
+		 * @param[in] options
+		 * Settings that control how the record is stored
+		 */
+		Writer(
+			const std::string &filepath,
+			const WriterOptions &options);
+
 		/**
 		 * Destructor
 		 */
@@ -69,7 +231,27 @@ namespace protorecord
 			bool enable_timestamping = false);
 
 		/**
-		 * Write a protobuf message to the record
+		 * Opens a record for writing
+		 *
+		 * @param[in] filepath
+		 * Path to save record to
+		 *
+		 * @param[in] options
+		 * Settings that control how the record is stored
+		 *
+		 * @return
+		 * True if the Writer was successfully initialized, false if the
+		 * record creation failed, or if the Writer was already opened.
+		 */
+		bool
+		open(
+			const std::string &filepath,
+			const WriterOptions &options);
+
+		/**
+		 * Write a protobuf message to the record. If the Writer was opened
+		 * in async mode, this method may be called from several threads at
+		 * once. Items from the same thread are recorded in call order.
 		 *
 		 * @param[in] pb
 		 * The google::protobuf message to write
@@ -88,7 +270,8 @@ namespace protorecord
 		 * properly serialized the protobuf message to the buffer. This
 		 * method is provided for performance purposes because it skips
 		 * the process of serialization and just write the binary data
-		 * to the record.
+		 * to the record. Like write(), this method is thread safe when the
+		 * Writer was opened in async mode.
 		 *
 		 * @param[in] msg_data
 		 * Pointer to the serialized data buffer to write to disk
@@ -107,12 +290,93 @@ namespace protorecord
 			uint32_t msg_data_size);
 
 		/**
+		 * Writes a batch of protobuf messages to the record. In synchronous
+		 * mode the messages are serialized into one contiguous buffer which
+		 * is appended to the data file with a single write.
+		 *
+		 * @param[in] first
+		 * Iterator to the first message in the batch
+		 *
+		 * @param[in] last
+		 * Iterator one past the last message in the batch
+		 *
+		 * @param[in] timestamping
+		 * How the items should be timestamped. Ignored if timestamping is
+		 * disabled.
+		 *
 		 * @return
-		 * The number of items that have been written thus far
+		 * True if every message was written successfully, false otherwise
+		 */
+		template<class ITER_T>
+		bool
+		write_batch(
+			ITER_T first,
+			ITER_T last,
+			BatchTimestamp timestamping = BatchTimestamp::PER_BATCH);
+
+		/**
+		 * Writes a batch of externally serialized protobuf messages to the
+		 * record. See write_assumed().
+		 *
+		 * @param[in] items
+		 * The serialized items
+		 *
+		 * @param[in] num_items
+		 * The number of items in 'items'
+		 *
+		 * @param[in] timestamping
+		 * How the items should be timestamped. Ignored if timestamping is
+		 * disabled.
+		 *
+		 * @return
+		 * True if every item was written successfully, false otherwise. The
+		 * HAS_ASSUMED_DATA flag is set once items are written.
+		 */
+		bool
+		write_batch(
+			const ItemSpan *items,
+			size_t num_items,
+			BatchTimestamp timestamping = BatchTimestamp::PER_BATCH);
+
+		/**
+		 * Stores the recorded message type, along with the .proto files it's
+		 * declared in, so that the record can be read without the type's
+		 * generated code (see Reader::message_descriptor()). write() and
+		 * write_batch() store the type of the first message they're given,
+		 * so this only needs to be called for records made with
+		 * write_assumed(). Only the first call has an effect.
+		 * WriterOptions::key_field is looked up in this type, so items are
+		 * only indexed by it once the schema is stored. Items that an async
+		 * Writer still had queued at the time may or may not be indexed.
+		 *
+		 * @param[in] descriptor
+		 * The recorded message type, e.g. MyMessage::descriptor()
+		 *
+		 * @return
+		 * True if the schema is stored, false otherwise. Also false if the
+		 * key field can't be indexed.
+		 */
+		bool
+		store_schema(
+			const google::protobuf::Descriptor *descriptor);
+
+		/**
+		 * @return
+		 * The number of items that have been written thus far. In async
+		 * mode this includes items that are still waiting in the queue.
 		 */
 		size_t
 		size();
 
+		/**
+		 * @return
+		 * The number of items that were discarded because the async queue
+		 * was full. Always zero unless an async Writer is configured with
+		 * one of the FullQueuePolicy::DROP_* policies.
+		 */
+		size_t
+		dropped();
+
 		/**
 		 * Stores the finalized index to disk and closes all opened
 		 * file descriptors. This method is automatically called by
@@ -157,22 +421,100 @@ namespace protorecord
 			bool allow_overwrite);
 
 		/**
-		 * Will store the current IndexSummary to disk
+		 * Will store the current IndexSummary to disk at
+		 * SUMMARY_BLOCK_OFFSET. The summary is patched in place with
+		 * pwrite(), so the index file's append position isn't disturbed.
 		 *
-		 * @param[in] pos
-		 * The location in the index file to store the summary
+		 * @return
+		 * True if the summary was stored succesfully, false otherwise
+		 */
+		bool
+		store_summary();
+
+		/**
+		 * Flushes buffered data and index entries to disk, then updates the
+		 * summary so that it covers every item written so far.
 		 *
-		 * @param[in] restore_pos
-		 * If set to true, the index_file_ position will be restored
-		 * back to where it was when this method was called.
+		 * @return
+		 * True on success. On failure the RECORD_WRITE_ERROR flag is set.
+		 */
+		bool
+		checkpoint();
+
+		/**
+		 * Checkpoints the record if items were stored since the last
+		 * checkpoint, and WriterOptions::checkpoint_interval has passed
 		 *
 		 * @return
-		 * True if the summary was stored succesfully, false otherwise
+		 * True on success, or if no checkpoint was needed
 		 */
 		bool
-		store_summary(
-			std::streampos pos,
-			bool restore_pos);
+		checkpoint_if_due();
+
+		/**
+		 * Serializes a message into a fixed size index block. Index blocks
+		 * hold a single size byte, the message, then zero padding.
+		 *
+		 * @param[in] msg
+		 * The message to serialize
+		 *
+		 * @param[out] block
+		 * Where to serialize the block to
+		 *
+		 * @param[in] block_size
+		 * The size of the block in bytes
+		 *
+		 * @return
+		 * True on success, false if the message doesn't fit in the block
+		 */
+		bool
+		serialize_index_block(
+			const google::protobuf::MessageLite &msg,
+			char *block,
+			size_t block_size);
+
+		/**
+		 * Appends a message to the end of the index as a fixed size index
+		 * block. The block is buffered in memory, and the index buffer is
+		 * flushed (via checkpoint()) if it is full.
+		 *
+		 * @param[in] msg
+		 * The message to append
+		 *
+		 * @param[in] block_size
+		 * The size of the block in bytes
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		append_index_block(
+			const google::protobuf::MessageLite &msg,
+			size_t block_size);
+
+		/**
+		 * Appends an item's entry to the end of the index. The entry is
+		 * buffered in memory, and the index buffer is flushed (via
+		 * checkpoint()) if it is full.
+		 *
+		 * @param[in] entry
+		 * The entry to append
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		append_index_entry(
+			const IndexEntry &entry);
+
+		/**
+		 * Appends everything in the index buffer to the index file
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		flush_index();
 
 		/**
 		 * Methods used to append the serialized item's data to the record
@@ -189,7 +531,8 @@ namespace protorecord
 		 *
 		 * @return
 		 * True if the item was written successfully, if so the class's
-		 * total_item_count_ is incremented.
+		 * total_item_count_ is incremented. If the write fails, the record's
+		 * RECORD_WRITE_ERROR flag is set.
 		 */
 		bool
 		write_item_data(
@@ -197,6 +540,265 @@ namespace protorecord
 			uint32_t item_data_size,
 			const std::chrono::microseconds &timestamp);
 
+		/**
+		 * Appends a batch of serialized items that are laid out back to back
+		 * in memory. If the batch fits in the current data file, it's written
+		 * with a single call, otherwise it falls back to write_item_data().
+		 *
+		 * @param[in] batch_data
+		 * The items' data
+		 *
+		 * @param[in] item_sizes
+		 * The size of each item in the batch
+		 *
+		 * @param[in] timestamps
+		 * Either one timestamp per item, or a single timestamp shared by the
+		 * whole batch. Ignored if timestamping is disabled.
+		 *
+		 * @return
+		 * True if every item was written successfully. If a write fails, the
+		 * record's RECORD_WRITE_ERROR flag is set.
+		 */
+		bool
+		write_batch_data(
+			const char *batch_data,
+			const std::vector<uint32_t> &item_sizes,
+			const std::vector<std::chrono::microseconds> &timestamps);
+
+		/**
+		 * Reserves memory for the next item at the end of the data file, so
+		 * that it can be serialized in place. Starts a new data file first
+		 * if the item doesn't belong in the current one.
+		 *
+		 * @param[in] item_data_size
+		 * The size of the item in bytes
+		 *
+		 * @return
+		 * Where to serialize the item, followed by a commit_item_data(). If
+		 * nullptr, the item must be written with write_item_data() instead.
+		 */
+		char *
+		reserve_item_data(
+			uint32_t item_data_size);
+
+		/**
+		 * Appends the item that was serialized into reserve_item_data()'s
+		 * memory to the record
+		 *
+		 * @param[in] item_data
+		 * The memory returned by reserve_item_data()
+		 *
+		 * @param[in] item_data_size
+		 * The size of the item in bytes
+		 *
+		 * @param[in] timestamp
+		 * The timestamp of the item
+		 *
+		 * @return
+		 * Same as write_item_data()
+		 */
+		bool
+		commit_item_data(
+			const char *item_data,
+			uint32_t item_data_size,
+			const std::chrono::microseconds &timestamp);
+
+		/**
+		 * Adds the index entry of an item whose data was just stored
+		 *
+		 * @param[in] okay
+		 * False if storing the item's data failed
+		 *
+		 * @param[in] item_data_size
+		 * The size of the item in bytes
+		 *
+		 * @param[in] timestamp
+		 * The timestamp of the item
+		 *
+		 * @return
+		 * True if the item was recorded. If not, the record's
+		 * RECORD_WRITE_ERROR flag is set.
+		 */
+		bool
+		finish_item(
+			bool okay,
+			uint32_t item_data_size,
+			const std::chrono::microseconds &timestamp);
+
+		/**
+		 * Serializes a message into a slot of the async queue
+		 *
+		 * @param[in] pb
+		 * The message to queue
+		 *
+		 * @param[in] timestamp
+		 * The item's timestamp
+		 *
+		 * @return
+		 * True if the message was queued, false otherwise
+		 */
+		template<class PROTOBUF_T>
+		bool
+		enqueue_item(
+			const PROTOBUF_T &pb,
+			const std::chrono::microseconds &timestamp);
+
+		/**
+		 * Copies serialized item data into a slot of the async queue
+		 *
+		 * @param[in] item_data
+		 * Pointer to the serialized item
+		 *
+		 * @param[in] item_data_size
+		 * The size of the item in bytes
+		 *
+		 * @param[in] timestamp
+		 * The item's timestamp
+		 *
+		 * @return
+		 * True if the item was queued, false otherwise
+		 */
+		bool
+		enqueue_item_data(
+			const void *item_data,
+			uint32_t item_data_size,
+			const std::chrono::microseconds &timestamp);
+
+		/**
+		 * Decides if the next item should be stored in a new data file,
+		 * based on the configured segment limits.
+		 *
+		 * @param[in] item_data_size
+		 * The size of the next item in bytes
+		 *
+		 * @return
+		 * True if a new data file should be started
+		 */
+		bool
+		needs_new_segment(
+			uint32_t item_data_size);
+
+		/**
+		 * Closes the current data file (if any) and opens the next one
+		 *
+		 * @param[in] file_num
+		 * The number of the data file to open
+		 *
+		 * @return
+		 * True if the data file was opened, false otherwise
+		 */
+		bool
+		open_data_file(
+			uint32_t file_num);
+
+		/**
+		 * Packs an item into the current data block and points index_entry_
+		 * at it. If the item doesn't fit, the current block is submitted to
+		 * be compressed first. Only used when compression is enabled.
+		 *
+		 * @param[in] item_data
+		 * Pointer to the serialized item
+		 *
+		 * @param[in] item_data_size
+		 * The size of the item_data block in bytes
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		append_to_block(
+			const void *item_data,
+			uint32_t item_data_size);
+
+		/**
+		 * Submits the current data block to the compressor and appends any
+		 * blocks that finished compressing to the record.
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		submit_block();
+
+		/**
+		 * Appends blocks that finished compressing to the record, in the
+		 * order they were submitted.
+		 *
+		 * @param[in] wait_all
+		 * If true, wait until every submitted block has been stored.
+		 * Otherwise only wait if the compressor has too many blocks in
+		 * flight.
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		store_finished_blocks(
+			bool wait_all);
+
+		/**
+		 * Appends a compressed block to the data file, and its entry to the
+		 * block table.
+		 *
+		 * @param[in] block
+		 * The block to store
+		 *
+		 * @return
+		 * True on success, false otherwise
+		 */
+		bool
+		store_block(
+			const BlockCompressor::Block &block);
+
+		/**
+		 * Reserves a slot in the async queue according to the configured
+		 * FullQueuePolicy, and keeps track of any items that were dropped.
+		 *
+		 * @return
+		 * The reserved slot, or nullptr if the new item was dropped
+		 */
+		ItemQueue::Slot *
+		reserve_slot();
+
+		/**
+		 * Publishes a filled in slot to the I/O thread
+		 *
+		 * @param[in] slot
+		 * A slot previously returned by reserve_slot()
+		 *
+		 * @param[in] valid
+		 * False if the slot couldn't be filled in and should be skipped
+		 */
+		void
+		commit_slot(
+			ItemQueue::Slot *slot,
+			bool valid);
+
+		/**
+		 * Clears the failure reason. Safe to call from multiple producers.
+		 */
+		void
+		clear_reason();
+
+		/**
+		 * Stores a failure reason to be returned by reason(). Safe to call
+		 * from multiple producers.
+		 *
+		 * @param[in] reason
+		 * Human readable explanation of the failure
+		 */
+		void
+		set_reason(
+			const std::string &reason);
+
+	private:
+		/**
+		 * Main loop of the async I/O thread. Drains the queue into the
+		 * record files until the queue is closed.
+		 */
+		void
+		io_thread_main();
+
 	private:
 		// set to true if the writer was initialized succesfully
 		bool initialized_;
@@ -208,18 +810,90 @@ namespace protorecord
 		// the records filepath
 		std::string record_path_;
 
-		// the opened index file for this recording
-		std::ofstream index_file_;
+		// file descriptor for this recording's index file
+		int index_fd_;
+
+		// index blocks waiting to be appended to the index file
+		std::vector<char> index_buffer_;
+
+		// number of bytes of index appended since the last checkpoint. in
+		// use_mmap mode this counts the bytes written to index_file_.
+		size_t index_buffer_used_;
+
+		// the memory mapped index file that entries are encoded into. only
+		// used in use_mmap mode; the summary is still updated via index_fd_.
+		std::unique_ptr<OutputFile> index_file_;
 
 		// the opened data file where samples are recorded
-		std::ofstream data_file_;
+		std::unique_ptr<OutputFile> data_file_;
+
+		// number of the data file that's currently being written
+		uint32_t data_file_num_;
+
+		// number of bytes written to the current data file
+		uint64_t data_file_size_;
+
+		// the monotonic clock time when the current data file was opened
+		std::chrono::microseconds data_file_start_mono_;
+
+		// see WriterOptions::segment_max_bytes
+		uint64_t segment_max_bytes_;
+
+		// see WriterOptions::segment_max_duration
+		std::chrono::microseconds segment_max_duration_;
+
+		// see WriterOptions::checkpoint_interval
+		std::chrono::microseconds checkpoint_interval_;
+
+		// monotonic time of the last checkpoint
+		std::chrono::microseconds last_checkpoint_mono_;
+
+		// number of stored items the last checkpoint's summary counted
+		uint64_t checkpointed_item_count_;
 
 		// shared buffer used to serialize data to files
 		std::vector<char> buffer_;
 
+		// the items of a batch are serialized into here back to back
+		std::vector<char> batch_buffer_;
+
+		// the size of each item in batch_buffer_
+		std::vector<uint32_t> batch_sizes_;
+
+		// the timestamps of the items in batch_buffer_
+		std::vector<std::chrono::microseconds> batch_timestamps_;
+
 		// the total number of recorded samples thus far
 		uint64_t total_item_count_;
 
+		// the number of items that are in the data files. when compression
+		// is enabled, items don't reach the data file until their block has
+		// been compressed, so the summary only counts these.
+		uint64_t stored_item_count_;
+
+		// see WriterOptions::compression
+		Codec compression_;
+
+		// see WriterOptions::compression_block_size
+		size_t block_size_;
+
+		// compresses data blocks in the background. nullptr if compression
+		// is disabled.
+		std::unique_ptr<BlockCompressor> compressor_;
+
+		// the block that items are currently being packed into
+		std::unique_ptr<BlockCompressor::Block> block_;
+
+		// number of blocks that have been submitted to compressor_. this is
+		// also the number of the block that's being filled.
+		uint64_t submitted_block_count_;
+
+		// number of blocks stored in the data files and the block table
+		uint64_t stored_block_count_;
+
+		// file descriptor for the block table. -1 if compression is disabled.
+		int blocks_fd_;
+
 		// the system clock time when the recording was opened
 		std::chrono::microseconds start_time_system_;
 
@@ -227,7 +901,56 @@ namespace protorecord
 		std::chrono::microseconds start_time_mono_;
 
 		// bitmask of protorecord::Flags::*
-		uint32_t flags_;
+		// the async I/O thread can set bits too, hence the atomic
+		std::atomic<uint32_t> flags_;
+
+		// queue used to hand items off to the I/O thread in async mode.
+		// nullptr if the Writer is synchronous.
+		std::unique_ptr<ItemQueue> queue_;
+
+		// what to do when queue_ is full
+		FullQueuePolicy queue_policy_;
+
+		// the background thread that drains queue_ into the record files
+		std::thread io_thread_;
+
+		// the number of items accepted into queue_ that are still expected
+		// to make it into the record
+		std::atomic<uint64_t> queued_item_count_;
+
+		// the number of items that were dropped because queue_ was full
+		std::atomic<uint64_t> dropped_item_count_;
+
+		// shared memory channel every item is published into. nullptr if
+		// WriterOptions::live_channel is empty.
+		std::unique_ptr<LiveChannel> live_channel_;
+
+		// set to true once the record's schema was stored. checked on every
+		// write(), so it's kept apart from the mutex.
+		std::atomic<bool> schema_stored_;
+
+		// serializes store_schema() between async producers
+		std::mutex schema_mutex_;
+
+		// collects the items' keys for the key index. nullptr if neither
+		// WriterOptions::key_field nor key_extractor are set.
+		std::unique_ptr<KeyIndexBuilder> key_index_;
+
+		// see WriterOptions::key_filter_bits and key_filter_items
+		size_t key_filter_bits_;
+		uint64_t key_filter_items_;
+
+		// the index entry that's being appended to the index file
+		IndexEntry index_entry_;
+
+		// the summary that gets stored at SUMMARY_BLOCK_OFFSET
+		protorecord::IndexSummary summary_;
+
+		// guards fail_reason_ when multiple threads are writing
+		std::mutex reason_mutex_;
+
+		// true if fail_reason_ is not empty
+		std::atomic<bool> has_reason_;
 
 		// set to a human reasble string explaing previous method's failure
 		std::string fail_reason_;
@@ -240,40 +963,168 @@ namespace protorecord
 		const PROTOBUF_T &pb)
 	{
 		bool okay = true;
-		fail_reason_ = "";
+		clear_reason();
 
 		if (initialized_)
 		{
+			if ( ! schema_stored_.load(std::memory_order_acquire))
+			{
+				store_schema(pb.GetDescriptor());
+			}
+
 			std::chrono::microseconds timestamp;
 			if (timestamping_enabled_)
 			{
 				timestamp = get_mono_time() - start_time_mono_;
 			}
 
-			uint32_t obj_size = pb.ByteSizeLong();
-			if (buffer_.size() < obj_size)
+			if (queue_)
+			{
+				// serialize straight into the queue and let the I/O thread
+				// take care of the rest
+				okay = enqueue_item(pb,timestamp);
+			}
+			else
+			{
+				// ByteSizeLong() caches the sizes that serializing needs, so
+				// there's no need to have SerializeToArray() compute them again
+				uint32_t obj_size = pb.ByteSizeLong();
+				char *item_data = reserve_item_data(obj_size);
+				if (item_data != nullptr)
+				{
+					// serialize straight into the data file's memory
+					pb.SerializeWithCachedSizesToArray((uint8_t*)item_data);
+					okay = commit_item_data(item_data,obj_size,timestamp);
+				}
+				else
+				{
+					if (buffer_.size() < obj_size)
+					{
+						// leave some headroom so slightly larger items don't
+						// cause another resize
+						buffer_.resize(obj_size*2);
+					}
+
+					pb.SerializeWithCachedSizesToArray((uint8_t*)buffer_.data());
+					okay = write_item_data(buffer_.data(),obj_size,timestamp);
+				}
+
+				if ( ! okay)
+				{
+					set_reason("failed to write item to record");
+				}
+			}
+		}
+		else
+		{
+			set_reason("Writer not initialized");
+			okay = false;
+		}
+
+		return okay;
+	}
+
+	template<class ITER_T>
+	bool
+	Writer::write_batch(
+		ITER_T first,
+		ITER_T last,
+		BatchTimestamp timestamping)
+	{
+		bool okay = true;
+		clear_reason();
+
+		const bool per_item = timestamping == BatchTimestamp::PER_ITEM;
+		std::chrono::microseconds timestamp(0);
+		if (timestamping_enabled_)
+		{
+			timestamp = get_mono_time() - start_time_mono_;
+		}
+
+		if (initialized_ && first != last && ! schema_stored_.load(std::memory_order_acquire))
+		{
+			store_schema(first->GetDescriptor());
+		}
+
+		if ( ! initialized_)
+		{
+			set_reason("Writer not initialized");
+			okay = false;
+		}
+		else if (queue_)
+		{
+			for (; okay && first != last; ++first)
 			{
-				// for internal class needs, we need the buffer at least as an IndexItem
-				// so that we can serialize items for the index file
-				buffer_.resize(obj_size*2);
+				if (timestamping_enabled_ && per_item)
+				{
+					timestamp = get_mono_time() - start_time_mono_;
+				}
+				okay = enqueue_item(*first,timestamp);
 			}
+		}
+		else
+		{
+			// serialize the whole batch back to back
+			size_t used = 0;
+			batch_sizes_.clear();
+			batch_timestamps_.clear();
+			for (; okay && first != last; ++first)
+			{
+				uint32_t obj_size = first->ByteSizeLong();
+				if (batch_buffer_.size() < used + obj_size)
+				{
+					batch_buffer_.resize((used + obj_size) * 2);
+				}
 
-			if (pb.SerializeToArray((void*)buffer_.data(),buffer_.size()))
+				first->SerializeWithCachedSizesToArray((uint8_t*)(batch_buffer_.data() + used));
+				used += obj_size;
+				batch_sizes_.push_back(obj_size);
+				if (timestamping_enabled_ && per_item)
+				{
+					batch_timestamps_.push_back(get_mono_time() - start_time_mono_);
+				}
+			}
+			if ( ! per_item)
 			{
-				okay = okay && write_item_data(buffer_.data(),obj_size,timestamp);
+				batch_timestamps_.push_back(timestamp);
 			}
-			else
+
+			if ( ! write_batch_data(batch_buffer_.data(),batch_sizes_,batch_timestamps_))
 			{
-				fail_reason_ = "failed to serialize protobuf msg";
+				set_reason("failed to write batch to record");
 				okay = false;
 			}
 		}
-		else
+
+		return okay;
+	}
+
+	template<class PROTOBUF_T>
+	bool
+	Writer::enqueue_item(
+		const PROTOBUF_T &pb,
+		const std::chrono::microseconds &timestamp)
+	{
+		bool okay = true;
+		uint32_t obj_size = pb.ByteSizeLong();
+		ItemQueue::Slot *slot = reserve_slot();
+		if (slot == nullptr)
 		{
-			fail_reason_ = "Writer not initialized";
+			set_reason("async queue is full; item was dropped");
 			okay = false;
 		}
+		else
+		{
+			if (slot->data.size() < obj_size)
+			{
+				slot->data.resize(obj_size*2);
+			}
 
+			slot->size = obj_size;
+			slot->timestamp = timestamp;
+			pb.SerializeWithCachedSizesToArray((uint8_t*)slot->data.data());
+			commit_slot(slot,true);
+		}
 		return okay;
 	}
 }// protorecord
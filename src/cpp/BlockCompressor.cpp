@@ -0,0 +1,180 @@
+#include "protorecord/BlockCompressor.h"
+
+namespace protorecord
+{
+	//-------------------------------------------------------------------------
+	// constructors/destructors
+	//-------------------------------------------------------------------------
+
+	BlockCompressor::BlockCompressor(
+		Codec codec,
+		size_t num_threads,
+		size_t max_in_flight)
+	 : codec_(codec)
+	 , max_in_flight_(max_in_flight < 1 ? 1 : max_in_flight)
+	 , in_flight_()
+	 , pending_()
+	 , free_blocks_()
+	 , stopping_(false)
+	 , workers_()
+	{
+		for (size_t i=0; i<num_threads; i++)
+		{
+			workers_.emplace_back(&BlockCompressor::worker_main,this);
+		}
+	}
+
+	BlockCompressor::~BlockCompressor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		pending_cv_.notify_all();
+		for (auto &worker : workers_)
+		{
+			worker.join();
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	std::unique_ptr<BlockCompressor::Block>
+	BlockCompressor::get_block()
+	{
+		std::unique_ptr<Block> block;
+		if (free_blocks_.empty())
+		{
+			block.reset(new Block());
+		}
+		else
+		{
+			block = std::move(free_blocks_.back());
+			free_blocks_.pop_back();
+		}
+
+		block->raw_size = 0;
+		block->compressed_size = 0;
+		block->codec = Codec::NONE;
+		block->num_items = 0;
+		block->finished = false;
+		return block;
+	}
+
+	void
+	BlockCompressor::submit(
+		std::unique_ptr<Block> block)
+	{
+		Block *raw_block = block.get();
+		if (workers_.empty())
+		{
+			compress(*raw_block);
+			raw_block->finished = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			in_flight_.push_back(std::move(block));
+			if ( ! raw_block->finished)
+			{
+				pending_.push_back(raw_block);
+			}
+		}
+		pending_cv_.notify_one();
+	}
+
+	std::unique_ptr<BlockCompressor::Block>
+	BlockCompressor::pop_finished(
+		bool wait)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (in_flight_.empty())
+		{
+			return nullptr;
+		}
+		else if (wait)
+		{
+			finished_cv_.wait(lock,[this]{return in_flight_.front()->finished;});
+		}
+		else if ( ! in_flight_.front()->finished)
+		{
+			return nullptr;
+		}
+
+		std::unique_ptr<Block> block = std::move(in_flight_.front());
+		in_flight_.pop_front();
+		return block;
+	}
+
+	void
+	BlockCompressor::recycle(
+		std::unique_ptr<Block> block)
+	{
+		free_blocks_.push_back(std::move(block));
+	}
+
+	bool
+	BlockCompressor::full()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return in_flight_.size() >= max_in_flight_;
+	}
+
+	//-------------------------------------------------------------------------
+	// protected methods
+	//-------------------------------------------------------------------------
+
+	void
+	BlockCompressor::compress(
+		Block &block)
+	{
+		bool okay = compress_block(
+			codec_,
+			block.raw.data(),
+			block.raw_size,
+			block.compressed,
+			block.compressed_size);
+
+		// there's no point paying for decompression if the block didn't
+		// shrink, so store it as is
+		if (okay && block.compressed_size < block.raw_size)
+		{
+			block.codec = codec_;
+		}
+		else
+		{
+			block.codec = Codec::NONE;
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// private methods
+	//-------------------------------------------------------------------------
+
+	void
+	BlockCompressor::worker_main()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			pending_cv_.wait(lock,[this]{return stopping_ || ! pending_.empty();});
+			if (stopping_)
+			{
+				break;
+			}
+
+			Block *block = pending_.front();
+			pending_.pop_front();
+
+			lock.unlock();
+			compress(*block);
+			lock.lock();
+
+			block->finished = true;
+			finished_cv_.notify_all();
+		}
+	}
+
+}// protorecord
@@ -0,0 +1,338 @@
+#include "protorecord/ColumnExport.h"
+
+#include <errno.h>
+#include <fstream>
+#include <mutex>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace protorecord
+{
+	/**
+	 * Appends the elements of 'values' to 'file', converted to ELEMENT_T
+	 */
+	template<class ELEMENT_T, class VALUE_T>
+	static
+	void
+	append_array(
+		std::ofstream &file,
+		const std::vector<VALUE_T> &values)
+	{
+		if (std::is_same<ELEMENT_T,VALUE_T>::value)
+		{
+			file.write((const char*)values.data(),values.size() * sizeof(VALUE_T));
+			return;
+		}
+
+		std::vector<ELEMENT_T> elements(values.begin(),values.end());
+		file.write((const char*)elements.data(),elements.size() * sizeof(ELEMENT_T));
+	}
+
+	/**
+	 * @return
+	 * A column entry for a file of 'name'
+	 */
+	static
+	ExportedColumn
+	make_column(
+		const std::string &name,
+		const std::string &dtype,
+		size_t element_size)
+	{
+		ExportedColumn column;
+		column.name = name;
+		column.file = name + ".bin";
+		column.dtype = dtype;
+		column.element_size = element_size;
+		return column;
+	}
+
+	ColumnExport::ColumnExport(
+		const google::protobuf::Descriptor *descriptor,
+		const std::vector<FieldPath> &fields,
+		const std::vector<Predicate> &predicates)
+	 : descriptor_(descriptor)
+	 , fields_(fields)
+	 , predicates_(predicates)
+	 , columns_()
+	 , num_items_(0)
+	 , fail_reason_("")
+	{
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	bool
+	ColumnExport::run(
+		const std::vector<std::string> &record_paths,
+		const std::string &output_dir,
+		const ScanOptions &options)
+	{
+		fail_reason_ = "";
+		columns_.clear();
+		num_items_ = 0;
+
+		bool okay = ! record_paths.empty();
+		if ( ! okay)
+		{
+			fail_reason_ = "no records given";
+		}
+
+		// the stored schema's descriptor is owned by the Reader that built
+		// it, so the Reader is kept around for the whole export
+		std::unique_ptr<Reader> schema_reader;
+		const google::protobuf::Descriptor *descriptor = descriptor_;
+		if (okay && descriptor == nullptr)
+		{
+			schema_reader.reset(new Reader(record_paths[0]));
+			descriptor = schema_reader->message_descriptor();
+			if (descriptor == nullptr)
+			{
+				fail_reason_ = "record '" + record_paths[0] + "' has no usable schema. reason: " +
+					schema_reader->reason();
+				okay = false;
+			}
+		}
+
+		std::unique_ptr<Projection> projection;
+		if (okay)
+		{
+			projection.reset(new Projection(descriptor,fields_,predicates_));
+			okay = projection->is_valid();
+			if ( ! okay)
+			{
+				fail_reason_ = projection->reason();
+			}
+		}
+
+		// one file per projected field, followed by the item's position
+		const ProjectionResult empty_result = okay ? projection->make_result() : ProjectionResult();
+		for (const Column &column : empty_result.columns)
+		{
+			switch (column.type)
+			{
+				case ColumnType::INT64:
+					columns_.push_back(make_column(column.name,"<i8",sizeof(int64_t)));
+					break;
+				case ColumnType::UINT64:
+					columns_.push_back(make_column(column.name,"<u8",sizeof(uint64_t)));
+					break;
+				case ColumnType::DOUBLE:
+					columns_.push_back(make_column(column.name,"<f8",sizeof(double)));
+					break;
+				case ColumnType::BOOL:
+					columns_.push_back(make_column(column.name,"|b1",sizeof(uint8_t)));
+					break;
+				case ColumnType::STRING:
+					fail_reason_ = "field '" + column.name + "' isn't numeric";
+					okay = false;
+					break;
+			}
+		}
+		const bool multi_record = record_paths.size() > 1;
+		bool has_timestamps = okay;
+		for (size_t r=0; okay && r<record_paths.size(); r++)
+		{
+			Reader reader(record_paths[r]);
+			has_timestamps = has_timestamps && reader.has_timestamps();
+		}
+		columns_.push_back(make_column("_item","<u8",sizeof(uint64_t)));
+		if (multi_record)
+		{
+			columns_.push_back(make_column("_record","<u4",sizeof(uint32_t)));
+		}
+		if (has_timestamps)
+		{
+			columns_.push_back(make_column("_timestamp_us","<u8",sizeof(uint64_t)));
+		}
+
+		if (okay && mkdir(output_dir.c_str(),0777) < 0 && errno != EEXIST)
+		{
+			fail_reason_ = "failed to create '" + output_dir + "'. error: " + strerror(errno);
+			okay = false;
+		}
+
+		std::vector<std::ofstream> files(columns_.size());
+		for (size_t c=0; okay && c<columns_.size(); c++)
+		{
+			const std::string path = output_dir + "/" + columns_[c].file;
+			files[c].open(path,std::ios::binary | std::ios::trunc);
+			if ( ! files[c].good())
+			{
+				fail_reason_ = "failed to create '" + path + "'";
+				okay = false;
+			}
+		}
+
+		ScanOptions scan_options = options;
+		scan_options.ordered = false;
+		std::unique_ptr<ParallelScan> scan;
+		if (okay)
+		{
+			scan.reset(new ParallelScan(record_paths,scan_options));
+			fail_reason_ = scan->reason();
+			okay = fail_reason_.empty();
+		}
+		if ( ! okay)
+		{
+			columns_.clear();
+			return false;
+		}
+
+		// every chunk is extracted into a result of its own, which is
+		// appended to the files once every chunk before it was
+		const std::vector<ScanChunk> &chunks = scan->chunks();
+		std::vector<ProjectionResult> partials(chunks.size(),empty_result);
+		std::vector<bool> chunk_done(chunks.size(),false);
+		size_t next_chunk = 0;
+		std::mutex mutex;
+		std::string malformed;
+		okay = scan->scan_raw([&](const ScanItem &item, std::string_view item_data){
+			ProjectionResult &partial = partials[item.chunk];
+			if ( ! projection->apply(item_data,item,partial))
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				malformed = "item " + std::to_string(item.item) + " of record '" +
+					record_paths[item.record] + "' is malformed";
+				return false;
+			}
+			else if (item.item + 1 < chunks[item.chunk].last)
+			{
+				return true;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			chunk_done[item.chunk] = true;
+			for (; next_chunk < chunks.size() && chunk_done[next_chunk]; next_chunk++)
+			{
+				const ProjectionResult &done = partials[next_chunk];
+				size_t f = 0;
+				for (const Column &column : done.columns)
+				{
+					switch (column.type)
+					{
+						case ColumnType::INT64:
+							append_array<int64_t>(files[f],column.int_values);
+							break;
+						case ColumnType::UINT64:
+							append_array<uint64_t>(files[f],column.uint_values);
+							break;
+						case ColumnType::DOUBLE:
+							append_array<double>(files[f],column.double_values);
+							break;
+						case ColumnType::BOOL:
+							append_array<uint8_t>(files[f],column.uint_values);
+							break;
+						case ColumnType::STRING:
+							break;
+					}
+					f++;
+				}
+
+				std::vector<uint64_t> positions(done.items.size());
+				for (size_t i=0; i<done.items.size(); i++)
+				{
+					positions[i] = done.items[i].item;
+				}
+				append_array<uint64_t>(files[f++],positions);
+				if (multi_record)
+				{
+					for (size_t i=0; i<done.items.size(); i++)
+					{
+						positions[i] = done.items[i].record;
+					}
+					append_array<uint32_t>(files[f++],positions);
+				}
+				if (has_timestamps)
+				{
+					for (size_t i=0; i<done.items.size(); i++)
+					{
+						positions[i] = done.items[i].timestamp;
+					}
+					append_array<uint64_t>(files[f++],positions);
+				}
+
+				num_items_ += done.items.size();
+				partials[next_chunk] = ProjectionResult();
+			}
+			return true;
+		});
+
+		if ( ! okay)
+		{
+			fail_reason_ = malformed.empty() ? scan->reason() : malformed;
+		}
+
+		for (size_t c=0; okay && c<files.size(); c++)
+		{
+			files[c].close();
+			if (files[c].fail())
+			{
+				fail_reason_ = "failed to write '" + output_dir + "/" + columns_[c].file + "'";
+				okay = false;
+			}
+		}
+
+		okay = okay && write_manifest(output_dir);
+		if ( ! okay)
+		{
+			columns_.clear();
+			num_items_ = 0;
+		}
+		return okay;
+	}
+
+	const std::vector<ExportedColumn> &
+	ColumnExport::columns() const
+	{
+		return columns_;
+	}
+
+	uint64_t
+	ColumnExport::size() const
+	{
+		return num_items_;
+	}
+
+	std::string
+	ColumnExport::reason()
+	{
+		return std::move(fail_reason_);
+	}
+
+	//-------------------------------------------------------------------------
+	// protected methods
+	//-------------------------------------------------------------------------
+
+	bool
+	ColumnExport::write_manifest(
+		const std::string &output_dir)
+	{
+		const std::string path = output_dir + "/manifest.json";
+		std::ofstream manifest(path,std::ios::trunc);
+		manifest << "{" << std::endl;
+		manifest << "  \"items\": " << num_items_ << "," << std::endl;
+		manifest << "  \"columns\": [" << std::endl;
+		for (size_t c=0; c<columns_.size(); c++)
+		{
+			const ExportedColumn &column = columns_[c];
+			manifest << "    {\"name\": \"" << column.name << "\", ";
+			manifest << "\"file\": \"" << column.file << "\", ";
+			manifest << "\"dtype\": \"" << column.dtype << "\"}";
+			manifest << (c + 1 < columns_.size() ? "," : "") << std::endl;
+		}
+		manifest << "  ]" << std::endl;
+		manifest << "}" << std::endl;
+		manifest.close();
+
+		if (manifest.fail())
+		{
+			fail_reason_ = "failed to write '" + path + "'";
+			return false;
+		}
+		return true;
+	}
+
+}// protorecord
@@ -0,0 +1,173 @@
+#include "protorecord/Compression.h"
+
+#ifdef PROTORECORD_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef PROTORECORD_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef PROTORECORD_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace protorecord
+{
+	bool
+	codec_available(
+		Codec codec)
+	{
+		switch (codec)
+		{
+			case Codec::NONE:
+				return true;
+#ifdef PROTORECORD_HAVE_LZ4
+			case Codec::LZ4:
+				return true;
+#endif
+#ifdef PROTORECORD_HAVE_ZSTD
+			case Codec::ZSTD:
+				return true;
+#endif
+#ifdef PROTORECORD_HAVE_ZLIB
+			case Codec::ZLIB:
+				return true;
+#endif
+			default:
+				return false;
+		}
+	}
+
+	std::string
+	codec_name(
+		Codec codec)
+	{
+		switch (codec)
+		{
+			case Codec::NONE:
+				return "none";
+			case Codec::LZ4:
+				return "lz4";
+			case Codec::ZSTD:
+				return "zstd";
+			case Codec::ZLIB:
+				return "zlib";
+		}
+		return "unknown";
+	}
+
+	bool
+	compress_block(
+		Codec codec,
+		const char *src,
+		size_t src_size,
+		std::vector<char> &dst,
+		size_t &dst_size)
+	{
+		bool okay = false;
+		dst_size = 0;
+
+		switch (codec)
+		{
+			case Codec::NONE:
+				dst.assign(src,src + src_size);
+				dst_size = src_size;
+				okay = true;
+				break;
+#ifdef PROTORECORD_HAVE_LZ4
+			case Codec::LZ4:
+			{
+				int bound = LZ4_compressBound((int)src_size);
+				if (dst.size() < (size_t)bound)
+				{
+					dst.resize(bound);
+				}
+				int size = LZ4_compress_default(src,dst.data(),(int)src_size,bound);
+				okay = size > 0;
+				dst_size = okay ? size : 0;
+				break;
+			}
+#endif
+#ifdef PROTORECORD_HAVE_ZSTD
+			case Codec::ZSTD:
+			{
+				// level 1 favors speed, which is what a recorder wants
+				size_t bound = ZSTD_compressBound(src_size);
+				if (dst.size() < bound)
+				{
+					dst.resize(bound);
+				}
+				size_t size = ZSTD_compress(dst.data(),bound,src,src_size,1);
+				okay = ! ZSTD_isError(size);
+				dst_size = okay ? size : 0;
+				break;
+			}
+#endif
+#ifdef PROTORECORD_HAVE_ZLIB
+			case Codec::ZLIB:
+			{
+				uLongf size = compressBound(src_size);
+				if (dst.size() < size)
+				{
+					dst.resize(size);
+				}
+				okay = compress2(
+					(Bytef*)dst.data(),&size,
+					(const Bytef*)src,src_size,
+					Z_BEST_SPEED) == Z_OK;
+				dst_size = okay ? size : 0;
+				break;
+			}
+#endif
+			default:
+				break;
+		}
+
+		return okay;
+	}
+
+	bool
+	decompress_block(
+		Codec codec,
+		const char *src,
+		size_t src_size,
+		char *dst,
+		size_t raw_size)
+	{
+		bool okay = false;
+
+		switch (codec)
+		{
+			case Codec::NONE:
+				okay = src_size == raw_size;
+				if (okay)
+				{
+					std::copy(src,src + src_size,dst);
+				}
+				break;
+#ifdef PROTORECORD_HAVE_LZ4
+			case Codec::LZ4:
+				okay = LZ4_decompress_safe(src,dst,(int)src_size,(int)raw_size) == (int)raw_size;
+				break;
+#endif
+#ifdef PROTORECORD_HAVE_ZSTD
+			case Codec::ZSTD:
+				okay = ZSTD_decompress(dst,raw_size,src,src_size) == raw_size;
+				break;
+#endif
+#ifdef PROTORECORD_HAVE_ZLIB
+			case Codec::ZLIB:
+			{
+				uLongf size = raw_size;
+				okay = uncompress((Bytef*)dst,&size,(const Bytef*)src,src_size) == Z_OK;
+				okay = okay && size == raw_size;
+				break;
+			}
+#endif
+			default:
+				break;
+		}
+
+		return okay;
+	}
+
+}// protorecord
@@ -0,0 +1,210 @@
+#include "protorecord/ItemQueue.h"
+
+#include <thread>
+
+namespace protorecord
+{
+	// rounds value up to the next power of two
+	static
+	uint64_t
+	round_up_pow2(
+		uint64_t value)
+	{
+		uint64_t pow2 = 1;
+		while (pow2 < value)
+		{
+			pow2 <<= 1;
+		}
+		return pow2;
+	}
+
+	//-------------------------------------------------------------------------
+	// constructors/destructors
+	//-------------------------------------------------------------------------
+
+	ItemQueue::ItemQueue(
+		size_t capacity,
+		size_t slot_reserve)
+	 : mask_(round_up_pow2(capacity < 2 ? 2 : capacity) - 1)
+	 , slots_(mask_ + 1)
+	 , enqueue_pos_(0)
+	 , dequeue_pos_(0)
+	 , consumer_waiting_(false)
+	 , closed_(false)
+	{
+		for (uint64_t i=0; i<slots_.size(); i++)
+		{
+			slots_[i].data.resize(slot_reserve);
+			slots_[i].size = 0;
+			slots_[i].valid = false;
+			slots_[i].pos = i;
+			slots_[i].seq.store(i,std::memory_order_relaxed);
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	ItemQueue::Slot *
+	ItemQueue::reserve(
+		FullQueuePolicy policy,
+		bool &dropped_oldest)
+	{
+		dropped_oldest = false;
+
+		uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot &slot = slots_[pos & mask_];
+			uint64_t seq = slot.seq.load(std::memory_order_acquire);
+			int64_t diff = (int64_t)(seq - pos);
+			if (diff == 0)
+			{
+				// slot is free; race the other producers for it
+				if (enqueue_pos_.compare_exchange_weak(pos,pos + 1,std::memory_order_relaxed))
+				{
+					slot.pos = pos;
+					return &slot;
+				}
+			}
+			else if (diff > 0)
+			{
+				// another producer beat us to this position
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+			else if (policy == FullQueuePolicy::DROP_NEWEST)
+			{
+				// the slot still holds the item from one lap ago, so the queue is full
+				return nullptr;
+			}
+			else if (policy == FullQueuePolicy::DROP_OLDEST)
+			{
+				// try to claim the oldest item before the consumer does. if we
+				// win, its slot is exactly the one we need. the oldest item must
+				// be committed though, otherwise its producer is still using it.
+				uint64_t oldest = pos - slots_.size();
+				if (seq == oldest + 1 &&
+					dequeue_pos_.compare_exchange_strong(oldest,oldest + 1,std::memory_order_acq_rel))
+				{
+					// nobody can move past 'pos' while we're holding its slot
+					enqueue_pos_.store(pos + 1,std::memory_order_relaxed);
+					dropped_oldest = true;
+					slot.pos = pos;
+					return &slot;
+				}
+				else if (slot.seq.load(std::memory_order_acquire) == seq)
+				{
+					// the consumer is still writing the oldest item to disk, so
+					// there's nothing we can discard without waiting on it.
+					return nullptr;
+				}
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+			else
+			{
+				std::this_thread::yield();
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void
+	ItemQueue::commit(
+		Slot *slot)
+	{
+		slot->seq.store(slot->pos + 1,std::memory_order_release);
+
+		// only pay for the wake up if the consumer is actually asleep
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (consumer_waiting_.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			cv_.notify_one();
+		}
+	}
+
+	ItemQueue::Slot *
+	ItemQueue::try_pop()
+	{
+		uint64_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot &slot = slots_[pos & mask_];
+			uint64_t seq = slot.seq.load(std::memory_order_acquire);
+			int64_t diff = (int64_t)(seq - (pos + 1));
+			if (diff == 0)
+			{
+				if (dequeue_pos_.compare_exchange_weak(pos,pos + 1,std::memory_order_acq_rel))
+				{
+					return &slot;
+				}
+			}
+			else if (diff < 0)
+			{
+				// queue is empty
+				return nullptr;
+			}
+			else
+			{
+				// the producer discarded the item we were looking at
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void
+	ItemQueue::release(
+		Slot *slot)
+	{
+		slot->seq.store(slot->pos + slots_.size(),std::memory_order_release);
+	}
+
+	bool
+	ItemQueue::wait(
+		std::chrono::microseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		consumer_waiting_.store(true,std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if ( ! closed_ && ! has_items())
+		{
+			cv_.wait_for(lock,timeout);
+		}
+		consumer_waiting_.store(false,std::memory_order_relaxed);
+
+		return ! closed_ || has_items();
+	}
+
+	void
+	ItemQueue::close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+		cv_.notify_all();
+	}
+
+	size_t
+	ItemQueue::capacity()
+	{
+		return slots_.size();
+	}
+
+	//-------------------------------------------------------------------------
+	// protected methods
+	//-------------------------------------------------------------------------
+
+	bool
+	ItemQueue::has_items()
+	{
+		uint64_t pos = dequeue_pos_.load(std::memory_order_acquire);
+		return slots_[pos & mask_].seq.load(std::memory_order_acquire) == pos + 1;
+	}
+
+	//-------------------------------------------------------------------------
+	// private methods
+	//-------------------------------------------------------------------------
+
+}// protorecord
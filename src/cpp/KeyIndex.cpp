@@ -0,0 +1,663 @@
+#include "protorecord/KeyIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stddef.h>
+#include <string.h>
+
+#include "protorecord/Index.h"
+#include "protorecord/Projection.h"
+
+namespace protorecord
+{
+	// identifies a key index file
+	static const char KEY_INDEX_MAGIC[8] = {'P','R','K','E','Y','S','\0','\0'};
+	static const uint32_t KEY_INDEX_VERSION = 1;
+
+	// flips the sign bit of signed keys, so that they sort as unsigned ones
+	static const uint64_t KEY_SIGN_BIT = (uint64_t)1 << 63;
+
+	// identifies a key filter file
+	static const char KEY_FILTER_MAGIC[8] = {'P','R','F','I','L','T','\0','\0'};
+	static const uint32_t KEY_FILTER_VERSION = 1;
+
+	// every key's bits are set within one cache line sized block, so a
+	// lookup touches a single cache line per filter
+	static const size_t FILTER_BLOCK_WORDS = 8;
+	static const size_t FILTER_BLOCK_BITS = FILTER_BLOCK_WORDS * 64;
+
+	/**
+	 * Appends 'value' to 'out' in little-endian byte order
+	 */
+	static
+	void
+	append_le(
+		std::string &out,
+		uint64_t value)
+	{
+		char buffer[sizeof(uint64_t)];
+		store_le<uint64_t>(buffer,value);
+		out.append(buffer,sizeof(buffer));
+	}
+
+	/**
+	 * @return
+	 * A hash of an encoded key. It's stored in the filter files, so it
+	 * must never change.
+	 */
+	static
+	uint64_t
+	hash_key(
+		std::string_view key)
+	{
+		// FNV-1a, followed by MurmurHash3's finalizer to spread the bits
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (char c : key)
+		{
+			hash = (hash ^ (uint8_t)c) * 0x100000001b3ULL;
+		}
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	/**
+	 * Calls 'probe' with the word and bit of every bit a key sets in its
+	 * filter block
+	 */
+	template<class PROBE_T>
+	static
+	bool
+	for_each_probe(
+		uint64_t hash,
+		uint32_t num_probes,
+		PROBE_T probe)
+	{
+		// double hashing within the block, off the bits that didn't pick it
+		const uint32_t h1 = (uint32_t)hash;
+		const uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+		for (uint32_t p=0; p<num_probes; p++)
+		{
+			const uint32_t bit = (h1 + p * h2) % FILTER_BLOCK_BITS;
+			if ( ! probe(bit / 64,bit % 64))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @return
+	 * The block of a filter with 'num_blocks' blocks a key of 'hash' goes to
+	 */
+	static
+	uint64_t
+	filter_block(
+		uint64_t hash,
+		uint64_t num_blocks)
+	{
+		// rehashed, so that the block doesn't depend on the probed bits
+		return (hash * 0x9e3779b97f4a7c15ULL >> 32) % num_blocks;
+	}
+
+	std::string
+	encode_key(
+		int64_t key)
+	{
+		return encode_key((uint64_t)key ^ KEY_SIGN_BIT);
+	}
+
+	std::string
+	encode_key(
+		uint64_t key)
+	{
+		std::string encoded(sizeof(uint64_t),'\0');
+		for (size_t i=0; i<sizeof(uint64_t); i++)
+		{
+			encoded[i] = (char)(key >> (8 * (sizeof(uint64_t) - 1 - i)));
+		}
+		return encoded;
+	}
+
+	//-------------------------------------------------------------------------
+	// KeyIndexBuilder
+	//-------------------------------------------------------------------------
+
+	KeyIndexBuilder::KeyIndexBuilder(
+		const std::string &key_field,
+		const KeyExtractor &extractor)
+	 : key_field_(key_field)
+	 , extractor_(extractor)
+	 , key_type_(KeyType::BYTES)
+	 , projection_()
+	 , key_result_()
+	 , int_keys_()
+	 , byte_keys_()
+	 , sorted_(false)
+	 , extracted_key_()
+	 , fail_reason_("")
+	 , mutex_()
+	{
+	}
+
+	KeyIndexBuilder::~KeyIndexBuilder()
+	{
+	}
+
+	bool
+	KeyIndexBuilder::set_descriptor(
+		const google::protobuf::Descriptor *descriptor)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (extractor_)
+		{
+			return true;
+		}
+
+		std::unique_ptr<Projection> projection(new Projection(descriptor,{key_field_}));
+		if ( ! projection->is_valid())
+		{
+			fail_reason_ = "can't index key field. reason: " + projection->reason();
+			return false;
+		}
+
+		std::unique_ptr<ProjectionResult> key_result(new ProjectionResult(projection->make_result()));
+		switch (key_result->columns[0].type)
+		{
+			case ColumnType::INT64:
+				key_type_ = KeyType::INT64;
+				break;
+			case ColumnType::UINT64:
+			case ColumnType::BOOL:
+				key_type_ = KeyType::UINT64;
+				break;
+			case ColumnType::STRING:
+				key_type_ = KeyType::BYTES;
+				break;
+			case ColumnType::DOUBLE:
+				fail_reason_ = "can't index key field '" + key_field_ + "'. floating point keys aren't supported";
+				return false;
+		}
+
+		projection_ = std::move(projection);
+		key_result_ = std::move(key_result);
+		return true;
+	}
+
+	void
+	KeyIndexBuilder::add(
+		const char *item_data,
+		uint32_t item_data_size,
+		uint64_t item_num)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		sorted_ = false;
+		if (extractor_)
+		{
+			extracted_key_.clear();
+			if (extractor_(std::string_view(item_data,item_data_size),extracted_key_))
+			{
+				byte_keys_.emplace_back(extracted_key_,item_num);
+			}
+			return;
+		}
+		else if ( ! projection_)
+		{
+			return;
+		}
+
+		// malformed items aren't indexed
+		ScanItem item;
+		item.item = item_num;
+		if ( ! projection_->apply(std::string_view(item_data,item_data_size),item,*key_result_))
+		{
+			return;
+		}
+
+		Column &column = key_result_->columns[0];
+		switch (column.type)
+		{
+			case ColumnType::INT64:
+				int_keys_.emplace_back((uint64_t)column.int_values[0] ^ KEY_SIGN_BIT,item_num);
+				break;
+			case ColumnType::UINT64:
+			case ColumnType::BOOL:
+				int_keys_.emplace_back(column.uint_values[0],item_num);
+				break;
+			case ColumnType::STRING:
+				byte_keys_.emplace_back(std::move(column.string_values[0]),item_num);
+				break;
+			case ColumnType::DOUBLE:
+				break;
+		}
+
+		key_result_->items.clear();
+		column.int_values.clear();
+		column.uint_values.clear();
+		column.string_values.clear();
+		column.present.clear();
+	}
+
+	bool
+	KeyIndexBuilder::store_index(
+		const std::string &filepath)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if ( ! sort_keys())
+		{
+			return false;
+		}
+
+		const bool int_keys = key_type_ != KeyType::BYTES;
+		const size_t num_postings = int_keys ? int_keys_.size() : byte_keys_.size();
+		std::string key_offsets;
+		std::string posting_offsets;
+		std::string postings;
+		std::string key_bytes;
+		postings.reserve(num_postings * sizeof(uint64_t));
+		uint64_t num_keys = 0;
+		for (size_t p=0; p<num_postings; p++)
+		{
+			const bool new_key = int_keys ?
+				p == 0 || int_keys_[p].first != int_keys_[p - 1].first :
+				p == 0 || byte_keys_[p].first != byte_keys_[p - 1].first;
+			if (new_key)
+			{
+				append_le(key_offsets,key_bytes.size());
+				append_le(posting_offsets,p);
+				key_bytes += int_keys ? encode_key(int_keys_[p].first) : byte_keys_[p].first;
+				num_keys++;
+			}
+			append_le(postings,int_keys ? int_keys_[p].second : byte_keys_[p].second);
+		}
+		append_le(key_offsets,key_bytes.size());
+		append_le(posting_offsets,num_postings);
+
+		std::string header(sizeof(KeyIndexHeader),'\0');
+		memcpy(&header[offsetof(KeyIndexHeader,magic)],KEY_INDEX_MAGIC,sizeof(KEY_INDEX_MAGIC));
+		store_le<uint32_t>(&header[offsetof(KeyIndexHeader,version)],KEY_INDEX_VERSION);
+		store_le<uint32_t>(&header[offsetof(KeyIndexHeader,key_type)],(uint32_t)key_type_);
+		store_le<uint64_t>(&header[offsetof(KeyIndexHeader,num_keys)],num_keys);
+		store_le<uint64_t>(&header[offsetof(KeyIndexHeader,num_postings)],num_postings);
+		store_le<uint64_t>(&header[offsetof(KeyIndexHeader,key_bytes)],key_bytes.size());
+
+		std::ofstream file(filepath,std::ios::binary | std::ios::trunc);
+		file << header << key_offsets << posting_offsets << postings << key_bytes;
+		file.close();
+		if (file.fail())
+		{
+			fail_reason_ = "failed to write key index '" + filepath + "'";
+			return false;
+		}
+		return true;
+	}
+
+	bool
+	KeyIndexBuilder::store_filters(
+		const std::string &filepath,
+		size_t bits_per_key,
+		uint64_t items_per_filter,
+		uint64_t num_items)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if ( ! sort_keys())
+		{
+			return false;
+		}
+		items_per_filter = std::max<uint64_t>(items_per_filter,1);
+		const uint32_t num_filters = (uint32_t)((num_items + items_per_filter - 1) / items_per_filter);
+		const uint32_t num_probes = std::min<uint32_t>(std::max<uint32_t>(std::lround(bits_per_key * 0.693),1),16);
+
+		// the keys are sorted, so every key's items are next to each other.
+		// a key is added to each filter once, however many items have it,
+		// and to the record wide filter after the ranges' filters.
+		const bool int_keys = key_type_ != KeyType::BYTES;
+		const size_t num_postings = int_keys ? int_keys_.size() : byte_keys_.size();
+		auto for_each_key = [&](auto handle_key){
+			std::string key;
+			uint64_t last_filter = UINT64_MAX;
+			for (size_t p=0; p<num_postings; p++)
+			{
+				const bool new_key = int_keys ?
+					p == 0 || int_keys_[p].first != int_keys_[p - 1].first :
+					p == 0 || byte_keys_[p].first != byte_keys_[p - 1].first;
+				if (new_key)
+				{
+					key = int_keys ? encode_key(int_keys_[p].first) : byte_keys_[p].first;
+					last_filter = UINT64_MAX;
+					handle_key(num_filters,key);
+				}
+				const uint64_t f = (int_keys ? int_keys_[p].second : byte_keys_[p].second) / items_per_filter;
+				if (f != last_filter)
+				{
+					handle_key(f,key);
+					last_filter = f;
+				}
+			}
+		};
+
+		// size each filter by the number of distinct keys it holds
+		std::vector<uint64_t> filter_keys(num_filters + 1,0);
+		for_each_key([&](uint64_t f, const std::string &){
+			filter_keys[f]++;
+		});
+		std::string block_offsets;
+		std::vector<uint64_t> first_block(num_filters + 2,0);
+		for (uint32_t f=0; f<=num_filters; f++)
+		{
+			const uint64_t bits = std::max<uint64_t>(filter_keys[f] * bits_per_key,1);
+			first_block[f + 1] = first_block[f] + (bits + FILTER_BLOCK_BITS - 1) / FILTER_BLOCK_BITS;
+		}
+		for (uint64_t offset : first_block)
+		{
+			append_le(block_offsets,offset);
+		}
+
+		const uint64_t num_blocks = first_block[num_filters + 1];
+		std::vector<uint64_t> words(num_blocks * FILTER_BLOCK_WORDS,0);
+		for_each_key([&](uint64_t f, const std::string &key){
+			const uint64_t hash = hash_key(key);
+			const uint64_t block = first_block[f] + filter_block(hash,first_block[f + 1] - first_block[f]);
+			uint64_t *block_words = words.data() + block * FILTER_BLOCK_WORDS;
+			for_each_probe(hash,num_probes,[&](uint32_t word, uint32_t bit){
+				block_words[word] |= (uint64_t)1 << bit;
+				return true;
+			});
+		});
+		std::string blocks;
+		blocks.reserve(words.size() * sizeof(uint64_t));
+		for (uint64_t word : words)
+		{
+			append_le(blocks,word);
+		}
+
+		std::string header(sizeof(KeyFilterHeader),'\0');
+		memcpy(&header[offsetof(KeyFilterHeader,magic)],KEY_FILTER_MAGIC,sizeof(KEY_FILTER_MAGIC));
+		store_le<uint32_t>(&header[offsetof(KeyFilterHeader,version)],KEY_FILTER_VERSION);
+		store_le<uint32_t>(&header[offsetof(KeyFilterHeader,key_type)],(uint32_t)key_type_);
+		store_le<uint32_t>(&header[offsetof(KeyFilterHeader,num_filters)],num_filters);
+		store_le<uint32_t>(&header[offsetof(KeyFilterHeader,num_probes)],num_probes);
+		store_le<uint64_t>(&header[offsetof(KeyFilterHeader,items_per_filter)],items_per_filter);
+		store_le<uint64_t>(&header[offsetof(KeyFilterHeader,num_items)],num_items);
+		store_le<uint64_t>(&header[offsetof(KeyFilterHeader,num_blocks)],num_blocks);
+
+		std::ofstream file(filepath,std::ios::binary | std::ios::trunc);
+		file << header << block_offsets << blocks;
+		file.close();
+		if (file.fail())
+		{
+			fail_reason_ = "failed to write key filters '" + filepath + "'";
+			return false;
+		}
+		return true;
+	}
+
+	std::string
+	KeyIndexBuilder::reason()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return std::move(fail_reason_);
+	}
+
+	bool
+	KeyIndexBuilder::sort_keys()
+	{
+		if ( ! extractor_ && ! projection_)
+		{
+			fail_reason_ = "key index wasn't stored. key field '" + key_field_ +
+				"' couldn't be found in the recorded message type";
+			return false;
+		}
+		else if ( ! sorted_)
+		{
+			// items were added in ascending order, so sorting by key keeps
+			// every key's items sorted too
+			std::sort(int_keys_.begin(),int_keys_.end());
+			std::sort(byte_keys_.begin(),byte_keys_.end());
+			sorted_ = true;
+		}
+		return true;
+	}
+
+	//-------------------------------------------------------------------------
+	// KeyIndex
+	//-------------------------------------------------------------------------
+
+	KeyIndex::KeyIndex()
+	 : map_()
+	 , header_()
+	 , key_offsets_(nullptr)
+	 , posting_offsets_(nullptr)
+	 , postings_(nullptr)
+	 , key_bytes_(nullptr)
+	{
+	}
+
+	bool
+	KeyIndex::open(
+		const std::string &filepath)
+	{
+		bool okay = map_.open(filepath) && map_.size() >= sizeof(KeyIndexHeader);
+		const char *data = map_.data();
+		if (okay)
+		{
+			memcpy(header_.magic,data + offsetof(KeyIndexHeader,magic),sizeof(header_.magic));
+			header_.version = load_le<uint32_t>(data + offsetof(KeyIndexHeader,version));
+			header_.key_type = load_le<uint32_t>(data + offsetof(KeyIndexHeader,key_type));
+			header_.num_keys = load_le<uint64_t>(data + offsetof(KeyIndexHeader,num_keys));
+			header_.num_postings = load_le<uint64_t>(data + offsetof(KeyIndexHeader,num_postings));
+			header_.key_bytes = load_le<uint64_t>(data + offsetof(KeyIndexHeader,key_bytes));
+			okay = memcmp(header_.magic,KEY_INDEX_MAGIC,sizeof(KEY_INDEX_MAGIC)) == 0 &&
+				header_.version == KEY_INDEX_VERSION;
+		}
+
+		// guard against truncated files before trusting any of the sizes
+		const uint64_t max_entries = map_.size() / sizeof(uint64_t);
+		okay = okay && header_.num_keys < max_entries && header_.num_postings < max_entries &&
+			header_.key_bytes <= map_.size() &&
+			map_.size() == sizeof(KeyIndexHeader) +
+				(2 * (header_.num_keys + 1) + header_.num_postings) * sizeof(uint64_t) +
+				header_.key_bytes;
+		if ( ! okay)
+		{
+			map_.close();
+			return false;
+		}
+
+		map_.advise(AccessPattern::RANDOM);
+		key_offsets_ = data + sizeof(KeyIndexHeader);
+		posting_offsets_ = key_offsets_ + (header_.num_keys + 1) * sizeof(uint64_t);
+		postings_ = posting_offsets_ + (header_.num_keys + 1) * sizeof(uint64_t);
+		key_bytes_ = postings_ + header_.num_postings * sizeof(uint64_t);
+		return true;
+	}
+
+	KeyType
+	KeyIndex::key_type() const
+	{
+		return (KeyType)header_.key_type;
+	}
+
+	void
+	KeyIndex::lookup(
+		std::string_view key,
+		std::vector<uint64_t> &items) const
+	{
+		items.clear();
+		if ( ! map_.is_open())
+		{
+			return;
+		}
+
+		// find the first key that isn't less than 'key'
+		uint64_t first = 0;
+		uint64_t count = header_.num_keys;
+		while (count > 0)
+		{
+			const uint64_t step = count / 2;
+			if (key_at(first + step) < key)
+			{
+				first += step + 1;
+				count -= step + 1;
+			}
+			else
+			{
+				count = step;
+			}
+		}
+		if (first == header_.num_keys || key_at(first) != key)
+		{
+			return;
+		}
+
+		const uint64_t begin = load_le<uint64_t>(posting_offsets_ + first * sizeof(uint64_t));
+		const uint64_t end = load_le<uint64_t>(posting_offsets_ + (first + 1) * sizeof(uint64_t));
+		items.resize(end - begin);
+		for (uint64_t p=begin; p<end; p++)
+		{
+			items[p - begin] = load_le<uint64_t>(postings_ + p * sizeof(uint64_t));
+		}
+	}
+
+	std::string_view
+	KeyIndex::key_at(
+		uint64_t k) const
+	{
+		const uint64_t begin = load_le<uint64_t>(key_offsets_ + k * sizeof(uint64_t));
+		const uint64_t end = load_le<uint64_t>(key_offsets_ + (k + 1) * sizeof(uint64_t));
+		return std::string_view(key_bytes_ + begin,end - begin);
+	}
+
+	//-------------------------------------------------------------------------
+	// KeyFilter
+	//-------------------------------------------------------------------------
+
+	KeyFilter::KeyFilter()
+	 : map_()
+	 , header_()
+	 , block_offsets_(nullptr)
+	 , blocks_(nullptr)
+	{
+	}
+
+	bool
+	KeyFilter::open(
+		const std::string &filepath)
+	{
+		bool okay = map_.open(filepath) && map_.size() >= sizeof(KeyFilterHeader);
+		const char *data = map_.data();
+		if (okay)
+		{
+			memcpy(header_.magic,data + offsetof(KeyFilterHeader,magic),sizeof(header_.magic));
+			header_.version = load_le<uint32_t>(data + offsetof(KeyFilterHeader,version));
+			header_.key_type = load_le<uint32_t>(data + offsetof(KeyFilterHeader,key_type));
+			header_.num_filters = load_le<uint32_t>(data + offsetof(KeyFilterHeader,num_filters));
+			header_.num_probes = load_le<uint32_t>(data + offsetof(KeyFilterHeader,num_probes));
+			header_.items_per_filter = load_le<uint64_t>(data + offsetof(KeyFilterHeader,items_per_filter));
+			header_.num_items = load_le<uint64_t>(data + offsetof(KeyFilterHeader,num_items));
+			header_.num_blocks = load_le<uint64_t>(data + offsetof(KeyFilterHeader,num_blocks));
+			okay = memcmp(header_.magic,KEY_FILTER_MAGIC,sizeof(KEY_FILTER_MAGIC)) == 0 &&
+				header_.version == KEY_FILTER_VERSION && header_.items_per_filter > 0;
+		}
+
+		// guard against truncated files before trusting any of the sizes
+		const uint64_t BLOCK_SIZE = FILTER_BLOCK_WORDS * sizeof(uint64_t);
+		okay = okay && header_.num_blocks < map_.size() / BLOCK_SIZE + 1 &&
+			map_.size() == sizeof(KeyFilterHeader) +
+				((uint64_t)header_.num_filters + 2) * sizeof(uint64_t) +
+				header_.num_blocks * BLOCK_SIZE;
+		if ( ! okay)
+		{
+			map_.close();
+			return false;
+		}
+
+		map_.advise(AccessPattern::RANDOM);
+		block_offsets_ = data + sizeof(KeyFilterHeader);
+		blocks_ = block_offsets_ + ((uint64_t)header_.num_filters + 2) * sizeof(uint64_t);
+		return true;
+	}
+
+	KeyType
+	KeyFilter::key_type() const
+	{
+		return (KeyType)header_.key_type;
+	}
+
+	bool
+	KeyFilter::might_contain(
+		std::string_view key) const
+	{
+		if ( ! map_.is_open())
+		{
+			return true;
+		}
+
+		// the record wide filter is as selective as any of the ranges' ones
+		return filter_passes(header_.num_filters,hash_key(key));
+	}
+
+	void
+	KeyFilter::key_ranges(
+		std::string_view key,
+		std::vector<std::pair<uint64_t,uint64_t>> &ranges) const
+	{
+		ranges.clear();
+		if ( ! map_.is_open())
+		{
+			return;
+		}
+
+		// most keys that aren't there are ruled out by the record wide filter
+		// alone. neighboring filters that let the key pass make up one range.
+		const uint64_t hash = hash_key(key);
+		if ( ! filter_passes(header_.num_filters,hash))
+		{
+			return;
+		}
+		for (uint64_t f=0; f<header_.num_filters; f++)
+		{
+			if ( ! filter_passes(f,hash))
+			{
+				continue;
+			}
+
+			const uint64_t first = f * header_.items_per_filter;
+			const uint64_t last = std::min(first + header_.items_per_filter,header_.num_items);
+			if ( ! ranges.empty() && ranges.back().second == first)
+			{
+				ranges.back().second = last;
+			}
+			else
+			{
+				ranges.emplace_back(first,last);
+			}
+		}
+	}
+
+	bool
+	KeyFilter::filter_passes(
+		uint64_t f,
+		uint64_t hash) const
+	{
+		const uint64_t first_block = load_le<uint64_t>(block_offsets_ + f * sizeof(uint64_t));
+		const uint64_t end_block = load_le<uint64_t>(block_offsets_ + (f + 1) * sizeof(uint64_t));
+		if (end_block <= first_block || end_block > header_.num_blocks)
+		{
+			// malformed, so it can't rule anything out
+			return true;
+		}
+
+		const uint64_t block = first_block + filter_block(hash,end_block - first_block);
+		const char *block_data = blocks_ + block * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+		return for_each_probe(hash,header_.num_probes,[&](uint32_t word, uint32_t bit){
+			return (load_le<uint64_t>(block_data + word * sizeof(uint64_t)) >> bit) & 1;
+		});
+	}
+
+}// protorecord
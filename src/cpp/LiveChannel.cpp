@@ -0,0 +1,426 @@
+#include "protorecord/LiveChannel.h"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace protorecord
+{
+	// identifies the shared memory object as a live channel
+	const uint32_t LIVE_CHANNEL_MAGIC = 0x4c565052;// "PRVL"
+
+	// bumped whenever the layout of the channel changes
+	const uint32_t LIVE_CHANNEL_VERSION = 1;
+
+	// the ring starts this many bytes into the mapping
+	const size_t LIVE_CHANNEL_RING_OFFSET = 4096;
+
+	// the smallest ring that create() makes
+	const uint64_t LIVE_CHANNEL_MIN_CAPACITY = 64 * 1024;
+
+	// items are aligned to this many bytes in the ring, so that there's
+	// always room for a record header before the ring wraps around
+	const uint64_t LIVE_RECORD_ALIGNMENT = 16;
+
+	// record size that tells readers to continue at the start of the ring
+	const uint32_t LIVE_RECORD_WRAP = UINT32_MAX;
+
+	// written at the start of the mapping. the positions only ever grow;
+	// a position's byte in the ring is (position % capacity).
+	struct LiveChannelHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t capacity;
+
+		// set to 1 when the writer closes the channel
+		std::atomic<uint32_t> closed;
+
+		// bytes up to here may be getting overwritten. it's moved forward
+		// before the writer touches the ring.
+		alignas(64) std::atomic<uint64_t> reserve_pos;
+
+		// bytes up to here hold complete items. it's moved forward after
+		// the writer is done with the ring.
+		alignas(64) std::atomic<uint64_t> commit_pos;
+	};
+
+	// precedes every item in the ring
+	struct LiveRecordHeader
+	{
+		// size of the item, or LIVE_RECORD_WRAP
+		uint32_t size;
+		uint32_t reserved;
+
+		// index of the item in the record
+		uint64_t item_num;
+	};
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free,"live channels need lock-free 64bit atomics");
+	static_assert(sizeof(LiveChannelHeader) <= LIVE_CHANNEL_RING_OFFSET,"live channel header is too large");
+	static_assert(sizeof(LiveRecordHeader) <= LIVE_RECORD_ALIGNMENT,"live record header is too large");
+
+	/**
+	 * @return
+	 * The number of bytes an item of 'item_data_size' takes up in the ring
+	 */
+	static
+	uint64_t
+	record_length(
+		uint64_t item_data_size)
+	{
+		uint64_t length = sizeof(LiveRecordHeader) + item_data_size;
+		return (length + LIVE_RECORD_ALIGNMENT - 1) & ~(LIVE_RECORD_ALIGNMENT - 1);
+	}
+
+	/**
+	 * @return
+	 * 'name' as a shared memory object name, which must start with a '/'
+	 */
+	static
+	std::string
+	shm_name(
+		const std::string &name)
+	{
+		if ( ! name.empty() && name[0] == '/')
+		{
+			return name;
+		}
+		return "/" + name;
+	}
+
+	//-------------------------------------------------------------------------
+	// constructors/destructors
+	//-------------------------------------------------------------------------
+
+	LiveChannel::LiveChannel()
+	 : name_()
+	 , is_writer_(false)
+	 , header_(nullptr)
+	 , ring_(nullptr)
+	 , capacity_(0)
+	 , map_size_(0)
+	 , write_pos_(0)
+	 , fail_reason_("")
+	{
+	}
+
+	LiveChannel::~LiveChannel()
+	{
+		close();
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	bool
+	LiveChannel::create(
+		const std::string &name,
+		size_t capacity)
+	{
+		close();
+
+		uint64_t ring_capacity = LIVE_CHANNEL_MIN_CAPACITY;
+		while (ring_capacity < capacity)
+		{
+			ring_capacity *= 2;
+		}
+
+		// readers of a stale channel keep their old mapping, and find out
+		// that its writer is gone
+		name_ = shm_name(name);
+		shm_unlink(name_.c_str());
+		int fd = shm_open(name_.c_str(),O_RDWR | O_CREAT | O_EXCL,0644);
+		bool okay = fd >= 0;
+		if ( ! okay)
+		{
+			fail_reason_ = "failed to create shared memory '" + name_ + "'. " + strerror(errno);
+		}
+
+		size_t map_size = LIVE_CHANNEL_RING_OFFSET + ring_capacity;
+		if (okay && ftruncate(fd,map_size) != 0)
+		{
+			fail_reason_ = "failed to size shared memory '" + name_ + "'. " + strerror(errno);
+			okay = false;
+		}
+
+		okay = okay && map(fd,map_size,true);
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+
+		if (okay)
+		{
+			is_writer_ = true;
+			capacity_ = ring_capacity;
+			write_pos_ = 0;
+			header_->capacity = ring_capacity;
+			header_->closed.store(0);
+			header_->reserve_pos.store(0);
+			header_->commit_pos.store(0);
+
+			// readers check the magic number last
+			header_->version = LIVE_CHANNEL_VERSION;
+			std::atomic_thread_fence(std::memory_order_release);
+			header_->magic = LIVE_CHANNEL_MAGIC;
+		}
+		else
+		{
+			if (fd >= 0)
+			{
+				shm_unlink(name_.c_str());
+			}
+			close();
+		}
+		return okay;
+	}
+
+	bool
+	LiveChannel::open(
+		const std::string &name)
+	{
+		close();
+
+		name_ = shm_name(name);
+		int fd = shm_open(name_.c_str(),O_RDONLY,0);
+		bool okay = fd >= 0;
+		if ( ! okay)
+		{
+			fail_reason_ = "failed to open shared memory '" + name_ + "'. " + strerror(errno);
+		}
+
+		struct stat st;
+		if (okay && (fstat(fd,&st) != 0 || (size_t)st.st_size <= LIVE_CHANNEL_RING_OFFSET))
+		{
+			fail_reason_ = "shared memory '" + name_ + "' isn't a live channel";
+			okay = false;
+		}
+
+		okay = okay && map(fd,st.st_size,false);
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+
+		if (okay)
+		{
+			uint32_t magic = header_->magic;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (magic != LIVE_CHANNEL_MAGIC || header_->version != LIVE_CHANNEL_VERSION)
+			{
+				fail_reason_ = "shared memory '" + name_ + "' isn't a live channel, or has an unsupported version";
+				okay = false;
+			}
+			else if (header_->capacity + LIVE_CHANNEL_RING_OFFSET > map_size_)
+			{
+				fail_reason_ = "live channel '" + name_ + "' is truncated";
+				okay = false;
+			}
+			else
+			{
+				capacity_ = header_->capacity;
+			}
+		}
+
+		if ( ! okay)
+		{
+			close();
+		}
+		return okay;
+	}
+
+	void
+	LiveChannel::close()
+	{
+		if (header_ != nullptr)
+		{
+			if (is_writer_)
+			{
+				header_->closed.store(1,std::memory_order_release);
+				shm_unlink(name_.c_str());
+			}
+			munmap(header_,map_size_);
+		}
+		is_writer_ = false;
+		header_ = nullptr;
+		ring_ = nullptr;
+		capacity_ = 0;
+		map_size_ = 0;
+		write_pos_ = 0;
+	}
+
+	bool
+	LiveChannel::is_open() const
+	{
+		return header_ != nullptr;
+	}
+
+	void
+	LiveChannel::publish(
+		const char *item_data,
+		uint32_t item_data_size,
+		uint64_t item_num)
+	{
+		const uint64_t length = record_length(item_data_size);
+		if ( ! is_writer_ || length > capacity_)
+		{
+			return;
+		}
+
+		// items never wrap around the end of the ring. if there's no room
+		// left before the end, the rest is skipped.
+		const uint64_t offset = write_pos_ & (capacity_ - 1);
+		uint64_t start_pos = write_pos_;
+		if (capacity_ - offset < length)
+		{
+			start_pos += capacity_ - offset;
+		}
+
+		// claim the bytes before overwriting them, so that readers copying
+		// an old item out of them can tell that it was overwritten
+		header_->reserve_pos.store(start_pos + length,std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		if (start_pos != write_pos_)
+		{
+			LiveRecordHeader wrap = {LIVE_RECORD_WRAP,0,0};
+			memcpy(ring_ + offset,&wrap,sizeof(wrap));
+		}
+
+		char *record = ring_ + (start_pos & (capacity_ - 1));
+		LiveRecordHeader record_header = {item_data_size,0,item_num};
+		memcpy(record,&record_header,sizeof(record_header));
+		memcpy(record + sizeof(record_header),item_data,item_data_size);
+
+		write_pos_ = start_pos + length;
+		header_->commit_pos.store(write_pos_,std::memory_order_release);
+	}
+
+	bool
+	LiveChannel::read(
+		uint64_t &read_pos,
+		std::vector<char> &item_data,
+		uint32_t &item_data_size,
+		uint64_t &item_num) const
+	{
+		if (header_ == nullptr)
+		{
+			return false;
+		}
+
+		while (true)
+		{
+			const uint64_t commit_pos = header_->commit_pos.load(std::memory_order_acquire);
+			if (read_pos >= commit_pos)
+			{
+				return false;
+			}
+			else if (commit_pos - read_pos > capacity_)
+			{
+				// lapped. everything between here and the newest item is
+				// either overwritten or about to be.
+				read_pos = commit_pos;
+				return false;
+			}
+
+			const uint64_t offset = read_pos & (capacity_ - 1);
+			LiveRecordHeader record_header;
+			memcpy(&record_header,ring_ + offset,sizeof(record_header));
+
+			uint64_t next_pos = 0;
+			bool torn = false;
+			if (record_header.size == LIVE_RECORD_WRAP)
+			{
+				next_pos = read_pos + (capacity_ - offset);
+			}
+			else
+			{
+				// a header that's being overwritten can hold any size
+				next_pos = read_pos + record_length(record_header.size);
+				torn = next_pos > commit_pos || offset + (next_pos - read_pos) > capacity_;
+				if ( ! torn)
+				{
+					if (item_data.size() < record_header.size)
+					{
+						item_data.resize(record_header.size);
+					}
+					memcpy(item_data.data(),ring_ + offset + sizeof(record_header),record_header.size);
+				}
+			}
+
+			// if the writer claimed any of the bytes while they were being
+			// copied, the copy can't be trusted
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const uint64_t reserve_pos = header_->reserve_pos.load(std::memory_order_relaxed);
+			if (torn || reserve_pos > read_pos + capacity_)
+			{
+				read_pos = header_->commit_pos.load(std::memory_order_acquire);
+				return false;
+			}
+
+			read_pos = next_pos;
+			if (record_header.size != LIVE_RECORD_WRAP)
+			{
+				item_data_size = record_header.size;
+				item_num = record_header.item_num;
+				return true;
+			}
+		}
+	}
+
+	uint64_t
+	LiveChannel::write_pos() const
+	{
+		if (header_ == nullptr)
+		{
+			return 0;
+		}
+		return header_->commit_pos.load(std::memory_order_acquire);
+	}
+
+	bool
+	LiveChannel::writer_closed() const
+	{
+		return header_ == nullptr || header_->closed.load(std::memory_order_acquire) != 0;
+	}
+
+	std::string
+	LiveChannel::reason()
+	{
+		return std::move(fail_reason_);
+	}
+
+	//-------------------------------------------------------------------------
+	// protected methods
+	//-------------------------------------------------------------------------
+
+	bool
+	LiveChannel::map(
+		int fd,
+		size_t map_size,
+		bool writable)
+	{
+		// the writer faults the whole ring in up front, so that publishing
+		// never waits on a page fault
+		int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+		int flags = writable ? MAP_SHARED | MAP_POPULATE : MAP_SHARED;
+		void *addr = mmap(nullptr,map_size,prot,flags,fd,0);
+		if (addr == MAP_FAILED)
+		{
+			fail_reason_ = "failed to map shared memory '" + name_ + "'. " + strerror(errno);
+			return false;
+		}
+
+		header_ = (LiveChannelHeader*)addr;
+		ring_ = (char*)addr + LIVE_CHANNEL_RING_OFFSET;
+		map_size_ = map_size;
+		return true;
+	}
+
+}// protorecord
@@ -0,0 +1,126 @@
+#include "protorecord/LiveReader.h"
+
+#include <thread>
+
+namespace protorecord
+{
+	// follow() polls without sleeping for this long before backing off
+	const std::chrono::microseconds LIVE_SPIN_TIME(100);
+
+	// how long follow() sleeps between polls once it has backed off
+	const std::chrono::microseconds LIVE_POLL_INTERVAL(50);
+
+	LiveReader::LiveReader(
+		const std::string &channel,
+		size_t max_item_size)
+	 : channel_()
+	 , read_pos_(0)
+	 , item_data_(max_item_size)
+	 , item_data_size_(0)
+	 , pending_(false)
+	 , pending_item_num_(0)
+	 , last_item_num_(UINT64_MAX)
+	 , taken_item_num_(0)
+	 , dropped_(0)
+	 , fail_reason_("")
+	{
+		if (channel_.open(channel))
+		{
+			read_pos_ = channel_.write_pos();
+		}
+		else
+		{
+			fail_reason_ = channel_.reason();
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	bool
+	LiveReader::is_open() const
+	{
+		return channel_.is_open();
+	}
+
+	bool
+	LiveReader::has_next()
+	{
+		if (pending_)
+		{
+			return true;
+		}
+
+		uint64_t item_num = 0;
+		pending_ = channel_.read(read_pos_,item_data_,item_data_size_,item_num);
+		if (pending_)
+		{
+			// items are published in record order, so gaps are drops
+			uint64_t expected = last_item_num_ + 1;
+			if (last_item_num_ != UINT64_MAX && item_num > expected)
+			{
+				dropped_ += item_num - expected;
+			}
+			pending_item_num_ = item_num;
+			last_item_num_ = item_num;
+		}
+		return pending_;
+	}
+
+	bool
+	LiveReader::follow(
+		std::chrono::microseconds timeout)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		while ( ! has_next())
+		{
+			if (channel_.writer_closed())
+			{
+				// items published right before closing are still readable
+				return has_next();
+			}
+
+			auto waited = std::chrono::steady_clock::now() - start;
+			if (waited >= timeout)
+			{
+				return false;
+			}
+			else if (waited < LIVE_SPIN_TIME)
+			{
+				// let the writer run if it shares our CPU
+				std::this_thread::yield();
+			}
+			else
+			{
+				std::this_thread::sleep_for(LIVE_POLL_INTERVAL);
+			}
+		}
+		return true;
+	}
+
+	uint64_t
+	LiveReader::item_num()
+	{
+		return taken_item_num_;
+	}
+
+	uint64_t
+	LiveReader::dropped()
+	{
+		return dropped_;
+	}
+
+	bool
+	LiveReader::writer_closed()
+	{
+		return channel_.writer_closed();
+	}
+
+	std::string
+	LiveReader::reason()
+	{
+		return std::move(fail_reason_);
+	}
+
+}// protorecord
@@ -0,0 +1,119 @@
+#include "protorecord/MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace protorecord
+{
+	//-------------------------------------------------------------------------
+	// constructors/destructors
+	//-------------------------------------------------------------------------
+
+	MappedFile::MappedFile()
+	 : addr_(nullptr)
+	 , size_(0)
+	 , is_open_(false)
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	bool
+	MappedFile::open(
+		const std::string &filepath)
+	{
+		close();
+
+		int fd = ::open(filepath.c_str(),O_RDONLY);
+		bool okay = fd >= 0;
+
+		struct stat st;
+		okay = okay && fstat(fd,&st) == 0;
+
+		// mmap() rejects empty mappings, but an empty file is still valid
+		if (okay && st.st_size > 0)
+		{
+			void *addr = mmap(nullptr,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+			okay = addr != MAP_FAILED;
+			if (okay)
+			{
+				addr_ = (char*)addr;
+				size_ = st.st_size;
+			}
+		}
+
+		// the mapping stays valid after the descriptor is closed
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+
+		is_open_ = okay;
+		return okay;
+	}
+
+	void
+	MappedFile::close()
+	{
+		if (addr_ != nullptr)
+		{
+			munmap(addr_,size_);
+		}
+		addr_ = nullptr;
+		size_ = 0;
+		is_open_ = false;
+	}
+
+	bool
+	MappedFile::advise(
+		AccessPattern pattern)
+	{
+		if (addr_ == nullptr)
+		{
+			return is_open_;
+		}
+
+		int advice = MADV_NORMAL;
+		switch (pattern)
+		{
+			case AccessPattern::NORMAL:
+				advice = MADV_NORMAL;
+				break;
+			case AccessPattern::SEQUENTIAL:
+				advice = MADV_SEQUENTIAL;
+				break;
+			case AccessPattern::RANDOM:
+				advice = MADV_RANDOM;
+				break;
+		}
+		return madvise(addr_,size_,advice) == 0;
+	}
+
+	bool
+	MappedFile::is_open() const
+	{
+		return is_open_;
+	}
+
+	const char *
+	MappedFile::data() const
+	{
+		return addr_;
+	}
+
+	size_t
+	MappedFile::size() const
+	{
+		return size_;
+	}
+
+}// protorecord
@@ -0,0 +1,194 @@
+#include "protorecord/ParallelScan.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace protorecord
+{
+
+	ParallelScan::ParallelScan(
+		const std::vector<std::string> &record_paths,
+		const ScanOptions &options)
+	 : record_paths_(record_paths)
+	 , options_(options)
+	 , initialized_(false)
+	 , chunks_()
+	 , total_items_(0)
+	 , next_chunk_(0)
+	 , stopping_(false)
+	 , next_turn_(0)
+	 , mutex_()
+	 , turn_cv_()
+	 , fail_reason_("")
+	{
+		options_.chunk_size = std::max<uint64_t>(options_.chunk_size,1);
+		if (options_.num_threads == 0)
+		{
+			options_.num_threads = std::max<size_t>(std::thread::hardware_concurrency(),1);
+		}
+		initialized_ = plan_chunks();
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	uint64_t
+	ParallelScan::size()
+	{
+		return total_items_;
+	}
+
+	const std::vector<ScanChunk> &
+	ParallelScan::chunks()
+	{
+		return chunks_;
+	}
+
+	std::string
+	ParallelScan::reason()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return std::move(fail_reason_);
+	}
+
+	//-------------------------------------------------------------------------
+	// protected methods
+	//-------------------------------------------------------------------------
+
+	bool
+	ParallelScan::plan_chunks()
+	{
+		bool okay = true;
+		for (size_t r=0; okay && r<record_paths_.size(); r++)
+		{
+			Reader reader(record_paths_[r],options_.reader_options);
+			std::string why = reader.reason();
+			if ( ! why.empty())
+			{
+				fail_reason_ = "failed to open record '" + record_paths_[r] + "'. reason: " + why;
+				okay = false;
+				break;
+			}
+
+			const uint64_t num_items = reader.size();
+			for (uint64_t first=0; first<num_items; first+=options_.chunk_size)
+			{
+				ScanChunk chunk;
+				chunk.record = r;
+				chunk.first = first;
+				chunk.last = std::min(first + options_.chunk_size,num_items);
+				chunks_.push_back(chunk);
+			}
+			total_items_ += num_items;
+		}
+
+		if ( ! okay)
+		{
+			chunks_.clear();
+			total_items_ = 0;
+		}
+		return okay;
+	}
+
+	bool
+	ParallelScan::run(
+		const std::function<bool(size_t, Reader &, size_t)> &scan_chunk)
+	{
+		if ( ! initialized_)
+		{
+			stop("ParallelScan not initialized");
+			return false;
+		}
+
+		next_chunk_ = 0;
+		stopping_ = false;
+		next_turn_ = 0;
+		fail_reason_ = "";
+
+		auto worker_main = [&](size_t worker_num){
+			// chunks are picked up in record order, so a worker never needs
+			// a record again once it has moved on to the next one
+			std::unique_ptr<Reader> reader;
+			size_t reader_record = 0;
+			while ( ! stopping_)
+			{
+				size_t chunk_num = next_chunk_.fetch_add(1);
+				if (chunk_num >= chunks_.size())
+				{
+					break;
+				}
+
+				const ScanChunk &chunk = chunks_[chunk_num];
+				if ( ! reader || reader_record != chunk.record)
+				{
+					reader.reset(new Reader(record_paths_[chunk.record],options_.reader_options));
+					reader_record = chunk.record;
+				}
+
+				if ( ! scan_chunk(worker_num,*reader,chunk_num))
+				{
+					break;
+				}
+			}
+		};
+
+		// the calling thread works too, so one thread means no extra ones
+		std::vector<std::thread> workers;
+		for (size_t w=1; w<num_workers(); w++)
+		{
+			workers.emplace_back(worker_main,w);
+		}
+		worker_main(0);
+		for (auto &worker : workers)
+		{
+			worker.join();
+		}
+
+		return ! stopping_;
+	}
+
+	size_t
+	ParallelScan::num_workers()
+	{
+		return std::max<size_t>(std::min(options_.num_threads,chunks_.size()),1);
+	}
+
+	bool
+	ParallelScan::wait_for_turn(
+		size_t chunk_num)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		turn_cv_.wait(lock,[this,chunk_num](){
+			return next_turn_ == chunk_num || stopping_;
+		});
+		return ! stopping_;
+	}
+
+	void
+	ParallelScan::end_turn(
+		size_t chunk_num)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			next_turn_ = chunk_num + 1;
+		}
+		turn_cv_.notify_all();
+	}
+
+	void
+	ParallelScan::stop(
+		const std::string &why)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if ( ! stopping_ && fail_reason_.empty())
+			{
+				fail_reason_ = why;
+			}
+			stopping_ = true;
+		}
+		turn_cv_.notify_all();
+	}
+
+}// protorecord
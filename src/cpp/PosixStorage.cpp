@@ -0,0 +1,673 @@
+#include "protorecord/PosixStorage.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace protorecord
+{
+	//-------------------------------------------------------------------------
+	// PosixOutputFile
+	//-------------------------------------------------------------------------
+
+	PosixOutputFile::PosixOutputFile(
+		size_t buffer_size)
+	 : fd_(-1)
+	 , buffer_(buffer_size)
+	 , buffer_used_(0)
+	 , failed_(false)
+	{
+	}
+
+	PosixOutputFile::~PosixOutputFile()
+	{
+		close();
+	}
+
+	bool
+	PosixOutputFile::open(
+		const std::string &filepath)
+	{
+		close();
+		fd_ = ::open(filepath.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+		buffer_used_ = 0;
+		failed_ = fd_ < 0;
+		return ! failed_;
+	}
+
+	bool
+	PosixOutputFile::append(
+		const void *data,
+		size_t size)
+	{
+		if (failed_ || fd_ < 0)
+		{
+			return false;
+		}
+
+		if (buffer_used_ + size <= buffer_.size())
+		{
+			memcpy(buffer_.data() + buffer_used_,data,size);
+			buffer_used_ += size;
+			return true;
+		}
+
+		// too big to buffer; write the pending data and the new data together
+		struct iovec iov[2];
+		iov[0].iov_base = buffer_.data();
+		iov[0].iov_len = buffer_used_;
+		iov[1].iov_base = const_cast<void*>(data);
+		iov[1].iov_len = size;
+		struct iovec *next = buffer_used_ > 0 ? iov : iov + 1;
+		int remaining = buffer_used_ > 0 ? 2 : 1;
+		while (remaining > 0)
+		{
+			ssize_t written = writev(fd_,next,remaining);
+			if (written < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				failed_ = true;
+				return false;
+			}
+
+			// skip past whatever was written
+			while (remaining > 0 && (size_t)written >= next->iov_len)
+			{
+				written -= next->iov_len;
+				next++;
+				remaining--;
+			}
+			if (remaining > 0)
+			{
+				next->iov_base = (char*)next->iov_base + written;
+				next->iov_len -= written;
+			}
+		}
+		buffer_used_ = 0;
+		return true;
+	}
+
+	bool
+	PosixOutputFile::flush()
+	{
+		if (failed_ || fd_ < 0)
+		{
+			return false;
+		}
+
+		size_t offset = 0;
+		while (offset < buffer_used_)
+		{
+			ssize_t written = write(fd_,buffer_.data() + offset,buffer_used_ - offset);
+			if (written < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				failed_ = true;
+				return false;
+			}
+			offset += written;
+		}
+		buffer_used_ = 0;
+		return true;
+	}
+
+	char *
+	PosixOutputFile::reserve(
+		size_t size)
+	{
+		if (failed_ || fd_ < 0 || size > buffer_.size())
+		{
+			return nullptr;
+		}
+
+		if (buffer_used_ + size > buffer_.size() && ! flush())
+		{
+			return nullptr;
+		}
+		return buffer_.data() + buffer_used_;
+	}
+
+	void
+	PosixOutputFile::commit(
+		size_t size)
+	{
+		buffer_used_ += size;
+	}
+
+	void
+	PosixOutputFile::close()
+	{
+		if (fd_ >= 0)
+		{
+			flush();
+			::close(fd_);
+		}
+		fd_ = -1;
+		buffer_used_ = 0;
+	}
+
+	//-------------------------------------------------------------------------
+	// DirectOutputFile
+	//-------------------------------------------------------------------------
+
+	static
+	bool
+	pwrite_fully(
+		int fd,
+		const char *data,
+		size_t size,
+		uint64_t offset)
+	{
+		while (size > 0)
+		{
+			ssize_t written = pwrite(fd,data,size,offset);
+			if (written < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (written <= 0)
+			{
+				return false;
+			}
+			data += written;
+			size -= written;
+			offset += written;
+		}
+		return true;
+	}
+
+	DirectOutputFile::DirectOutputFile(
+		size_t buffer_size,
+		uint64_t preallocate_extent)
+	 : fd_(-1)
+	 , buffer_size_((buffer_size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT)
+	 , preallocate_extent_(preallocate_extent)
+	 , buffers_{nullptr,nullptr}
+	 , fill_(0)
+	 , fill_used_(0)
+	 , fill_offset_(0)
+	 , allocated_(0)
+	 , failed_(false)
+	 , mutex_()
+	 , cv_()
+	 , write_pending_(false)
+	 , write_data_(nullptr)
+	 , write_size_(0)
+	 , write_offset_(0)
+	 , stop_(false)
+	 , write_thread_()
+	{
+		for (auto &buffer : buffers_)
+		{
+			void *mem = nullptr;
+			if (posix_memalign(&mem,DIRECT_IO_ALIGNMENT,buffer_size_) == 0)
+			{
+				buffer = (char*)mem;
+			}
+		}
+	}
+
+	DirectOutputFile::~DirectOutputFile()
+	{
+		close();
+		for (auto &buffer : buffers_)
+		{
+			free(buffer);
+		}
+	}
+
+	bool
+	DirectOutputFile::open(
+		const std::string &filepath)
+	{
+		close();
+		if (buffers_[0] == nullptr || buffers_[1] == nullptr)
+		{
+			return false;
+		}
+
+		const int FLAGS = O_WRONLY | O_CREAT | O_TRUNC;
+		fd_ = ::open(filepath.c_str(),FLAGS | O_DIRECT,0644);
+		if (fd_ < 0 && errno == EINVAL)
+		{
+			fd_ = ::open(filepath.c_str(),FLAGS,0644);
+		}
+
+		fill_ = 0;
+		fill_used_ = 0;
+		fill_offset_ = 0;
+		allocated_ = 0;
+		failed_ = fd_ < 0;
+		write_pending_ = false;
+		stop_ = false;
+		if ( ! failed_)
+		{
+			write_thread_ = std::thread(&DirectOutputFile::write_thread_main,this);
+		}
+		return ! failed_;
+	}
+
+	bool
+	DirectOutputFile::append(
+		const void *data,
+		size_t size)
+	{
+		const char *src = (const char*)data;
+		bool okay = fd_ >= 0 && ! failed_;
+		while (okay && size > 0)
+		{
+			size_t n = std::min(size,buffer_size_ - fill_used_);
+			memcpy(buffers_[fill_] + fill_used_,src,n);
+			fill_used_ += n;
+			src += n;
+			size -= n;
+
+			if (fill_used_ == buffer_size_)
+			{
+				okay = submit_full_buffer();
+			}
+		}
+		return okay;
+	}
+
+	bool
+	DirectOutputFile::flush()
+	{
+		bool okay = fd_ >= 0 && wait_idle();
+
+		// write out the whole blocks, and keep the tail at the front of the
+		// buffer so that it's rewritten along with whatever follows it
+		char *buffer = buffers_[fill_];
+		size_t aligned_size = fill_used_ / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+		size_t tail_size = fill_used_ - aligned_size;
+		if (okay && aligned_size > 0)
+		{
+			preallocate(fill_offset_ + aligned_size);
+			okay = pwrite_fully(fd_,buffer,aligned_size,fill_offset_);
+			fill_offset_ += aligned_size;
+			memmove(buffer,buffer + aligned_size,tail_size);
+			fill_used_ = tail_size;
+		}
+
+		if (okay && tail_size > 0)
+		{
+			memset(buffer + tail_size,0,DIRECT_IO_ALIGNMENT - tail_size);
+			preallocate(fill_offset_ + DIRECT_IO_ALIGNMENT);
+			okay = pwrite_fully(fd_,buffer,DIRECT_IO_ALIGNMENT,fill_offset_);
+		}
+
+		failed_ = failed_ || ! okay;
+		return okay;
+	}
+
+	void
+	DirectOutputFile::close()
+	{
+		if (fd_ < 0)
+		{
+			return;
+		}
+
+		flush();
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		cv_.notify_all();
+		write_thread_.join();
+
+		// drop the padding and whatever was preallocated past the data
+		if (ftruncate(fd_,fill_offset_ + fill_used_) != 0)
+		{
+			failed_ = true;
+		}
+		::close(fd_);
+		fd_ = -1;
+	}
+
+	bool
+	DirectOutputFile::submit_full_buffer()
+	{
+		if ( ! wait_idle())
+		{
+			return false;
+		}
+
+		preallocate(fill_offset_ + buffer_size_);
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			write_data_ = buffers_[fill_];
+			write_size_ = buffer_size_;
+			write_offset_ = fill_offset_;
+			write_pending_ = true;
+		}
+		cv_.notify_all();
+
+		fill_ = 1 - fill_;
+		fill_used_ = 0;
+		fill_offset_ += buffer_size_;
+		return true;
+	}
+
+	bool
+	DirectOutputFile::wait_idle()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait(lock,[this]{return ! write_pending_;});
+		return ! failed_;
+	}
+
+	void
+	DirectOutputFile::preallocate(
+		uint64_t end)
+	{
+		// the extent is allocated without FALLOC_FL_KEEP_SIZE, so that the
+		// writes don't have to update the file size either
+		while (preallocate_extent_ > 0 && allocated_ < end)
+		{
+			if (fallocate(fd_,0,allocated_,preallocate_extent_) != 0)
+			{
+				// not supported by the filesystem, or out of space. either
+				// way the writes will tell whether there's room.
+				preallocate_extent_ = 0;
+				break;
+			}
+			allocated_ += preallocate_extent_;
+		}
+	}
+
+	void
+	DirectOutputFile::write_thread_main()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			cv_.wait(lock,[this]{return write_pending_ || stop_;});
+			if ( ! write_pending_)
+			{
+				break;
+			}
+
+			lock.unlock();
+			bool okay = pwrite_fully(fd_,write_data_,write_size_,write_offset_);
+			lock.lock();
+
+			failed_ = failed_ || ! okay;
+			write_pending_ = false;
+			cv_.notify_all();
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// MappedOutputFile
+	//-------------------------------------------------------------------------
+
+	MappedOutputFile::MappedOutputFile(
+		uint64_t extent)
+	 : fd_(-1)
+	 , extent_(extent)
+	 , window_(nullptr)
+	 , window_offset_(0)
+	 , window_size_(0)
+	 , size_(0)
+	 , file_size_(0)
+	 , failed_(false)
+	{
+		// windows have to start at page boundaries
+		const uint64_t page_size = sysconf(_SC_PAGESIZE);
+		extent_ = std::max<uint64_t>(extent_,page_size);
+		extent_ = (extent_ + page_size - 1) / page_size * page_size;
+	}
+
+	MappedOutputFile::~MappedOutputFile()
+	{
+		close();
+	}
+
+	bool
+	MappedOutputFile::open(
+		const std::string &filepath)
+	{
+		close();
+
+		// a writable shared mapping needs read access too
+		fd_ = ::open(filepath.c_str(),O_RDWR | O_CREAT | O_TRUNC,0644);
+		size_ = 0;
+		file_size_ = 0;
+		failed_ = fd_ < 0;
+		return ! failed_;
+	}
+
+	bool
+	MappedOutputFile::append(
+		const void *data,
+		size_t size)
+	{
+		char *dst = reserve(size);
+		if (dst == nullptr)
+		{
+			return false;
+		}
+		memcpy(dst,data,size);
+		commit(size);
+		return true;
+	}
+
+	bool
+	MappedOutputFile::flush()
+	{
+		return fd_ >= 0 && ! failed_;
+	}
+
+	char *
+	MappedOutputFile::reserve(
+		size_t size)
+	{
+		if (fd_ < 0 || failed_)
+		{
+			return nullptr;
+		}
+
+		if (window_ == nullptr || size_ + size > window_offset_ + window_size_)
+		{
+			if ( ! remap(size))
+			{
+				failed_ = true;
+				return nullptr;
+			}
+		}
+		return window_ + (size_ - window_offset_);
+	}
+
+	void
+	MappedOutputFile::commit(
+		size_t size)
+	{
+		size_ += size;
+	}
+
+	void
+	MappedOutputFile::close()
+	{
+		if (fd_ < 0)
+		{
+			return;
+		}
+
+		unmap();
+
+		// drop whatever the file was grown by past the data
+		if (ftruncate(fd_,size_) != 0)
+		{
+			failed_ = true;
+		}
+		::close(fd_);
+		fd_ = -1;
+	}
+
+	bool
+	MappedOutputFile::remap(
+		size_t size)
+	{
+		unmap();
+
+		const uint64_t page_size = sysconf(_SC_PAGESIZE);
+		uint64_t window_offset = size_ / page_size * page_size;
+		uint64_t window_end = window_offset + extent_;
+		while (window_end < size_ + size)
+		{
+			window_end += extent_;
+		}
+
+		// the whole window has to be backed by the file. allocating the
+		// blocks up front also means running out of disk space fails here,
+		// rather than with a SIGBUS when the mapping is written to.
+		if (file_size_ < window_end)
+		{
+			int res = fallocate(fd_,0,file_size_,window_end - file_size_);
+			if (res != 0 && (errno == EOPNOTSUPP || errno == ENOSYS))
+			{
+				res = ftruncate(fd_,window_end);
+			}
+			if (res != 0)
+			{
+				return false;
+			}
+			file_size_ = window_end;
+		}
+
+		void *addr = mmap(nullptr,window_end - window_offset,PROT_READ | PROT_WRITE,MAP_SHARED,fd_,window_offset);
+		if (addr == MAP_FAILED)
+		{
+			return false;
+		}
+		window_ = (char*)addr;
+		window_offset_ = window_offset;
+		window_size_ = window_end - window_offset;
+		return true;
+	}
+
+	void
+	MappedOutputFile::unmap()
+	{
+		if (window_ != nullptr)
+		{
+			munmap(window_,window_size_);
+		}
+		window_ = nullptr;
+		window_offset_ = 0;
+		window_size_ = 0;
+	}
+
+	//-------------------------------------------------------------------------
+	// PosixInputFile
+	//-------------------------------------------------------------------------
+
+	PosixInputFile::PosixInputFile(
+		size_t window_size)
+	 : fd_(-1)
+	 , window_(window_size)
+	 , window_offset_(0)
+	 , window_used_(0)
+	{
+	}
+
+	PosixInputFile::~PosixInputFile()
+	{
+		close();
+	}
+
+	bool
+	PosixInputFile::open(
+		const std::string &filepath)
+	{
+		close();
+		fd_ = ::open(filepath.c_str(),O_RDONLY);
+		return fd_ >= 0;
+	}
+
+	bool
+	PosixInputFile::read(
+		uint64_t offset,
+		size_t size,
+		char *dst)
+	{
+		if (fd_ < 0)
+		{
+			return false;
+		}
+
+		// serve the read from the window if it's in there
+		if (offset >= window_offset_ && offset + size <= window_offset_ + window_used_)
+		{
+			memcpy(dst,window_.data() + (offset - window_offset_),size);
+			return true;
+		}
+
+		// read straight into the destination if the window can't hold it
+		bool into_window = size <= window_.size();
+		char *buf = into_window ? window_.data() : dst;
+		size_t buf_size = into_window ? window_.size() : size;
+		if (into_window)
+		{
+			window_offset_ = offset;
+			window_used_ = 0;
+		}
+
+		// a short read is fine as long as it covers the requested range
+		size_t got = 0;
+		while (got < buf_size)
+		{
+			ssize_t res = pread(fd_,buf + got,buf_size - got,offset + got);
+			if (res < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (res <= 0)
+			{
+				break;
+			}
+			got += res;
+		}
+
+		if (into_window)
+		{
+			window_used_ = got;
+			if (got >= size)
+			{
+				memcpy(dst,window_.data(),size);
+			}
+		}
+		return got >= size;
+	}
+
+	void
+	PosixInputFile::invalidate()
+	{
+		window_used_ = 0;
+	}
+
+	void
+	PosixInputFile::close()
+	{
+		if (fd_ >= 0)
+		{
+			::close(fd_);
+		}
+		fd_ = -1;
+		window_offset_ = 0;
+		window_used_ = 0;
+	}
+
+}// protorecord
@@ -0,0 +1,276 @@
+#include "protorecord/Prefetcher.h"
+#include "protorecord/Reader.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace protorecord
+{
+	// largest number of items read into one chunk
+	const size_t PREFETCH_CHUNK_ITEMS = 256;
+
+	Prefetcher::Prefetcher(
+		const std::string &filepath,
+		const ReaderOptions &options)
+	 : reader_()
+	 , total_items_(0)
+	 , max_items_(std::max<size_t>(options.prefetch_items,1))
+	 , max_bytes_(std::max<size_t>(options.prefetch_bytes,1))
+	 , chunk_items_(1)
+	 , current_()
+	 , consume_pos_(0)
+	 , started_(false)
+	 , fetch_pos_(0)
+	 , ready_()
+	 , free_chunks_()
+	 , queued_items_(0)
+	 , queued_bytes_(0)
+	 , done_(false)
+	 , stopping_(false)
+	 , mutex_()
+	 , ready_cv_()
+	 , space_cv_()
+	 , thread_()
+	{
+		ReaderOptions reader_options = options;
+		reader_options.prefetch_items = 0;
+		reader_.reset(new Reader(filepath,reader_options));
+		total_items_ = reader_->size();
+
+		// a few chunks in flight let the thread read while the consumer parses
+		chunk_items_ = std::min(std::max<size_t>(max_items_ / 4,1),PREFETCH_CHUNK_ITEMS);
+	}
+
+	Prefetcher::~Prefetcher()
+	{
+		stop();
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	bool
+	Prefetcher::peek(
+		uint64_t item_idx,
+		const IndexEntry *&entry,
+		const char *&item_data)
+	{
+		if ( ! started_ || item_idx != consume_pos_)
+		{
+			restart(item_idx);
+		}
+
+		// move on to the next chunk once the current one is used up
+		if ( ! current_ || item_idx >= current_->first + current_->count)
+		{
+			release_current();
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			ready_cv_.wait(lock,[this](){
+				return ! ready_.empty() || done_;
+			});
+			if (ready_.empty())
+			{
+				return false;
+			}
+			current_ = std::move(ready_.front());
+			ready_.pop_front();
+		}
+
+		if ( ! current_->okay)
+		{
+			return false;
+		}
+
+		size_t i = item_idx - current_->first;
+		entry = &current_->entries[i];
+		item_data = current_->data.data() + current_->offsets[i];
+		return true;
+	}
+
+	void
+	Prefetcher::pop(
+		uint64_t item_idx)
+	{
+		if (started_ && item_idx == consume_pos_)
+		{
+			consume_pos_++;
+		}
+	}
+
+	void
+	Prefetcher::refresh()
+	{
+		// reading ahead restarts at the next peek()
+		stop();
+		reader_->refresh();
+		total_items_ = reader_->size();
+	}
+
+	//-------------------------------------------------------------------------
+	// protected methods
+	//-------------------------------------------------------------------------
+
+	void
+	Prefetcher::restart(
+		uint64_t item_idx)
+	{
+		stop();
+
+		consume_pos_ = item_idx;
+		fetch_pos_ = item_idx;
+		done_ = false;
+		stopping_ = false;
+		started_ = true;
+		thread_ = std::thread(&Prefetcher::prefetch_main,this);
+	}
+
+	void
+	Prefetcher::stop()
+	{
+		if (thread_.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+			space_cv_.notify_all();
+			thread_.join();
+		}
+
+		// everything read ahead so far is useless now
+		if (current_)
+		{
+			free_chunks_.push_back(std::move(current_));
+		}
+		while ( ! ready_.empty())
+		{
+			free_chunks_.push_back(std::move(ready_.front()));
+			ready_.pop_front();
+		}
+		queued_items_ = 0;
+		queued_bytes_ = 0;
+		started_ = false;
+	}
+
+	void
+	Prefetcher::fill_chunk(
+		Chunk &chunk)
+	{
+		chunk.okay = reader_->get_index_items(chunk.first,chunk.count,chunk.entries);
+		chunk.offsets.resize(chunk.count);
+		chunk.data_size = 0;
+
+		// consecutive items are usually stored back to back, and can be
+		// copied in one go
+		const char *batch_data = nullptr;
+		chunk.okay = chunk.okay && reader_->read_batch_data(chunk.entries,batch_data);
+		if (chunk.okay && batch_data != nullptr)
+		{
+			const IndexEntry &first = chunk.entries.front();
+			const IndexEntry &last = chunk.entries.back();
+			chunk.data_size = last.offset + last.size - first.offset;
+			if (chunk.data.size() < chunk.data_size)
+			{
+				chunk.data.resize(chunk.data_size * 2);
+			}
+			memcpy(chunk.data.data(),batch_data,chunk.data_size);
+			for (size_t i=0; i<chunk.count; i++)
+			{
+				chunk.offsets[i] = chunk.entries[i].offset - first.offset;
+			}
+			return;
+		}
+
+		for (size_t i=0; chunk.okay && i<chunk.count; i++)
+		{
+			const IndexEntry &entry = chunk.entries[i];
+			const char *item_data = nullptr;
+			chunk.okay = reader_->read_item(entry,item_data);
+			if (chunk.okay)
+			{
+				if (chunk.data.size() < chunk.data_size + entry.size)
+				{
+					chunk.data.resize((chunk.data_size + entry.size) * 2);
+				}
+				memcpy(chunk.data.data() + chunk.data_size,item_data,entry.size);
+				chunk.offsets[i] = chunk.data_size;
+				chunk.data_size += entry.size;
+			}
+		}
+	}
+
+	void
+	Prefetcher::release_current()
+	{
+		if (current_)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				queued_items_ -= current_->count;
+				queued_bytes_ -= current_->data_size;
+				free_chunks_.push_back(std::move(current_));
+			}
+			space_cv_.notify_one();
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// private methods
+	//-------------------------------------------------------------------------
+
+	void
+	Prefetcher::prefetch_main()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while ( ! stopping_)
+		{
+			space_cv_.wait(lock,[this](){
+				return stopping_ || (queued_items_ < max_items_ && queued_bytes_ < max_bytes_);
+			});
+			if (stopping_)
+			{
+				break;
+			}
+			if (fetch_pos_ >= total_items_)
+			{
+				done_ = true;
+				break;
+			}
+
+			std::unique_ptr<Chunk> chunk;
+			if (free_chunks_.empty())
+			{
+				chunk.reset(new Chunk());
+			}
+			else
+			{
+				chunk = std::move(free_chunks_.back());
+				free_chunks_.pop_back();
+			}
+			chunk->first = fetch_pos_;
+			chunk->count = std::min<uint64_t>(chunk_items_,total_items_ - fetch_pos_);
+
+			// read without holding the lock so the consumer can carry on
+			lock.unlock();
+			fill_chunk(*chunk);
+			lock.lock();
+
+			fetch_pos_ += chunk->count;
+			queued_items_ += chunk->count;
+			queued_bytes_ += chunk->data_size;
+			// on failure the consumer reads the rest itself, and gets the error
+			done_ = ! chunk->okay;
+			ready_.push_back(std::move(chunk));
+			ready_cv_.notify_one();
+			if (done_)
+			{
+				break;
+			}
+		}
+		lock.unlock();
+		ready_cv_.notify_all();
+	}
+
+}// protorecord
@@ -0,0 +1,668 @@
+#include "protorecord/Projection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <mutex>
+#include <string.h>
+
+namespace protorecord
+{
+	using google::protobuf::FieldDescriptor;
+
+	// protobuf wire types
+	const uint32_t WIRETYPE_VARINT = 0;
+	const uint32_t WIRETYPE_FIXED64 = 1;
+	const uint32_t WIRETYPE_LENGTH_DELIMITED = 2;
+	const uint32_t WIRETYPE_FIXED32 = 5;
+
+	/**
+	 * Decodes a base 128 varint
+	 *
+	 * @return
+	 * True on success, false if the varint runs past 'end' or is too long
+	 */
+	static
+	bool
+	read_varint(
+		const uint8_t *&pos,
+		const uint8_t *end,
+		uint64_t &value)
+	{
+		value = 0;
+		for (unsigned int shift=0; shift<64 && pos<end; shift+=7)
+		{
+			uint8_t byte = *pos++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Moves past a field that isn't needed
+	 *
+	 * @return
+	 * True on success, false if the field runs past 'end' or is a group,
+	 * which isn't supported
+	 */
+	static
+	bool
+	skip_field(
+		uint32_t wire_type,
+		const uint8_t *&pos,
+		const uint8_t *end)
+	{
+		uint64_t length = 0;
+		switch (wire_type)
+		{
+			case WIRETYPE_VARINT:
+				return read_varint(pos,end,length);
+			case WIRETYPE_FIXED64:
+				length = 8;
+				break;
+			case WIRETYPE_LENGTH_DELIMITED:
+				if ( ! read_varint(pos,end,length))
+				{
+					return false;
+				}
+				break;
+			case WIRETYPE_FIXED32:
+				length = 4;
+				break;
+			default:
+				return false;
+		}
+
+		if (length > (uint64_t)(end - pos))
+		{
+			return false;
+		}
+		pos += length;
+		return true;
+	}
+
+	/**
+	 * @return
+	 * The wire type a singular field of 'type' is encoded with
+	 */
+	static
+	uint32_t
+	wire_type_of(
+		FieldDescriptor::Type type)
+	{
+		switch (type)
+		{
+			case FieldDescriptor::TYPE_FIXED64:
+			case FieldDescriptor::TYPE_SFIXED64:
+			case FieldDescriptor::TYPE_DOUBLE:
+				return WIRETYPE_FIXED64;
+			case FieldDescriptor::TYPE_FIXED32:
+			case FieldDescriptor::TYPE_SFIXED32:
+			case FieldDescriptor::TYPE_FLOAT:
+				return WIRETYPE_FIXED32;
+			case FieldDescriptor::TYPE_STRING:
+			case FieldDescriptor::TYPE_BYTES:
+				return WIRETYPE_LENGTH_DELIMITED;
+			default:
+				return WIRETYPE_VARINT;
+		}
+	}
+
+	/**
+	 * @return
+	 * -1, 0 or 1 as 'a' is less than, equal to or greater than 'b'
+	 */
+	template<class T>
+	static
+	int
+	compare_values(
+		const T &a,
+		const T &b)
+	{
+		return a < b ? -1 : (b < a ? 1 : 0);
+	}
+
+	Projection::Projection(
+		const google::protobuf::Descriptor *descriptor,
+		const std::vector<FieldPath> &fields,
+		const std::vector<Predicate> &predicates,
+		const ProjectionOptions &options)
+	 : descriptor_(descriptor)
+	 , specs_()
+	 , nodes_(1)
+	 , num_columns_(0)
+	 , predicates_(predicates)
+	 , predicate_specs_()
+	 , options_(options)
+	 , valid_(descriptor != nullptr)
+	 , fail_reason_("")
+	{
+		nodes_[0].descriptor = descriptor;
+		if ( ! valid_)
+		{
+			fail_reason_ = "no message descriptor given";
+		}
+
+		// projected fields come first, so their specs line up with the
+		// result's columns
+		for (size_t f=0; valid_ && f<fields.size(); f++)
+		{
+			valid_ = add_path(fields[f]) >= 0;
+			num_columns_++;
+		}
+
+		for (size_t p=0; valid_ && p<predicates_.size(); p++)
+		{
+			const Predicate &predicate = predicates_[p];
+			int spec = find_field(0,predicate.field);
+			if (spec < 0)
+			{
+				const FieldDescriptor *field_desc = descriptor_->FindFieldByNumber(predicate.field);
+				spec = add_field(0,predicate.field,field_desc ? field_desc->name() : "");
+			}
+			valid_ = spec >= 0;
+
+			const bool string_field = valid_ && specs_[spec].type == ColumnType::STRING;
+			const bool string_value = predicate.kind == Predicate::ValueKind::STRING;
+			if (valid_ && string_field != string_value)
+			{
+				fail_reason_ = "predicate on field " + std::to_string(predicate.field) +
+					(string_field ? " needs a string value" : " needs a numeric value");
+				valid_ = false;
+			}
+			predicate_specs_.push_back(spec);
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// public methods
+	//-------------------------------------------------------------------------
+
+	bool
+	Projection::is_valid() const
+	{
+		return valid_;
+	}
+
+	bool
+	Projection::scan(
+		const std::vector<std::string> &record_paths,
+		ProjectionResult &result,
+		const ScanOptions &options)
+	{
+		result = make_result();
+		if ( ! valid_)
+		{
+			fail_reason_ = "Projection is invalid";
+			return false;
+		}
+		fail_reason_ = "";
+
+		// every chunk is extracted into a result of its own, which are
+		// concatenated in record order once the workers are done
+		ScanOptions scan_options = options;
+		scan_options.ordered = false;
+		ParallelScan scan(record_paths,scan_options);
+		std::vector<ProjectionResult> partials(scan.chunks().size(),result);
+
+		std::mutex malformed_mutex;
+		std::string malformed;
+		bool okay = scan.scan_raw([&](const ScanItem &item, std::string_view item_data){
+			if ( ! apply(item_data,item,partials[item.chunk]))
+			{
+				std::lock_guard<std::mutex> lock(malformed_mutex);
+				malformed = "item " + std::to_string(item.item) + " of record '" +
+					record_paths[item.record] + "' is malformed";
+				return false;
+			}
+			return true;
+		});
+
+		if ( ! okay)
+		{
+			fail_reason_ = malformed.empty() ? scan.reason() : malformed;
+			return false;
+		}
+
+		for (auto &partial : partials)
+		{
+			result.items.insert(result.items.end(),partial.items.begin(),partial.items.end());
+			for (size_t c=0; c<result.columns.size(); c++)
+			{
+				Column &column = result.columns[c];
+				Column &part = partial.columns[c];
+				column.int_values.insert(column.int_values.end(),part.int_values.begin(),part.int_values.end());
+				column.uint_values.insert(column.uint_values.end(),part.uint_values.begin(),part.uint_values.end());
+				column.double_values.insert(column.double_values.end(),part.double_values.begin(),part.double_values.end());
+				column.string_values.insert(column.string_values.end(),
+					std::make_move_iterator(part.string_values.begin()),
+					std::make_move_iterator(part.string_values.end()));
+				column.present.insert(column.present.end(),part.present.begin(),part.present.end());
+			}
+			partial = ProjectionResult();
+		}
+		return true;
+	}
+
+	bool
+	Projection::apply(
+		std::string_view item_data,
+		const ScanItem &item,
+		ProjectionResult &result) const
+	{
+		// reused by every item the thread applies the Projection to
+		static thread_local std::vector<FieldValue> values;
+
+		if ( ! valid_ || ! decode(item_data,values))
+		{
+			return false;
+		}
+
+		for (size_t p=0; p<predicates_.size(); p++)
+		{
+			const size_t spec = predicate_specs_[p];
+			if ( ! matches(predicates_[p],spec,values[spec]))
+			{
+				return true;
+			}
+		}
+
+		result.items.push_back(item);
+		for (size_t c=0; c<num_columns_; c++)
+		{
+			const FieldValue &value = values[c];
+			Column &column = result.columns[c];
+			switch (column.type)
+			{
+				case ColumnType::INT64:
+					column.int_values.push_back(value.int_value);
+					break;
+				case ColumnType::UINT64:
+				case ColumnType::BOOL:
+					column.uint_values.push_back(value.uint_value);
+					break;
+				case ColumnType::DOUBLE:
+					column.double_values.push_back(value.double_value);
+					break;
+				case ColumnType::STRING:
+					column.string_values.emplace_back(value.string_value);
+					break;
+			}
+			column.present.push_back(value.present);
+		}
+		return true;
+	}
+
+	ProjectionResult
+	Projection::make_result() const
+	{
+		ProjectionResult result;
+		for (size_t c=0; c<num_columns_; c++)
+		{
+			Column column;
+			column.field = specs_[c].descriptor->number();
+			column.name = specs_[c].name;
+			column.type = specs_[c].type;
+			result.columns.push_back(column);
+		}
+		return result;
+	}
+
+	std::string
+	Projection::reason()
+	{
+		return std::move(fail_reason_);
+	}
+
+	//-------------------------------------------------------------------------
+	// protected methods
+	//-------------------------------------------------------------------------
+
+	int
+	Projection::find_field(
+		size_t node,
+		uint32_t field) const
+	{
+		const std::vector<int> &spec_by_field = nodes_[node].spec_by_field;
+		return field < spec_by_field.size() ? spec_by_field[field] : -1;
+	}
+
+	int
+	Projection::add_field(
+		size_t node,
+		uint32_t field,
+		const std::string &name)
+	{
+		const google::protobuf::Descriptor *node_desc = nodes_[node].descriptor;
+		const FieldDescriptor *field_desc = node_desc->FindFieldByNumber(field);
+		if (field_desc == nullptr)
+		{
+			fail_reason_ = "message '" + node_desc->full_name() + "' has no field " + std::to_string(field);
+			return -1;
+		}
+		else if (field_desc->is_repeated() || field_desc->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE)
+		{
+			fail_reason_ = "field '" + name + "' isn't a singular scalar or string field";
+			return -1;
+		}
+
+		FieldSpec spec;
+		spec.descriptor = field_desc;
+		spec.field_type = field_desc->type();
+		spec.wire_type = wire_type_of(spec.field_type);
+		spec.name = name;
+		switch (field_desc->cpp_type())
+		{
+			case FieldDescriptor::CPPTYPE_INT32:
+				spec.type = ColumnType::INT64;
+				spec.default_value.int_value = field_desc->default_value_int32();
+				break;
+			case FieldDescriptor::CPPTYPE_INT64:
+				spec.type = ColumnType::INT64;
+				spec.default_value.int_value = field_desc->default_value_int64();
+				break;
+			case FieldDescriptor::CPPTYPE_ENUM:
+				spec.type = ColumnType::INT64;
+				spec.default_value.int_value = field_desc->default_value_enum()->number();
+				break;
+			case FieldDescriptor::CPPTYPE_UINT32:
+				spec.type = ColumnType::UINT64;
+				spec.default_value.uint_value = field_desc->default_value_uint32();
+				break;
+			case FieldDescriptor::CPPTYPE_UINT64:
+				spec.type = ColumnType::UINT64;
+				spec.default_value.uint_value = field_desc->default_value_uint64();
+				break;
+			case FieldDescriptor::CPPTYPE_FLOAT:
+				spec.type = ColumnType::DOUBLE;
+				spec.default_value.double_value = field_desc->default_value_float();
+				break;
+			case FieldDescriptor::CPPTYPE_DOUBLE:
+				spec.type = ColumnType::DOUBLE;
+				spec.default_value.double_value = field_desc->default_value_double();
+				break;
+			case FieldDescriptor::CPPTYPE_BOOL:
+				spec.type = ColumnType::BOOL;
+				spec.default_value.uint_value = field_desc->default_value_bool();
+				break;
+			default:
+				spec.type = ColumnType::STRING;
+				// owned by the descriptor, so views of it stay valid
+				spec.default_value.string_value = field_desc->default_value_string();
+				break;
+		}
+
+		std::vector<int> &spec_by_field = nodes_[node].spec_by_field;
+		if (spec_by_field.size() <= field)
+		{
+			spec_by_field.resize(field + 1,-1);
+		}
+		spec_by_field[field] = specs_.size();
+		specs_.push_back(spec);
+		return specs_.size() - 1;
+	}
+
+	int
+	Projection::add_path(
+		const FieldPath &field)
+	{
+		if (field.path.empty())
+		{
+			if (find_field(0,field.number) >= 0)
+			{
+				fail_reason_ = "field " + std::to_string(field.number) + " is projected twice";
+				return -1;
+			}
+			const FieldDescriptor *field_desc = descriptor_->FindFieldByNumber(field.number);
+			return add_field(0,field.number,field_desc ? field_desc->name() : "");
+		}
+
+		const std::string &path = field.path;
+		size_t node = 0;
+		size_t name_start = 0;
+		while (true)
+		{
+			const size_t name_end = std::min(path.find('.',name_start),path.size());
+			const std::string name = path.substr(name_start,name_end - name_start);
+			const google::protobuf::Descriptor *node_desc = nodes_[node].descriptor;
+			const FieldDescriptor *field_desc = node_desc->FindFieldByName(name);
+			if (field_desc == nullptr)
+			{
+				fail_reason_ = "message '" + node_desc->full_name() + "' has no field '" + name + "'";
+				return -1;
+			}
+
+			const uint32_t number = field_desc->number();
+			if (name_end == path.size())
+			{
+				if (find_field(node,number) >= 0)
+				{
+					fail_reason_ = "field '" + path + "' is projected twice";
+					return -1;
+				}
+				return add_field(node,number,path);
+			}
+			else if (field_desc->is_repeated() || field_desc->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE)
+			{
+				fail_reason_ = "field '" + path.substr(0,name_end) + "' isn't a singular message field";
+				return -1;
+			}
+
+			// walk into the nested message, adding it if it's the first of
+			// its fields that's needed
+			std::vector<int> &node_by_field = nodes_[node].node_by_field;
+			if (node_by_field.size() <= number)
+			{
+				node_by_field.resize(number + 1,-1);
+			}
+			if (node_by_field[number] < 0)
+			{
+				node_by_field[number] = nodes_.size();
+				MessageNode nested;
+				nested.descriptor = field_desc->message_type();
+				nodes_.push_back(nested);
+			}
+			node = nodes_[node].node_by_field[number];
+			name_start = name_end + 1;
+		}
+	}
+
+	bool
+	Projection::decode(
+		std::string_view item_data,
+		std::vector<FieldValue> &values) const
+	{
+		values.resize(specs_.size());
+		for (size_t s=0; s<specs_.size(); s++)
+		{
+			values[s] = specs_[s].default_value;
+		}
+
+		const uint8_t *pos = (const uint8_t*)item_data.data();
+		size_t remaining = specs_.size();
+		return decode_message(0,pos,pos + item_data.size(),values,remaining);
+	}
+
+	bool
+	Projection::decode_message(
+		size_t node,
+		const uint8_t *pos,
+		const uint8_t *end,
+		std::vector<FieldValue> &values,
+		size_t &remaining) const
+	{
+		const MessageNode &message = nodes_[node];
+		while (pos < end && (remaining > 0 || ! options_.assume_canonical))
+		{
+			uint64_t tag = 0;
+			if ( ! read_varint(pos,end,tag))
+			{
+				return false;
+			}
+			const uint32_t wire_type = tag & 0x7;
+			const uint64_t field = tag >> 3;
+			const int spec_idx = field < message.spec_by_field.size() ? message.spec_by_field[field] : -1;
+			const int node_idx = field < message.node_by_field.size() ? message.node_by_field[field] : -1;
+			if (node_idx >= 0 && wire_type == WIRETYPE_LENGTH_DELIMITED)
+			{
+				uint64_t length = 0;
+				if ( ! read_varint(pos,end,length) || length > (uint64_t)(end - pos))
+				{
+					return false;
+				}
+				if ( ! decode_message(node_idx,pos,pos + length,values,remaining))
+				{
+					return false;
+				}
+				pos += length;
+				continue;
+			}
+			else if (spec_idx < 0 || wire_type != specs_[spec_idx].wire_type)
+			{
+				if ( ! skip_field(wire_type,pos,end))
+				{
+					return false;
+				}
+				continue;
+			}
+
+			const FieldSpec &spec = specs_[spec_idx];
+			FieldValue &value = values[spec_idx];
+			if ( ! value.present)
+			{
+				remaining--;
+				value.present = true;
+			}
+
+			uint64_t raw = 0;
+			if (wire_type == WIRETYPE_VARINT)
+			{
+				if ( ! read_varint(pos,end,raw))
+				{
+					return false;
+				}
+			}
+			else if (wire_type == WIRETYPE_FIXED64 || wire_type == WIRETYPE_FIXED32)
+			{
+				const size_t width = wire_type == WIRETYPE_FIXED64 ? 8 : 4;
+				if ((size_t)(end - pos) < width)
+				{
+					return false;
+				}
+				// the wire format is little endian, like the hosts we run on
+				memcpy(&raw,pos,width);
+				pos += width;
+			}
+			else
+			{
+				if ( ! read_varint(pos,end,raw) || raw > (uint64_t)(end - pos))
+				{
+					return false;
+				}
+				value.string_value = std::string_view((const char*)pos,raw);
+				pos += raw;
+				continue;
+			}
+
+			switch (spec.field_type)
+			{
+				case FieldDescriptor::TYPE_INT32:
+				case FieldDescriptor::TYPE_SFIXED32:
+				case FieldDescriptor::TYPE_ENUM:
+					value.int_value = (int32_t)raw;
+					break;
+				case FieldDescriptor::TYPE_INT64:
+				case FieldDescriptor::TYPE_SFIXED64:
+					value.int_value = (int64_t)raw;
+					break;
+				case FieldDescriptor::TYPE_SINT32:
+					value.int_value = (int32_t)((uint32_t)(raw >> 1) ^ -(uint32_t)(raw & 1));
+					break;
+				case FieldDescriptor::TYPE_SINT64:
+					value.int_value = (int64_t)((raw >> 1) ^ -(raw & 1));
+					break;
+				case FieldDescriptor::TYPE_UINT32:
+				case FieldDescriptor::TYPE_FIXED32:
+					value.uint_value = (uint32_t)raw;
+					break;
+				case FieldDescriptor::TYPE_BOOL:
+					value.uint_value = raw != 0;
+					break;
+				case FieldDescriptor::TYPE_FLOAT:
+				{
+					float f;
+					uint32_t bits = raw;
+					memcpy(&f,&bits,sizeof(f));
+					value.double_value = f;
+					break;
+				}
+				case FieldDescriptor::TYPE_DOUBLE:
+					memcpy(&value.double_value,&raw,sizeof(double));
+					break;
+				default:
+					value.uint_value = raw;
+					break;
+			}
+		}
+		return true;
+	}
+
+	bool
+	Projection::matches(
+		const Predicate &predicate,
+		size_t spec,
+		const FieldValue &value) const
+	{
+		int cmp = 0;
+		if (predicate.kind == Predicate::ValueKind::STRING)
+		{
+			cmp = compare_values(value.string_value,std::string_view(predicate.string_value));
+		}
+		else
+		{
+			// long double holds any int64 or uint64 exactly on x86
+			long double field_value = value.uint_value;
+			if (specs_[spec].type == ColumnType::INT64)
+			{
+				field_value = value.int_value;
+			}
+			else if (specs_[spec].type == ColumnType::DOUBLE)
+			{
+				field_value = value.double_value;
+			}
+
+			long double predicate_value = predicate.uint_value;
+			if (predicate.kind == Predicate::ValueKind::INT)
+			{
+				predicate_value = predicate.int_value;
+			}
+			else if (predicate.kind == Predicate::ValueKind::DOUBLE)
+			{
+				predicate_value = predicate.double_value;
+			}
+
+			// NaN is unequal to everything
+			if (std::isnan(field_value) || std::isnan(predicate_value))
+			{
+				return predicate.op == CompareOp::NE;
+			}
+			cmp = compare_values(field_value,predicate_value);
+		}
+
+		switch (predicate.op)
+		{
+			case CompareOp::EQ: return cmp == 0;
+			case CompareOp::NE: return cmp != 0;
+			case CompareOp::LT: return cmp < 0;
+			case CompareOp::LE: return cmp <= 0;
+			case CompareOp::GT: return cmp > 0;
+			case CompareOp::GE: return cmp >= 0;
+		}
+		return false;
+	}
+
+}// protorecord
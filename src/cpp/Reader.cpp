@@ -1,25 +1,77 @@
+#include "protorecord/Compression.h"
 #include "protorecord/Utils.h"
 #include "protorecord/Reader.h"
 
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <thread>
+#include <unistd.h>
+
 namespace protorecord
 {
+	// how often follow() checks the record when inotify isn't available
+	const std::chrono::microseconds FOLLOW_POLL_INTERVAL = std::chrono::milliseconds(1);
+
+	// the longest follow() sleeps for without checking the record
+	const std::chrono::microseconds FOLLOW_MAX_WAIT = std::chrono::milliseconds(100);
+
 	//-------------------------------------------------------------------------
 	// constructors/destructors
 	//-------------------------------------------------------------------------
 
 	Reader::Reader(
 		const std::string &filepath)
+	 : Reader(filepath,ReaderOptions())
+	{
+	}
+
+	Reader::Reader(
+		const std::string &filepath,
+		const ReaderOptions &options)
 	 : initialized_(false)
 	 , index_summary_()
+	 , index_format_(PROTORECORD_INDEX_FORMAT_V1)
+	 , item_block_offset_(ITEM_BLOCK_OFFSET)
+	 , item_block_stride_(ITEM_BLOCK_STRIDE)
 	 , index_item_()
+	 , v1_index_item_()
+	 , use_mmap_(options.use_mmap)
+	 , access_pattern_(options.access_pattern)
+	 , storage_backend_(options.storage_backend)
 	 , index_file_()
-	 , data_file_()
+	 , index_map_()
+	 , record_path_(filepath)
+	 , data_files_()
+	 , mapped_data_files_()
+	 , blocks_file_()
+	 , blocks_map_()
+	 , compressed_(false)
+	 , block_entry_()
+	 , cached_block_num_(-1)
+	 , block_cache_()
+	 , inotify_fd_(-1)
+	 , follow_polling_(false)
+	 , handle_mutex_()
+	 , schema_()
+	 , schema_loaded_(false)
+	 , schema_pool_()
+	 , schema_factory_()
+	 , schema_descriptor_(nullptr)
+	 , schema_prototype_(nullptr)
+	 , key_index_()
+	 , key_filter_()
 	 , next_item_num_(0)
 	 , failbit_(false)
 	 , fail_reason_("")
 	{
-		buffer_.resize(64000);
+		// always large enough for the record's version and summary blocks
+		buffer_.resize(std::max<size_t>(options.max_item_size,UINT8_MAX));
 		initialized_ = init_record(filepath);
+		if (initialized_ && options.prefetch_items > 0)
+		{
+			prefetcher_.reset(new Prefetcher(filepath,options));
+		}
 	}
 
 	Reader::~Reader()
@@ -40,19 +92,233 @@ namespace protorecord
 			next_item_num_ < index_summary_.total_items();
 	}
 
+	bool
+	Reader::seek(
+		uint64_t item_idx)
+	{
+		fail_reason_ = "";
+		bool okay = initialized_;
+		if ( ! okay)
+		{
+			fail_reason_ = "Reader not initialized";
+		}
+		else if (item_idx > index_summary_.total_items())
+		{
+			fail_reason_ = "can't seek to item " + std::to_string(item_idx) +
+				"; record only has " + std::to_string(index_summary_.total_items());
+			okay = false;
+		}
+		else
+		{
+			// a successful seek gives the Reader a fresh start
+			next_item_num_ = item_idx;
+			failbit_ = false;
+		}
+		return okay;
+	}
+
+	uint64_t
+	Reader::tell()
+	{
+		fail_reason_ = "";
+		return next_item_num_;
+	}
+
+	bool
+	Reader::get_raw(
+		uint64_t item_idx,
+		std::string_view &item_data)
+	{
+		fail_reason_ = "";
+
+		// use our own entry so the next item's state isn't disturbed
+		IndexEntry entry;
+		bool okay = get_index_item(item_idx,entry);
+
+		const char *data = nullptr;
+		okay = okay && read_item(entry,data);
+		if (okay)
+		{
+			item_data = std::string_view(data,entry.size);
+		}
+		return okay;
+	}
+
 	bool
 	Reader::get_next_timestamp(
 		uint64_t &item_timestamp)
 	{
 		fail_reason_ = "";
-		bool okay = get_index_item(next_item_num_,index_item_);
-		if (okay && index_item_.has_timestamp())
+		const IndexEntry *entry = nullptr;
+		const char *item_data = nullptr;
+		bool okay = true;
+		if (prefetcher_ && next_item_num_ < this->size() &&
+			prefetcher_->peek(next_item_num_,entry,item_data))
+		{
+			index_item_ = *entry;
+		}
+		else
+		{
+			okay = get_index_item(next_item_num_,index_item_);
+		}
+
+		if (okay && has_timestamps())
+		{
+			item_timestamp = index_item_.timestamp;
+		}
+		return okay;
+	}
+
+	bool
+	Reader::seek_to_time(
+		uint64_t timestamp_us)
+	{
+		fail_reason_ = "";
+		uint64_t item_idx = 0;
+		bool okay = find_time(timestamp_us,item_idx);
+		okay = okay && seek(item_idx);
+		return okay;
+	}
+
+	ItemRange
+	Reader::range(
+		uint64_t begin_us,
+		uint64_t end_us)
+	{
+		fail_reason_ = "";
+		ItemRange range;
+		bool okay = find_time(begin_us,range.first);
+		okay = okay && find_time(end_us,range.last);
+		if ( ! okay || range.last < range.first)
+		{
+			range.first = range.last = 0;
+		}
+		return range;
+	}
+
+	ItemView
+	Reader::items()
+	{
+		return items(ItemRange{0,size()});
+	}
+
+	ItemView
+	Reader::items(
+		const ItemRange &range)
+	{
+		const uint64_t last = std::min<uint64_t>(range.last,size());
+		const uint64_t first = std::min(range.first,last);
+		return ItemView{ItemIterator(this,first),ItemIterator(this,last)};
+	}
+
+	ItemIterator
+	Reader::begin()
+	{
+		return ItemIterator(this,0);
+	}
+
+	ItemIterator
+	Reader::end()
+	{
+		return ItemIterator(this,size());
+	}
+
+	bool
+	Reader::refresh()
+	{
+		fail_reason_ = "";
+		bool okay = initialized_;
+		if ( ! okay)
+		{
+			fail_reason_ = "Reader not initialized";
+			return false;
+		}
+
+		// the summary is patched in place, so read it from disk again
+		index_file_->invalidate();
+		protorecord::IndexSummary summary;
+		if ( ! read_summary(summary))
+		{
+			fail_reason_ = "failed to parse IndexSummary";
+			return false;
+		}
+		else if (summary.total_items() < index_summary_.total_items())
+		{
+			fail_reason_ = "record shrank from " + std::to_string(index_summary_.total_items()) +
+				" to " + std::to_string(summary.total_items()) + " items. was it overwritten?";
+			return false;
+		}
+
+		const bool grew = summary.total_items() > index_summary_.total_items();
+		const uint32_t old_data_files = index_summary_.data_files();
+		index_summary_ = summary;
+		if ( ! grew)
+		{
+			return true;
+		}
+
+		// the files may have been read (or mapped) before the new items
+		// were written to them. earlier segments are complete though.
+		for (auto &data_file : data_files_)
+		{
+			if (data_file)
+			{
+				data_file->invalidate();
+			}
+		}
+		if (blocks_file_)
+		{
+			blocks_file_->invalidate();
+		}
+		if (use_mmap_)
+		{
+			okay = index_map_.open(record_path_ + "/index") && index_map_.advise(access_pattern_);
+			if (okay && blocks_map_.is_open())
+			{
+				okay = blocks_map_.open(record_path_ + "/blocks");
+			}
+			for (size_t f=old_data_files>0 ? old_data_files - 1 : 0; f<mapped_data_files_.size(); f++)
+			{
+				mapped_data_files_[f].reset();
+			}
+			if ( ! okay)
+			{
+				fail_reason_ = "failed to map the record again";
+			}
+		}
+
+		if (prefetcher_)
 		{
-			item_timestamp = index_item_.timestamp();
+			prefetcher_->refresh();
 		}
+
+		// new items give a Reader that ran off the end a fresh start
+		failbit_ = ! okay;
 		return okay;
 	}
 
+	bool
+	Reader::follow(
+		std::chrono::microseconds timeout)
+	{
+		// watch before refreshing, so no checkpoint in between goes unnoticed
+		watch_index();
+
+		const auto deadline = get_mono_time() + timeout;
+		bool okay = refresh();
+		while (okay && next_item_num_ >= index_summary_.total_items())
+		{
+			auto now = get_mono_time();
+			if (now >= deadline)
+			{
+				break;
+			}
+			wait_for_change(deadline - now);
+			okay = refresh();
+		}
+		return okay && next_item_num_ < index_summary_.total_items();
+	}
+
 	size_t
 	Reader::size()
 	{
@@ -93,6 +359,31 @@ namespace protorecord
 		return is_flag_set(protorecord::Flags::HAS_TIMESTAMPS);
 	}
 
+	bool
+	Reader::has_dropped_items()
+	{
+		fail_reason_ = "";
+		return is_flag_set(protorecord::Flags::HAS_DROPPED_ITEMS);
+	}
+
+	size_t
+	Reader::dropped()
+	{
+		fail_reason_ = "";
+		if (is_flag_set(protorecord::Flags::HAS_DROPPED_ITEMS))
+		{
+			return index_summary_.dropped_items();
+		}
+		return 0;
+	}
+
+	bool
+	Reader::has_compressed_blocks()
+	{
+		fail_reason_ = "";
+		return is_flag_set(protorecord::Flags::HAS_COMPRESSED_BLOCKS);
+	}
+
 	bool
 	Reader::get_start_time(
 		uint64_t &start_time_us)
@@ -117,6 +408,166 @@ namespace protorecord
 		return version_;
 	}
 
+	std::string
+	Reader::message_type()
+	{
+		fail_reason_ = "";
+		if (load_schema())
+		{
+			return schema_.type_name();
+		}
+		return "";
+	}
+
+	const google::protobuf::Descriptor *
+	Reader::message_descriptor()
+	{
+		fail_reason_ = "";
+		load_schema();
+		return schema_descriptor_;
+	}
+
+	std::unique_ptr<google::protobuf::Message>
+	Reader::new_message()
+	{
+		fail_reason_ = "";
+		if ( ! load_schema())
+		{
+			return nullptr;
+		}
+		return std::unique_ptr<google::protobuf::Message>(schema_prototype_->New());
+	}
+
+	bool
+	Reader::has_key_index()
+	{
+		fail_reason_ = "";
+		return is_flag_set(protorecord::Flags::HAS_KEY_INDEX);
+	}
+
+	bool
+	Reader::lookup(
+		int64_t key,
+		std::vector<uint64_t> &items)
+	{
+		fail_reason_ = "";
+		items.clear();
+		if ( ! load_key_index())
+		{
+			return false;
+		}
+		else if (key_index_->key_type() == KeyType::BYTES)
+		{
+			fail_reason_ = "key index has string keys";
+			return false;
+		}
+
+		std::string encoded;
+		if (encode_int_key(key_index_->key_type(),key,encoded))
+		{
+			key_index_->lookup(encoded,items);
+		}
+		return true;
+	}
+
+	bool
+	Reader::lookup(
+		const std::string &key,
+		std::vector<uint64_t> &items)
+	{
+		fail_reason_ = "";
+		items.clear();
+		if ( ! load_key_index())
+		{
+			return false;
+		}
+		else if (key_index_->key_type() != KeyType::BYTES)
+		{
+			fail_reason_ = "key index has integer keys";
+			return false;
+		}
+
+		key_index_->lookup(key,items);
+		return true;
+	}
+
+	bool
+	Reader::has_key_filters()
+	{
+		fail_reason_ = "";
+		return is_flag_set(protorecord::Flags::HAS_KEY_FILTERS);
+	}
+
+	bool
+	Reader::might_contain(
+		int64_t key)
+	{
+		fail_reason_ = "";
+		if ( ! load_key_filter())
+		{
+			return true;
+		}
+
+		std::string encoded;
+		return encode_int_key(key_filter_->key_type(),key,encoded) && key_filter_->might_contain(encoded);
+	}
+
+	bool
+	Reader::might_contain(
+		const std::string &key)
+	{
+		fail_reason_ = "";
+		if ( ! load_key_filter())
+		{
+			return true;
+		}
+		return key_filter_->key_type() == KeyType::BYTES && key_filter_->might_contain(key);
+	}
+
+	bool
+	Reader::key_ranges(
+		int64_t key,
+		std::vector<ItemRange> &ranges)
+	{
+		fail_reason_ = "";
+		ranges.clear();
+		if ( ! load_key_filter())
+		{
+			return false;
+		}
+
+		std::string encoded;
+		if (encode_int_key(key_filter_->key_type(),key,encoded))
+		{
+			add_key_ranges(encoded,ranges);
+		}
+		return true;
+	}
+
+	bool
+	Reader::key_ranges(
+		const std::string &key,
+		std::vector<ItemRange> &ranges)
+	{
+		fail_reason_ = "";
+		ranges.clear();
+		if ( ! load_key_filter())
+		{
+			return false;
+		}
+		else if (key_filter_->key_type() == KeyType::BYTES)
+		{
+			add_key_ranges(key,ranges);
+		}
+		return true;
+	}
+
+	std::string
+	Reader::reason()
+	{
+		return std::move(fail_reason_);
+	}
+
 	//-------------------------------------------------------------------------
 	// protected methods
 	//-------------------------------------------------------------------------
@@ -129,39 +580,49 @@ namespace protorecord
 		bool okay = true;
 
 		// open the index file
-		const auto INDEX_FLAGS = std::ofstream::in | std::ofstream::binary;
 		const auto INDEX_FILEPATH = filepath + "/index";
 		if (okay)
 		{
-			index_file_.open(INDEX_FILEPATH,INDEX_FLAGS);
-			if ( ! index_file_.good())
+			index_file_ = make_input_file(storage_backend_,access_pattern_);
+			if ( ! index_file_->open(INDEX_FILEPATH))
 			{
 				fail_reason_ = "failed to open index file '" + INDEX_FILEPATH + "'";
 				okay = false;
 			}
 		}
 
-		// open the data file
-		const auto DATA_FLAGS = std::ofstream::in | std::ofstream::binary;
-		const auto DATA_FILEPATH = filepath + "/data";
-		if (okay)
+		// in mmap mode the index is read out of a mapping rather than the
+		// file. the file is still used to parse the header below.
+		if (okay && use_mmap_)
 		{
-			data_file_.open(DATA_FILEPATH,DATA_FLAGS);
-			if ( ! data_file_.good())
+			if (index_map_.open(INDEX_FILEPATH))
 			{
-				fail_reason_ = "failed to open data file '" + DATA_FILEPATH + "'";
+				index_map_.advise(access_pattern_);
+			}
+			else
+			{
+				fail_reason_ = "failed to map index file '" + INDEX_FILEPATH + "'";
 				okay = false;
 			}
 		}
 
+		// open the first data file. the rest are opened as they're needed.
+		if (okay && use_mmap_ && get_mapped_data_file(0) == nullptr)
+		{
+			okay = false;
+		}
+		else if (okay && ! use_mmap_ && get_data_file(0) == nullptr)
+		{
+			okay = false;
+		}
+
 		// set version to invalid default
 		version_.set_major(0);
 		version_.set_minor(0);
 		version_.set_patch(0);
 
 		// intialize index item
-		index_item_.set_offset(0);
-		index_item_.set_size(0);
+		index_item_ = IndexEntry();
 
 		// initialize index summary
 		index_summary_.set_total_items(0);
@@ -174,9 +635,8 @@ namespace protorecord
 			if (okay)
 			{
 				uint8_t version_size = 0;
-				index_file_.read((char*)&version_size,1);// TODO check return
-				index_file_.read(buffer_.data(),version_size);
-				if ( ! index_file_.eof())
+				if (index_file_->read(0,1,(char*)&version_size) &&
+					index_file_->read(1,version_size,buffer_.data()))
 				{
 					version_.ParseFromArray(buffer_.data(),version_size);
 
@@ -186,6 +646,7 @@ namespace protorecord
 						fail_reason_ = "file/library version incompatibility";
 						okay = false;
 					}
+					index_format_ = version_.index_format();
 				}
 				else
 				{
@@ -195,22 +656,10 @@ namespace protorecord
 			}
 
 			// read IndexSummary from record
-			if (okay)
+			if (okay && ! read_summary(index_summary_))
 			{
-				uint8_t summary_size = 0;
-				index_file_.seekg(SUMMARY_BLOCK_OFFSET);
-				index_file_.read((char*)&summary_size,1);// TODO check return
-				index_file_.read(buffer_.data(),summary_size);
-
-				if ( ! index_file_.eof())
-				{
-					index_summary_.ParseFromArray(buffer_.data(),summary_size);
-				}
-				else
-				{
-					fail_reason_ = "index file too small to parse IndexSummary";
-					okay = false;
-				}
+				fail_reason_ = "index file too small to parse IndexSummary";
+				okay = false;
 			}
 		}
 		catch (const std::exception &ex)
@@ -225,73 +674,733 @@ namespace protorecord
 			okay = false;
 		}
 
-		return okay;
-	}
-
-	void
-	Reader::close()
-	{
-		index_file_.close();
-		data_file_.close();
-	}
+		// figure out where the items are laid out in the index
+		if (okay && index_format_ == PROTORECORD_INDEX_FORMAT_V2)
+		{
+			bool has_timestamps = index_summary_.flags() & protorecord::Flags::HAS_TIMESTAMPS;
+			item_block_offset_ = ITEM_BLOCK_OFFSET_V2;
+			item_block_stride_ = index_entry_stride_v2(has_timestamps);
+		}
+		else if (okay)
+		{
+			item_block_offset_ = ITEM_BLOCK_OFFSET;
+			item_block_stride_ = ITEM_BLOCK_STRIDE;
+		}
 
-	bool
-	Reader::is_compatible(
-		const Version &record_version)
-	{
-		bool okay = true;
+		// compressed records keep a table of where their blocks are
+		if (okay && (index_summary_.flags() & protorecord::Flags::HAS_COMPRESSED_BLOCKS))
+		{
+			Codec codec = (Codec)index_summary_.compression();
+			const auto BLOCKS_FILEPATH = filepath + "/blocks";
+			if ( ! codec_available(codec))
+			{
+				fail_reason_ = "record is compressed with '" + codec_name(codec) +
+					"', which is not supported by this build of protorecord";
+				okay = false;
+			}
+			else if (use_mmap_ && ! blocks_map_.open(BLOCKS_FILEPATH))
+			{
+				fail_reason_ = "failed to map block table '" + BLOCKS_FILEPATH + "'";
+				okay = false;
+			}
+			else if ( ! use_mmap_)
+			{
+				blocks_file_ = make_input_file(storage_backend_,access_pattern_);
+				if ( ! blocks_file_->open(BLOCKS_FILEPATH))
+				{
+					fail_reason_ = "failed to open block table '" + BLOCKS_FILEPATH + "'";
+					okay = false;
+				}
+			}
+			compressed_ = true;
+		}
+
+		return okay;
+	}
+
+	bool
+	Reader::read_summary(
+		protorecord::IndexSummary &summary)
+	{
+		uint8_t summary_size = 0;
+		bool okay = index_file_->read(SUMMARY_BLOCK_OFFSET,1,(char*)&summary_size);
+		okay = okay && index_file_->read(SUMMARY_BLOCK_OFFSET + 1,summary_size,buffer_.data());
+		okay = okay && summary.ParseFromArray(buffer_.data(),summary_size);
+		return okay;
+	}
+
+	void
+	Reader::watch_index()
+	{
+		// the Writer pwrite()s the summary at every checkpoint, which
+		// inotify reports as a modification of the index file
+		if (inotify_fd_ < 0 && ! follow_polling_)
+		{
+			inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (inotify_fd_ >= 0 &&
+				inotify_add_watch(inotify_fd_,(record_path_ + "/index").c_str(),IN_MODIFY) < 0)
+			{
+				::close(inotify_fd_);
+				inotify_fd_ = -1;
+			}
+			follow_polling_ = inotify_fd_ < 0;
+		}
+	}
+
+	void
+	Reader::wait_for_change(
+		std::chrono::microseconds timeout)
+	{
+		// wake up now and then regardless, in case an event gets lost
+		timeout = std::min(timeout,FOLLOW_MAX_WAIT);
+		if (follow_polling_)
+		{
+			std::this_thread::sleep_for(std::min(timeout,FOLLOW_POLL_INTERVAL));
+			return;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = inotify_fd_;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int timeout_ms = (timeout.count() + 999) / 1000;
+		if (poll(&pfd,1,timeout_ms) > 0)
+		{
+			// the events themselves don't matter, only that there were some
+			char events[4096];
+			while (read(inotify_fd_,events,sizeof(events)) > 0)
+			{
+			}
+		}
+	}
+
+	void
+	Reader::close()
+	{
+		if (inotify_fd_ >= 0)
+		{
+			::close(inotify_fd_);
+			inotify_fd_ = -1;
+		}
+
+		index_file_.reset();
+		index_map_.close();
+		blocks_file_.reset();
+		blocks_map_.close();
+		data_files_.clear();
+		mapped_data_files_.clear();
+	}
+
+	bool
+	Reader::is_compatible(
+		const Version &record_version)
+	{
+		// oldest minor version this Reader still knows how to parse
+		const uint32_t OLDEST_MINOR = 2;
+
+		bool okay = true;
 		okay = okay && record_version.major() == protorecord::major_version();
-		okay = okay && record_version.minor() == protorecord::minor_version();
-		okay = okay && record_version.patch() == protorecord::patch_version();
+		okay = okay && record_version.minor() >= OLDEST_MINOR;
+
+		// records from newer libraries may have changed the format
+		okay = okay && record_version.minor() <= protorecord::minor_version();
+
+		// make sure we understand how the index is laid out
+		okay = okay && (
+			record_version.index_format() == PROTORECORD_INDEX_FORMAT_V1 ||
+			record_version.index_format() == PROTORECORD_INDEX_FORMAT_V2);
 		return okay;
 	}
 
 	bool
 	Reader::get_index_item(
 		uint64_t item_idx,
-		protorecord::IndexItem &item_out)
+		IndexEntry &item_out)
 	{
 		fail_reason_ = "";
 		bool okay = initialized_ && item_idx < this->size();
+		if (initialized_ && ! okay)
+		{
+			fail_reason_ = "item " + std::to_string(item_idx) + " is out of range";
+		}
 
 		if (okay)
 		{
-			// compute position to IndexItem in file
-			std::streampos pos = ITEM_BLOCK_OFFSET + ITEM_BLOCK_STRIDE * item_idx;
+			// compute position to the item in file
+			uint64_t pos = item_block_offset_ + item_block_stride_ * item_idx;
+			const MappedFile *map = use_mmap_ ? &index_map_ : nullptr;
+			const char *block = nullptr;
 
-			// seek to position and read
-			uint8_t index_item_size = 0;
-			index_file_.seekg(pos);
-			index_file_.read((char*)&index_item_size,1);// TODO check return
-			index_file_.read(buffer_.data(),index_item_size);
-			if (index_file_.eof())
+			if (index_format_ == PROTORECORD_INDEX_FORMAT_V2)
 			{
-				fail_reason_ = "reached end of index file";
-				okay = false;
+				// fixed-width entry, no parsing required
+				if ( ! read_bytes(index_file_.get(),map,pos,item_block_stride_,block))
+				{
+					fail_reason_ = "reached end of index file";
+					okay = false;
+				}
+				else
+				{
+					decode_index_entry_v2(block,has_timestamps(),item_out);
+				}
 			}
 			else
 			{
-				try
+				// v1 items are prefixed with their size
+				uint8_t index_item_size = 0;
+				okay = read_bytes(index_file_.get(),map,pos,1,block);
+				if (okay)
+				{
+					index_item_size = (uint8_t)block[0];
+					okay = read_bytes(index_file_.get(),map,pos + 1,index_item_size,block);
+				}
+
+				if ( ! okay)
+				{
+					fail_reason_ = "reached end of index file";
+				}
+				else if (v1_index_item_.ParseFromArray(block,index_item_size))
 				{
-					index_item_.ParseFromArray(buffer_.data(),index_item_size);
+					item_out.offset = v1_index_item_.offset();
+					item_out.size = v1_index_item_.size();
+					item_out.file = v1_index_item_.file();
+					item_out.timestamp = v1_index_item_.timestamp();
 				}
-				catch (const std::exception &ex)
+				else
 				{
-					fail_reason_ = "caught std::exception. what: ";
-					fail_reason_ += ex.what();
+					fail_reason_ = "failed to parse index item";
 					okay = false;
 				}
-				catch (...)
+			}
+		}
+
+		return okay;
+	}
+
+	bool
+	Reader::get_index_items(
+		uint64_t first_idx,
+		size_t count,
+		std::vector<IndexEntry> &entries)
+	{
+		bool okay = initialized_ && first_idx + count <= this->size();
+		if (initialized_ && ! okay)
+		{
+			fail_reason_ = "items " + std::to_string(first_idx) + " to " +
+				std::to_string(first_idx + count) + " are out of range";
+		}
+
+		entries.resize(count);
+		if (okay && count > 0 && index_format_ == PROTORECORD_INDEX_FORMAT_V2)
+		{
+			// fixed-width entries are stored back to back
+			uint64_t pos = item_block_offset_ + item_block_stride_ * first_idx;
+			const MappedFile *map = use_mmap_ ? &index_map_ : nullptr;
+			const char *block = nullptr;
+			if ( ! read_bytes(index_file_.get(),map,pos,item_block_stride_ * count,block))
+			{
+				fail_reason_ = "reached end of index file";
+				okay = false;
+			}
+
+			for (size_t i=0; okay && i<count; i++)
+			{
+				decode_index_entry_v2(block + item_block_stride_ * i,has_timestamps(),entries[i]);
+			}
+		}
+		else
+		{
+			for (size_t i=0; okay && i<count; i++)
+			{
+				okay = get_index_item(first_idx + i,entries[i]);
+			}
+		}
+
+		return okay;
+	}
+
+	bool
+	Reader::read_batch_data(
+		const std::vector<IndexEntry> &entries,
+		const char *&batch_data)
+	{
+		batch_data = nullptr;
+		if (compressed_ || entries.empty())
+		{
+			// compressed items are served from the block cache anyway
+			return true;
+		}
+
+		// the items must be in one file, and stored in order
+		const IndexEntry &first = entries.front();
+		uint64_t end = first.offset;
+		for (const auto &entry : entries)
+		{
+			if (entry.file != first.file || entry.offset < end)
+			{
+				return true;
+			}
+			end = entry.offset + entry.size;
+		}
+
+		return read_data(first.file,first.offset,end - first.offset,batch_data);
+	}
+
+	bool
+	Reader::find_time(
+		uint64_t timestamp_us,
+		uint64_t &item_idx)
+	{
+		bool okay = initialized_;
+		if ( ! okay)
+		{
+			fail_reason_ = "Reader not initialized";
+		}
+		else if ( ! has_timestamps())
+		{
+			fail_reason_ = "record has no timestamps";
+			okay = false;
+		}
+
+		// lower bound search over [low,high)
+		uint64_t low = 0;
+		uint64_t high = index_summary_.total_items();
+		IndexEntry entry;
+		while (okay && low < high)
+		{
+			uint64_t mid = low + (high - low) / 2;
+			okay = get_index_item(mid,entry);
+			if (okay && entry.timestamp < timestamp_us)
+			{
+				low = mid + 1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+
+		if (okay)
+		{
+			item_idx = low;
+		}
+		return okay;
+	}
+
+	InputFile *
+	Reader::get_data_file(
+		uint32_t file_num)
+	{
+		if (file_num >= index_summary_.data_files())
+		{
+			fail_reason_ = "item refers to data file " + std::to_string(file_num) +
+				" but the record only has " + std::to_string(index_summary_.data_files());
+			return nullptr;
+		}
+		else if (file_num >= data_files_.size())
+		{
+			data_files_.resize(file_num + 1);
+		}
+
+		auto &data_file = data_files_[file_num];
+		if ( ! data_file)
+		{
+			const auto DATA_FILEPATH = data_file_path(record_path_,file_num);
+			data_file = make_input_file(storage_backend_,access_pattern_);
+			if ( ! data_file->open(DATA_FILEPATH))
+			{
+				fail_reason_ = "failed to open data file '" + DATA_FILEPATH + "'";
+				data_file.reset();
+			}
+		}
+
+		return data_file.get();
+	}
+
+	MappedFile *
+	Reader::get_mapped_data_file(
+		uint32_t file_num)
+	{
+		if (file_num >= index_summary_.data_files())
+		{
+			fail_reason_ = "item refers to data file " + std::to_string(file_num) +
+				" but the record only has " + std::to_string(index_summary_.data_files());
+			return nullptr;
+		}
+		else if (file_num >= mapped_data_files_.size())
+		{
+			mapped_data_files_.resize(file_num + 1);
+		}
+
+		auto &mapped_file = mapped_data_files_[file_num];
+		if ( ! mapped_file)
+		{
+			const auto DATA_FILEPATH = data_file_path(record_path_,file_num);
+			mapped_file.reset(new MappedFile());
+			if (mapped_file->open(DATA_FILEPATH))
+			{
+				mapped_file->advise(access_pattern_);
+			}
+			else
+			{
+				fail_reason_ = "failed to map data file '" + DATA_FILEPATH + "'";
+				mapped_file.reset();
+			}
+		}
+
+		return mapped_file.get();
+	}
+
+	bool
+	Reader::read_data(
+		uint32_t file_num,
+		uint64_t offset,
+		size_t size,
+		const char *&data)
+	{
+		bool okay = true;
+		if (use_mmap_)
+		{
+			MappedFile *map = get_mapped_data_file(file_num);
+			okay = map != nullptr;
+			okay = okay && read_bytes(nullptr,map,offset,size,data);
+		}
+		else
+		{
+			InputFile *file = get_data_file(file_num);
+			okay = file != nullptr;
+			okay = okay && read_bytes(file,nullptr,offset,size,data);
+		}
+
+		if ( ! okay && fail_reason_.empty())
+		{
+			fail_reason_ = "reached end of data file";
+		}
+		return okay;
+	}
+
+	bool
+	Reader::read_bytes(
+		InputFile *file,
+		const MappedFile *map,
+		uint64_t offset,
+		size_t size,
+		const char *&data)
+	{
+		bool okay = true;
+		if (map != nullptr)
+		{
+			// no copy, just point into the mapping
+			okay = offset + size <= map->size();
+			if (okay)
+			{
+				data = map->data() + offset;
+			}
+		}
+		else
+		{
+			if (buffer_.size() < size)
+			{
+				buffer_.resize(size * 2);
+			}
+
+			okay = file->read(offset,size,buffer_.data());
+			data = buffer_.data();
+		}
+		return okay;
+	}
+
+	bool
+	Reader::read_item(
+		const IndexEntry &entry,
+		const char *&item_data)
+	{
+		bool okay = true;
+
+		if (compressed_)
+		{
+			// the entry points into a decompressed block
+			okay = load_block(entry.file);
+			if (okay && (uint64_t)entry.offset + entry.size > block_entry_.raw_size)
+			{
+				fail_reason_ = "item extends past the end of block " + std::to_string(entry.file);
+				okay = false;
+			}
+			else if (okay)
+			{
+				item_data = block_cache_.data() + entry.offset;
+			}
+		}
+		else
+		{
+			okay = read_data(entry.file,entry.offset,entry.size,item_data);
+		}
+
+		return okay;
+	}
+
+	bool
+	Reader::load_block(
+		uint32_t block_num)
+	{
+		if (cached_block_num_ == (int64_t)block_num)
+		{
+			return true;
+		}
+
+		// forget the old block, block_entry_ is about to be overwritten
+		cached_block_num_ = -1;
+
+		bool okay = block_num < index_summary_.total_blocks();
+		if ( ! okay)
+		{
+			fail_reason_ = "item refers to block " + std::to_string(block_num) +
+				" but the record only has " + std::to_string(index_summary_.total_blocks());
+		}
+
+		// look the block up in the block table
+		const char *encoded = nullptr;
+		if (okay)
+		{
+			const MappedFile *map = use_mmap_ ? &blocks_map_ : nullptr;
+			uint64_t pos = (uint64_t)block_num * BLOCK_ENTRY_SIZE;
+			if (read_bytes(blocks_file_.get(),map,pos,BLOCK_ENTRY_SIZE,encoded))
+			{
+				decode_block_entry(encoded,block_entry_);
+			}
+			else
+			{
+				fail_reason_ = "reached end of block table";
+				okay = false;
+			}
+		}
+
+		// read the compressed block
+		const char *stored_data = nullptr;
+		okay = okay && read_data(block_entry_.file,block_entry_.offset,block_entry_.stored_size,stored_data);
+
+		if (okay)
+		{
+			if (block_cache_.size() < block_entry_.raw_size)
+			{
+				block_cache_.resize(block_entry_.raw_size);
+			}
+
+			okay = decompress_block(
+				(Codec)block_entry_.codec,
+				stored_data,
+				block_entry_.stored_size,
+				block_cache_.data(),
+				block_entry_.raw_size);
+			if ( ! okay)
+			{
+				fail_reason_ = "failed to decompress block " + std::to_string(block_num);
+			}
+		}
+
+		if (okay)
+		{
+			cached_block_num_ = block_num;
+		}
+		return okay;
+	}
+
+	bool
+	Reader::handle_entry(
+		uint64_t item_idx,
+		IndexEntry &entry)
+	{
+		std::lock_guard<std::mutex> lock(handle_mutex_);
+		return get_index_item(item_idx,entry);
+	}
+
+	bool
+	Reader::handle_data(
+		const IndexEntry &entry,
+		std::string_view &item_data)
+	{
+		// data that isn't mapped is overwritten by the next read, so every
+		// thread gets a copy of its own to parse outside of the lock
+		static thread_local std::vector<char> handle_buffer;
+
+		std::lock_guard<std::mutex> lock(handle_mutex_);
+		const char *data = nullptr;
+		bool okay = read_item(entry,data);
+		if (okay && use_mmap_ && ! compressed_)
+		{
+			item_data = std::string_view(data,entry.size);
+		}
+		else if (okay)
+		{
+			if (handle_buffer.size() < entry.size)
+			{
+				handle_buffer.resize(entry.size);
+			}
+			memcpy(handle_buffer.data(),data,entry.size);
+			item_data = std::string_view(handle_buffer.data(),entry.size);
+		}
+		return okay;
+	}
+
+	bool
+	Reader::load_schema()
+	{
+		if (schema_loaded_)
+		{
+			return true;
+		}
+		else if ( ! initialized_)
+		{
+			fail_reason_ = "Reader not initialized";
+			return false;
+		}
+
+		// a live record gets its schema with the first item, so keep
+		// looking until it shows up
+		const auto SCHEMA_FILEPATH = record_path_ + "/schema";
+		std::ifstream schema_file(SCHEMA_FILEPATH,std::ios::binary);
+		bool okay = schema_file.good();
+		if ( ! okay)
+		{
+			fail_reason_ = "record has no schema";
+		}
+		else if ( ! schema_.ParseFromIstream(&schema_file))
+		{
+			fail_reason_ = "failed to parse schema file '" + SCHEMA_FILEPATH + "'";
+			okay = false;
+		}
+
+		std::unique_ptr<google::protobuf::DescriptorPool> pool;
+		if (okay)
+		{
+			pool.reset(new google::protobuf::DescriptorPool());
+			for (int f=0; okay && f<schema_.files().file_size(); f++)
+			{
+				if (pool->BuildFile(schema_.files().file(f)) == nullptr)
 				{
-					fail_reason_ = "caught unknown exception";
+					fail_reason_ = "failed to build '" + schema_.files().file(f).name() + "' from schema";
 					okay = false;
 				}
 			}
 		}
 
+		const google::protobuf::Descriptor *descriptor = nullptr;
+		if (okay)
+		{
+			descriptor = pool->FindMessageTypeByName(schema_.type_name());
+			if (descriptor == nullptr)
+			{
+				fail_reason_ = "schema has no message type '" + schema_.type_name() + "'";
+				okay = false;
+			}
+		}
+
+		if (okay)
+		{
+			schema_pool_ = std::move(pool);
+			schema_factory_.reset(new google::protobuf::DynamicMessageFactory(schema_pool_.get()));
+			schema_descriptor_ = descriptor;
+			schema_prototype_ = schema_factory_->GetPrototype(descriptor);
+			schema_loaded_ = true;
+		}
 		return okay;
 	}
 
+	bool
+	Reader::load_key_index()
+	{
+		if (key_index_)
+		{
+			return true;
+		}
+		else if ( ! initialized_)
+		{
+			fail_reason_ = "Reader not initialized";
+			return false;
+		}
+		else if ( ! is_flag_set(protorecord::Flags::HAS_KEY_INDEX))
+		{
+			fail_reason_ = "record has no key index";
+			return false;
+		}
+
+		const auto KEYS_FILEPATH = record_path_ + "/keys";
+		std::unique_ptr<KeyIndex> key_index(new KeyIndex());
+		if ( ! key_index->open(KEYS_FILEPATH))
+		{
+			fail_reason_ = "failed to open key index '" + KEYS_FILEPATH + "'";
+			return false;
+		}
+		key_index_ = std::move(key_index);
+		return true;
+	}
+
+	bool
+	Reader::load_key_filter()
+	{
+		if (key_filter_)
+		{
+			return true;
+		}
+		else if ( ! initialized_)
+		{
+			fail_reason_ = "Reader not initialized";
+			return false;
+		}
+		else if ( ! is_flag_set(protorecord::Flags::HAS_KEY_FILTERS))
+		{
+			fail_reason_ = "record has no key filters";
+			return false;
+		}
+
+		const auto FILTERS_FILEPATH = record_path_ + "/filters";
+		std::unique_ptr<KeyFilter> key_filter(new KeyFilter());
+		if ( ! key_filter->open(FILTERS_FILEPATH))
+		{
+			fail_reason_ = "failed to open key filters '" + FILTERS_FILEPATH + "'";
+			return false;
+		}
+		key_filter_ = std::move(key_filter);
+		return true;
+	}
+
+	void
+	Reader::add_key_ranges(
+		std::string_view key,
+		std::vector<ItemRange> &ranges)
+	{
+		std::vector<std::pair<uint64_t,uint64_t>> filter_ranges;
+		key_filter_->key_ranges(key,filter_ranges);
+		for (const auto &range : filter_ranges)
+		{
+			ranges.push_back(ItemRange{range.first,range.second});
+		}
+	}
+
+	bool
+	Reader::encode_int_key(
+		KeyType key_type,
+		int64_t key,
+		std::string &encoded)
+	{
+		switch (key_type)
+		{
+			case KeyType::INT64:
+				encoded = encode_key(key);
+				return true;
+			case KeyType::UINT64:
+				// negative keys never match unsigned ones
+				if (key >= 0)
+				{
+					encoded = encode_key((uint64_t)key);
+					return true;
+				}
+				return false;
+			default:
+				return false;
+		}
+	}
+
 	bool
 	Reader::is_flag_set(
 		uint32_t flag)
@@ -307,4 +1416,62 @@ namespace protorecord
 	// private methods
 	//-------------------------------------------------------------------------
 
+	//-------------------------------------------------------------------------
+	// ItemHandle
+	//-------------------------------------------------------------------------
+
+	ItemHandle::ItemHandle()
+	 : ItemHandle(nullptr,0)
+	{
+	}
+
+	ItemHandle::ItemHandle(
+		Reader *reader,
+		uint64_t item_idx)
+	 : reader_(reader)
+	 , item_idx_(item_idx)
+	 , entry_()
+	 , has_entry_(false)
+	{
+	}
+
+	uint64_t
+	ItemHandle::index() const
+	{
+		return item_idx_;
+	}
+
+	uint32_t
+	ItemHandle::size() const
+	{
+		return load_entry() ? entry_.size : 0;
+	}
+
+	uint64_t
+	ItemHandle::timestamp() const
+	{
+		return load_entry() ? entry_.timestamp : 0;
+	}
+
+	std::string_view
+	ItemHandle::raw() const
+	{
+		std::string_view item_data;
+		if ( ! load_entry() || ! reader_->handle_data(entry_,item_data))
+		{
+			return std::string_view();
+		}
+		return item_data;
+	}
+
+	bool
+	ItemHandle::load_entry() const
+	{
+		if ( ! has_entry_ && reader_ != nullptr)
+		{
+			has_entry_ = reader_->handle_entry(item_idx_,entry_);
+		}
+		return has_entry_;
+	}
+
 }// protorecord
\ No newline at end of file
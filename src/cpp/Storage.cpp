@@ -0,0 +1,96 @@
+#include "protorecord/Storage.h"
+#include "protorecord/PosixStorage.h"
+
+#ifdef PROTORECORD_HAVE_IO_URING
+#include "protorecord/UringStorage.h"
+#endif
+
+namespace protorecord
+{
+	// number of bytes a PosixOutputFile buffers before writing
+	const size_t POSIX_WRITE_BUFFER_SIZE = 64 * 1024;
+
+	// number of bytes a PosixInputFile reads at a time for sequential access
+	const size_t POSIX_READ_WINDOW_SIZE = 64 * 1024;
+
+	// size of each of the two O_DIRECT write buffers
+	const size_t DIRECT_WRITE_BUFFER_SIZE = 1024 * 1024;
+
+	// number of bytes a MappedOutputFile grows its file by, unless told
+	const uint64_t DEFAULT_MAPPED_EXTENT = 64 * 1024 * 1024;
+
+	// size and number of the io_uring write buffers
+	const size_t URING_WRITE_BUFFER_SIZE = 256 * 1024;
+	const unsigned int URING_WRITE_BUFFERS = 8;
+
+	// size and number of the io_uring read-ahead chunks
+	const size_t URING_READ_CHUNK_SIZE = 256 * 1024;
+	const unsigned int URING_READ_CHUNKS = 4;
+
+	bool
+	storage_backend_available(
+		StorageBackend backend)
+	{
+		switch (backend)
+		{
+			case StorageBackend::AUTO:
+			case StorageBackend::POSIX:
+				return true;
+			case StorageBackend::IO_URING:
+#ifdef PROTORECORD_HAVE_IO_URING
+				return IoUring::supported();
+#else
+				return false;
+#endif
+		}
+		return false;
+	}
+
+	std::unique_ptr<OutputFile>
+	make_output_file(
+		StorageBackend backend,
+		WriteMode mode,
+		uint64_t preallocate_extent)
+	{
+		if (mode == WriteMode::DIRECT)
+		{
+			return std::unique_ptr<OutputFile>(new DirectOutputFile(DIRECT_WRITE_BUFFER_SIZE,preallocate_extent));
+		}
+		else if (mode == WriteMode::MAPPED)
+		{
+			uint64_t extent = preallocate_extent > 0 ? preallocate_extent : DEFAULT_MAPPED_EXTENT;
+			return std::unique_ptr<OutputFile>(new MappedOutputFile(extent));
+		}
+
+#ifdef PROTORECORD_HAVE_IO_URING
+		bool want_uring = backend == StorageBackend::AUTO || backend == StorageBackend::IO_URING;
+		if (want_uring && IoUring::supported())
+		{
+			return std::unique_ptr<OutputFile>(new UringOutputFile(URING_WRITE_BUFFER_SIZE,URING_WRITE_BUFFERS));
+		}
+#endif
+		return std::unique_ptr<OutputFile>(new PosixOutputFile(POSIX_WRITE_BUFFER_SIZE));
+	}
+
+	std::unique_ptr<InputFile>
+	make_input_file(
+		StorageBackend backend,
+		AccessPattern pattern)
+	{
+		// read-ahead only wastes bandwidth when jumping around a file
+		if (pattern == AccessPattern::RANDOM)
+		{
+			return std::unique_ptr<InputFile>(new PosixInputFile(0));
+		}
+
+#ifdef PROTORECORD_HAVE_IO_URING
+		bool want_uring = backend == StorageBackend::AUTO || backend == StorageBackend::IO_URING;
+		if (want_uring && IoUring::supported())
+		{
+			return std::unique_ptr<InputFile>(new UringInputFile(URING_READ_CHUNK_SIZE,URING_READ_CHUNKS));
+		}
+#endif
+		return std::unique_ptr<InputFile>(new PosixInputFile(POSIX_READ_WINDOW_SIZE));
+	}
+
+}// protorecord
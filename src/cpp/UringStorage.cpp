@@ -0,0 +1,841 @@
+#include "protorecord/UringStorage.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace protorecord
+{
+	//-------------------------------------------------------------------------
+	// io_uring system calls
+	//-------------------------------------------------------------------------
+
+	static
+	int
+	sys_io_uring_setup(
+		unsigned int entries,
+		struct io_uring_params *params)
+	{
+		return (int)syscall(__NR_io_uring_setup,entries,params);
+	}
+
+	static
+	int
+	sys_io_uring_enter(
+		int fd,
+		unsigned int to_submit,
+		unsigned int min_complete,
+		unsigned int flags)
+	{
+		return (int)syscall(__NR_io_uring_enter,fd,to_submit,min_complete,flags,nullptr,0);
+	}
+
+	static
+	int
+	sys_io_uring_register(
+		int fd,
+		unsigned int opcode,
+		const void *arg,
+		unsigned int nr_args)
+	{
+		return (int)syscall(__NR_io_uring_register,fd,opcode,arg,nr_args);
+	}
+
+	// writes whatever a short write left over
+	static
+	bool
+	pwrite_fully(
+		int fd,
+		const char *data,
+		size_t size,
+		uint64_t offset)
+	{
+		while (size > 0)
+		{
+			ssize_t written = pwrite(fd,data,size,offset);
+			if (written < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (written <= 0)
+			{
+				return false;
+			}
+			data += written;
+			size -= written;
+			offset += written;
+		}
+		return true;
+	}
+
+	//-------------------------------------------------------------------------
+	// IoUring
+	//-------------------------------------------------------------------------
+
+	IoUring::IoUring()
+	 : ring_fd_(-1)
+	 , sq_ptr_(nullptr)
+	 , sq_ring_size_(0)
+	 , cq_ptr_(nullptr)
+	 , cq_ring_size_(0)
+	 , sqes_(nullptr)
+	 , sqes_size_(0)
+	 , sq_head_(nullptr)
+	 , sq_tail_(nullptr)
+	 , sq_mask_(nullptr)
+	 , sq_array_(nullptr)
+	 , sq_entries_(0)
+	 , cq_head_(nullptr)
+	 , cq_tail_(nullptr)
+	 , cq_mask_(nullptr)
+	 , cqes_(nullptr)
+	 , sqe_tail_(0)
+	 , sqe_submitted_(0)
+	{
+	}
+
+	IoUring::~IoUring()
+	{
+		destroy();
+	}
+
+	bool
+	IoUring::init(
+		unsigned int entries)
+	{
+		destroy();
+
+		struct io_uring_params params;
+		memset(&params,0,sizeof(params));
+		ring_fd_ = sys_io_uring_setup(entries,&params);
+		if (ring_fd_ < 0)
+		{
+			ring_fd_ = -1;
+			return false;
+		}
+
+		sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single_mmap)
+		{
+			sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_,cq_ring_size_);
+		}
+
+		sq_ptr_ = mmap(nullptr,sq_ring_size_,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ring_fd_,IORING_OFF_SQ_RING);
+		bool okay = sq_ptr_ != MAP_FAILED;
+		if ( ! okay)
+		{
+			sq_ptr_ = nullptr;
+		}
+
+		if (okay && single_mmap)
+		{
+			cq_ptr_ = sq_ptr_;
+		}
+		else if (okay)
+		{
+			cq_ptr_ = mmap(nullptr,cq_ring_size_,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ring_fd_,IORING_OFF_CQ_RING);
+			okay = cq_ptr_ != MAP_FAILED;
+			if ( ! okay)
+			{
+				cq_ptr_ = nullptr;
+			}
+		}
+
+		if (okay)
+		{
+			sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+			void *sqes = mmap(nullptr,sqes_size_,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ring_fd_,IORING_OFF_SQES);
+			okay = sqes != MAP_FAILED;
+			sqes_ = okay ? (struct io_uring_sqe*)sqes : nullptr;
+		}
+
+		if ( ! okay)
+		{
+			destroy();
+			return false;
+		}
+
+		char *sq = (char*)sq_ptr_;
+		sq_head_ = (unsigned int*)(sq + params.sq_off.head);
+		sq_tail_ = (unsigned int*)(sq + params.sq_off.tail);
+		sq_mask_ = (unsigned int*)(sq + params.sq_off.ring_mask);
+		sq_array_ = (unsigned int*)(sq + params.sq_off.array);
+		sq_entries_ = params.sq_entries;
+
+		char *cq = (char*)cq_ptr_;
+		cq_head_ = (unsigned int*)(cq + params.cq_off.head);
+		cq_tail_ = (unsigned int*)(cq + params.cq_off.tail);
+		cq_mask_ = (unsigned int*)(cq + params.cq_off.ring_mask);
+		cqes_ = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+		sqe_tail_ = *sq_tail_;
+		sqe_submitted_ = sqe_tail_;
+		return true;
+	}
+
+	void
+	IoUring::destroy()
+	{
+		if (sqes_ != nullptr)
+		{
+			munmap(sqes_,sqes_size_);
+		}
+		if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_)
+		{
+			munmap(cq_ptr_,cq_ring_size_);
+		}
+		if (sq_ptr_ != nullptr)
+		{
+			munmap(sq_ptr_,sq_ring_size_);
+		}
+		if (ring_fd_ >= 0)
+		{
+			::close(ring_fd_);
+		}
+		ring_fd_ = -1;
+		sq_ptr_ = nullptr;
+		cq_ptr_ = nullptr;
+		sqes_ = nullptr;
+	}
+
+	bool
+	IoUring::is_ready() const
+	{
+		return ring_fd_ >= 0;
+	}
+
+	bool
+	IoUring::register_buffers(
+		const struct iovec *iovecs,
+		unsigned int count)
+	{
+		return sys_io_uring_register(ring_fd_,IORING_REGISTER_BUFFERS,iovecs,count) == 0;
+	}
+
+	bool
+	IoUring::supports_op(
+		unsigned int opcode)
+	{
+		// the probe is followed by an entry for every possible opcode
+		const unsigned int MAX_OPS = 256;
+		std::vector<char> buffer(sizeof(struct io_uring_probe) + MAX_OPS * sizeof(struct io_uring_probe_op),0);
+		struct io_uring_probe *probe = (struct io_uring_probe*)buffer.data();
+		if (sys_io_uring_register(ring_fd_,IORING_REGISTER_PROBE,probe,MAX_OPS) < 0)
+		{
+			return false;
+		}
+		return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+	}
+
+	struct io_uring_sqe *
+	IoUring::get_sqe()
+	{
+		unsigned int head = __atomic_load_n(sq_head_,__ATOMIC_ACQUIRE);
+		if (sqe_tail_ - head >= sq_entries_)
+		{
+			return nullptr;
+		}
+
+		unsigned int idx = sqe_tail_ & *sq_mask_;
+		struct io_uring_sqe *sqe = &sqes_[idx];
+		memset(sqe,0,sizeof(*sqe));
+		sq_array_[idx] = idx;
+		sqe_tail_++;
+		return sqe;
+	}
+
+	bool
+	IoUring::submit(
+		unsigned int wait_nr)
+	{
+		// publish the new entries before telling the kernel about them
+		__atomic_store_n(sq_tail_,sqe_tail_,__ATOMIC_RELEASE);
+		unsigned int to_submit = sqe_tail_ - sqe_submitted_;
+		unsigned int flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+		while (to_submit > 0 || wait_nr > 0)
+		{
+			int res = sys_io_uring_enter(ring_fd_,to_submit,wait_nr,flags);
+			if (res < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				return false;
+			}
+			sqe_submitted_ += res;
+			to_submit -= res;
+			wait_nr = 0;
+			flags = 0;
+		}
+		return true;
+	}
+
+	struct io_uring_cqe *
+	IoUring::wait_cqe()
+	{
+		while (true)
+		{
+			unsigned int head = *cq_head_;
+			unsigned int tail = __atomic_load_n(cq_tail_,__ATOMIC_ACQUIRE);
+			if (head != tail)
+			{
+				return &cqes_[head & *cq_mask_];
+			}
+
+			int res = sys_io_uring_enter(ring_fd_,0,1,IORING_ENTER_GETEVENTS);
+			if (res < 0 && errno != EINTR)
+			{
+				return nullptr;
+			}
+		}
+	}
+
+	void
+	IoUring::cqe_seen()
+	{
+		__atomic_store_n(cq_head_,*cq_head_ + 1,__ATOMIC_RELEASE);
+	}
+
+	bool
+	IoUring::supported()
+	{
+		static const bool supported = []()
+		{
+			IoUring ring;
+			return ring.init(1) &&
+				ring.supports_op(IORING_OP_READ) &&
+				ring.supports_op(IORING_OP_WRITE) &&
+				ring.supports_op(IORING_OP_WRITE_FIXED);
+		}();
+		return supported;
+	}
+
+	//-------------------------------------------------------------------------
+	// UringOutputFile
+	//-------------------------------------------------------------------------
+
+	UringOutputFile::UringOutputFile(
+		size_t buffer_size,
+		unsigned int num_buffers)
+	 : ring_()
+	 , fd_(-1)
+	 , buffers_(num_buffers)
+	 , registered_(false)
+	 , current_(0)
+	 , file_offset_(0)
+	 , in_flight_(0)
+	 , failed_(false)
+	{
+		for (auto &buffer : buffers_)
+		{
+			buffer.data.resize(buffer_size);
+		}
+	}
+
+	UringOutputFile::~UringOutputFile()
+	{
+		close();
+	}
+
+	bool
+	UringOutputFile::open(
+		const std::string &filepath)
+	{
+		close();
+
+		// the ring and its buffers are kept across files
+		if ( ! ring_.is_ready())
+		{
+			if ( ! ring_.init(buffers_.size()))
+			{
+				return false;
+			}
+
+			// fixed buffers save the kernel from mapping the pages on every
+			// write, but registration can fail due to RLIMIT_MEMLOCK
+			std::vector<struct iovec> iovecs(buffers_.size());
+			for (size_t i=0; i<buffers_.size(); i++)
+			{
+				iovecs[i].iov_base = buffers_[i].data.data();
+				iovecs[i].iov_len = buffers_[i].data.size();
+			}
+			registered_ = ring_.register_buffers(iovecs.data(),iovecs.size());
+		}
+
+		fd_ = ::open(filepath.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+		current_ = 0;
+		file_offset_ = 0;
+		failed_ = fd_ < 0;
+		for (auto &buffer : buffers_)
+		{
+			buffer.used = 0;
+		}
+		return ! failed_;
+	}
+
+	bool
+	UringOutputFile::append(
+		const void *data,
+		size_t size)
+	{
+		const char *src = (const char*)data;
+		while ( ! failed_ && fd_ >= 0 && size > 0)
+		{
+			Buffer &buffer = buffers_[current_];
+			size_t n = std::min(size,buffer.data.size() - buffer.used);
+			memcpy(buffer.data.data() + buffer.used,src,n);
+			buffer.used += n;
+			src += n;
+			size -= n;
+
+			if (buffer.used == buffer.data.size())
+			{
+				submit_current();
+			}
+		}
+		return ! failed_ && fd_ >= 0;
+	}
+
+	bool
+	UringOutputFile::flush()
+	{
+		if (fd_ < 0)
+		{
+			return false;
+		}
+
+		bool okay = submit_current();
+		while (in_flight_ > 0)
+		{
+			okay = reap_one() && okay;
+		}
+		return okay && ! failed_;
+	}
+
+	char *
+	UringOutputFile::reserve(
+		size_t size)
+	{
+		if (failed_ || fd_ < 0 || size > buffers_[current_].data.size())
+		{
+			return nullptr;
+		}
+
+		Buffer *buffer = &buffers_[current_];
+		if (buffer->used + size > buffer->data.size())
+		{
+			if ( ! submit_current())
+			{
+				return nullptr;
+			}
+			buffer = &buffers_[current_];
+		}
+		return buffer->data.data() + buffer->used;
+	}
+
+	void
+	UringOutputFile::commit(
+		size_t size)
+	{
+		Buffer &buffer = buffers_[current_];
+		buffer.used += size;
+		if (buffer.used == buffer.data.size())
+		{
+			submit_current();
+		}
+	}
+
+	void
+	UringOutputFile::close()
+	{
+		if (fd_ >= 0)
+		{
+			flush();
+			::close(fd_);
+		}
+		fd_ = -1;
+	}
+
+	bool
+	UringOutputFile::submit_current()
+	{
+		Buffer &buffer = buffers_[current_];
+		if (buffer.used == 0)
+		{
+			return true;
+		}
+
+		struct io_uring_sqe *sqe = ring_.get_sqe();
+		while (sqe == nullptr && in_flight_ > 0)
+		{
+			reap_one();
+			sqe = ring_.get_sqe();
+		}
+		if (sqe == nullptr)
+		{
+			failed_ = true;
+			return false;
+		}
+
+		sqe->opcode = registered_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+		sqe->fd = fd_;
+		sqe->addr = (uint64_t)buffer.data.data();
+		sqe->len = buffer.used;
+		sqe->off = file_offset_;
+		sqe->buf_index = registered_ ? current_ : 0;
+		sqe->user_data = current_;
+		buffer.offset = file_offset_;
+		buffer.in_flight = true;
+		in_flight_++;
+		file_offset_ += buffer.used;
+
+		if ( ! ring_.submit())
+		{
+			failed_ = true;
+			return false;
+		}
+
+		// move on to the next buffer once its previous write has completed
+		current_ = (current_ + 1) % buffers_.size();
+		while (buffers_[current_].in_flight)
+		{
+			reap_one();
+		}
+		buffers_[current_].used = 0;
+		return ! failed_;
+	}
+
+	bool
+	UringOutputFile::reap_one()
+	{
+		struct io_uring_cqe *cqe = ring_.wait_cqe();
+		if (cqe == nullptr)
+		{
+			// the ring is broken, so nothing in flight will complete
+			for (auto &buffer : buffers_)
+			{
+				buffer.in_flight = false;
+			}
+			in_flight_ = 0;
+			failed_ = true;
+			return false;
+		}
+
+		Buffer &buffer = buffers_[cqe->user_data];
+		int res = cqe->res;
+		ring_.cqe_seen();
+
+		bool okay = res >= 0;
+		if (okay && (size_t)res < buffer.used)
+		{
+			okay = pwrite_fully(fd_,buffer.data.data() + res,buffer.used - res,buffer.offset + res);
+		}
+		buffer.in_flight = false;
+		in_flight_--;
+		failed_ = failed_ || ! okay;
+		return okay;
+	}
+
+	//-------------------------------------------------------------------------
+	// UringInputFile
+	//-------------------------------------------------------------------------
+
+	UringInputFile::UringInputFile(
+		size_t chunk_size,
+		unsigned int num_chunks)
+	 : ring_()
+	 , fd_(-1)
+	 , file_size_(0)
+	 , chunk_size_(chunk_size)
+	 , chunks_(num_chunks)
+	 , current_(nullptr)
+	 , in_flight_(0)
+	{
+		for (auto &chunk : chunks_)
+		{
+			chunk.data.resize(chunk_size);
+		}
+	}
+
+	UringInputFile::~UringInputFile()
+	{
+		close();
+	}
+
+	bool
+	UringInputFile::open(
+		const std::string &filepath)
+	{
+		close();
+
+		if ( ! ring_.is_ready() && ! ring_.init(chunks_.size()))
+		{
+			return false;
+		}
+
+		fd_ = ::open(filepath.c_str(),O_RDONLY);
+		return fd_ >= 0 && update_file_size();
+	}
+
+	bool
+	UringInputFile::read(
+		uint64_t offset,
+		size_t size,
+		char *dst)
+	{
+		if (fd_ < 0)
+		{
+			return false;
+		}
+
+		// most reads land in the same chunk as the one before
+		if (current_ != nullptr && current_->state == ChunkState::READY)
+		{
+			uint64_t chunk_start = current_->number * chunk_size_;
+			if (offset >= chunk_start && offset + size <= chunk_start + current_->used)
+			{
+				memcpy(dst,current_->data.data() + (offset - chunk_start),size);
+				return true;
+			}
+		}
+
+		if (offset + size > file_size_ && ( ! update_file_size() || offset + size > file_size_))
+		{
+			return false;
+		}
+
+		bool reread = false;
+		while (size > 0)
+		{
+			uint64_t number = offset / chunk_size_;
+			Chunk *chunk = get_chunk(number);
+			current_ = chunk;
+			if (chunk == nullptr)
+			{
+				return false;
+			}
+
+			size_t chunk_offset = offset - number * chunk_size_;
+			if (chunk_offset >= chunk->used)
+			{
+				// the chunk was read before the file grew; read it again
+				if (chunk->used == chunk_size_ || reread)
+				{
+					return false;
+				}
+				chunk->state = ChunkState::EMPTY;
+				reread = true;
+				continue;
+			}
+
+			size_t n = std::min(size,chunk->used - chunk_offset);
+			memcpy(dst,chunk->data.data() + chunk_offset,n);
+			dst += n;
+			offset += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	void
+	UringInputFile::invalidate()
+	{
+		// chunks still being read may hold stale data too
+		while (in_flight_ > 0 && reap_one())
+		{
+		}
+		for (auto &chunk : chunks_)
+		{
+			chunk.state = ChunkState::EMPTY;
+		}
+		current_ = nullptr;
+
+		if (fd_ >= 0)
+		{
+			update_file_size();
+		}
+	}
+
+	void
+	UringInputFile::close()
+	{
+		// buffers can't be reused until the kernel is done with them
+		while (in_flight_ > 0 && reap_one())
+		{
+		}
+		for (auto &chunk : chunks_)
+		{
+			chunk.state = ChunkState::EMPTY;
+		}
+		current_ = nullptr;
+
+		if (fd_ >= 0)
+		{
+			::close(fd_);
+		}
+		fd_ = -1;
+		file_size_ = 0;
+	}
+
+	bool
+	UringInputFile::read_ahead(
+		uint64_t number)
+	{
+		uint64_t window_end = number + chunks_.size();
+		bool submitted = false;
+		for (uint64_t next=number; next<window_end; next++)
+		{
+			if (next * chunk_size_ >= file_size_)
+			{
+				break;
+			}
+
+			bool have_chunk = false;
+			Chunk *free_chunk = nullptr;
+			for (auto &chunk : chunks_)
+			{
+				if (chunk.state != ChunkState::EMPTY && chunk.number == next)
+				{
+					have_chunk = true;
+					break;
+				}
+
+				// chunks outside of the read-ahead window get recycled
+				bool stale = chunk.number < number || chunk.number >= window_end;
+				if (free_chunk == nullptr &&
+					(chunk.state == ChunkState::EMPTY ||
+						(chunk.state == ChunkState::READY && stale)))
+				{
+					free_chunk = &chunk;
+				}
+			}
+			if (have_chunk)
+			{
+				continue;
+			}
+			if (free_chunk == nullptr)
+			{
+				break;
+			}
+
+			struct io_uring_sqe *sqe = ring_.get_sqe();
+			if (sqe == nullptr)
+			{
+				break;
+			}
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = fd_;
+			sqe->addr = (uint64_t)free_chunk->data.data();
+			sqe->len = chunk_size_;
+			sqe->off = next * chunk_size_;
+			sqe->user_data = free_chunk - chunks_.data();
+			free_chunk->number = next;
+			free_chunk->used = 0;
+			free_chunk->state = ChunkState::IN_FLIGHT;
+			in_flight_++;
+			submitted = true;
+		}
+		return ! submitted || ring_.submit();
+	}
+
+	bool
+	UringInputFile::reap_one()
+	{
+		struct io_uring_cqe *cqe = ring_.wait_cqe();
+		if (cqe == nullptr)
+		{
+			for (auto &chunk : chunks_)
+			{
+				chunk.state = ChunkState::EMPTY;
+			}
+			in_flight_ = 0;
+			return false;
+		}
+
+		Chunk &chunk = chunks_[cqe->user_data];
+		int res = cqe->res;
+		ring_.cqe_seen();
+		in_flight_--;
+
+		if (res < 0)
+		{
+			chunk.state = ChunkState::EMPTY;
+			return false;
+		}
+
+		// top up short reads that stopped before the end of the file
+		size_t used = res;
+		uint64_t chunk_offset = chunk.number * chunk_size_;
+		while (used < chunk_size_)
+		{
+			ssize_t got = pread(fd_,chunk.data.data() + used,chunk_size_ - used,chunk_offset + used);
+			if (got < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (got <= 0)
+			{
+				break;
+			}
+			used += got;
+		}
+		chunk.used = used;
+		chunk.state = ChunkState::READY;
+		return true;
+	}
+
+	UringInputFile::Chunk *
+	UringInputFile::get_chunk(
+		uint64_t number)
+	{
+		if ( ! read_ahead(number))
+		{
+			return nullptr;
+		}
+
+		for (auto &chunk : chunks_)
+		{
+			if (chunk.state == ChunkState::EMPTY || chunk.number != number)
+			{
+				continue;
+			}
+			while (chunk.state == ChunkState::IN_FLIGHT)
+			{
+				if ( ! reap_one())
+				{
+					return nullptr;
+				}
+			}
+			return chunk.state == ChunkState::READY ? &chunk : nullptr;
+		}
+
+		// every buffer is busy with reads that aren't needed anymore
+		if (in_flight_ > 0 && reap_one())
+		{
+			return get_chunk(number);
+		}
+		return nullptr;
+	}
+
+	bool
+	UringInputFile::update_file_size()
+	{
+		struct stat st;
+		if (fstat(fd_,&st) != 0)
+		{
+			return false;
+		}
+		file_size_ = st.st_size;
+		return true;
+	}
+
+}// protorecord
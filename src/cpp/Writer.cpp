@@ -1,16 +1,79 @@
 #include "protorecord/Constants.h"
 #include "protorecord/Writer.h"
 #include "Protorecord.pb.h"
+#include <set>
 // TODO support non-unix systems
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 
 namespace protorecord
 {
+	// number of bytes a memory mapped index grows by. indices are much
+	// smaller than the data, so they don't need the data file's extents.
+	const uint64_t INDEX_MAPPED_EXTENT = 4 * 1024 * 1024;
+
 	//-------------------------------------------------------------------------
 	// constructors/destructors
 	//-------------------------------------------------------------------------
 
+	// builds the default WriterOptions with timestamping set accordingly
+	static
+	WriterOptions
+	timestamping_options(
+		bool enable_timestamping)
+	{
+		WriterOptions options;
+		options.enable_timestamping = enable_timestamping;
+		return options;
+	}
+
+	// writes all of 'size' bytes to 'fd', retrying on partial writes
+	static
+	bool
+	write_fully(
+		int fd,
+		const char *data,
+		size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t written = ::write(fd,data,size);
+			if (written < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			else if (written <= 0)
+			{
+				return false;
+			}
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+
+	// adds 'file' to 'files' after every file it imports, unless it's
+	// already in there
+	static
+	void
+	add_schema_file(
+		const google::protobuf::FileDescriptor *file,
+		std::set<std::string> &added,
+		google::protobuf::FileDescriptorSet &files)
+	{
+		if (added.insert(file->name()).second)
+		{
+			for (int d=0; d<file->dependency_count(); d++)
+			{
+				add_schema_file(file->dependency(d),added,files);
+			}
+			file->CopyTo(files.add_file());
+		}
+	}
+
 	Writer::Writer()
 	 : Writer("")
 	{
@@ -25,17 +88,57 @@ namespace protorecord
 	Writer::Writer(
 		const std::string &filepath,
 		bool enable_timestamping)
+	 : Writer(filepath,timestamping_options(enable_timestamping))
+	{
+	}
+
+	Writer::Writer(
+		const std::string &filepath,
+		const WriterOptions &options)
 	 : initialized_(false)
 	 , timestamping_enabled_()
 	 , record_path_()
+	 , index_fd_(-1)
+	 , index_buffer_()
+	 , index_buffer_used_(0)
 	 , index_file_()
 	 , data_file_()
+	 , data_file_num_(0)
+	 , data_file_size_(0)
+	 , data_file_start_mono_(0)
+	 , segment_max_bytes_(0)
+	 , segment_max_duration_(0)
+	 , checkpoint_interval_(0)
+	 , last_checkpoint_mono_(0)
+	 , checkpointed_item_count_(0)
 	 , total_item_count_(0)
+	 , stored_item_count_(0)
+	 , compression_(Codec::NONE)
+	 , block_size_(0)
+	 , compressor_()
+	 , block_()
+	 , submitted_block_count_(0)
+	 , stored_block_count_(0)
+	 , blocks_fd_(-1)
 	 , flags_(protorecord::Flags::VALID)
+	 , queue_()
+	 , queue_policy_(FullQueuePolicy::BLOCK)
+	 , io_thread_()
+	 , queued_item_count_(0)
+	 , dropped_item_count_(0)
+	 , live_channel_()
+	 , schema_stored_(false)
+	 , schema_mutex_()
+	 , key_index_()
+	 , key_filter_bits_(0)
+	 , key_filter_items_(0)
+	 , index_entry_()
+	 , summary_()
+	 , has_reason_(false)
 	 , fail_reason_("")
 	{
 		buffer_.resize(64000);
-		open(filepath,enable_timestamping);
+		open(filepath,options);
 	}
 
 	/**
@@ -55,24 +158,118 @@ namespace protorecord
 		const std::string &filepath,
 		bool enable_timestamping)
 	{
-		fail_reason_ = "";
+		return open(filepath,timestamping_options(enable_timestamping));
+	}
+
+	bool
+	Writer::open(
+		const std::string &filepath,
+		const WriterOptions &options)
+	{
+		clear_reason();
 
 		if (initialized_)
 		{
 			// don't reinitialize file
-			fail_reason_ = "Writer already intialized";
+			set_reason("Writer already intialized");
+			return false;
+		}
+
+		if (filepath != "" && ! codec_available(options.compression))
+		{
+			set_reason("compression codec '" + codec_name(options.compression) +
+				"' is not supported by this build of protorecord");
+			return false;
+		}
+
+		if (filepath != "" && options.direct_io && options.use_mmap)
+		{
+			set_reason("direct_io and use_mmap can't be used together");
 			return false;
 		}
 
 		if (filepath != "")
 		{
 			// reset member variables
-			timestamping_enabled_ = enable_timestamping;
+			timestamping_enabled_ = options.enable_timestamping;
 			record_path_ = filepath;
 			total_item_count_ = 0;
+			stored_item_count_ = 0;
+			index_entry_ = IndexEntry();
+			summary_.Clear();
 			flags_ = protorecord::Flags::VALID;
+			queue_policy_ = options.full_queue_policy;
+			queued_item_count_ = 0;
+			dropped_item_count_ = 0;
+			schema_stored_ = false;
+			key_index_.reset();
+			if ( ! options.key_field.empty() || options.key_extractor)
+			{
+				key_index_.reset(new KeyIndexBuilder(options.key_field,options.key_extractor));
+			}
+			key_filter_bits_ = options.key_filter_bits;
+			key_filter_items_ = options.key_filter_items;
+			index_buffer_.resize(std::max<size_t>(options.index_buffer_size,ITEM_BLOCK_OFFSET_V2));
+			index_buffer_used_ = 0;
+			if (buffer_.size() < options.max_item_size)
+			{
+				buffer_.resize(options.max_item_size);
+			}
+			segment_max_bytes_ = options.segment_max_bytes;
+			segment_max_duration_ = options.segment_max_duration;
+			checkpoint_interval_ = options.checkpoint_interval;
+			checkpointed_item_count_ = 0;
+			compression_ = options.compression;
+			block_size_ = options.compression_block_size;
+			submitted_block_count_ = 0;
+			stored_block_count_ = 0;
+			WriteMode write_mode = WriteMode::BUFFERED;
+			if (options.direct_io)
+			{
+				write_mode = WriteMode::DIRECT;
+			}
+			else if (options.use_mmap)
+			{
+				write_mode = WriteMode::MAPPED;
+			}
+			data_file_ = make_output_file(options.storage_backend,write_mode,options.preallocate_extent);
+			if (options.use_mmap)
+			{
+				index_file_ = make_output_file(options.storage_backend,WriteMode::MAPPED,INDEX_MAPPED_EXTENT);
+			}
+			else
+			{
+				index_file_.reset();
+			}
 
 			initialized_ = init_record(filepath,true);
+
+			if (initialized_ && compression_ != Codec::NONE)
+			{
+				// let a couple of blocks queue up per worker so that none of
+				// them sit idle while the previous block is being stored
+				const size_t max_in_flight = options.compression_threads * 2 + 1;
+				compressor_.reset(new BlockCompressor(compression_,options.compression_threads,max_in_flight));
+				block_ = compressor_->get_block();
+			}
+
+			if (initialized_ && options.async)
+			{
+				queue_.reset(new ItemQueue(options.async_queue_depth,options.async_slot_size));
+				io_thread_ = std::thread(&Writer::io_thread_main,this);
+			}
+
+			if (initialized_ && ! options.live_channel.empty())
+			{
+				live_channel_.reset(new LiveChannel());
+				if ( ! live_channel_->create(options.live_channel,options.live_channel_size))
+				{
+					std::string why = live_channel_->reason();
+					live_channel_.reset();
+					close();
+					set_reason(why);
+				}
+			}
 		}
 
 		return initialized_;
@@ -84,7 +281,7 @@ namespace protorecord
 		uint32_t msg_data_size)
 	{
 		bool okay = initialized_;
-		fail_reason_ = "";
+		clear_reason();
 
 		std::chrono::microseconds timestamp;
 		if (timestamping_enabled_)
@@ -92,7 +289,22 @@ namespace protorecord
 			timestamp = get_mono_time() - start_time_mono_;
 		}
 
-		okay = okay && write_item_data(msg_data,msg_data_size,timestamp);
+		if (okay && queue_)
+		{
+			okay = enqueue_item_data(msg_data,msg_data_size,timestamp);
+		}
+		else if (okay)
+		{
+			okay = write_item_data(msg_data,msg_data_size,timestamp);
+			if ( ! okay)
+			{
+				set_reason("failed to write item to record");
+			}
+		}
+		else
+		{
+			set_reason("Writer not initialized");
+		}
 
 		if (okay)
 		{
@@ -102,24 +314,212 @@ namespace protorecord
 		return okay;
 	}
 
+	bool
+	Writer::write_batch(
+		const ItemSpan *items,
+		size_t num_items,
+		BatchTimestamp timestamping)
+	{
+		bool okay = initialized_;
+		clear_reason();
+
+		const bool per_item = timestamping == BatchTimestamp::PER_ITEM;
+		std::chrono::microseconds timestamp(0);
+		if (timestamping_enabled_)
+		{
+			timestamp = get_mono_time() - start_time_mono_;
+		}
+
+		if (okay && queue_)
+		{
+			for (size_t i=0; okay && i<num_items; i++)
+			{
+				if (timestamping_enabled_ && per_item)
+				{
+					timestamp = get_mono_time() - start_time_mono_;
+				}
+				okay = enqueue_item_data(items[i].data,items[i].size,timestamp);
+			}
+		}
+		else if (okay)
+		{
+			// gather the items so they can be written with a single call
+			size_t used = 0;
+			batch_sizes_.clear();
+			batch_timestamps_.clear();
+			for (size_t i=0; i<num_items; i++)
+			{
+				if (batch_buffer_.size() < used + items[i].size)
+				{
+					batch_buffer_.resize((used + items[i].size) * 2);
+				}
+
+				memcpy(batch_buffer_.data() + used,items[i].data,items[i].size);
+				used += items[i].size;
+				batch_sizes_.push_back(items[i].size);
+				if (timestamping_enabled_ && per_item)
+				{
+					batch_timestamps_.push_back(get_mono_time() - start_time_mono_);
+				}
+			}
+			if ( ! per_item)
+			{
+				batch_timestamps_.push_back(timestamp);
+			}
+
+			okay = write_batch_data(batch_buffer_.data(),batch_sizes_,batch_timestamps_);
+			if ( ! okay)
+			{
+				set_reason("failed to write batch to record");
+			}
+		}
+		else
+		{
+			set_reason("Writer not initialized");
+		}
+
+		if (okay && num_items > 0)
+		{
+			flags_ |= protorecord::Flags::HAS_ASSUMED_DATA;
+		}
+
+		return okay;
+	}
+
+	bool
+	Writer::store_schema(
+		const google::protobuf::Descriptor *descriptor)
+	{
+		std::lock_guard<std::mutex> lock(schema_mutex_);
+		if (schema_stored_.load(std::memory_order_relaxed))
+		{
+			return true;
+		}
+		else if ( ! initialized_ || descriptor == nullptr)
+		{
+			set_reason(initialized_ ? "no message descriptor given" : "Writer not initialized");
+			return false;
+		}
+
+		protorecord::Schema schema;
+		schema.set_type_name(descriptor->full_name());
+		std::set<std::string> added;
+		add_schema_file(descriptor->file(),added,*schema.mutable_files());
+
+		std::string schema_data;
+		bool okay = schema.SerializeToString(&schema_data);
+
+		const auto SCHEMA_FILEPATH = record_path_ + "/schema";
+		int fd = -1;
+		if (okay)
+		{
+			fd = ::open(SCHEMA_FILEPATH.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0666);
+			okay = fd >= 0;
+		}
+		okay = okay && write_fully(fd,schema_data.data(),schema_data.size());
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+
+		if (okay)
+		{
+			flags_ |= protorecord::Flags::HAS_SCHEMA;
+		}
+		else
+		{
+			flags_ |= protorecord::Flags::RECORD_WRITE_ERROR;
+			set_reason("failed to store schema: " + SCHEMA_FILEPATH);
+		}
+
+		// resolve the key field before any producer can skip this method,
+		// so that no item written after it is indexed without it. an async
+		// Writer's I/O thread picks it up under the builder's lock.
+		if (key_index_ && ! key_index_->set_descriptor(descriptor))
+		{
+			set_reason(key_index_->reason());
+			okay = false;
+		}
+
+		// only try once, even if it failed. the items themselves are fine.
+		// released, so that producers that see the flag also see the key
+		// field resolved.
+		schema_stored_.store(true,std::memory_order_release);
+		return okay;
+	}
+
 	size_t
 	Writer::size()
 	{
-		fail_reason_ = "";
+		clear_reason();
+		if (queue_)
+		{
+			return queued_item_count_;
+		}
 		return total_item_count_;
 	}
 
+	size_t
+	Writer::dropped()
+	{
+		clear_reason();
+		return dropped_item_count_;
+	}
+
 	void
 	Writer::close(
 		bool store_readme)
 	{
-		fail_reason_ = "";
+		clear_reason();
 
 		if (initialized_)
 		{
-			store_summary(SUMMARY_BLOCK_OFFSET,true);
-			index_file_.close();
-			data_file_.close();
+			if (queue_)
+			{
+				// let the I/O thread drain whatever is left in the queue
+				queue_->close();
+				io_thread_.join();
+				queue_.reset();
+			}
+
+			if (compressor_)
+			{
+				// the last block is most likely only partially filled
+				submit_block();
+				store_finished_blocks(true);
+				block_.reset();
+				compressor_.reset();
+			}
+
+			// tells LiveReaders that no more items are coming
+			live_channel_.reset();
+
+			// stored before the last checkpoint, so that its flags say so
+			if (key_index_)
+			{
+				bool okay = key_index_->store_index(record_path_ + "/keys");
+				if (okay)
+				{
+					flags_ |= protorecord::Flags::HAS_KEY_INDEX;
+				}
+				if (okay && key_filter_bits_ > 0)
+				{
+					const auto FILTERS_FILEPATH = record_path_ + "/filters";
+					okay = key_index_->store_filters(FILTERS_FILEPATH,key_filter_bits_,key_filter_items_,total_item_count_);
+					if (okay)
+					{
+						flags_ |= protorecord::Flags::HAS_KEY_FILTERS;
+					}
+				}
+				if ( ! okay)
+				{
+					set_reason(key_index_->reason());
+				}
+				key_index_.reset();
+			}
+
+			checkpoint();
+			data_file_->close();
 
 			if (store_readme)
 			{
@@ -137,17 +537,43 @@ namespace protorecord
 					strftime(buffer,sizeof(buffer),"%A %B %d, %G %r",timeinfo);
 					readme << "Creation Time: " << buffer << std::endl;
 					readme << "Items: " << total_item_count_ << std::endl;
+					readme << "Data Files: " << (data_file_num_ + 1) << std::endl;
+					if (compression_ != Codec::NONE)
+					{
+						readme << "Compression: " << codec_name(compression_) << std::endl;
+					}
+					if (dropped_item_count_ > 0)
+					{
+						readme << "Dropped Items: " << dropped_item_count_ << std::endl;
+					}
 
 					readme.close();
 				}
 			}
 		}
+
+		if (index_file_)
+		{
+			index_file_->close();
+		}
+		if (index_fd_ >= 0)
+		{
+			::close(index_fd_);
+			index_fd_ = -1;
+		}
+		if (blocks_fd_ >= 0)
+		{
+			::close(blocks_fd_);
+			blocks_fd_ = -1;
+		}
 		initialized_ = false;
 	}
 
 	std::string
 	Writer::reason()
 	{
+		std::lock_guard<std::mutex> lock(reason_mutex_);
+		has_reason_.store(false,std::memory_order_relaxed);
 		return std::move(fail_reason_);
 	}
 
@@ -169,36 +595,65 @@ namespace protorecord
 		}
 		else if (status < 0)
 		{
-			fail_reason_ = std::string(" - failed to create record. ") +
+			set_reason(std::string(" - failed to create record. ") +
 				"error: " + strerror(errno) + "; " +
-				"filepath: '" + filepath + "'";
+				"filepath: '" + filepath + "'");
 			okay = false;
 		}
 
 		// open the index file
-		const auto INDEX_FLAGS = std::ofstream::out | std::ofstream::binary;
+		const auto INDEX_FLAGS = O_WRONLY | O_CREAT | O_TRUNC;
 		const auto INDEX_FILEPATH = filepath + "/index";
 		if (okay)
 		{
-			index_file_.open(INDEX_FILEPATH,INDEX_FLAGS);
-			if ( ! index_file_.good())
+			index_fd_ = ::open(INDEX_FILEPATH.c_str(),INDEX_FLAGS,0666);
+			if (index_fd_ < 0 || (index_file_ && ! index_file_->open(INDEX_FILEPATH)))
 			{
-				fail_reason_ = "failed to create index file: " + INDEX_FILEPATH;
+				set_reason("failed to create index file: " + INDEX_FILEPATH);
 				okay = false;
 			}
 		}
 
-		// open the data file
-		const auto DATA_FLAGS = std::ofstream::out | std::ofstream::binary;
-		const auto DATA_FILEPATH = filepath + "/data";
-		if (okay)
+		// the block table only exists in compressed records
+		const auto BLOCKS_FILEPATH = filepath + "/blocks";
+		if (okay && compression_ != Codec::NONE)
 		{
-			data_file_.open(DATA_FILEPATH,DATA_FLAGS);
-			if ( ! data_file_.good())
+			blocks_fd_ = ::open(BLOCKS_FILEPATH.c_str(),INDEX_FLAGS,0666);
+			if (blocks_fd_ < 0)
 			{
-				fail_reason_ = "failed to create data file: " + DATA_FILEPATH;
+				set_reason("failed to create block table: " + BLOCKS_FILEPATH);
 				okay = false;
 			}
+			flags_ |= protorecord::Flags::HAS_COMPRESSED_BLOCKS;
+		}
+		else if (okay)
+		{
+			unlink(BLOCKS_FILEPATH.c_str());
+		}
+
+		// the schema is stored once the first item's type is known, and the
+		// key index once the record is closed
+		if (okay)
+		{
+			unlink((filepath + "/schema").c_str());
+			unlink((filepath + "/keys").c_str());
+			unlink((filepath + "/filters").c_str());
+		}
+
+		// remove any extra data files left behind by a record we're overwriting
+		for (uint32_t file_num=1; okay; file_num++)
+		{
+			if (unlink(data_file_path(filepath,file_num).c_str()) < 0)
+			{
+				break;
+			}
+		}
+
+		// open the first data file
+		if (okay && ! open_data_file(0))
+		{
+			set_reason("failed to create data file: " + data_file_path(filepath,0));
+			okay = false;
 		}
 
 		if (timestamping_enabled_)
@@ -208,6 +663,7 @@ namespace protorecord
 
 		start_time_system_ = get_system_time();
 		start_time_mono_ = get_mono_time();
+		last_checkpoint_mono_ = start_time_mono_;
 
 		if (okay)
 		{
@@ -216,103 +672,629 @@ namespace protorecord
 			version.set_major(protorecord::major_version());
 			version.set_minor(protorecord::minor_version());
 			version.set_patch(protorecord::patch_version());
-			uint8_t version_size = version.ByteSizeLong();
-			version.SerializeToArray((void*)buffer_.data(),buffer_.size());
-			index_file_.write((const char *)&version_size,1);
-			index_file_.write(buffer_.data(),version_size);
+			version.set_index_format(PROTORECORD_INDEX_FORMAT_V2);
+			okay = okay && append_index_block(version,VERSION_BLOCK_SIZE);
+
+			// store current summary information in index file. it gets
+			// updated in place at every checkpoint.
+			summary_.set_total_items(total_item_count_);
+			summary_.set_start_time_utc(start_time_system_.count());
+			summary_.set_flags(flags_);
+			summary_.set_data_files(data_file_num_ + 1);
+			if (compression_ != Codec::NONE)
+			{
+				summary_.set_compression((uint32_t)compression_);
+				summary_.set_total_blocks(stored_block_count_);
+			}
+			okay = okay && append_index_block(summary_,SUMMARY_BLOCK_SIZE_V2);
 
-			// store current summary information in index file
-			store_summary(SUMMARY_BLOCK_OFFSET,false);// don't restore to previous position
+			// make sure readers see a valid header right away
+			okay = okay && flush_index();
+			if ( ! okay)
+			{
+				set_reason("failed to write index file header: " + INDEX_FILEPATH);
+			}
 		}
 
 		return okay;
 	}
 
 	bool
-	Writer::store_summary(
-		std::streampos pos,
-		bool restore_pos)
+	Writer::store_summary()
 	{
-		bool okay = index_file_.good();
+		bool okay = index_fd_ >= 0;
 
 		if (okay)
 		{
-			// cache current position and seek to where index summary is stored
-			auto prev_pos = index_file_.tellp();
-			index_file_.seekp(pos);
+			// create index summary based on member variables. only count the
+			// items that have made it to the data files.
+			summary_.set_total_items(stored_item_count_);
+			summary_.set_start_time_utc(start_time_system_.count());
+			summary_.set_flags(flags_);
+			summary_.set_data_files(data_file_num_ + 1);
+			if (dropped_item_count_ > 0)
+			{
+				summary_.set_dropped_items(dropped_item_count_);
+			}
+			if (compression_ != Codec::NONE)
+			{
+				summary_.set_total_blocks(stored_block_count_);
+			}
+
+			// patch the summary in place without moving the append position
+			char block[SUMMARY_BLOCK_SIZE_V2] = {0};
+			okay = serialize_index_block(summary_,block,sizeof(block));
+			okay = okay && pwrite(index_fd_,block,sizeof(block),SUMMARY_BLOCK_OFFSET) == sizeof(block);
+		}
+
+		return okay;
+	}
+
+	bool
+	Writer::checkpoint()
+	{
+		// data must hit the file before the index entries that point to it,
+		// and those must hit the file before the summary that counts them.
+		bool okay = data_file_->flush();
+		okay = flush_index() && okay;
+		okay = store_summary() && okay;
+		if ( ! okay)
+		{
+			flags_ |= protorecord::Flags::RECORD_WRITE_ERROR;
+		}
+		last_checkpoint_mono_ = get_mono_time();
+		checkpointed_item_count_ = stored_item_count_;
+		return okay;
+	}
 
-			// create index summary based on member variables
-			static protorecord::IndexSummary summary;
-			summary.set_total_items(total_item_count_);
-			summary.set_start_time_utc(start_time_system_.count());
-			summary.set_flags(flags_);
+	bool
+	Writer::checkpoint_if_due()
+	{
+		bool okay = true;
+		if (checkpoint_interval_.count() > 0 &&
+			stored_item_count_ != checkpointed_item_count_ &&
+			get_mono_time() - last_checkpoint_mono_ >= checkpoint_interval_)
+		{
+			okay = checkpoint();
+		}
+		return okay;
+	}
+
+	bool
+	Writer::serialize_index_block(
+		const google::protobuf::MessageLite &msg,
+		char *block,
+		size_t block_size)
+	{
+		// blocks are a single size byte, followed by the message, followed
+		// by zero padding out to block_size
+		size_t msg_size = msg.ByteSizeLong();
+		if (msg_size + 1 > block_size)
+		{
+			return false;
+		}
+
+		block[0] = (uint8_t)msg_size;
+		msg.SerializeWithCachedSizesToArray((uint8_t*)block + 1);
+		memset(block + 1 + msg_size,0,block_size - 1 - msg_size);
+		return true;
+	}
+
+	bool
+	Writer::append_index_block(
+		const google::protobuf::MessageLite &msg,
+		size_t block_size)
+	{
+		bool okay = true;
+		if (index_buffer_used_ + block_size > index_buffer_.size())
+		{
+			okay = checkpoint();
+		}
 
-			// save latest index summary
-			okay = okay && summary.SerializeToArray((void*)buffer_.data(),buffer_.size());
-			uint8_t summary_size = summary.ByteSizeLong();
-			index_file_.write((const char *)&summary_size,1);
-			index_file_.write(buffer_.data(),summary_size);
+		char *block = index_buffer_.data() + index_buffer_used_;
+		if (okay && index_file_)
+		{
+			block = index_file_->reserve(block_size);
+			okay = block != nullptr;
+		}
 
-			if (restore_pos)
+		okay = okay && serialize_index_block(msg,block,block_size);
+		if (okay)
+		{
+			if (index_file_)
 			{
-				// restore position back
-				index_file_.seekp(prev_pos);
+				index_file_->commit(block_size);
 			}
+			index_buffer_used_ += block_size;
 		}
+		return okay;
+	}
 
+	bool
+	Writer::append_index_entry(
+		const IndexEntry &entry)
+	{
+		const size_t stride = index_entry_stride_v2(timestamping_enabled_);
+
+		bool okay = true;
+		if (index_buffer_used_ + stride > index_buffer_.size())
+		{
+			okay = checkpoint();
+		}
+
+		char *encoded = index_buffer_.data() + index_buffer_used_;
+		if (okay && index_file_)
+		{
+			// encode straight into the mapped index
+			encoded = index_file_->reserve(stride);
+			okay = encoded != nullptr;
+		}
+
+		if (okay)
+		{
+			encode_index_entry_v2(entry,timestamping_enabled_,encoded);
+			if (index_file_)
+			{
+				index_file_->commit(stride);
+			}
+			index_buffer_used_ += stride;
+		}
 		return okay;
 	}
 
+	bool
+	Writer::flush_index()
+	{
+		if (index_file_)
+		{
+			// the entries are already in the mapping
+			index_buffer_used_ = 0;
+			return index_file_->flush();
+		}
+
+		if ( ! write_fully(index_fd_,index_buffer_.data(),index_buffer_used_))
+		{
+			return false;
+		}
+
+		index_buffer_used_ = 0;
+		return true;
+	}
+
 	bool
 	Writer::write_item_data(
 		const void *item_data,
 		uint32_t item_data_size,
 		const std::chrono::microseconds &timestamp)
 	{
-		bool okay = true;
+		// NOTE: this method is called from the I/O thread in async mode, so
+		// it must not touch fail_reason_. callers are in charge of reporting.
+		bool okay = initialized_;
 
-		if (initialized_)
+		if (okay)
 		{
-			// build an index item for this entry
-			static protorecord::IndexItem index_item;
-			index_item.set_file(0);// TODO use more files
-			index_item.set_offset(data_file_.tellp());
-			index_item.set_size(item_data_size);
-			if (timestamping_enabled_)
+			if (compressor_)
 			{
-				index_item.set_timestamp(timestamp.count());
+				// the item reaches the data file once its block is compressed
+				okay = append_to_block(item_data,item_data_size);
 			}
+			else
+			{
+				if (needs_new_segment(item_data_size))
+				{
+					okay = open_data_file(data_file_num_ + 1);
+				}
 
-			data_file_.write((const char *)item_data,item_data_size);
+				index_entry_.file = data_file_num_;
+				index_entry_.offset = data_file_size_;
 
-			// update index file
-			if (index_item.SerializeToArray((void*)buffer_.data(),buffer_.size()))
+				okay = data_file_->append(item_data,item_data_size) && okay;
+				data_file_size_ += item_data_size;
+			}
+
+			if (okay && live_channel_)
 			{
-				uint32_t pos = ITEM_BLOCK_OFFSET + total_item_count_ * ITEM_BLOCK_STRIDE;
-				uint8_t index_item_serialize_size = index_item.ByteSizeLong();
-				index_file_.seekp(pos);
-				index_file_.write((const char *)&index_item_serialize_size,1);
-				index_file_.write(buffer_.data(),index_item_serialize_size);
-				// increment item count
-				total_item_count_++;
+				live_channel_->publish((const char*)item_data,item_data_size,total_item_count_);
 			}
-			else
+			if (okay && key_index_)
 			{
-				fail_reason_ = "**internal error** failed to serialize index_item_";
-				okay = false;
+				key_index_->add((const char*)item_data,item_data_size,total_item_count_);
+			}
+			okay = finish_item(okay,item_data_size,timestamp);
+		}
+
+		return okay;
+	}
+
+	char *
+	Writer::reserve_item_data(
+		uint32_t item_data_size)
+	{
+		// compressed items are packed into blocks instead
+		if ( ! initialized_ || compressor_)
+		{
+			return nullptr;
+		}
+
+		if (needs_new_segment(item_data_size) && ! open_data_file(data_file_num_ + 1))
+		{
+			return nullptr;
+		}
+		return data_file_->reserve(item_data_size);
+	}
+
+	bool
+	Writer::commit_item_data(
+		const char *item_data,
+		uint32_t item_data_size,
+		const std::chrono::microseconds &timestamp)
+	{
+		if (live_channel_)
+		{
+			// the reserved memory may be handed off to the kernel on commit
+			live_channel_->publish(item_data,item_data_size,total_item_count_);
+		}
+		if (key_index_)
+		{
+			key_index_->add(item_data,item_data_size,total_item_count_);
+		}
+		index_entry_.file = data_file_num_;
+		index_entry_.offset = data_file_size_;
+		data_file_->commit(item_data_size);
+		data_file_size_ += item_data_size;
+		return finish_item(true,item_data_size,timestamp);
+	}
+
+	bool
+	Writer::finish_item(
+		bool okay,
+		uint32_t item_data_size,
+		const std::chrono::microseconds &timestamp)
+	{
+		// build an index item for this entry
+		index_entry_.size = item_data_size;
+		if (timestamping_enabled_)
+		{
+			// producers in async mode can be preempted between taking the
+			// timestamp and queueing the item. never let timestamps go
+			// backwards, so that Readers can binary search them.
+			index_entry_.timestamp = std::max<uint64_t>(index_entry_.timestamp,timestamp.count());
+		}
+
+		// entries are always appended in order, so just buffer them up
+		if (okay && append_index_entry(index_entry_))
+		{
+			// increment item count
+			total_item_count_++;
+			if ( ! compressor_)
+			{
+				stored_item_count_++;
+			}
+		}
+		else
+		{
+			okay = false;
+		}
+
+		okay = okay && checkpoint_if_due();
+
+		if ( ! okay)
+		{
+			flags_ |= protorecord::Flags::RECORD_WRITE_ERROR;
+		}
+		return okay;
+	}
+
+	bool
+	Writer::write_batch_data(
+		const char *batch_data,
+		const std::vector<uint32_t> &item_sizes,
+		const std::vector<std::chrono::microseconds> &timestamps)
+	{
+		bool okay = initialized_;
+		const bool per_item = timestamps.size() == item_sizes.size();
+		const std::chrono::microseconds no_timestamp(0);
+
+		uint64_t batch_size = 0;
+		for (const auto item_size : item_sizes)
+		{
+			batch_size += item_size;
+		}
+
+		// compressed items are copied into blocks anyway, and batches that
+		// would span data files have to be split up item by item
+		bool fits = segment_max_bytes_ == 0 || data_file_size_ + batch_size <= segment_max_bytes_;
+		if (okay && (compressor_ || ! fits || needs_new_segment(batch_size)))
+		{
+			const char *item_data = batch_data;
+			for (size_t i=0; okay && i<item_sizes.size(); i++)
+			{
+				const auto &timestamp = timestamps.empty() ? no_timestamp : timestamps[per_item ? i : 0];
+				okay = write_item_data(item_data,item_sizes[i],timestamp);
+				item_data += item_sizes[i];
+			}
+		}
+		else if (okay)
+		{
+			uint64_t item_offset = data_file_size_;
+			okay = data_file_->append(batch_data,batch_size);
+			data_file_size_ += batch_size;
+
+			const char *item_data = batch_data;
+			for (size_t i=0; okay && i<item_sizes.size(); i++)
+			{
+				if (live_channel_)
+				{
+					live_channel_->publish(item_data,item_sizes[i],total_item_count_);
+				}
+				if (key_index_)
+				{
+					key_index_->add(item_data,item_sizes[i],total_item_count_);
+				}
+				item_data += item_sizes[i];
+
+				index_entry_.file = data_file_num_;
+				index_entry_.offset = item_offset;
+				index_entry_.size = item_sizes[i];
+				if (timestamping_enabled_ && ! timestamps.empty())
+				{
+					const auto &timestamp = timestamps[per_item ? i : 0];
+					index_entry_.timestamp = std::max<uint64_t>(index_entry_.timestamp,timestamp.count());
+				}
+				item_offset += item_sizes[i];
+
+				okay = append_index_entry(index_entry_);
+				if (okay)
+				{
+					total_item_count_++;
+					stored_item_count_++;
+				}
+			}
+
+			okay = okay && checkpoint_if_due();
+
+			if ( ! okay)
+			{
+				flags_ |= protorecord::Flags::RECORD_WRITE_ERROR;
 			}
 		}
+
+		return okay;
+	}
+
+	bool
+	Writer::needs_new_segment(
+		uint32_t item_data_size)
+	{
+		if (data_file_size_ == 0)
+		{
+			// never leave a data file empty, even if the item is huge
+			return false;
+		}
+		else if (segment_max_bytes_ > 0 && data_file_size_ + item_data_size > segment_max_bytes_)
+		{
+			return true;
+		}
+		else if (segment_max_duration_.count() > 0)
+		{
+			return get_mono_time() - data_file_start_mono_ >= segment_max_duration_;
+		}
+		return false;
+	}
+
+	bool
+	Writer::open_data_file(
+		uint32_t file_num)
+	{
+		data_file_->close();
+		data_file_num_ = file_num;
+		data_file_size_ = 0;
+		data_file_start_mono_ = get_mono_time();
+		return data_file_->open(data_file_path(record_path_,file_num));
+	}
+
+	bool
+	Writer::append_to_block(
+		const void *item_data,
+		uint32_t item_data_size)
+	{
+		bool okay = true;
+
+		// start a new block if the item would overflow the current one. a
+		// block always gets at least one item, no matter how large it is.
+		if (block_->raw_size > 0 && block_->raw_size + item_data_size > block_size_)
+		{
+			okay = submit_block();
+		}
+
+		index_entry_.file = submitted_block_count_;
+		index_entry_.offset = block_->raw_size;
+
+		auto &raw = block_->raw;
+		if (raw.size() < block_->raw_size + item_data_size)
+		{
+			raw.resize(std::max(block_size_,block_->raw_size + item_data_size));
+		}
+		memcpy(raw.data() + block_->raw_size,item_data,item_data_size);
+		block_->raw_size += item_data_size;
+		block_->num_items++;
+
+		return okay;
+	}
+
+	bool
+	Writer::submit_block()
+	{
+		if (block_->num_items == 0)
+		{
+			return true;
+		}
+
+		compressor_->submit(std::move(block_));
+		submitted_block_count_++;
+		block_ = compressor_->get_block();
+		return store_finished_blocks(false);
+	}
+
+	bool
+	Writer::store_finished_blocks(
+		bool wait_all)
+	{
+		bool okay = true;
+		std::unique_ptr<BlockCompressor::Block> block;
+		while ((block = compressor_->pop_finished(wait_all || compressor_->full())))
+		{
+			okay = store_block(*block) && okay;
+			compressor_->recycle(std::move(block));
+		}
+		return okay;
+	}
+
+	bool
+	Writer::store_block(
+		const BlockCompressor::Block &block)
+	{
+		bool okay = true;
+		if (needs_new_segment(block.stored_size()))
+		{
+			okay = open_data_file(data_file_num_ + 1);
+		}
+
+		BlockEntry entry;
+		entry.offset = data_file_size_;
+		entry.stored_size = block.stored_size();
+		entry.raw_size = block.raw_size;
+		entry.file = data_file_num_;
+		entry.codec = (uint32_t)block.codec;
+
+		okay = data_file_->append(block.stored_data(),block.stored_size()) && okay;
+		data_file_size_ += block.stored_size();
+
+		// the table is tiny next to the blocks, so it isn't worth buffering.
+		// the entry is written even if the data wasn't, so that block
+		// numbers stay in sync with the index.
+		char encoded[BLOCK_ENTRY_SIZE];
+		encode_block_entry(entry,encoded);
+		okay = write_fully(blocks_fd_,encoded,sizeof(encoded)) && okay;
+		stored_block_count_++;
+
+		if (okay)
+		{
+			stored_item_count_ += block.num_items;
+		}
 		else
 		{
-			fail_reason_ = "Writer not initialized";
+			flags_ |= protorecord::Flags::RECORD_WRITE_ERROR;
+		}
+		return okay;
+	}
+
+	ItemQueue::Slot *
+	Writer::reserve_slot()
+	{
+		bool dropped_oldest = false;
+		ItemQueue::Slot *slot = queue_->reserve(queue_policy_,dropped_oldest);
+		if (slot == nullptr || dropped_oldest)
+		{
+			dropped_item_count_++;
+			flags_ |= protorecord::Flags::HAS_DROPPED_ITEMS;
+		}
+		if (slot != nullptr && ! dropped_oldest)
+		{
+			queued_item_count_++;
+		}
+		return slot;
+	}
+
+	bool
+	Writer::enqueue_item_data(
+		const void *item_data,
+		uint32_t item_data_size,
+		const std::chrono::microseconds &timestamp)
+	{
+		bool okay = true;
+		ItemQueue::Slot *slot = reserve_slot();
+		if (slot == nullptr)
+		{
+			set_reason("async queue is full; item was dropped");
 			okay = false;
 		}
+		else
+		{
+			if (slot->data.size() < item_data_size)
+			{
+				slot->data.resize(item_data_size*2);
+			}
 
+			memcpy(slot->data.data(),item_data,item_data_size);
+			slot->size = item_data_size;
+			slot->timestamp = timestamp;
+			commit_slot(slot,true);
+		}
 		return okay;
 	}
 
+	void
+	Writer::commit_slot(
+		ItemQueue::Slot *slot,
+		bool valid)
+	{
+		slot->valid = valid;
+		if ( ! valid)
+		{
+			queued_item_count_--;
+		}
+		queue_->commit(slot);
+	}
+
+	void
+	Writer::clear_reason()
+	{
+		// avoid the lock when there's nothing to clear
+		if (has_reason_.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(reason_mutex_);
+			fail_reason_.clear();
+			has_reason_.store(false,std::memory_order_relaxed);
+		}
+	}
+
+	void
+	Writer::set_reason(
+		const std::string &reason)
+	{
+		std::lock_guard<std::mutex> lock(reason_mutex_);
+		fail_reason_ = reason;
+		has_reason_.store(true,std::memory_order_relaxed);
+	}
+
 	//-------------------------------------------------------------------------
 	// private methods
 	//-------------------------------------------------------------------------
 
+	void
+	Writer::io_thread_main()
+	{
+		// wake up often enough to checkpoint on time while idle
+		std::chrono::microseconds wait_timeout(std::chrono::milliseconds(10));
+		if (checkpoint_interval_.count() > 0)
+		{
+			wait_timeout = std::min(wait_timeout,checkpoint_interval_);
+		}
+
+		while (queue_->wait(wait_timeout))
+		{
+			ItemQueue::Slot *slot = nullptr;
+			while ((slot = queue_->try_pop()) != nullptr)
+			{
+				if (slot->valid)
+				{
+					write_item_data(slot->data.data(),slot->size,slot->timestamp);
+				}
+				queue_->release(slot);
+			}
+			checkpoint_if_due();
+		}
+	}
+
 }// protorecord
\ No newline at end of file
@@ -35,6 +35,30 @@ public class Constants {
     public static int ITEM_BLOCK_OFFSET = (SUMMARY_BLOCK_OFFSET + SUMMARY_BLOCK_SIZE);
 
     public static int ITEM_BLOCK_STRIDE = (PROTORECORD_INDEX_ITEM_SIZE_TIMESTAMP + 1);
+
+    // index format where items are length prefixed IndexItem messages that
+    // are padded out to ITEM_BLOCK_STRIDE. used by protorecord 0.2.x
+    public static int PROTORECORD_INDEX_FORMAT_V1 = 1;
+
+    // index format where items are packed little-endian fixed-width entries
+    public static int PROTORECORD_INDEX_FORMAT_V2 = 2;
+
+    // in a v2 index the summary block is given room to grow, and the items
+    // start on a 64 byte boundary
+    public static int ITEM_BLOCK_OFFSET_V2 = 128;
+
+    // size in bytes of a v2 index entry (offset, size, file)
+    public static int INDEX_V2_ENTRY_SIZE = 16;
+
+    // size in bytes of a v2 index entry with a trailing timestamp
+    public static int INDEX_V2_ENTRY_SIZE_TIMESTAMP = 24;
+
+    // newest record version this Reader knows how to parse
+    public static int NEWEST_MAJOR = 0;
+    public static int NEWEST_MINOR = 3;
+
+    // oldest minor version this Reader still knows how to parse
+    public static int OLDEST_MINOR = 2;
     
     static class Flags {
         // set if the other bits in the words are valid
@@ -51,5 +75,8 @@ public class Constants {
 
         // indicating the record contains timestamped items
         public static int HAS_TIMESTAMPS = 0x8;
+
+        // set if the items' data is stored in compressed blocks
+        public static int HAS_COMPRESSED_BLOCKS = 0x20;
     }
 }
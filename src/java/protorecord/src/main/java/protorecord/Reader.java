@@ -10,6 +10,8 @@ import java.io.File;
 import java.io.FileNotFoundException;
 import java.io.IOException;
 import java.io.RandomAccessFile;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import protorecord.Protorecord.IndexItem;
 import protorecord.Protorecord.IndexSummary;
 import protorecord.Protorecord.Version;
@@ -27,6 +29,9 @@ public class Reader<MSG_T extends com.google.protobuf.Message> {
     private int version_minor_;
     private int version_patch_;
 
+    // how the record's index is laid out (PROTORECORD_INDEX_FORMAT_*)
+    private int index_format_;
+
     private long index_summary_total_items_;
     private long index_summary_start_time_utc_;
     private int index_summary_flags_;
@@ -35,6 +40,10 @@ public class Reader<MSG_T extends com.google.protobuf.Message> {
     private long index_item_offset_;
     private int index_item_size_;
 
+    // where the items are laid out in the index file
+    private long item_block_offset_;
+    private int item_block_stride_;
+
     // the opened index file
     private RandomAccessFile index_file_;
 
@@ -130,14 +139,14 @@ public class Reader<MSG_T extends com.google.protobuf.Message> {
             if (index_item != null) {
                 try {
                     byte[] msg_buffer = new byte[index_item.getSize()];
-                    data_file_.seek(index_item.getOffset());
-                    data_file_.read(msg_buffer,0,index_item.getSize());
+                    data_file_.seek(Integer.toUnsignedLong(index_item.getOffset()));
+                    data_file_.readFully(msg_buffer,0,index_item.getSize());
                     out_msg = parser_.parseFrom(msg_buffer);
                 } catch (IOException ex) {
                     fail_reason_ = "reached end of data file";
                     out_msg = null;
                 }
-            } else {
+            } else if (fail_reason_.isEmpty()) {
                 fail_reason_ = "index_item is null";
                 out_msg = null;
             }
@@ -319,6 +328,7 @@ public class Reader<MSG_T extends com.google.protobuf.Message> {
         version_major_ = 0;
         version_minor_ = 0;
         version_patch_ = 0;
+        index_format_ = Constants.PROTORECORD_INDEX_FORMAT_V1;
 
         // intialize index item
         index_item_offset_ = 0;
@@ -341,13 +351,10 @@ public class Reader<MSG_T extends com.google.protobuf.Message> {
                 version_major_ = version.getMajor();
                 version_minor_ = version.getMinor();
                 version_patch_ = version.getPatch();
+                index_format_ = version.getIndexFormat();
 
                 // check for compatibility
-                if ( ! is_compatible(version))
-                {
-                    fail_reason_ = "file/library version incompatibility";
-                    okay = false;
-                }
+                okay = is_compatible(version);
             }
 
             // read IndexSummary from record
@@ -363,12 +370,33 @@ public class Reader<MSG_T extends com.google.protobuf.Message> {
                 index_summary_start_time_utc_ = summary.getStartTimeUtc();
                 index_summary_flags_ = summary.getFlags();
             }
+
+            // this Reader only reads the items from the uncompressed data file
+            if (okay && (index_summary_flags_ & Constants.Flags.HAS_COMPRESSED_BLOCKS) > 0)
+            {
+                fail_reason_ = "compressed records are not supported";
+                okay = false;
+            }
         } catch (IOException ex) {
             fail_reason_ = "caught IOException ";
             fail_reason_ += ex.toString();
             okay = false;
         }
 
+        // figure out where the items are laid out in the index
+        if (okay && index_format_ == Constants.PROTORECORD_INDEX_FORMAT_V2)
+        {
+            item_block_offset_ = Constants.ITEM_BLOCK_OFFSET_V2;
+            item_block_stride_ = (index_summary_flags_ & Constants.Flags.HAS_TIMESTAMPS) > 0 ?
+                    Constants.INDEX_V2_ENTRY_SIZE_TIMESTAMP :
+                    Constants.INDEX_V2_ENTRY_SIZE;
+        }
+        else if (okay)
+        {
+            item_block_offset_ = Constants.ITEM_BLOCK_OFFSET;
+            item_block_stride_ = Constants.ITEM_BLOCK_STRIDE;
+        }
+
         return okay;
     }
  
@@ -392,11 +420,35 @@ public class Reader<MSG_T extends com.google.protobuf.Message> {
     /**
      * @return
      * True if record's version number is compatible with this version of
-     * Reader class.
+     * Reader class. Sets fail_reason_ otherwise.
      */
     private boolean is_compatible(Version record_version)
     {
-        return true;
+        boolean okay = true;
+        okay = okay && record_version.getMajor() == Constants.NEWEST_MAJOR;
+        okay = okay && record_version.getMinor() >= Constants.OLDEST_MINOR;
+
+        // records from newer libraries may have changed the format
+        okay = okay && record_version.getMinor() <= Constants.NEWEST_MINOR;
+        if ( ! okay)
+        {
+            fail_reason_ = String.format(
+                    "file/library version incompatibility. record is version %d.%d.%d",
+                    record_version.getMajor(),
+                    record_version.getMinor(),
+                    record_version.getPatch());
+            return false;
+        }
+
+        // make sure we understand how the index is laid out
+        int index_format = record_version.getIndexFormat();
+        if (index_format != Constants.PROTORECORD_INDEX_FORMAT_V1 &&
+            index_format != Constants.PROTORECORD_INDEX_FORMAT_V2)
+        {
+            fail_reason_ = String.format("unsupported index format %d",index_format);
+            okay = false;
+        }
+        return okay;
     }
  
     /**
@@ -421,27 +473,73 @@ public class Reader<MSG_T extends com.google.protobuf.Message> {
 
         if (okay)
         {
-            // compute position to IndexItem in file
-            // FIXME lossy conversion here, but java files only support int
-            // position peeks
-            int pos = (int)(Constants.ITEM_BLOCK_OFFSET + Constants.ITEM_BLOCK_STRIDE * item_idx);
+            // compute position to the item in file
+            long pos = item_block_offset_ + (long)item_block_stride_ * item_idx;
 
             // seek to position and read
             try {
                 index_file_.seek(pos);
-                int index_item_size = index_file_.read();
-                byte[] item_buffer = new byte[index_item_size];
-                index_file_.read(item_buffer,0,index_item_size);
-                item_out = item_parser_.parseFrom(item_buffer);
+                if (index_format_ == Constants.PROTORECORD_INDEX_FORMAT_V2)
+                {
+                    item_out = read_index_entry_v2();
+                }
+                else
+                {
+                    // v1 items are prefixed with their size
+                    int index_item_size = index_file_.read();
+                    byte[] item_buffer = new byte[index_item_size];
+                    index_file_.readFully(item_buffer,0,index_item_size);
+                    item_out = item_parser_.parseFrom(item_buffer);
+                }
             } catch (IOException ex) {
                 fail_reason_ = "reached end of index file";
                 okay = false;
             }
         }
 
+        // this Reader only opens the first data file
+        if (item_out != null && item_out.getFile() != 0)
+        {
+            fail_reason_ = "records split over several data files are not supported";
+            item_out = null;
+        }
+
         return item_out;
     }
  
+    /**
+     * Reads a fixed-width little-endian v2 index entry at the index file's
+     * current position
+     *
+     * @return
+     * The entry as an IndexItem
+     */
+    private IndexItem read_index_entry_v2() throws IOException
+    {
+        byte[] entry = new byte[item_block_stride_];
+        index_file_.readFully(entry,0,item_block_stride_);
+        ByteBuffer buf = ByteBuffer.wrap(entry).order(ByteOrder.LITTLE_ENDIAN);
+
+        long offset = buf.getLong(0);
+        int size = buf.getInt(8);
+        int file = buf.getInt(12);
+        if ((offset >>> 32) != 0)
+        {
+            // IndexItem can't hold the offset, so the item can't be read
+            throw new IOException("item offset " + offset + " is out of range");
+        }
+
+        IndexItem.Builder item = IndexItem.newBuilder()
+                .setOffset((int)offset)
+                .setSize(size)
+                .setFile(file);
+        if (item_block_stride_ == Constants.INDEX_V2_ENTRY_SIZE_TIMESTAMP)
+        {
+            item.setTimestamp(buf.getLong(16));
+        }
+        return item.build();
+    }
+ 
     /**
      * @param[in] flag
      * The flag to check for
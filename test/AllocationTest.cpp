@@ -0,0 +1,316 @@
+#include "AllocationTest.h"
+
+#include <atomic>
+#include <malloc.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "DemoMessages.pb.h"
+#include "protorecord.h"
+
+//-----------------------------------------------------------------------------
+// allocation tracking
+//
+// every heap allocation in the process ends up in one of the functions below.
+// they forward to glibc's allocator, and count the calls while counting is
+// enabled.
+//-----------------------------------------------------------------------------
+
+extern "C"
+{
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t num, size_t size);
+	void *__libc_realloc(void *ptr, size_t size);
+	void *__libc_memalign(size_t alignment, size_t size);
+	void __libc_free(void *ptr);
+}
+
+static std::atomic<bool> counting(false);
+static std::atomic<uint64_t> allocations(0);
+
+static
+void
+count_allocation()
+{
+	if (counting.load(std::memory_order_relaxed))
+	{
+		allocations.fetch_add(1,std::memory_order_relaxed);
+	}
+}
+
+extern "C"
+void *
+malloc(
+	size_t size)
+{
+	count_allocation();
+	return __libc_malloc(size);
+}
+
+extern "C"
+void *
+calloc(
+	size_t num,
+	size_t size)
+{
+	count_allocation();
+	return __libc_calloc(num,size);
+}
+
+extern "C"
+void *
+realloc(
+	void *ptr,
+	size_t size)
+{
+	count_allocation();
+	return __libc_realloc(ptr,size);
+}
+
+extern "C"
+int
+posix_memalign(
+	void **memptr,
+	size_t alignment,
+	size_t size)
+{
+	count_allocation();
+	*memptr = __libc_memalign(alignment,size);
+	return *memptr != nullptr ? 0 : ENOMEM;
+}
+
+extern "C"
+void *
+aligned_alloc(
+	size_t alignment,
+	size_t size)
+{
+	count_allocation();
+	return __libc_memalign(alignment,size);
+}
+
+extern "C"
+void
+free(
+	void *ptr)
+{
+	__libc_free(ptr);
+}
+
+void *
+operator new(
+	size_t size)
+{
+	count_allocation();
+	void *ptr = __libc_malloc(size);
+	if (ptr == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void *
+operator new[](
+	size_t size)
+{
+	return operator new(size);
+}
+
+void
+operator delete(
+	void *ptr) noexcept
+{
+	__libc_free(ptr);
+}
+
+void
+operator delete[](
+	void *ptr) noexcept
+{
+	__libc_free(ptr);
+}
+
+void
+operator delete(
+	void *ptr,
+	size_t) noexcept
+{
+	__libc_free(ptr);
+}
+
+void
+operator delete[](
+	void *ptr,
+	size_t) noexcept
+{
+	__libc_free(ptr);
+}
+
+namespace protorecord
+{
+	// number of iterations done before allocations are counted
+	const unsigned int WARMUP_ITERATIONS = 10000;
+
+	// number of steady state iterations that must not allocate
+	const unsigned int STEADY_STATE_ITERATIONS = 1000000;
+
+	// counts the allocations made while a scope is alive
+	class AllocationCounter
+	{
+	public:
+		AllocationCounter()
+		{
+			allocations.store(0);
+			counting.store(true);
+		}
+
+		~AllocationCounter()
+		{
+			counting.store(false);
+		}
+
+		uint64_t
+		count() const
+		{
+			return allocations.load();
+		}
+	};
+
+	// a message with a string and repeated fields, reused across items
+	static
+	void
+	fill_message(
+		protorecord::demo::LargeMessage &msg,
+		unsigned int i)
+	{
+		msg.Clear();
+		for (unsigned int j=0; j<4; j++)
+		{
+			msg.add_mystrings("helloworld");
+			msg.add_myints(i + j);
+			msg.add_mybools(j % 2);
+		}
+	}
+
+	AllocationTest::AllocationTest()
+	{
+	}
+
+	void
+	AllocationTest::setUp()
+	{
+		mkdir(TEST_TMP_PATH.c_str(),0777);
+	}
+
+	void
+	AllocationTest::tearDown()
+	{
+	}
+
+	void
+	AllocationTest::writer_steady_state()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+
+		WriterOptions buffered_options;
+		buffered_options.storage_backend = StorageBackend::POSIX;
+		WriterOptions uring_options;
+		uring_options.storage_backend = StorageBackend::IO_URING;
+		WriterOptions mmap_options;
+		mmap_options.use_mmap = true;
+		WriterOptions direct_options;
+		direct_options.direct_io = true;
+		WriterOptions async_options;
+		async_options.async = true;
+		const WriterOptions OPTIONS[] = {buffered_options, uring_options, mmap_options, direct_options, async_options};
+
+		for (auto options : OPTIONS)
+		{
+			options.enable_timestamping = true;
+			Writer writer(RECORD_PATH,options);
+
+			protorecord::demo::LargeMessage msg;
+			unsigned int i = 0;
+			for (; i<WARMUP_ITERATIONS; i++)
+			{
+				fill_message(msg,i);
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+
+			uint64_t num_allocations = 0;
+			bool okay = true;
+			{
+				AllocationCounter counter;
+				for (; i<WARMUP_ITERATIONS + STEADY_STATE_ITERATIONS; i++)
+				{
+					msg.set_myints(0,i);
+					okay = writer.write(msg) && okay;
+				}
+				num_allocations = counter.count();
+			}
+			CPPUNIT_ASSERT(okay);
+			CPPUNIT_ASSERT_EQUAL((uint64_t)0,num_allocations);
+			writer.close();
+		}
+	}
+
+	void
+	AllocationTest::reader_steady_state()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = WARMUP_ITERATIONS + STEADY_STATE_ITERATIONS;
+
+		WriterOptions writer_options;
+		writer_options.enable_timestamping = true;
+		Writer writer(RECORD_PATH,writer_options);
+		protorecord::demo::LargeMessage msg;
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			fill_message(msg,i);
+			CPPUNIT_ASSERT(writer.write(msg));
+		}
+		writer.close();
+
+		ReaderOptions posix_options;
+		posix_options.storage_backend = StorageBackend::POSIX;
+		ReaderOptions uring_options;
+		uring_options.storage_backend = StorageBackend::IO_URING;
+		ReaderOptions mmap_options;
+		mmap_options.use_mmap = true;
+		const ReaderOptions OPTIONS[] = {posix_options, uring_options, mmap_options};
+
+		for (const auto &options : OPTIONS)
+		{
+			Reader reader(RECORD_PATH,options);
+			unsigned int i = 0;
+			for (; i<WARMUP_ITERATIONS; i++)
+			{
+				CPPUNIT_ASSERT(reader.take_next(msg));
+			}
+
+			uint64_t num_allocations = 0;
+			bool okay = true;
+			{
+				AllocationCounter counter;
+				for (; i<NUM_ITEMS; i++)
+				{
+					okay = reader.take_next(msg) && okay;
+					okay = msg.myints(0) == i && okay;
+				}
+				num_allocations = counter.count();
+			}
+			CPPUNIT_ASSERT(okay);
+			CPPUNIT_ASSERT_EQUAL((uint64_t)0,num_allocations);
+		}
+	}
+
+}// protorecord
+
+int main()
+{
+	CppUnit::TextUi::TestRunner runner;
+	runner.addTest(protorecord::AllocationTest::suite());
+	return runner.run() ? 0 : EXIT_FAILURE;
+}
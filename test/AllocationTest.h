@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+namespace protorecord
+{
+
+	// checks that the Writer and Reader make no heap allocations once warmed up
+	class AllocationTest : public CppUnit::TestFixture
+	{
+		CPPUNIT_TEST_SUITE(AllocationTest);
+		CPPUNIT_TEST(writer_steady_state);
+		CPPUNIT_TEST(reader_steady_state);
+		CPPUNIT_TEST_SUITE_END();
+
+	public:
+		AllocationTest();
+		void setUp();
+		void tearDown();
+
+	protected:
+		void writer_steady_state();
+		void reader_steady_state();
+
+	private:
+		const std::string TEST_TMP_PATH = "allocation_test_tmp";
+
+	};
+
+}
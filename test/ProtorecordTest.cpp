@@ -1,6 +1,13 @@
 #include "ProtorecordTest.h"
 
+#include <algorithm>
+#include <atomic>
+#ifdef PROTORECORD_TEST_PARALLEL_ALGORITHMS
+#include <execution>
+#endif
+#include <mutex>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 #include "DemoMessages.pb.h"
 #include "protorecord.h"
@@ -328,6 +335,43 @@ namespace protorecord
 			CPPUNIT_ASSERT_EQUAL(std::string("this is record2"),msg.mystring());
 			expect++;
 		}
+
+		// ----------------------------------------
+
+		// drop items into a third record, with a tiny queue the I/O thread
+		// can't keep up with
+		const std::string RECORD3_PATH(TEST_TMP_PATH + "/" + __func__ + "3");
+		const std::string RECORD4_PATH(TEST_TMP_PATH + "/" + __func__ + "4");
+		WriterOptions drop_options;
+		drop_options.async = true;
+		drop_options.async_queue_depth = 2;
+		drop_options.full_queue_policy = FullQueuePolicy::DROP_NEWEST;
+		CPPUNIT_ASSERT(writer.open(RECORD3_PATH,drop_options));
+		for (unsigned int i=0; i<100000; i++)
+		{
+			msg.set_myint(i);
+			writer.write(msg);
+		}
+		const size_t dropped = writer.dropped();
+		writer.close();
+
+		Reader reader3(RECORD3_PATH);
+		CPPUNIT_ASSERT_EQUAL(dropped > 0,reader3.has_dropped_items());
+		CPPUNIT_ASSERT_EQUAL(dropped,reader3.dropped());
+
+		// none of the third record's summary may leak into the fourth
+		CPPUNIT_ASSERT(writer.open(RECORD4_PATH));
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			msg.set_myint(i);
+			CPPUNIT_ASSERT(writer.write(msg));
+		}
+		writer.close();
+
+		Reader reader4(RECORD4_PATH);
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,reader4.size());
+		CPPUNIT_ASSERT_EQUAL(false,reader4.has_dropped_items());
+		CPPUNIT_ASSERT_EQUAL((size_t)0,reader4.dropped());
 	}
 
 	void
@@ -423,6 +467,2156 @@ namespace protorecord
 		}
 	}
 
+	void
+	ProtorecordTest::async_write_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const size_t NUM_ITEMS = 100000;
+
+		WriterOptions options;
+		options.async = true;
+		options.async_queue_depth = 64;
+		options.full_queue_policy = FullQueuePolicy::BLOCK;
+		Writer writer(RECORD_PATH,options);
+
+		protorecord::demo::BasicMessage msg;
+		msg.set_mystring("helloworld");
+
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			msg.set_myint(i);
+			CPPUNIT_ASSERT(writer.write(msg));
+		}
+
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,writer.size());
+		CPPUNIT_ASSERT_EQUAL((size_t)0,writer.dropped());
+
+		writer.close();
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,reader.size());
+		CPPUNIT_ASSERT_EQUAL(false,reader.has_dropped_items());
+
+		unsigned int expect = 0;
+		while (reader.has_next())
+		{
+			CPPUNIT_ASSERT_MESSAGE(
+				"reader ran away!",
+				expect < NUM_ITEMS);
+			CPPUNIT_ASSERT(reader.take_next(msg));
+			CPPUNIT_ASSERT_EQUAL(expect,msg.myint());
+			CPPUNIT_ASSERT_EQUAL(std::string("helloworld"),msg.mystring());
+			expect++;
+		}
+		CPPUNIT_ASSERT_EQUAL((unsigned int)NUM_ITEMS,expect);
+	}
+
+	void
+	ProtorecordTest::async_drop_policies()
+	{
+		const size_t NUM_ITEMS = 100000;
+		const FullQueuePolicy POLICIES[] = {
+			FullQueuePolicy::DROP_NEWEST,
+			FullQueuePolicy::DROP_OLDEST};
+
+		for (const auto policy : POLICIES)
+		{
+			const std::string RECORD_PATH(
+				TEST_TMP_PATH + "/" + __func__ + std::to_string((int)policy));
+
+			// tiny queue so that the I/O thread can't keep up
+			WriterOptions options;
+			options.async = true;
+			options.async_queue_depth = 2;
+			options.full_queue_policy = policy;
+			Writer writer(RECORD_PATH,options);
+
+			protorecord::demo::BasicMessage msg;
+			msg.set_mystring("helloworld");
+
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_myint(i);
+				writer.write(msg);
+			}
+
+			// every item is either recorded or accounted for as dropped
+			const size_t written = writer.size();
+			const size_t dropped = writer.dropped();
+			CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,written + dropped);
+
+			writer.close();
+
+			Reader reader(RECORD_PATH);
+			CPPUNIT_ASSERT_EQUAL(written,reader.size());
+			CPPUNIT_ASSERT_EQUAL(dropped > 0,reader.has_dropped_items());
+			CPPUNIT_ASSERT_EQUAL(dropped,reader.dropped());
+
+			// surviving items must still be in the order they were written
+			bool first_item = true;
+			unsigned int prev = 0;
+			while (reader.has_next())
+			{
+				CPPUNIT_ASSERT(reader.take_next(msg));
+				CPPUNIT_ASSERT(first_item || msg.myint() > prev);
+				prev = msg.myint();
+				first_item = false;
+			}
+		}
+	}
+
+	void
+	ProtorecordTest::async_multi_producer()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const size_t NUM_PRODUCERS = 8;
+		const size_t ITEMS_PER_PRODUCER = 10000;
+		const size_t NUM_ITEMS = NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+
+		WriterOptions options;
+		options.async = true;
+		options.async_queue_depth = 256;
+		Writer writer(RECORD_PATH,options);
+
+		std::vector<std::thread> producers;
+		for (unsigned int p=0; p<NUM_PRODUCERS; p++)
+		{
+			producers.emplace_back([&writer,p,ITEMS_PER_PRODUCER](){
+				protorecord::demo::BasicMessage msg;
+				msg.set_mystring("producer" + std::to_string(p));
+				for (unsigned int i=0; i<ITEMS_PER_PRODUCER; i++)
+				{
+					msg.set_myint(p * ITEMS_PER_PRODUCER + i);
+					writer.write(msg);
+				}
+			});
+		}
+		for (auto &producer : producers)
+		{
+			producer.join();
+		}
+
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,writer.size());
+		writer.close();
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,reader.size());
+
+		// items are interleaved, but each producer's items stay in order
+		std::vector<unsigned int> next_expect(NUM_PRODUCERS,0);
+		protorecord::demo::BasicMessage msg;
+		while (reader.has_next())
+		{
+			CPPUNIT_ASSERT(reader.take_next(msg));
+			unsigned int p = msg.myint() / ITEMS_PER_PRODUCER;
+			unsigned int i = msg.myint() % ITEMS_PER_PRODUCER;
+			CPPUNIT_ASSERT(p < NUM_PRODUCERS);
+			CPPUNIT_ASSERT_EQUAL(next_expect[p],i);
+			CPPUNIT_ASSERT_EQUAL("producer" + std::to_string(p),msg.mystring());
+			next_expect[p]++;
+		}
+		for (unsigned int p=0; p<NUM_PRODUCERS; p++)
+		{
+			CPPUNIT_ASSERT_EQUAL((unsigned int)ITEMS_PER_PRODUCER,next_expect[p]);
+		}
+	}
+
+	void
+	ProtorecordTest::index_v1_compat()
+	{
+		// recorded with protorecord 0.2.0, which used the v1 index format
+		const std::string RECORD_PATH(std::string(TEST_RECORDS_DIR) + "/basic_helloworld");
+		const size_t NUM_ITEMS = 10;
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,reader.size());
+		CPPUNIT_ASSERT_EQUAL(false,reader.has_timestamps());
+
+		Version version = reader.get_version();
+		CPPUNIT_ASSERT_EQUAL((int)0,(int)version.major());
+		CPPUNIT_ASSERT_EQUAL((int)2,(int)version.minor());
+		CPPUNIT_ASSERT_EQUAL((int)PROTORECORD_INDEX_FORMAT_V1,(int)version.index_format());
+
+		protorecord::demo::BasicMessage msg;
+		unsigned int expect = 0;
+		while (reader.has_next())
+		{
+			CPPUNIT_ASSERT_MESSAGE(
+				"reader ran away!",
+				expect < NUM_ITEMS);
+			CPPUNIT_ASSERT(reader.take_next(msg));
+			CPPUNIT_ASSERT_EQUAL(expect,msg.myint());
+			CPPUNIT_ASSERT_EQUAL(std::string("helloworld"),msg.mystring());
+			expect++;
+		}
+		CPPUNIT_ASSERT_EQUAL((unsigned int)NUM_ITEMS,expect);
+	}
+
+	void
+	ProtorecordTest::segmented_write_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const size_t NUM_ITEMS = 10000;
+		const uint64_t SEGMENT_MAX_BYTES = 4096;
+
+		WriterOptions options;
+		options.segment_max_bytes = SEGMENT_MAX_BYTES;
+		Writer writer(RECORD_PATH,options);
+
+		protorecord::demo::BasicMessage msg;
+		msg.set_mystring("helloworld");
+
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			msg.set_myint(i);
+			CPPUNIT_ASSERT(writer.write(msg));
+		}
+
+		writer.close();
+
+		// make sure the data was actually split up, and that no data file
+		// grew past the limit
+		struct stat st;
+		CPPUNIT_ASSERT_EQUAL(0,stat(data_file_path(RECORD_PATH,0).c_str(),&st));
+		CPPUNIT_ASSERT(st.st_size <= (off_t)SEGMENT_MAX_BYTES);
+		CPPUNIT_ASSERT_EQUAL(0,stat(data_file_path(RECORD_PATH,1).c_str(),&st));
+		CPPUNIT_ASSERT(st.st_size <= (off_t)SEGMENT_MAX_BYTES);
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,reader.size());
+
+		unsigned int expect = 0;
+		while (reader.has_next())
+		{
+			CPPUNIT_ASSERT_MESSAGE(
+				"reader ran away!",
+				expect < NUM_ITEMS);
+			CPPUNIT_ASSERT(reader.take_next(msg));
+			CPPUNIT_ASSERT_EQUAL(expect,msg.myint());
+			CPPUNIT_ASSERT_EQUAL(std::string("helloworld"),msg.mystring());
+			expect++;
+		}
+		CPPUNIT_ASSERT_EQUAL((unsigned int)NUM_ITEMS,expect);
+
+		// overwriting with a single segment record must not leave the old
+		// segments behind
+		Writer overwriter(RECORD_PATH);
+		CPPUNIT_ASSERT(overwriter.write(msg));
+		overwriter.close();
+		CPPUNIT_ASSERT(stat(data_file_path(RECORD_PATH,1).c_str(),&st) < 0);
+
+		// time based rotation
+		WriterOptions timed_options;
+		timed_options.segment_max_duration = std::chrono::milliseconds(5);
+		Writer timed_writer(RECORD_PATH,timed_options);
+		for (unsigned int i=0; i<10; i++)
+		{
+			msg.set_myint(i);
+			CPPUNIT_ASSERT(timed_writer.write(msg));
+			usleep(10000);
+		}
+		timed_writer.close();
+		CPPUNIT_ASSERT_EQUAL(0,stat(data_file_path(RECORD_PATH,9).c_str(),&st));
+
+		Reader timed_reader(RECORD_PATH);
+		for (unsigned int i=0; i<10; i++)
+		{
+			CPPUNIT_ASSERT(timed_reader.take_next(msg));
+			CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+		}
+	}
+
+	void
+	ProtorecordTest::compressed_write_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const size_t NUM_ITEMS = 20000;
+		const Codec CODECS[] = {Codec::LZ4, Codec::ZSTD, Codec::ZLIB};
+
+		protorecord::demo::LargeMessage msg;
+		for (unsigned int i=0; i<4; i++)
+		{
+			msg.add_mystrings("helloworld" + std::to_string(i));
+			msg.add_myints(i);
+			msg.add_mybools(i % 2);
+		}
+
+		for (const auto codec : CODECS)
+		{
+			WriterOptions options;
+			options.compression = codec;
+			options.compression_block_size = 16 * 1024;
+
+			if ( ! codec_available(codec))
+			{
+				// the Writer must refuse codecs it wasn't built with
+				Writer writer;
+				CPPUNIT_ASSERT( ! writer.open(RECORD_PATH,options));
+				CPPUNIT_ASSERT(writer.reason() != "");
+				continue;
+			}
+
+			// exercise both the worker pool (behind an async Writer) and inline
+			// compression, and make sure blocks are spread across segments
+			for (size_t threads=0; threads<=2; threads+=2)
+			{
+				options.compression_threads = threads;
+				options.async = threads > 0;
+				options.segment_max_bytes = 64 * 1024;
+				options.enable_timestamping = true;
+				Writer writer(RECORD_PATH,options);
+				for (unsigned int i=0; i<NUM_ITEMS; i++)
+				{
+					msg.set_myints(0,i);
+					CPPUNIT_ASSERT(writer.write(msg));
+				}
+				writer.close();
+
+				Reader reader(RECORD_PATH);
+				CPPUNIT_ASSERT_EQUAL(std::string(""),reader.reason());
+				CPPUNIT_ASSERT(reader.has_compressed_blocks());
+				CPPUNIT_ASSERT(reader.has_timestamps());
+				CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,reader.size());
+
+				uint64_t prev_timestamp = 0;
+				for (unsigned int i=0; i<NUM_ITEMS; i++)
+				{
+					uint64_t timestamp = 0;
+					CPPUNIT_ASSERT(reader.get_next_timestamp(timestamp));
+					CPPUNIT_ASSERT(timestamp >= prev_timestamp);
+					prev_timestamp = timestamp;
+
+					CPPUNIT_ASSERT(reader.take_next(msg));
+					CPPUNIT_ASSERT_EQUAL(i,msg.myints(0));
+					CPPUNIT_ASSERT_EQUAL(std::string("helloworld3"),msg.mystrings(3));
+				}
+				CPPUNIT_ASSERT( ! reader.has_next());
+			}
+
+			// the repetitive messages should compress well
+			struct stat st;
+			CPPUNIT_ASSERT_EQUAL(0,stat(data_file_path(RECORD_PATH,0).c_str(),&st));
+			CPPUNIT_ASSERT(st.st_size <= 64 * 1024);
+			const off_t raw_size = NUM_ITEMS * msg.ByteSizeLong();
+			off_t stored_size = 0;
+			for (uint32_t file_num=0; stat(data_file_path(RECORD_PATH,file_num).c_str(),&st) == 0; file_num++)
+			{
+				stored_size += st.st_size;
+			}
+			CPPUNIT_ASSERT(stored_size < raw_size / 2);
+		}
+
+		// overwriting with an uncompressed record must remove the block table
+		Writer writer(RECORD_PATH);
+		CPPUNIT_ASSERT(writer.write(msg));
+		writer.close();
+		struct stat st;
+		CPPUNIT_ASSERT(stat((RECORD_PATH + "/blocks").c_str(),&st) < 0);
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT( ! reader.has_compressed_blocks());
+		CPPUNIT_ASSERT(reader.take_next(msg));
+	}
+
+	void
+	ProtorecordTest::mmap_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const size_t NUM_ITEMS = 5000;
+
+		ReaderOptions mmap_options;
+		mmap_options.use_mmap = true;
+
+		protorecord::demo::BasicMessage msg;
+		msg.set_mystring("helloworld");
+
+		// spread the items over a few segments, and compress them if possible
+		WriterOptions options;
+		options.segment_max_bytes = 16 * 1024;
+		for (size_t pass=0; pass<2; pass++)
+		{
+			options.compression = pass > 0 ? Codec::ZLIB : Codec::NONE;
+			if ( ! codec_available(options.compression))
+			{
+				continue;
+			}
+
+			Writer writer(RECORD_PATH,options);
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_myint(i);
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			Reader reader(RECORD_PATH,mmap_options);
+			CPPUNIT_ASSERT_EQUAL(std::string(""),reader.reason());
+			CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,reader.size());
+
+			// raw access hands back the exact bytes that were written
+			std::string_view raw;
+			for (unsigned int i=0; i<NUM_ITEMS; i+=999)
+			{
+				msg.set_myint(i);
+				CPPUNIT_ASSERT(reader.get_raw(i,raw));
+				CPPUNIT_ASSERT(msg.SerializeAsString() == raw);
+			}
+			CPPUNIT_ASSERT( ! reader.get_raw(NUM_ITEMS,raw));
+
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				CPPUNIT_ASSERT(reader.take_next(msg));
+				CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+				CPPUNIT_ASSERT_EQUAL(std::string("helloworld"),msg.mystring());
+			}
+			CPPUNIT_ASSERT( ! reader.has_next());
+		}
+
+		// old v1 records can be mapped too
+		Reader v1_reader(std::string(TEST_RECORDS_DIR) + "/basic_helloworld",mmap_options);
+		CPPUNIT_ASSERT_EQUAL((size_t)10,v1_reader.size());
+		size_t v1_items = 0;
+		while (v1_reader.take_next(msg))
+		{
+			CPPUNIT_ASSERT_EQUAL(std::string("helloworld"),msg.mystring());
+			v1_items++;
+		}
+		CPPUNIT_ASSERT_EQUAL((size_t)10,v1_items);
+	}
+
+	void
+	ProtorecordTest::random_access()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 1000;
+
+		Writer writer(RECORD_PATH);
+		protorecord::demo::BasicMessage msg;
+		msg.set_mystring("helloworld");
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			msg.set_myint(i);
+			CPPUNIT_ASSERT(writer.write(msg));
+		}
+		writer.close();
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0,reader.tell());
+
+		// get() reads anywhere without moving the Reader
+		const unsigned int IDXS[] = {999, 0, 500, 1, 998, 500};
+		for (const auto idx : IDXS)
+		{
+			CPPUNIT_ASSERT(reader.get(idx,msg));
+			CPPUNIT_ASSERT_EQUAL(idx,msg.myint());
+		}
+		CPPUNIT_ASSERT( ! reader.get(NUM_ITEMS,msg));
+		CPPUNIT_ASSERT(reader.reason() != "");
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0,reader.tell());
+
+		// jump forward, then back
+		CPPUNIT_ASSERT(reader.seek(700));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)700,reader.tell());
+		CPPUNIT_ASSERT(reader.take_next(msg));
+		CPPUNIT_ASSERT_EQUAL(700U,msg.myint());
+		CPPUNIT_ASSERT_EQUAL((uint64_t)701,reader.tell());
+		CPPUNIT_ASSERT(reader.seek(3));
+		CPPUNIT_ASSERT(reader.take_next(msg));
+		CPPUNIT_ASSERT_EQUAL(3U,msg.myint());
+
+		// seeking to the end is allowed, past it isn't
+		CPPUNIT_ASSERT(reader.seek(NUM_ITEMS));
+		CPPUNIT_ASSERT( ! reader.has_next());
+		CPPUNIT_ASSERT( ! reader.take_next(msg));
+		CPPUNIT_ASSERT( ! reader.seek(NUM_ITEMS + 1));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS,reader.tell());
+
+		// a seek recovers the Reader after it ran off the end
+		CPPUNIT_ASSERT(reader.seek(NUM_ITEMS - 1));
+		CPPUNIT_ASSERT(reader.take_next(msg));
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS - 1,msg.myint());
+	}
+
+	void
+	ProtorecordTest::time_seek()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 2000;
+
+		Writer writer(RECORD_PATH,true);
+		protorecord::demo::BasicMessage msg;
+		msg.set_mystring("helloworld");
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			msg.set_myint(i);
+			CPPUNIT_ASSERT(writer.write(msg));
+			if (i % 100 == 0)
+			{
+				usleep(1000);
+			}
+		}
+		writer.close();
+
+		// remember every timestamp so the searches can be checked against a
+		// linear scan
+		Reader reader(RECORD_PATH);
+		std::vector<uint64_t> timestamps;
+		uint64_t timestamp = 0;
+		while (reader.get_next_timestamp(timestamp))
+		{
+			timestamps.push_back(timestamp);
+			CPPUNIT_ASSERT(reader.take_next(msg));
+		}
+		CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,timestamps.size());
+		CPPUNIT_ASSERT(std::is_sorted(timestamps.begin(),timestamps.end()));
+
+		auto expected_idx = [&](uint64_t t) -> uint64_t {
+			return std::lower_bound(timestamps.begin(),timestamps.end(),t) - timestamps.begin();
+		};
+
+		const uint64_t last_time = timestamps.back();
+		const uint64_t PROBES[] = {0, 1, last_time / 3, last_time / 2, last_time, last_time + 1};
+		for (const auto t : PROBES)
+		{
+			CPPUNIT_ASSERT(reader.seek_to_time(t));
+			CPPUNIT_ASSERT_EQUAL(expected_idx(t),reader.tell());
+			if (reader.has_next())
+			{
+				CPPUNIT_ASSERT(reader.take_next(msg));
+				CPPUNIT_ASSERT_EQUAL((unsigned int)expected_idx(t),msg.myint());
+			}
+		}
+
+		// ranges only cover the items in the window
+		ItemRange range = reader.range(last_time / 4,last_time / 2);
+		CPPUNIT_ASSERT_EQUAL(expected_idx(last_time / 4),range.first);
+		CPPUNIT_ASSERT_EQUAL(expected_idx(last_time / 2),range.last);
+		uint64_t visited = 0;
+		for (const auto idx : range)
+		{
+			CPPUNIT_ASSERT(reader.get(idx,msg));
+			CPPUNIT_ASSERT_EQUAL((unsigned int)idx,msg.myint());
+			visited++;
+		}
+		CPPUNIT_ASSERT_EQUAL(range.size(),visited);
+		CPPUNIT_ASSERT(reader.range(last_time,0).empty());
+
+		// records without timestamps can't be searched
+		Writer plain_writer(RECORD_PATH);
+		CPPUNIT_ASSERT(plain_writer.write(msg));
+		plain_writer.close();
+		Reader plain_reader(RECORD_PATH);
+		CPPUNIT_ASSERT( ! plain_reader.seek_to_time(0));
+		CPPUNIT_ASSERT(plain_reader.range(0,100).empty());
+		CPPUNIT_ASSERT(plain_reader.reason() != "");
+	}
+
+	void
+	ProtorecordTest::batch_write_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_BATCHES = 100;
+		const unsigned int BATCH_SIZE = 16;
+		const unsigned int NUM_ITEMS = NUM_BATCHES * BATCH_SIZE;
+
+		std::vector<protorecord::demo::BasicMessage> batch(BATCH_SIZE);
+		for (auto &msg : batch)
+		{
+			msg.set_mystring("helloworld");
+		}
+
+		// plain, segmented (batches have to be split) and async records
+		WriterOptions segmented_options;
+		segmented_options.segment_max_bytes = 1000;
+		WriterOptions async_options;
+		async_options.async = true;
+		const WriterOptions OPTIONS[] = {WriterOptions(), segmented_options, async_options};
+
+		for (auto options : OPTIONS)
+		{
+			options.enable_timestamping = true;
+			Writer writer(RECORD_PATH,options);
+			for (unsigned int b=0; b<NUM_BATCHES; b++)
+			{
+				for (unsigned int i=0; i<BATCH_SIZE; i++)
+				{
+					batch[i].set_myint(b * BATCH_SIZE + i);
+				}
+				auto timestamping = b % 2 ? BatchTimestamp::PER_ITEM : BatchTimestamp::PER_BATCH;
+				CPPUNIT_ASSERT(writer.write_batch(batch.begin(),batch.end(),timestamping));
+			}
+			CPPUNIT_ASSERT(writer.write_batch(batch.begin(),batch.begin()));
+			writer.close();
+
+			Reader reader(RECORD_PATH);
+			CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,reader.size());
+			CPPUNIT_ASSERT( ! reader.has_assumed_data());
+			protorecord::demo::BasicMessage msg;
+			uint64_t prev_timestamp = 0;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				uint64_t timestamp = 0;
+				CPPUNIT_ASSERT(reader.get_next_timestamp(timestamp));
+				CPPUNIT_ASSERT(timestamp >= prev_timestamp);
+				prev_timestamp = timestamp;
+
+				CPPUNIT_ASSERT(reader.take_next(msg));
+				CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+			}
+			CPPUNIT_ASSERT( ! reader.has_next());
+		}
+
+		// externally serialized items
+		std::vector<std::string> serialized;
+		for (unsigned int i=0; i<BATCH_SIZE; i++)
+		{
+			batch[i].set_myint(i);
+			serialized.push_back(batch[i].SerializeAsString());
+		}
+		std::vector<ItemSpan> spans;
+		for (const auto &item : serialized)
+		{
+			spans.push_back(ItemSpan{item.data(),(uint32_t)item.size()});
+		}
+
+		Writer writer(RECORD_PATH);
+		CPPUNIT_ASSERT(writer.write_batch(spans.data(),spans.size()));
+		CPPUNIT_ASSERT_EQUAL((size_t)BATCH_SIZE,writer.size());
+		writer.close();
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT(reader.has_assumed_data());
+		protorecord::demo::BasicMessage msg;
+		for (unsigned int i=0; i<BATCH_SIZE; i++)
+		{
+			CPPUNIT_ASSERT(reader.take_next(msg));
+			CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+		}
+		CPPUNIT_ASSERT( ! reader.has_next());
+	}
+
+	void
+	ProtorecordTest::storage_backends()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 5000;
+
+		CPPUNIT_ASSERT(storage_backend_available(StorageBackend::AUTO));
+		CPPUNIT_ASSERT(storage_backend_available(StorageBackend::POSIX));
+		std::vector<StorageBackend> backends = {StorageBackend::POSIX};
+		if (storage_backend_available(StorageBackend::IO_URING))
+		{
+			backends.push_back(StorageBackend::IO_URING);
+		}
+
+		// every so often write an item that's bigger than the I/O buffers
+		auto item_string = [](unsigned int i)
+		{
+			size_t length = i % 1000 == 7 ? 600 * 1024 : i % 300;
+			return std::string(length,(char)('a' + i % 26));
+		};
+
+		for (auto write_backend : backends)
+		{
+			WriterOptions options;
+			options.storage_backend = write_backend;
+			options.segment_max_bytes = 4 * 1024 * 1024;
+			Writer writer(RECORD_PATH,options);
+			protorecord::demo::BasicMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_myint(i);
+				msg.set_mystring(item_string(i));
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			for (auto read_backend : backends)
+			{
+				ReaderOptions reader_options;
+				reader_options.storage_backend = read_backend;
+
+				// sequential reads go through read-ahead
+				Reader reader(RECORD_PATH,reader_options);
+				CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,reader.size());
+				for (unsigned int i=0; i<NUM_ITEMS; i++)
+				{
+					CPPUNIT_ASSERT(reader.take_next(msg));
+					CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+					CPPUNIT_ASSERT(msg.mystring() == item_string(i));
+				}
+				CPPUNIT_ASSERT( ! reader.has_next());
+
+				// jumping backwards has to throw away what was read ahead
+				for (unsigned int i=NUM_ITEMS; i>0; i-=97)
+				{
+					CPPUNIT_ASSERT(reader.get(i - 1,msg));
+					CPPUNIT_ASSERT_EQUAL(i - 1,msg.myint());
+					CPPUNIT_ASSERT(msg.mystring() == item_string(i - 1));
+					if (i <= 97)
+					{
+						break;
+					}
+				}
+
+				reader_options.access_pattern = AccessPattern::RANDOM;
+				Reader random_reader(RECORD_PATH,reader_options);
+				for (unsigned int i=0; i<NUM_ITEMS; i+=13)
+				{
+					CPPUNIT_ASSERT(random_reader.get(i,msg));
+					CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+				}
+			}
+		}
+	}
+
+	void
+	ProtorecordTest::direct_io_write_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 20000;
+
+		WriterOptions options;
+		options.direct_io = true;
+		options.preallocate_extent = 1024 * 1024;
+		options.segment_max_bytes = 3 * 1024 * 1024;
+		// checkpoint often, so that unaligned tails get written and rewritten
+		options.index_buffer_size = 4096;
+		Writer writer(RECORD_PATH,options);
+
+		protorecord::demo::BasicMessage msg;
+		uint64_t data_size = 0;
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			msg.set_myint(i);
+			msg.set_mystring(std::string(i % 500,'x'));
+			CPPUNIT_ASSERT(writer.write(msg));
+			data_size += msg.ByteSizeLong();
+
+			// everything up to the last checkpoint is readable mid-recording
+			if (i == NUM_ITEMS / 2)
+			{
+				Reader reader(RECORD_PATH);
+				CPPUNIT_ASSERT(reader.size() > 0);
+				for (unsigned int j=0; j<reader.size(); j++)
+				{
+					CPPUNIT_ASSERT(reader.take_next(msg));
+					CPPUNIT_ASSERT_EQUAL(j,msg.myint());
+				}
+			}
+		}
+		writer.close();
+
+		// the padding and preallocated space are truncated off
+		struct stat st;
+		uint64_t total_file_size = 0;
+		for (uint32_t file_num=0; stat(data_file_path(RECORD_PATH,file_num).c_str(),&st) == 0; file_num++)
+		{
+			CPPUNIT_ASSERT(st.st_size <= (off_t)options.segment_max_bytes);
+			total_file_size += st.st_size;
+		}
+		CPPUNIT_ASSERT_EQUAL(data_size,total_file_size);
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,reader.size());
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			CPPUNIT_ASSERT(reader.take_next(msg));
+			CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+			CPPUNIT_ASSERT_EQUAL((size_t)(i % 500),msg.mystring().size());
+		}
+		CPPUNIT_ASSERT( ! reader.has_next());
+	}
+
+	void
+	ProtorecordTest::mmap_write_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 20000;
+
+		WriterOptions options;
+		options.use_mmap = true;
+		options.enable_timestamping = true;
+		// small extents, so that the window gets remapped a lot
+		options.preallocate_extent = 64 * 1024;
+		options.segment_max_bytes = 1024 * 1024;
+		options.index_buffer_size = 4096;
+
+		// can't have both
+		options.direct_io = true;
+		Writer writer;
+		CPPUNIT_ASSERT( ! writer.open(RECORD_PATH,options));
+		options.direct_io = false;
+		CPPUNIT_ASSERT(writer.open(RECORD_PATH,options));
+		protorecord::demo::BasicMessage msg;
+		uint64_t data_size = 0;
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			msg.set_myint(i);
+			msg.set_mystring(std::string(i % 3 ? i % 200 : 100000,'x'));
+			CPPUNIT_ASSERT(writer.write(msg));
+			data_size += msg.ByteSizeLong();
+
+			// everything up to the last checkpoint is readable mid-recording
+			if (i == NUM_ITEMS / 2)
+			{
+				Reader reader(RECORD_PATH);
+				CPPUNIT_ASSERT(reader.size() > 0);
+				for (unsigned int j=0; j<reader.size(); j++)
+				{
+					CPPUNIT_ASSERT(reader.take_next(msg));
+					CPPUNIT_ASSERT_EQUAL(j,msg.myint());
+				}
+			}
+		}
+		writer.close();
+
+		// the files are truncated to what was written
+		struct stat st;
+		uint64_t total_file_size = 0;
+		for (uint32_t file_num=0; stat(data_file_path(RECORD_PATH,file_num).c_str(),&st) == 0; file_num++)
+		{
+			total_file_size += st.st_size;
+		}
+		CPPUNIT_ASSERT_EQUAL(data_size,total_file_size);
+		CPPUNIT_ASSERT_EQUAL(0,stat((RECORD_PATH + "/index").c_str(),&st));
+		const off_t index_size = ITEM_BLOCK_OFFSET_V2 + NUM_ITEMS * index_entry_stride_v2(true);
+		CPPUNIT_ASSERT_EQUAL(index_size,st.st_size);
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,reader.size());
+		CPPUNIT_ASSERT(reader.has_timestamps());
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			CPPUNIT_ASSERT(reader.take_next(msg));
+			CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+		}
+		CPPUNIT_ASSERT( ! reader.has_next());
+	}
+
+	void
+	ProtorecordTest::arena_batch_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 10000;
+		const size_t BATCH_SIZE = 333;
+
+		protorecord::demo::LargeMessage msg;
+		for (unsigned int i=0; i<4; i++)
+		{
+			msg.add_mystrings("helloworld" + std::to_string(i));
+			msg.add_myints(i);
+			msg.add_mybools(i % 2);
+		}
+
+		// plain, segmented (batches span data files) and compressed records
+		WriterOptions segmented_options;
+		segmented_options.segment_max_bytes = 16 * 1024;
+		WriterOptions compressed_options;
+		compressed_options.compression = Codec::ZLIB;
+		const WriterOptions OPTIONS[] = {WriterOptions(), segmented_options, compressed_options};
+
+		ReaderOptions mmap_options;
+		mmap_options.use_mmap = true;
+		const ReaderOptions READER_OPTIONS[] = {ReaderOptions(), mmap_options};
+
+		for (const auto &options : OPTIONS)
+		{
+			if ( ! codec_available(options.compression))
+			{
+				continue;
+			}
+
+			Writer writer(RECORD_PATH,options);
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_myints(0,i);
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			for (const auto &reader_options : READER_OPTIONS)
+			{
+				Reader reader(RECORD_PATH,reader_options);
+				google::protobuf::Arena arena;
+				std::vector<protorecord::demo::LargeMessage*> batch;
+				unsigned int expect = 0;
+				while (reader.take_batch(BATCH_SIZE,arena,batch))
+				{
+					CPPUNIT_ASSERT(batch.size() > 0 && batch.size() <= BATCH_SIZE);
+					for (const auto pb : batch)
+					{
+						CPPUNIT_ASSERT_EQUAL(&arena,pb->GetArena());
+						CPPUNIT_ASSERT_EQUAL(expect,pb->myints(0));
+						CPPUNIT_ASSERT_EQUAL(std::string("helloworld3"),pb->mystrings(3));
+						expect++;
+					}
+				}
+				CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,expect);
+				CPPUNIT_ASSERT(batch.empty());
+				CPPUNIT_ASSERT( ! reader.has_next());
+			}
+		}
+
+		// batches of a v1 index are read entry by entry
+		Reader reader(std::string(TEST_RECORDS_DIR) + "/basic_helloworld");
+		google::protobuf::Arena arena;
+		std::vector<protorecord::demo::BasicMessage*> batch;
+		CPPUNIT_ASSERT(reader.take_batch(100,arena,batch));
+		CPPUNIT_ASSERT_EQUAL(reader.size(),batch.size());
+		for (unsigned int i=0; i<batch.size(); i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(i,batch[i]->myint());
+		}
+		CPPUNIT_ASSERT( ! reader.take_batch(100,arena,batch));
+	}
+
+	void
+	ProtorecordTest::parallel_scan()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const std::vector<std::string> RECORD_PATHS = {RECORD_PATH + "_0", RECORD_PATH + "_1"};
+		const unsigned int NUM_ITEMS[] = {10000, 2345};
+
+		// the second record is split across data files
+		for (size_t r=0; r<RECORD_PATHS.size(); r++)
+		{
+			WriterOptions options;
+			options.segment_max_bytes = r == 1 ? 8 * 1024 : 0;
+			Writer writer(RECORD_PATHS[r],options);
+			protorecord::demo::BasicMessage msg;
+			msg.set_mystring("record" + std::to_string(r));
+			for (unsigned int i=0; i<NUM_ITEMS[r]; i++)
+			{
+				msg.set_myint(i);
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+		}
+
+		ScanOptions options;
+		options.num_threads = 4;
+		options.chunk_size = 1000;
+
+		// unordered, every item has to be seen exactly once
+		{
+			ParallelScan scan(RECORD_PATHS,options);
+			CPPUNIT_ASSERT_EQUAL((uint64_t)(NUM_ITEMS[0] + NUM_ITEMS[1]),scan.size());
+			CPPUNIT_ASSERT_EQUAL((size_t)(10 + 3),scan.chunks().size());
+
+			std::mutex seen_mutex;
+			std::vector<std::vector<unsigned int>> seen = {
+				std::vector<unsigned int>(NUM_ITEMS[0]),
+				std::vector<unsigned int>(NUM_ITEMS[1])};
+			bool okay = true;
+			CPPUNIT_ASSERT(scan.scan<protorecord::demo::BasicMessage>(
+				[&](const ScanItem &item, const protorecord::demo::BasicMessage &msg){
+					std::lock_guard<std::mutex> lock(seen_mutex);
+					okay = okay && msg.myint() == item.item;
+					okay = okay && msg.mystring() == "record" + std::to_string(item.record);
+					seen[item.record][item.item]++;
+					return true;
+				}));
+			CPPUNIT_ASSERT(okay);
+			for (const auto &record_seen : seen)
+			{
+				for (const auto count : record_seen)
+				{
+					CPPUNIT_ASSERT_EQUAL(1u,count);
+				}
+			}
+		}
+
+		// ordered, items have to arrive one after another in record order
+		{
+			options.ordered = true;
+			ParallelScan scan(RECORD_PATHS,options);
+			ScanItem expect;
+			bool okay = true;
+			CPPUNIT_ASSERT(scan.scan<protorecord::demo::BasicMessage>(
+				[&](const ScanItem &item, const protorecord::demo::BasicMessage &msg){
+					if (expect.item == NUM_ITEMS[expect.record])
+					{
+						expect.record++;
+						expect.item = 0;
+					}
+					okay = okay && item.record == expect.record && item.item == expect.item;
+					okay = okay && msg.myint() == expect.item;
+					expect.item++;
+					return true;
+				}));
+			CPPUNIT_ASSERT(okay);
+			CPPUNIT_ASSERT_EQUAL((size_t)1,expect.record);
+			CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS[1],expect.item);
+
+			// the callback can stop the scan early
+			uint64_t num_called = 0;
+			CPPUNIT_ASSERT( ! scan.scan<protorecord::demo::BasicMessage>(
+				[&](const ScanItem &, const protorecord::demo::BasicMessage &){
+					return ++num_called < 1500;
+				}));
+			CPPUNIT_ASSERT_EQUAL((uint64_t)1500,num_called);
+			CPPUNIT_ASSERT_EQUAL(std::string(""),scan.reason());
+		}
+
+		// records that can't be opened are reported
+		ParallelScan scan({RECORD_PATH + "_missing"},options);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0,scan.size());
+		CPPUNIT_ASSERT( ! scan.scan<protorecord::demo::BasicMessage>(
+			[](const ScanItem &, const protorecord::demo::BasicMessage &){
+				return true;
+			}));
+		CPPUNIT_ASSERT( ! scan.reason().empty());
+	}
+
+	void
+	ProtorecordTest::prefetch_read()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 5000;
+
+		protorecord::demo::BasicMessage msg;
+		msg.set_mystring("helloworld");
+
+		// plain, segmented and compressed records
+		WriterOptions segmented_options;
+		segmented_options.segment_max_bytes = 8 * 1024;
+		WriterOptions compressed_options;
+		compressed_options.compression = Codec::ZLIB;
+		const WriterOptions OPTIONS[] = {WriterOptions(), segmented_options, compressed_options};
+
+		// read ahead by item count, and by a byte limit smaller than a chunk
+		ReaderOptions items_options;
+		items_options.prefetch_items = 64;
+		ReaderOptions bytes_options;
+		bytes_options.prefetch_items = 1024;
+		bytes_options.prefetch_bytes = 100;
+		bytes_options.use_mmap = true;
+		const ReaderOptions READER_OPTIONS[] = {items_options, bytes_options};
+
+		for (auto options : OPTIONS)
+		{
+			if ( ! codec_available(options.compression))
+			{
+				continue;
+			}
+
+			options.enable_timestamping = true;
+			Writer writer(RECORD_PATH,options);
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_myint(i);
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			for (const auto &reader_options : READER_OPTIONS)
+			{
+				Reader reader(RECORD_PATH,reader_options);
+				uint64_t prev_timestamp = 0;
+				for (unsigned int i=0; i<NUM_ITEMS; i++)
+				{
+					uint64_t timestamp = 0;
+					CPPUNIT_ASSERT(reader.get_next_timestamp(timestamp));
+					CPPUNIT_ASSERT(timestamp >= prev_timestamp);
+					prev_timestamp = timestamp;
+
+					// peeking doesn't move the Reader along
+					CPPUNIT_ASSERT(reader.get_next(msg));
+					CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+					CPPUNIT_ASSERT(reader.take_next(msg));
+					CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+				}
+				CPPUNIT_ASSERT( ! reader.has_next());
+				CPPUNIT_ASSERT( ! reader.take_next(msg));
+
+				// reading ahead restarts wherever the Reader is moved to
+				const unsigned int SEEKS[] = {NUM_ITEMS / 2, 10, NUM_ITEMS - 1};
+				for (const auto seek_idx : SEEKS)
+				{
+					CPPUNIT_ASSERT(reader.seek(seek_idx));
+					for (unsigned int i=seek_idx; i<std::min(seek_idx + 300,NUM_ITEMS); i++)
+					{
+						CPPUNIT_ASSERT(reader.take_next(msg));
+						CPPUNIT_ASSERT_EQUAL(i,msg.myint());
+					}
+				}
+			}
+		}
+	}
+
+	void
+	ProtorecordTest::live_tailing()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 3000;
+		const auto TIMEOUT = std::chrono::seconds(5);
+
+		// synchronous, async, mmap, direct I/O and segmented writers
+		WriterOptions sync_options;
+		WriterOptions async_options;
+		async_options.async = true;
+		WriterOptions mmap_options;
+		mmap_options.use_mmap = true;
+		WriterOptions direct_options;
+		direct_options.direct_io = true;
+		WriterOptions segmented_options;
+		segmented_options.segment_max_bytes = 8 * 1024;
+		const WriterOptions OPTIONS[] = {sync_options, async_options, mmap_options, direct_options, segmented_options};
+
+		// streamed, prefetching and mmap readers
+		ReaderOptions prefetch_options;
+		prefetch_options.prefetch_items = 64;
+		ReaderOptions mmap_reader_options;
+		mmap_reader_options.use_mmap = true;
+		const ReaderOptions READER_OPTIONS[] = {ReaderOptions(), prefetch_options, mmap_reader_options};
+
+		for (size_t o=0; o<sizeof(OPTIONS) / sizeof(OPTIONS[0]); o++)
+		{
+			WriterOptions options = OPTIONS[o];
+			options.checkpoint_interval = std::chrono::milliseconds(1);
+			const ReaderOptions &reader_options = READER_OPTIONS[o % 3];
+
+			Writer writer(RECORD_PATH,options);
+
+			// a fresh recording can be opened before anything is written
+			Reader reader(RECORD_PATH,reader_options);
+			CPPUNIT_ASSERT_EQUAL(std::string(""),reader.reason());
+			CPPUNIT_ASSERT_EQUAL((size_t)0,reader.size());
+			CPPUNIT_ASSERT( ! reader.follow(std::chrono::milliseconds(5)));
+
+			std::thread writer_thread([&writer,NUM_ITEMS](){
+				protorecord::demo::BasicMessage msg;
+				msg.set_mystring("helloworld");
+				for (unsigned int i=0; i<NUM_ITEMS; i++)
+				{
+					msg.set_myint(i);
+					writer.write(msg);
+					if (i % 100 == 0)
+					{
+						std::this_thread::sleep_for(std::chrono::milliseconds(2));
+					}
+				}
+
+				// a synchronous writer publishes its last items on close
+				writer.close();
+			});
+
+			protorecord::demo::BasicMessage msg;
+			unsigned int expect = 0;
+			while (expect < NUM_ITEMS && reader.follow(TIMEOUT))
+			{
+				while (reader.take_next(msg))
+				{
+					CPPUNIT_ASSERT_EQUAL(expect,msg.myint());
+					CPPUNIT_ASSERT_EQUAL(std::string("helloworld"),msg.mystring());
+					expect++;
+				}
+			}
+			writer_thread.join();
+			CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,expect);
+			CPPUNIT_ASSERT( ! reader.follow(std::chrono::milliseconds(0)));
+			CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,reader.size());
+		}
+	}
+
+	void
+	ProtorecordTest::live_channel()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const std::string CHANNEL("protorecord_test_live_channel");
+		const unsigned int NUM_ITEMS = 3000;
+		const auto TIMEOUT = std::chrono::seconds(5);
+
+		// channels that don't exist can't be opened
+		LiveReader missing("protorecord_test_missing_channel");
+		CPPUNIT_ASSERT( ! missing.is_open());
+		CPPUNIT_ASSERT( ! missing.reason().empty());
+		CPPUNIT_ASSERT( ! missing.has_next());
+
+		// synchronous, async, mmap and compressed writers, plus batches
+		WriterOptions sync_options;
+		WriterOptions async_options;
+		async_options.async = true;
+		WriterOptions mmap_options;
+		mmap_options.use_mmap = true;
+		WriterOptions compressed_options;
+		compressed_options.compression = Codec::ZLIB;
+		const WriterOptions OPTIONS[] = {sync_options, async_options, mmap_options, compressed_options, sync_options};
+
+		for (size_t o=0; o<sizeof(OPTIONS) / sizeof(OPTIONS[0]); o++)
+		{
+			WriterOptions options = OPTIONS[o];
+			if ( ! codec_available(options.compression))
+			{
+				continue;
+			}
+			options.live_channel = CHANNEL;
+			const bool batched = o == 4;
+
+			Writer writer(RECORD_PATH,options);
+			CPPUNIT_ASSERT_EQUAL(std::string(""),writer.reason());
+			LiveReader live(CHANNEL);
+			CPPUNIT_ASSERT(live.is_open());
+			CPPUNIT_ASSERT( ! live.writer_closed());
+			CPPUNIT_ASSERT( ! live.follow(std::chrono::milliseconds(1)));
+
+			std::thread writer_thread([&writer,NUM_ITEMS,batched](){
+				protorecord::demo::BasicMessage msg;
+				msg.set_mystring("helloworld");
+				std::vector<std::string> serialized(10);
+				std::vector<ItemSpan> spans(serialized.size());
+				for (unsigned int i=0; i<NUM_ITEMS; i++)
+				{
+					msg.set_myint(i);
+					if ( ! batched)
+					{
+						writer.write(msg);
+					}
+					else
+					{
+						size_t b = i % serialized.size();
+						msg.SerializeToString(&serialized[b]);
+						spans[b].data = serialized[b].data();
+						spans[b].size = serialized[b].size();
+						if (b + 1 == serialized.size())
+						{
+							writer.write_batch(spans.data(),spans.size());
+						}
+					}
+				}
+				writer.close();
+			});
+
+			// a LiveReader sees the items before they reach the record
+			protorecord::demo::BasicMessage msg;
+			unsigned int expect = 0;
+			while (expect < NUM_ITEMS && live.follow(TIMEOUT))
+			{
+				while (live.take_next(msg))
+				{
+					CPPUNIT_ASSERT_EQUAL(expect,msg.myint());
+					CPPUNIT_ASSERT_EQUAL(std::string("helloworld"),msg.mystring());
+					CPPUNIT_ASSERT_EQUAL((uint64_t)expect,live.item_num());
+					expect++;
+				}
+			}
+			writer_thread.join();
+			CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,expect);
+			CPPUNIT_ASSERT_EQUAL((uint64_t)0,live.dropped());
+			CPPUNIT_ASSERT(live.writer_closed());
+			CPPUNIT_ASSERT( ! live.follow(TIMEOUT));
+		}
+
+		// a LiveReader that falls a whole ring behind skips ahead to the
+		// newest item, and counts the items it missed
+		WriterOptions options;
+		options.live_channel = CHANNEL;
+		options.live_channel_size = 64 * 1024;
+		Writer writer(RECORD_PATH,options);
+		LiveReader live(CHANNEL);
+		CPPUNIT_ASSERT(live.is_open());
+
+		protorecord::demo::BasicMessage msg;
+		msg.set_mystring(std::string(100,'x'));
+		msg.set_myint(0);
+		CPPUNIT_ASSERT(writer.write(msg));
+		CPPUNIT_ASSERT(live.take_next(msg));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0,msg.myint());
+
+		for (unsigned int i=1; i<=NUM_ITEMS; i++)
+		{
+			msg.set_myint(i);
+			CPPUNIT_ASSERT(writer.write(msg));
+		}
+		CPPUNIT_ASSERT( ! live.take_next(msg));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0,live.dropped());
+
+		msg.set_myint(NUM_ITEMS + 1);
+		CPPUNIT_ASSERT(writer.write(msg));
+		CPPUNIT_ASSERT(live.take_next(msg));
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS + 1,msg.myint());
+		CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS + 1,live.item_num());
+		CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS,live.dropped());
+		CPPUNIT_ASSERT( ! live.take_next(msg));
+
+		writer.close();
+		CPPUNIT_ASSERT(live.writer_closed());
+	}
+
+	void
+	ProtorecordTest::item_iterators()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 5000;
+		const size_t NUM_THREADS = 4;
+
+		// every tenth item is a large one
+		auto is_large = [](unsigned int i){
+			return i % 10 == 0;
+		};
+
+		WriterOptions compressed_options;
+		compressed_options.compression = Codec::ZLIB;
+		const WriterOptions OPTIONS[] = {WriterOptions(), compressed_options};
+
+		ReaderOptions mmap_options;
+		mmap_options.use_mmap = true;
+		const ReaderOptions READER_OPTIONS[] = {ReaderOptions(), mmap_options};
+
+		for (auto options : OPTIONS)
+		{
+			if ( ! codec_available(options.compression))
+			{
+				continue;
+			}
+			options.enable_timestamping = true;
+
+			Writer writer(RECORD_PATH,options);
+			protorecord::demo::BasicMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_myint(i);
+				msg.set_mystring(is_large(i) ? std::string(1000,'x') : "small");
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			for (const auto &reader_options : READER_OPTIONS)
+			{
+				Reader reader(RECORD_PATH,reader_options);
+				CPPUNIT_ASSERT_EQUAL((ptrdiff_t)NUM_ITEMS,std::distance(reader.begin(),reader.end()));
+				CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,reader.items().size());
+
+				// range-based for loops parse items on demand
+				unsigned int expect = 0;
+				for (const auto &item : reader.items())
+				{
+					CPPUNIT_ASSERT_EQUAL((uint64_t)expect,item.index());
+					CPPUNIT_ASSERT(item.parse(msg));
+					CPPUNIT_ASSERT_EQUAL(expect,msg.myint());
+					CPPUNIT_ASSERT_EQUAL((uint32_t)item.raw().size(),item.size());
+					expect++;
+				}
+				CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,expect);
+
+				// index metadata works with the standard algorithms
+				auto num_large = std::count_if(reader.begin(),reader.end(),[](const ItemHandle &item){
+					return item.size() > 1000;
+				});
+				CPPUNIT_ASSERT_EQUAL((ptrdiff_t)(NUM_ITEMS / 10),num_large);
+
+				auto items = reader.items();
+				auto it = std::partition_point(items.begin(),items.end(),[&](const ItemHandle &item){
+					return item.timestamp() < items[NUM_ITEMS / 2].timestamp();
+				});
+				CPPUNIT_ASSERT(it->index() <= NUM_ITEMS / 2);
+				CPPUNIT_ASSERT_EQUAL(it->timestamp(),items[NUM_ITEMS / 2].timestamp());
+				CPPUNIT_ASSERT_EQUAL((ptrdiff_t)NUM_ITEMS - 1,(items.end() - 1) - items.begin());
+				CPPUNIT_ASSERT(items.begin() + 10 < items.end() - 10);
+
+				// handles are returned by value, so they outlive the
+				// temporaries of reverse iterators and std::prev()
+				auto last = std::prev(items.end());
+				CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS - 1,last->index());
+				CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS - 2,std::prev(last,1)->index());
+				auto rbegin = std::make_reverse_iterator(items.end());
+				const ItemHandle &newest = *rbegin;
+				CPPUNIT_ASSERT(newest.parse(msg));
+				CPPUNIT_ASSERT_EQUAL(NUM_ITEMS - 1,msg.myint());
+				CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS - 3,rbegin[2].index());
+				unsigned int reversed = NUM_ITEMS;
+				for (auto r = rbegin; r != std::make_reverse_iterator(items.begin()); ++r)
+				{
+					reversed--;
+					CPPUNIT_ASSERT_EQUAL((uint64_t)reversed,r->index());
+				}
+				CPPUNIT_ASSERT_EQUAL(0u,reversed);
+
+				// views of a subrange, and ranges past the end are clipped
+				auto view = reader.items(ItemRange{100,200});
+				CPPUNIT_ASSERT_EQUAL((size_t)100,view.size());
+				CPPUNIT_ASSERT(view[0].parse(msg));
+				CPPUNIT_ASSERT_EQUAL(100u,msg.myint());
+				CPPUNIT_ASSERT_EQUAL((size_t)10,reader.items(ItemRange{NUM_ITEMS - 10,NUM_ITEMS + 10}).size());
+				CPPUNIT_ASSERT(reader.items(ItemRange{NUM_ITEMS + 10,NUM_ITEMS + 20}).empty());
+
+				// handles can be used from several threads at once
+				std::atomic<unsigned int> num_parsed(0);
+				std::atomic<bool> okay(true);
+				auto check = [&](const ItemHandle &item){
+					protorecord::demo::BasicMessage pb;
+					bool parsed = item.parse(pb) && pb.myint() == item.index();
+					parsed = parsed && pb.mystring().size() == (is_large(item.index()) ? 1000 : 5);
+					if (parsed)
+					{
+						num_parsed++;
+					}
+					else
+					{
+						okay = false;
+					}
+				};
+				std::vector<std::thread> threads;
+				for (size_t t=0; t<NUM_THREADS; t++)
+				{
+					threads.emplace_back([&,t](){
+						for (uint64_t i=t; i<NUM_ITEMS; i+=NUM_THREADS)
+						{
+							check(items[i]);
+						}
+					});
+				}
+				for (auto &thread : threads)
+				{
+					thread.join();
+				}
+				CPPUNIT_ASSERT(okay);
+				CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,num_parsed.load());
+
+#ifdef PROTORECORD_TEST_PARALLEL_ALGORITHMS
+				num_parsed = 0;
+				std::for_each(std::execution::par,items.begin(),items.end(),check);
+				CPPUNIT_ASSERT(okay);
+				CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,num_parsed.load());
+#endif
+
+				// iterating never moves the Reader
+				CPPUNIT_ASSERT_EQUAL((uint64_t)0,reader.tell());
+			}
+		}
+	}
+
+	void
+	ProtorecordTest::projection_scan()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 3000;
+		using protorecord::demo::WideMessage;
+
+		auto make_msg = [](unsigned int i){
+			WideMessage msg;
+			msg.set_timestamp(1000000ull * i);
+			msg.set_value(i);
+			msg.set_delta(-(int)i);
+			msg.set_temperature(i * 0.5);
+			msg.set_pressure(i * 0.25f);
+			msg.set_valid(i % 3 != 0);
+			msg.set_sensor_id(i * 7);
+			msg.set_offset(-1000000000000ll * i);
+			msg.set_description(std::string(200,'d'));
+			msg.set_extra25(std::string(100,'e'));
+			msg.mutable_nested()->set_mystring("nested");
+			msg.mutable_nested()->set_myint(i);
+			msg.add_samples(i);
+			// some items leave the label and status unset
+			if (i % 5 != 0)
+			{
+				msg.set_label("item" + std::to_string(i));
+				msg.set_status(WideMessage::FAULT);
+			}
+			return msg;
+		};
+
+		WriterOptions compressed_options;
+		compressed_options.compression = Codec::ZLIB;
+		const WriterOptions OPTIONS[] = {WriterOptions(), compressed_options};
+
+		for (const auto &options : OPTIONS)
+		{
+			if ( ! codec_available(options.compression))
+			{
+				continue;
+			}
+
+			Writer writer(RECORD_PATH,options);
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				CPPUNIT_ASSERT(writer.write(make_msg(i)));
+			}
+			writer.close();
+
+			// "value > 1000 and valid == true", extracting a few fields
+			// of different types
+			Projection projection(WideMessage::descriptor(),{1,3,5,7,10,9},{
+				Predicate(2,CompareOp::GT,1000),
+				Predicate(6,CompareOp::EQ,true)});
+			CPPUNIT_ASSERT_EQUAL(std::string(""),projection.reason());
+			CPPUNIT_ASSERT(projection.is_valid());
+
+			for (size_t num_threads : {1, 3})
+			{
+				ScanOptions scan_options;
+				scan_options.num_threads = num_threads;
+				scan_options.chunk_size = 128;
+				ProjectionResult result;
+				CPPUNIT_ASSERT(projection.scan({RECORD_PATH,RECORD_PATH},result,scan_options));
+				CPPUNIT_ASSERT_EQUAL(std::string(""),projection.reason());
+
+				std::vector<unsigned int> expected;
+				for (unsigned int i=1001; i<NUM_ITEMS; i++)
+				{
+					if (i % 3 != 0)
+					{
+						expected.push_back(i);
+					}
+				}
+				CPPUNIT_ASSERT_EQUAL(expected.size() * 2,result.items.size());
+				CPPUNIT_ASSERT_EQUAL((size_t)6,result.columns.size());
+				CPPUNIT_ASSERT_EQUAL(std::string("timestamp"),result.columns[0].name);
+				CPPUNIT_ASSERT(ColumnType::UINT64 == result.columns[0].type);
+				CPPUNIT_ASSERT(ColumnType::INT64 == result.columns[1].type);
+				CPPUNIT_ASSERT(ColumnType::DOUBLE == result.columns[2].type);
+				CPPUNIT_ASSERT(ColumnType::STRING == result.columns[3].type);
+				CPPUNIT_ASSERT(ColumnType::INT64 == result.columns[4].type);
+				CPPUNIT_ASSERT_EQUAL((uint32_t)9,result.columns[5].field);
+				for (const auto &column : result.columns)
+				{
+					CPPUNIT_ASSERT_EQUAL(result.items.size(),column.size());
+				}
+
+				for (size_t r=0; r<result.items.size(); r++)
+				{
+					const unsigned int i = expected[r % expected.size()];
+					CPPUNIT_ASSERT_EQUAL(r / expected.size(),result.items[r].record);
+					CPPUNIT_ASSERT_EQUAL((uint64_t)i,result.items[r].item);
+					CPPUNIT_ASSERT_EQUAL(1000000ull * i,(unsigned long long)result.columns[0].uint_values[r]);
+					CPPUNIT_ASSERT_EQUAL(-(int64_t)i,result.columns[1].int_values[r]);
+					CPPUNIT_ASSERT_EQUAL((double)(i * 0.25f),result.columns[2].double_values[r]);
+					CPPUNIT_ASSERT_EQUAL(-1000000000000ll * i,(long long)result.columns[5].int_values[r]);
+
+					// unset fields get their default values
+					const bool has_label = i % 5 != 0;
+					CPPUNIT_ASSERT_EQUAL(has_label,(bool)result.columns[3].present[r]);
+					CPPUNIT_ASSERT_EQUAL(has_label ? "item" + std::to_string(i) : std::string(""),result.columns[3].string_values[r]);
+					CPPUNIT_ASSERT_EQUAL((int64_t)(has_label ? WideMessage::FAULT : WideMessage::OK),result.columns[4].int_values[r]);
+				}
+			}
+
+			// string predicates, and predicates on unset fields
+			Projection by_label(WideMessage::descriptor(),{2},{Predicate(7,CompareOp::EQ,"item42")});
+			ProjectionResult result;
+			CPPUNIT_ASSERT(by_label.scan({RECORD_PATH},result));
+			CPPUNIT_ASSERT_EQUAL((size_t)1,result.items.size());
+			CPPUNIT_ASSERT_EQUAL((int64_t)42,result.columns[0].int_values[0]);
+
+			Projection by_status(WideMessage::descriptor(),{},{Predicate(10,CompareOp::EQ,(int)WideMessage::OK)});
+			CPPUNIT_ASSERT(by_status.scan({RECORD_PATH},result));
+			CPPUNIT_ASSERT_EQUAL((size_t)(NUM_ITEMS / 5),result.items.size());
+			CPPUNIT_ASSERT(result.columns.empty());
+		}
+
+		// like protobuf's parser, the last value of a field that's set
+		// several times wins, and nested messages are merged
+		WideMessage first;
+		first.set_timestamp(1);
+		first.mutable_nested()->set_mystring("first");
+		first.mutable_nested()->set_myint(1);
+		WideMessage second;
+		second.set_timestamp(2);
+		second.mutable_nested()->set_myint(2);
+		const std::string merged_data = first.SerializePartialAsString() + second.SerializePartialAsString();
+		WideMessage merged;
+		CPPUNIT_ASSERT(merged.ParsePartialFromString(merged_data));
+		Projection last_wins(WideMessage::descriptor(),{"timestamp","nested.myInt","nested.myString"});
+		ProjectionResult merged_result = last_wins.make_result();
+		CPPUNIT_ASSERT(last_wins.apply(merged_data,ScanItem(),merged_result));
+		CPPUNIT_ASSERT_EQUAL((size_t)1,merged_result.items.size());
+		CPPUNIT_ASSERT_EQUAL((uint64_t)merged.timestamp(),merged_result.columns[0].uint_values[0]);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)merged.nested().myint(),merged_result.columns[1].uint_values[0]);
+		CPPUNIT_ASSERT_EQUAL(merged.nested().mystring(),merged_result.columns[2].string_values[0]);
+
+		// items serialized in one go can stop at the last needed field
+		ProjectionOptions canonical_options;
+		canonical_options.assume_canonical = true;
+		Projection canonical(WideMessage::descriptor(),{"timestamp","nested.myInt"},{},canonical_options);
+		ProjectionResult canonical_result = canonical.make_result();
+		CPPUNIT_ASSERT(canonical.apply(first.SerializePartialAsString(),ScanItem(),canonical_result));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1,canonical_result.columns[0].uint_values[0]);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1,canonical_result.columns[1].uint_values[0]);
+
+		// unsupported fields and predicates are rejected
+		Projection repeated(WideMessage::descriptor(),{34});
+		CPPUNIT_ASSERT( ! repeated.is_valid());
+		CPPUNIT_ASSERT( ! repeated.reason().empty());
+		Projection nested(WideMessage::descriptor(),{1},{Predicate(33,CompareOp::EQ,1)});
+		CPPUNIT_ASSERT( ! nested.is_valid());
+		Projection missing(WideMessage::descriptor(),{99});
+		CPPUNIT_ASSERT( ! missing.is_valid());
+		Projection mistyped(WideMessage::descriptor(),{1},{Predicate(2,CompareOp::EQ,"text")});
+		CPPUNIT_ASSERT( ! mistyped.is_valid());
+		ProjectionResult result;
+		CPPUNIT_ASSERT( ! mistyped.scan({RECORD_PATH},result));
+
+		// malformed items fail the scan
+		Writer writer(RECORD_PATH);
+		CPPUNIT_ASSERT(writer.write(make_msg(0)));
+		const char GARBAGE[] = "\x0a\xff";
+		CPPUNIT_ASSERT(writer.write_assumed(GARBAGE,2));
+		writer.close();
+		Projection projection(WideMessage::descriptor(),{7});
+		CPPUNIT_ASSERT( ! projection.scan({RECORD_PATH},result));
+		CPPUNIT_ASSERT(projection.reason().find("item 1 ") != std::string::npos);
+	}
+
+	void
+	ProtorecordTest::embedded_schema()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 100;
+		using protorecord::demo::WideMessage;
+
+		WriterOptions async_options;
+		async_options.async = true;
+		const WriterOptions OPTIONS[] = {WriterOptions(), async_options};
+
+		for (const auto &options : OPTIONS)
+		{
+			// the first write() stores the message's schema
+			Writer writer(RECORD_PATH,options);
+			WideMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_timestamp(i);
+				msg.set_label("label" + std::to_string(i));
+				msg.set_status(i % 2 ? WideMessage::FAULT : WideMessage::OK);
+				msg.mutable_nested()->set_myint(i);
+				msg.mutable_nested()->set_mystring("nested");
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			// the record can be read without WideMessage's generated code
+			Reader reader(RECORD_PATH);
+			CPPUNIT_ASSERT(reader.flags() & Flags::HAS_SCHEMA);
+			CPPUNIT_ASSERT_EQUAL(std::string("protorecord.demo.WideMessage"),reader.message_type());
+			const google::protobuf::Descriptor *descriptor = reader.message_descriptor();
+			CPPUNIT_ASSERT(descriptor != nullptr);
+			CPPUNIT_ASSERT(descriptor != WideMessage::descriptor());
+			CPPUNIT_ASSERT_EQUAL(WideMessage::descriptor()->DebugString(),descriptor->DebugString());
+
+			std::unique_ptr<google::protobuf::Message> dynamic = reader.new_message();
+			CPPUNIT_ASSERT(dynamic != nullptr);
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				CPPUNIT_ASSERT(reader.get(i,msg));
+				CPPUNIT_ASSERT(reader.take_next(*dynamic));
+				CPPUNIT_ASSERT_EQUAL(msg.DebugString(),dynamic->DebugString());
+			}
+		}
+
+		// write_assumed() doesn't know the type, unless it's given
+		{
+			WideMessage msg;
+			msg.set_label("assumed");
+			std::string data = msg.SerializeAsString();
+			Writer writer(RECORD_PATH);
+			CPPUNIT_ASSERT(writer.write_assumed(data.data(),data.size()));
+			writer.close();
+
+			Reader reader(RECORD_PATH);
+			CPPUNIT_ASSERT( ! (reader.flags() & Flags::HAS_SCHEMA));
+			CPPUNIT_ASSERT_EQUAL(std::string(""),reader.message_type());
+			CPPUNIT_ASSERT(reader.message_descriptor() == nullptr);
+			CPPUNIT_ASSERT(reader.new_message() == nullptr);
+			CPPUNIT_ASSERT_EQUAL(std::string("record has no schema"),reader.reason());
+
+			CPPUNIT_ASSERT(writer.open(RECORD_PATH,WriterOptions()));
+			CPPUNIT_ASSERT(writer.store_schema(WideMessage::descriptor()));
+			CPPUNIT_ASSERT(writer.write_assumed(data.data(),data.size()));
+			writer.close();
+
+			Reader schema_reader(RECORD_PATH);
+			std::unique_ptr<google::protobuf::Message> dynamic = schema_reader.new_message();
+			CPPUNIT_ASSERT(dynamic != nullptr);
+			CPPUNIT_ASSERT(schema_reader.take_next(*dynamic));
+			CPPUNIT_ASSERT_EQUAL(msg.DebugString(),dynamic->DebugString());
+		}
+	}
+
+	// reads all of an exported column's file
+	template<class T>
+	static
+	std::vector<T>
+	read_column_file(
+		const std::string &path)
+	{
+		std::ifstream file(path,std::ios::binary | std::ios::ate);
+		std::vector<T> values(file.tellg() / sizeof(T));
+		file.seekg(0);
+		file.read((char*)values.data(),values.size() * sizeof(T));
+		return values;
+	}
+
+	void
+	ProtorecordTest::column_export()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const std::string RECORD_PATH_B(RECORD_PATH + "_b");
+		const std::string OUTPUT_DIR(RECORD_PATH + "_columns");
+		const unsigned int NUM_ITEMS = 10000;
+		using protorecord::demo::WideMessage;
+
+		for (const auto &path : {RECORD_PATH, RECORD_PATH_B})
+		{
+			Writer writer(path,true);
+			WideMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_timestamp(i * 10);
+				msg.set_delta(-(int)i);
+				msg.set_temperature(i / 4.0);
+				msg.set_valid(i % 2);
+				msg.mutable_nested()->set_myint(i + 1);
+				msg.mutable_nested()->set_mystring("nested");
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+		}
+
+		// the record's stored schema is used when no descriptor is given
+		ScanOptions options;
+		options.num_threads = 4;
+		options.chunk_size = 1000;
+		ColumnExport column_export(nullptr,{"timestamp","delta","temperature","valid","nested.myInt"});
+		CPPUNIT_ASSERT(column_export.run({RECORD_PATH},OUTPUT_DIR,options));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS,column_export.size());
+		CPPUNIT_ASSERT_EQUAL((size_t)7,column_export.columns().size());
+		CPPUNIT_ASSERT_EQUAL(std::string("<f8"),column_export.columns()[2].dtype);
+		CPPUNIT_ASSERT_EQUAL(std::string("_timestamp_us"),column_export.columns()[6].name);
+
+		auto timestamps = read_column_file<uint64_t>(OUTPUT_DIR + "/timestamp.bin");
+		auto deltas = read_column_file<int64_t>(OUTPUT_DIR + "/delta.bin");
+		auto temperatures = read_column_file<double>(OUTPUT_DIR + "/temperature.bin");
+		auto valids = read_column_file<uint8_t>(OUTPUT_DIR + "/valid.bin");
+		auto nested_ints = read_column_file<uint64_t>(OUTPUT_DIR + "/nested.myInt.bin");
+		auto items = read_column_file<uint64_t>(OUTPUT_DIR + "/_item.bin");
+		auto item_times = read_column_file<uint64_t>(OUTPUT_DIR + "/_timestamp_us.bin");
+		CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,timestamps.size());
+		CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,valids.size());
+		CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,item_times.size());
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL((uint64_t)i * 10,timestamps[i]);
+			CPPUNIT_ASSERT_EQUAL(-(int64_t)i,deltas[i]);
+			CPPUNIT_ASSERT_EQUAL(i / 4.0,temperatures[i]);
+			CPPUNIT_ASSERT_EQUAL((uint8_t)(i % 2),valids[i]);
+			CPPUNIT_ASSERT_EQUAL((uint64_t)i + 1,nested_ints[i]);
+			CPPUNIT_ASSERT_EQUAL((uint64_t)i,items[i]);
+		}
+		CPPUNIT_ASSERT(std::is_sorted(item_times.begin(),item_times.end()));
+
+		std::ifstream manifest(OUTPUT_DIR + "/manifest.json");
+		std::string manifest_text((std::istreambuf_iterator<char>(manifest)),std::istreambuf_iterator<char>());
+		CPPUNIT_ASSERT(manifest_text.find("\"items\": 10000") != std::string::npos);
+		CPPUNIT_ASSERT(manifest_text.find("{\"name\": \"nested.myInt\", \"file\": \"nested.myInt.bin\", \"dtype\": \"<u8\"}") != std::string::npos);
+
+		// several records are concatenated, and predicates filter items
+		ColumnExport filtered(WideMessage::descriptor(),{1},{Predicate(4,CompareOp::GE,NUM_ITEMS / 8.0)});
+		CPPUNIT_ASSERT(filtered.run({RECORD_PATH,RECORD_PATH_B},OUTPUT_DIR,options));
+		const uint64_t NUM_MATCHES = (NUM_ITEMS - NUM_ITEMS / 2) * 2;
+		CPPUNIT_ASSERT_EQUAL(NUM_MATCHES,filtered.size());
+		timestamps = read_column_file<uint64_t>(OUTPUT_DIR + "/timestamp.bin");
+		items = read_column_file<uint64_t>(OUTPUT_DIR + "/_item.bin");
+		auto records = read_column_file<uint32_t>(OUTPUT_DIR + "/_record.bin");
+		CPPUNIT_ASSERT_EQUAL((size_t)NUM_MATCHES,records.size());
+		for (size_t m=0; m<NUM_MATCHES; m++)
+		{
+			const uint64_t expect = NUM_ITEMS / 2 + m % (NUM_MATCHES / 2);
+			CPPUNIT_ASSERT_EQUAL(expect,items[m]);
+			CPPUNIT_ASSERT_EQUAL(expect * 10,timestamps[m]);
+			CPPUNIT_ASSERT_EQUAL((uint32_t)(m / (NUM_MATCHES / 2)),records[m]);
+		}
+
+		// only numeric fields can be exported
+		ColumnExport strings(WideMessage::descriptor(),{"label"});
+		CPPUNIT_ASSERT( ! strings.run({RECORD_PATH},OUTPUT_DIR));
+		CPPUNIT_ASSERT_EQUAL(std::string("field 'label' isn't numeric"),strings.reason());
+		ColumnExport missing(WideMessage::descriptor(),{"nested.missing"});
+		CPPUNIT_ASSERT( ! missing.run({RECORD_PATH},OUTPUT_DIR));
+		CPPUNIT_ASSERT( ! missing.reason().empty());
+	}
+
+	void
+	ProtorecordTest::key_index()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 10000;
+		const unsigned int NUM_KEYS = 100;
+		using protorecord::demo::WideMessage;
+
+		// signed keys, written by both the sync and async writers
+		for (bool async : {false, true})
+		{
+			WriterOptions options;
+			options.async = async;
+			options.key_field = "delta";
+			Writer writer(RECORD_PATH,options);
+			WideMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_delta((int)(i % NUM_KEYS) - (int)NUM_KEYS / 2);
+				msg.set_label("label" + std::to_string(i % 7));
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			Reader reader(RECORD_PATH);
+			CPPUNIT_ASSERT(reader.has_key_index());
+			std::vector<uint64_t> items;
+			for (int key=-(int)NUM_KEYS / 2; key<(int)NUM_KEYS / 2; key++)
+			{
+				CPPUNIT_ASSERT(reader.lookup(key,items));
+				CPPUNIT_ASSERT_EQUAL((size_t)(NUM_ITEMS / NUM_KEYS),items.size());
+				for (size_t k=0; k<items.size(); k++)
+				{
+					CPPUNIT_ASSERT_EQUAL((uint64_t)(key + NUM_KEYS / 2 + k * NUM_KEYS),items[k]);
+				}
+				CPPUNIT_ASSERT(reader.get(items.back(),msg));
+				CPPUNIT_ASSERT_EQUAL(key,msg.delta());
+			}
+
+			// keys that no item has
+			CPPUNIT_ASSERT(reader.lookup(NUM_KEYS,items));
+			CPPUNIT_ASSERT(items.empty());
+			CPPUNIT_ASSERT(reader.lookup(INT64_MIN,items));
+			CPPUNIT_ASSERT(items.empty());
+
+			// the keys are integers
+			CPPUNIT_ASSERT( ! reader.lookup("label0",items));
+			CPPUNIT_ASSERT_EQUAL(std::string("key index has integer keys"),reader.reason());
+		}
+
+		// string keys, and keys made by an extractor
+		{
+			WriterOptions options;
+			options.key_field = "label";
+			Writer writer(RECORD_PATH,options);
+			WideMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_label("label" + std::to_string(i % 7));
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			Reader reader(RECORD_PATH);
+			std::vector<uint64_t> items;
+			CPPUNIT_ASSERT(reader.lookup("label3",items));
+			CPPUNIT_ASSERT_EQUAL((size_t)(NUM_ITEMS + 3) / 7,items.size());
+			for (size_t k=0; k<items.size(); k++)
+			{
+				CPPUNIT_ASSERT_EQUAL((uint64_t)3 + 7 * k,items[k]);
+			}
+			CPPUNIT_ASSERT(reader.lookup("label7",items));
+			CPPUNIT_ASSERT(items.empty());
+			CPPUNIT_ASSERT( ! reader.lookup(3,items));
+		}
+		{
+			WriterOptions options;
+			options.key_extractor = [](std::string_view item_data, std::string &key){
+				key = std::to_string(item_data.size());
+				return item_data.size() % 2 == 0;
+			};
+			Writer writer(RECORD_PATH,options);
+			WideMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_label(std::string(i % 4,'x'));
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+
+			// items are 2 to 5 bytes long, and odd sized ones aren't indexed
+			Reader reader(RECORD_PATH);
+			std::vector<uint64_t> items;
+			CPPUNIT_ASSERT(reader.lookup("4",items));
+			CPPUNIT_ASSERT_EQUAL((size_t)(NUM_ITEMS / 4),items.size());
+			CPPUNIT_ASSERT_EQUAL((uint64_t)2,items.front());
+			CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS - 2,items.back());
+			CPPUNIT_ASSERT(reader.lookup("5",items));
+			CPPUNIT_ASSERT(items.empty());
+		}
+
+		// floating point fields can't be indexed
+		{
+			WriterOptions options;
+			options.key_field = "temperature";
+			Writer writer(RECORD_PATH,options);
+			CPPUNIT_ASSERT( ! writer.store_schema(WideMessage::descriptor()));
+			CPPUNIT_ASSERT( ! writer.reason().empty());
+			writer.close();
+			CPPUNIT_ASSERT( ! writer.reason().empty());
+
+			Reader reader(RECORD_PATH);
+			std::vector<uint64_t> items;
+			CPPUNIT_ASSERT( ! reader.has_key_index());
+			CPPUNIT_ASSERT( ! reader.lookup(0,items));
+			CPPUNIT_ASSERT_EQUAL(std::string("record has no key index"),reader.reason());
+		}
+	}
+
+	void
+	ProtorecordTest::key_index_multi_producer()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const size_t NUM_PRODUCERS = 8;
+		const size_t ITEMS_PER_PRODUCER = 2000;
+		const size_t NUM_ITEMS = NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+		const unsigned int NUM_ROUNDS = 10;
+
+		// producers race each other to store the schema. every item has to
+		// be indexed, whichever producer's item is written first.
+		for (unsigned int round=0; round<NUM_ROUNDS; round++)
+		{
+			WriterOptions options;
+			options.async = true;
+			options.async_queue_depth = 256;
+			options.key_field = "myInt";
+			Writer writer(RECORD_PATH,options);
+
+			std::atomic<bool> go(false);
+			std::vector<std::thread> producers;
+			for (unsigned int p=0; p<NUM_PRODUCERS; p++)
+			{
+				producers.emplace_back([&writer,&go,p,ITEMS_PER_PRODUCER](){
+					protorecord::demo::BasicMessage msg;
+					msg.set_mystring("producer" + std::to_string(p));
+					while ( ! go)
+					{
+					}
+					for (unsigned int i=0; i<ITEMS_PER_PRODUCER; i++)
+					{
+						msg.set_myint(p * ITEMS_PER_PRODUCER + i);
+						writer.write(msg);
+					}
+				});
+			}
+			go = true;
+			for (auto &producer : producers)
+			{
+				producer.join();
+			}
+			writer.close();
+
+			Reader reader(RECORD_PATH);
+			CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,reader.size());
+			CPPUNIT_ASSERT(reader.has_key_index());
+			std::vector<uint64_t> items;
+			protorecord::demo::BasicMessage msg;
+			for (unsigned int key=0; key<NUM_ITEMS; key++)
+			{
+				CPPUNIT_ASSERT(reader.lookup(key,items));
+				CPPUNIT_ASSERT_EQUAL((size_t)1,items.size());
+				CPPUNIT_ASSERT(reader.get(items[0],msg));
+				CPPUNIT_ASSERT_EQUAL(key,msg.myint());
+			}
+		}
+	}
+
+	void
+	ProtorecordTest::key_filters()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 10000;
+		const unsigned int ITEMS_PER_FILTER = 1000;
+		using protorecord::demo::WideMessage;
+
+		WriterOptions options;
+		options.key_field = "sensor_id";
+		options.key_filter_items = ITEMS_PER_FILTER;
+		{
+			Writer writer(RECORD_PATH,options);
+			WideMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_sensor_id(i);
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+		}
+
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT(reader.has_key_filters());
+		std::vector<ItemRange> ranges;
+		for (unsigned int i=0; i<NUM_ITEMS; i++)
+		{
+			// Bloom filters never rule out a key that's there
+			CPPUNIT_ASSERT(reader.might_contain(i));
+			CPPUNIT_ASSERT(reader.key_ranges(i,ranges));
+			CPPUNIT_ASSERT(std::any_of(ranges.begin(),ranges.end(),[&](const ItemRange &range){
+				return range.first <= i && i < range.last;
+			}));
+		}
+
+		// keys that aren't there are mostly ruled out, by the record wide
+		// filter and by the ones of each range of items
+		unsigned int false_positives = 0;
+		unsigned int false_ranges = 0;
+		for (unsigned int i=NUM_ITEMS; i<NUM_ITEMS * 2; i++)
+		{
+			false_positives += reader.might_contain(i);
+			CPPUNIT_ASSERT(reader.key_ranges(i,ranges));
+			false_ranges += ranges.size();
+		}
+		CPPUNIT_ASSERT(false_positives < NUM_ITEMS / 20);
+		CPPUNIT_ASSERT(false_ranges < NUM_ITEMS / 20);
+		CPPUNIT_ASSERT( ! reader.might_contain(-1));
+		CPPUNIT_ASSERT( ! reader.might_contain("1"));
+
+		// string keys
+		options.key_field = "label";
+		options.key_filter_items = NUM_ITEMS;
+		{
+			Writer writer(RECORD_PATH,options);
+			WideMessage msg;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				msg.set_label("label" + std::to_string(i));
+				CPPUNIT_ASSERT(writer.write(msg));
+			}
+			writer.close();
+		}
+		Reader labels(RECORD_PATH);
+		CPPUNIT_ASSERT(labels.might_contain("label0"));
+		CPPUNIT_ASSERT(labels.key_ranges("label" + std::to_string(NUM_ITEMS - 1),ranges));
+		CPPUNIT_ASSERT_EQUAL((size_t)1,ranges.size());
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0,ranges[0].first);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)NUM_ITEMS,ranges[0].last);
+		CPPUNIT_ASSERT( ! labels.might_contain(0));
+
+		// without filters nothing can be ruled out
+		options.key_filter_bits = 0;
+		{
+			Writer writer(RECORD_PATH,options);
+			WideMessage msg;
+			msg.set_label("label");
+			CPPUNIT_ASSERT(writer.write(msg));
+			writer.close();
+		}
+		Reader unfiltered(RECORD_PATH);
+		CPPUNIT_ASSERT(unfiltered.has_key_index());
+		CPPUNIT_ASSERT( ! unfiltered.has_key_filters());
+		CPPUNIT_ASSERT(unfiltered.might_contain("missing"));
+		CPPUNIT_ASSERT( ! unfiltered.key_ranges("missing",ranges));
+		CPPUNIT_ASSERT_EQUAL(std::string("record has no key filters"),unfiltered.reason());
+	}
+
+	void
+	ProtorecordTest::live_tailing_batches()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_BATCHES = 30;
+		const unsigned int BATCH_SIZE = 100;
+		const unsigned int NUM_ITEMS = NUM_BATCHES * BATCH_SIZE;
+		const auto TIMEOUT = std::chrono::seconds(5);
+
+		WriterOptions options;
+		options.checkpoint_interval = std::chrono::milliseconds(1);
+		Writer writer(RECORD_PATH,options);
+		Reader reader(RECORD_PATH);
+		CPPUNIT_ASSERT_EQUAL((size_t)0,reader.size());
+
+		// batches are checkpointed like single items, so every batch but the
+		// last one must show up while the writer is still open
+		std::atomic<unsigned int> seen(0);
+		std::atomic<bool> closed(false);
+		std::thread writer_thread([&](){
+			std::vector<protorecord::demo::BasicMessage> batch(BATCH_SIZE);
+			for (unsigned int b=0; b<NUM_BATCHES; b++)
+			{
+				for (unsigned int i=0; i<BATCH_SIZE; i++)
+				{
+					batch[i].set_mystring("helloworld");
+					batch[i].set_myint(b * BATCH_SIZE + i);
+				}
+				writer.write_batch(batch.begin(),batch.end());
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			}
+
+			auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+			while (seen < NUM_ITEMS - BATCH_SIZE && std::chrono::steady_clock::now() < deadline)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			closed = true;
+			writer.close();
+		});
+
+		protorecord::demo::BasicMessage msg;
+		unsigned int expect = 0;
+		unsigned int seen_while_open = 0;
+		while (expect < NUM_ITEMS && reader.follow(TIMEOUT))
+		{
+			while (reader.take_next(msg))
+			{
+				CPPUNIT_ASSERT_EQUAL(expect,msg.myint());
+				expect++;
+			}
+			if ( ! closed)
+			{
+				seen_while_open = expect;
+			}
+			seen = expect;
+		}
+		writer_thread.join();
+		CPPUNIT_ASSERT_EQUAL(NUM_ITEMS,expect);
+		CPPUNIT_ASSERT(seen_while_open >= NUM_ITEMS - BATCH_SIZE);
+	}
+
+	void
+	ProtorecordTest::key_index_late_schema()
+	{
+		const std::string RECORD_PATH(TEST_TMP_PATH + "/" + __func__);
+		const unsigned int NUM_ITEMS = 20000;
+		const unsigned int NUM_ROUNDS = 10;
+
+		// the schema of assumed items is stored while the I/O thread is
+		// still indexing the items queued before it
+		for (unsigned int round=0; round<NUM_ROUNDS; round++)
+		{
+			WriterOptions options;
+			options.async = true;
+			options.async_queue_depth = 1024;
+			options.key_field = "myInt";
+			Writer writer(RECORD_PATH,options);
+
+			protorecord::demo::BasicMessage msg;
+			msg.set_mystring("assumed");
+			std::string msg_data;
+			for (unsigned int i=0; i<NUM_ITEMS; i++)
+			{
+				if (i == NUM_ITEMS / 2)
+				{
+					CPPUNIT_ASSERT(writer.store_schema(protorecord::demo::BasicMessage::descriptor()));
+				}
+				msg.set_myint(i);
+				msg.SerializeToString(&msg_data);
+				CPPUNIT_ASSERT(writer.write_assumed(msg_data.data(),msg_data.size()));
+			}
+			writer.close();
+
+			// every item written after the schema is indexed. the ones
+			// before it may be, if they were still queued.
+			Reader reader(RECORD_PATH);
+			CPPUNIT_ASSERT_EQUAL((size_t)NUM_ITEMS,reader.size());
+			CPPUNIT_ASSERT(reader.has_key_index());
+			std::vector<uint64_t> items;
+			for (unsigned int key=0; key<NUM_ITEMS; key++)
+			{
+				CPPUNIT_ASSERT(reader.lookup(key,items));
+				if (key >= NUM_ITEMS / 2)
+				{
+					CPPUNIT_ASSERT_EQUAL((size_t)1,items.size());
+				}
+				CPPUNIT_ASSERT(items.size() <= 1);
+				if ( ! items.empty())
+				{
+					CPPUNIT_ASSERT_EQUAL((uint64_t)key,items[0]);
+				}
+			}
+		}
+	}
+
 }// protorecord
 
 int main()
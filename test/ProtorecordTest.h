@@ -18,6 +18,33 @@ namespace protorecord
 		CPPUNIT_TEST(reused_writer);
 		CPPUNIT_TEST(version);
 		CPPUNIT_TEST(timestamping);
+		CPPUNIT_TEST(async_write_read);
+		CPPUNIT_TEST(async_drop_policies);
+		CPPUNIT_TEST(async_multi_producer);
+		CPPUNIT_TEST(index_v1_compat);
+		CPPUNIT_TEST(segmented_write_read);
+		CPPUNIT_TEST(compressed_write_read);
+		CPPUNIT_TEST(mmap_read);
+		CPPUNIT_TEST(random_access);
+		CPPUNIT_TEST(time_seek);
+		CPPUNIT_TEST(batch_write_read);
+		CPPUNIT_TEST(storage_backends);
+		CPPUNIT_TEST(direct_io_write_read);
+		CPPUNIT_TEST(mmap_write_read);
+		CPPUNIT_TEST(arena_batch_read);
+		CPPUNIT_TEST(parallel_scan);
+		CPPUNIT_TEST(prefetch_read);
+		CPPUNIT_TEST(live_tailing);
+		CPPUNIT_TEST(live_tailing_batches);
+		CPPUNIT_TEST(live_channel);
+		CPPUNIT_TEST(item_iterators);
+		CPPUNIT_TEST(projection_scan);
+		CPPUNIT_TEST(embedded_schema);
+		CPPUNIT_TEST(column_export);
+		CPPUNIT_TEST(key_index);
+		CPPUNIT_TEST(key_index_multi_producer);
+		CPPUNIT_TEST(key_index_late_schema);
+		CPPUNIT_TEST(key_filters);
 		CPPUNIT_TEST_SUITE_END();
 
 	public:
@@ -34,6 +61,33 @@ namespace protorecord
 		void reused_writer();
 		void version();
 		void timestamping();
+		void async_write_read();
+		void async_drop_policies();
+		void async_multi_producer();
+		void index_v1_compat();
+		void segmented_write_read();
+		void compressed_write_read();
+		void mmap_read();
+		void random_access();
+		void time_seek();
+		void batch_write_read();
+		void storage_backends();
+		void direct_io_write_read();
+		void mmap_write_read();
+		void arena_batch_read();
+		void parallel_scan();
+		void prefetch_read();
+		void live_tailing();
+		void live_tailing_batches();
+		void live_channel();
+		void item_iterators();
+		void projection_scan();
+		void embedded_schema();
+		void column_export();
+		void key_index();
+		void key_index_multi_producer();
+		void key_index_late_schema();
+		void key_filters();
 
 	private:
 		const std::string TEST_TMP_PATH = "test_tmp";
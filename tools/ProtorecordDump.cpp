@@ -0,0 +1,505 @@
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <google/protobuf/text_format.h>
+#include <google/protobuf/util/json_util.h>
+#include <google/protobuf/util/type_resolver_util.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "protorecord.h"
+
+using namespace protorecord;
+
+const std::string USAGE(
+	"usage: protorecord-dump [options] <command> <record> [<record> ...]\n"
+	"\n"
+	"Reads records through the schema their Writer stored, so no generated\n"
+	"code is needed. Several records are handled as if they were one.\n"
+	"\n"
+	"commands:\n"
+	"  info      print each record's message type, size and flags\n"
+	"  schema    print the .proto files of the recorded message type\n"
+	"  count     parse every item and count them, and the malformed ones\n"
+	"  print     print every item in protobuf text format\n"
+	"  export    print every item as a line of JSON\n"
+	"  columns   export numeric fields to flat binary arrays in the -o directory,\n"
+	"            one file per field (see manifest.json in there)\n"
+	"  find      print the records that hold the -k key, using their key filters\n"
+	"            and key index\n"
+	"\n"
+	"options:\n"
+	"  -j <threads>    number of worker threads. 0 (the default) uses one per core\n"
+	"  -o <file>       write to <file> instead of stdout\n"
+	"  -f <field>      a field to export with 'columns', e.g. -f position.x\n"
+	"  -k <key>        the key to 'find'. integers also match string keys\n"
+	"  -h              show this message\n");
+
+// settings from the command line
+struct DumpOptions
+{
+	std::string command;
+	std::vector<std::string> record_paths;
+	size_t num_threads = 0;
+	std::string output_path;
+	std::vector<FieldPath> fields;
+	std::string key;
+	bool has_key = false;
+};
+
+/**
+ * Collects the text of every chunk of a scan, and writes the chunks out in
+ * record order as soon as every chunk before them is done. Workers only
+ * ever touch their own chunk's text, so appending to it isn't locked.
+ */
+class OrderedOutput
+{
+public:
+	OrderedOutput(
+		FILE *out,
+		const std::vector<ScanChunk> &chunks)
+	 : out_(out)
+	 , chunks_(chunks)
+	 , text_(chunks.size())
+	 , done_(chunks.size(),false)
+	 , next_chunk_(0)
+	 , mutex_()
+	{
+	}
+
+	// the text of 'item's chunk, to append the item to
+	std::string &
+	text(
+		const ScanItem &item)
+	{
+		return text_[item.chunk];
+	}
+
+	// called once 'item' was appended. writes out its chunk if it was the
+	// chunk's last item and every chunk before it was written. returns
+	// true if it was the chunk's last item.
+	bool
+	item_done(
+		const ScanItem &item)
+	{
+		if (item.item + 1 < chunks_[item.chunk].last)
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		done_[item.chunk] = true;
+		while (next_chunk_ < done_.size() && done_[next_chunk_])
+		{
+			std::string &text = text_[next_chunk_];
+			fwrite(text.data(),1,text.size(),out_);
+			std::string().swap(text);
+			next_chunk_++;
+		}
+		return true;
+	}
+
+private:
+	FILE *out_;
+	const std::vector<ScanChunk> &chunks_;
+	std::vector<std::string> text_;
+	std::vector<bool> done_;
+	size_t next_chunk_;
+	std::mutex mutex_;
+
+};
+
+bool
+parse_args(
+	int argc,
+	char *argv[],
+	DumpOptions &options)
+{
+	for (int a=1; a<argc; a++)
+	{
+		const std::string arg(argv[a]);
+		if (arg == "-h" || arg == "--help")
+		{
+			return false;
+		}
+		else if ((arg == "-j" || arg == "-o" || arg == "-f" || arg == "-k") && a + 1 >= argc)
+		{
+			std::cerr << "missing value for " << arg << std::endl;
+			return false;
+		}
+		else if (arg == "-j")
+		{
+			options.num_threads = std::stoul(argv[++a]);
+		}
+		else if (arg == "-o")
+		{
+			options.output_path = argv[++a];
+		}
+		else if (arg == "-f")
+		{
+			options.fields.push_back(std::string(argv[++a]));
+		}
+		else if (arg == "-k")
+		{
+			options.key = argv[++a];
+			options.has_key = true;
+		}
+		else if (options.command.empty())
+		{
+			options.command = arg;
+		}
+		else
+		{
+			options.record_paths.push_back(arg);
+		}
+	}
+	return ! options.command.empty() && ! options.record_paths.empty();
+}
+
+int
+info(
+	const DumpOptions &options,
+	FILE *out)
+{
+	int status = 0;
+	for (const auto &path : options.record_paths)
+	{
+		Reader reader(path);
+		std::string why = reader.reason();
+		if ( ! why.empty())
+		{
+			std::cerr << path << ": " << why << std::endl;
+			status = 1;
+			continue;
+		}
+
+		std::string type = reader.message_type();
+		fprintf(out,"%s\n",path.c_str());
+		fprintf(out,"  message type: %s\n",type.empty() ? "(no schema)" : type.c_str());
+		fprintf(out,"  version: %s\n",version_to_string(reader.get_version()).c_str());
+		fprintf(out,"  items: %zu\n",reader.size());
+		fprintf(out,"  timestamps: %s\n",reader.has_timestamps() ? "yes" : "no");
+		fprintf(out,"  compressed: %s\n",reader.has_compressed_blocks() ? "yes" : "no");
+		fprintf(out,"  key index: %s\n",reader.has_key_index() ? "yes" : "no");
+		fprintf(out,"  key filters: %s\n",reader.has_key_filters() ? "yes" : "no");
+		if (reader.has_dropped_items())
+		{
+			fprintf(out,"  dropped items: %zu\n",reader.dropped());
+		}
+	}
+	return status;
+}
+
+int
+schema(
+	Reader &reader,
+	FILE *out)
+{
+	// print the type's file first, then everything it imports
+	std::vector<const google::protobuf::FileDescriptor*> files = {reader.message_descriptor()->file()};
+	std::set<const google::protobuf::FileDescriptor*> seen(files.begin(),files.end());
+	for (size_t f=0; f<files.size(); f++)
+	{
+		fprintf(out,"// %s\n%s\n",files[f]->name().c_str(),files[f]->DebugString().c_str());
+		for (int d=0; d<files[f]->dependency_count(); d++)
+		{
+			if (seen.insert(files[f]->dependency(d)).second)
+			{
+				files.push_back(files[f]->dependency(d));
+			}
+		}
+	}
+	return 0;
+}
+
+int
+dump(
+	const DumpOptions &options,
+	Reader &reader,
+	FILE *out)
+{
+	ScanOptions scan_options;
+	scan_options.num_threads = options.num_threads;
+	scan_options.reader_options.use_mmap = true;
+	ParallelScan scan(options.record_paths,scan_options);
+	std::string why = scan.reason();
+	if ( ! why.empty())
+	{
+		std::cerr << why << std::endl;
+		return 1;
+	}
+
+	// every chunk is parsed into a message of its own. a chunk is only
+	// handled by one worker at a time, so they don't need to be locked.
+	std::unique_ptr<google::protobuf::Message> prototype = reader.new_message();
+	const google::protobuf::Descriptor *descriptor = prototype->GetDescriptor();
+	std::vector<std::unique_ptr<google::protobuf::Message>> chunk_msgs(scan.chunks().size());
+
+	// export converts the wire format to JSON directly, without parsing
+	std::unique_ptr<google::protobuf::util::TypeResolver> resolver(
+		google::protobuf::util::NewTypeResolverForDescriptorPool("type.googleapis.com",descriptor->file()->pool()));
+	const std::string type_url = "type.googleapis.com/" + descriptor->full_name();
+
+	const bool multi_record = options.record_paths.size() > 1;
+	std::atomic<uint64_t> num_items(0);
+	std::atomic<uint64_t> num_malformed(0);
+	OrderedOutput output(out,scan.chunks());
+	bool okay = scan.scan_raw([&](const ScanItem &item, std::string_view item_data){
+		std::string &text = output.text(item);
+		if (options.command == "export")
+		{
+			std::string json;
+			auto status = google::protobuf::util::BinaryToJsonString(
+				resolver.get(),type_url,std::string(item_data),&json);
+			if (status.ok())
+			{
+				text += json;
+				text += '\n';
+			}
+			else
+			{
+				num_malformed++;
+			}
+		}
+		else
+		{
+			auto &msg = chunk_msgs[item.chunk];
+			if ( ! msg)
+			{
+				msg.reset(prototype->New());
+			}
+
+			if ( ! msg->ParseFromArray(item_data.data(),item_data.size()))
+			{
+				num_malformed++;
+			}
+			else if (options.command == "print")
+			{
+				text += "# ";
+				if (multi_record)
+				{
+					text += options.record_paths[item.record] + " ";
+				}
+				text += "item " + std::to_string(item.item) + "\n";
+				std::string msg_text;
+				google::protobuf::TextFormat::PrintToString(*msg,&msg_text);
+				text += msg_text;
+			}
+		}
+		num_items++;
+		if (output.item_done(item))
+		{
+			chunk_msgs[item.chunk].reset();
+		}
+		return true;
+	});
+
+	if ( ! okay)
+	{
+		std::cerr << "scan failed. reason: " << scan.reason() << std::endl;
+		return 1;
+	}
+	if (options.command == "count")
+	{
+		fprintf(out,"%llu items\n",(unsigned long long)num_items.load());
+	}
+	if (num_malformed > 0)
+	{
+		std::cerr << num_malformed << " malformed items" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+int
+columns(
+	const DumpOptions &options)
+{
+	ScanOptions scan_options;
+	scan_options.num_threads = options.num_threads;
+	scan_options.reader_options.use_mmap = true;
+	ColumnExport column_export(nullptr,options.fields);
+	if ( ! column_export.run(options.record_paths,options.output_path,scan_options))
+	{
+		std::cerr << "export failed. reason: " << column_export.reason() << std::endl;
+		return 1;
+	}
+
+	std::cout << column_export.size() << " items" << std::endl;
+	for (const auto &column : column_export.columns())
+	{
+		std::cout << "  " << options.output_path << "/" << column.file << " (" << column.dtype << ")" << std::endl;
+	}
+	return 0;
+}
+
+int
+find(
+	const DumpOptions &options,
+	FILE *out)
+{
+	char *end = nullptr;
+	errno = 0;
+	const int64_t int_key = strtoll(options.key.c_str(),&end,10);
+	const bool is_int = ! options.key.empty() && *end == '\0' && errno == 0;
+
+	// only a few bytes of each record are read, so skip the read-ahead
+	ReaderOptions reader_options;
+	reader_options.access_pattern = AccessPattern::RANDOM;
+
+	// records are checked in parallel, but reported in the order given
+	const size_t num_records = options.record_paths.size();
+	std::vector<std::string> lines(num_records);
+	std::atomic<size_t> next_record(0);
+	std::atomic<size_t> num_ruled_out(0);
+	std::atomic<int> status(0);
+	auto check_records = [&](){
+		for (size_t r; (r = next_record++) < num_records;)
+		{
+			const std::string &path = options.record_paths[r];
+			Reader reader(path,reader_options);
+			std::string why = reader.reason();
+			if ( ! why.empty())
+			{
+				lines[r] = path + ": " + why + "\n";
+				status = 1;
+				continue;
+			}
+
+			// most records are ruled out by their filters alone
+			if ( ! (is_int && reader.might_contain(int_key)) && ! reader.might_contain(options.key))
+			{
+				num_ruled_out++;
+				continue;
+			}
+
+			std::vector<uint64_t> items;
+			if ((is_int && reader.lookup(int_key,items)) || reader.lookup(options.key,items))
+			{
+				if ( ! items.empty())
+				{
+					lines[r] = path + ": " + std::to_string(items.size()) + " items\n";
+				}
+			}
+			else
+			{
+				lines[r] = path + ": might hold the key, but has no key index\n";
+			}
+		}
+	};
+
+	size_t num_threads = options.num_threads;
+	if (num_threads == 0)
+	{
+		num_threads = std::max<size_t>(std::thread::hardware_concurrency(),1);
+	}
+	std::vector<std::thread> workers;
+	for (size_t t=1; t<std::min(num_threads,num_records); t++)
+	{
+		workers.emplace_back(check_records);
+	}
+	check_records();
+	for (auto &worker : workers)
+	{
+		worker.join();
+	}
+
+	for (const auto &line : lines)
+	{
+		fputs(line.c_str(),out);
+	}
+	std::cerr << num_ruled_out << " of " << num_records << " records ruled out by their key filters" << std::endl;
+	return status;
+}
+
+int main(int argc, char *argv[])
+{
+	DumpOptions options;
+	if ( ! parse_args(argc,argv,options))
+	{
+		std::cerr << USAGE;
+		return 2;
+	}
+
+	const std::vector<std::string> COMMANDS = {"info","schema","count","print","export","columns","find"};
+	if (std::find(COMMANDS.begin(),COMMANDS.end(),options.command) == COMMANDS.end())
+	{
+		std::cerr << "unknown command '" << options.command << "'" << std::endl << USAGE;
+		return 2;
+	}
+
+	if (options.command == "columns")
+	{
+		if (options.output_path.empty() || options.fields.empty())
+		{
+			std::cerr << "columns needs an output directory (-o) and fields (-f)" << std::endl;
+			return 2;
+		}
+		return columns(options);
+	}
+
+	FILE *out = stdout;
+	if ( ! options.output_path.empty())
+	{
+		out = fopen(options.output_path.c_str(),"w");
+		if (out == nullptr)
+		{
+			std::cerr << "failed to open '" << options.output_path << "'" << std::endl;
+			return 1;
+		}
+	}
+
+	int status = 0;
+	if (options.command == "info")
+	{
+		status = info(options,out);
+	}
+	else if (options.command == "find")
+	{
+		if (options.has_key)
+		{
+			status = find(options,out);
+		}
+		else
+		{
+			std::cerr << "find needs a key (-k)" << std::endl;
+			status = 2;
+		}
+	}
+	else
+	{
+		// every record is read with the first one's schema
+		Reader reader(options.record_paths[0]);
+		std::string why = reader.reason();
+		if (why.empty() && reader.message_descriptor() == nullptr)
+		{
+			why = reader.reason();
+		}
+
+		if ( ! why.empty())
+		{
+			std::cerr << options.record_paths[0] << ": " << why << std::endl;
+			status = 1;
+		}
+		else if (options.command == "schema")
+		{
+			status = schema(reader,out);
+		}
+		else
+		{
+			status = dump(options,reader,out);
+		}
+	}
+
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return status;
+}